@@ -45,4 +45,8 @@ void CController::set_cc_num(int new_cc_num) {
     _midi_cc_num = new_cc_num;
 }
 
+void CController::set_threshold(float threshold_percent) {
+    _delta_threshold = round(4096*threshold_percent/100);
+}
+
 void CController::on_change(int controller_input) {}
\ No newline at end of file
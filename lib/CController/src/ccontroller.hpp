@@ -18,6 +18,9 @@ class CController {
         /// @brief Assign new MIDI CC number to this controller.
         void set_cc_num(int new_cc_num);
 
+        /// @brief Set the change in reading, in percent of full scale, needed to send a new value.
+        void set_threshold(float threshold_percent);
+
         // Overload the following function to be executed in poll when controller changed.
         virtual void on_change(int controller_input);
 
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "event-queue.hpp"
+
+/// @brief Fixed size set of TriggerEvent each held until its own due time, then released earliest first.
+/// Events due at the same time come out in the order they were pushed. Times are micros() values and may wrap around.
+/// Nothing is evicted when full: the caller makes room with drop or pop so that it picks what is lost or sent early.
+/// @tparam SIZE Maximum number of events waiting
+template <size_t SIZE>
+class DelayLine {
+    public:
+
+        /// @brief Hold an event until due
+        /// @return false if the delay line is full and the event is dropped
+        bool push(const TriggerEvent &event, uint32_t due) {
+            if (_count == SIZE) {
+                _dropped++;
+                return false;
+            }
+            _events[_count] = event;
+            _due[_count] = due;
+            _count++;
+            return true;
+        }
+
+        /// @brief Time left before the earliest event is due
+        /// @param remaining Microseconds left, negative if the event is already late
+        /// @return false if the delay line is empty
+        bool next_due(uint32_t now, int32_t &remaining) {
+            if (_count == 0) {
+                return false;
+            }
+            remaining = (int32_t)(_due[_earliest(now)] - now);
+            return true;
+        }
+
+        /// @brief Remove the earliest event if it is due
+        /// @param due Time the event was due
+        /// @return false if no event is due
+        bool pop_due(uint32_t now, TriggerEvent &event, uint32_t &due) {
+            if (_count == 0) {
+                return false;
+            }
+            size_t index = _earliest(now);
+            if ((int32_t)(_due[index] - now) > 0) {
+                return false;
+            }
+            event = _events[index];
+            due = _due[index];
+            _remove(index);
+            return true;
+        }
+
+        /// @brief Remove the earliest event, due or not
+        /// @param due Time the event was due
+        /// @return false if the delay line is empty
+        bool pop(uint32_t now, TriggerEvent &event, uint32_t &due) {
+            if (_count == 0) {
+                return false;
+            }
+            size_t index = _earliest(now);
+            event = _events[index];
+            due = _due[index];
+            _remove(index);
+            return true;
+        }
+
+        /// @brief Drop the oldest event of a type, counted as dropped
+        /// @return false if no event of this type is waiting
+        bool drop(uint8_t type) {
+            for (size_t i=0; i<_count; i++) {
+                if (_events[i].type == type) {
+                    _remove(i);
+                    _dropped++;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /// @brief Number of events waiting
+        size_t size() {
+            return _count;
+        }
+
+        bool is_empty() {
+            return _count == 0;
+        }
+
+        bool is_full() {
+            return _count == SIZE;
+        }
+
+        /// @brief Number of events dropped because the delay line was full
+        uint32_t get_dropped() {
+            return _dropped;
+        }
+
+    private:
+
+        TriggerEvent _events[SIZE];
+        uint32_t _due[SIZE];
+        size_t _count = 0;
+        uint32_t _dropped = 0;
+
+        void _remove(size_t index) {
+            _count--;
+            memmove(&_events[index], &_events[index+1], (_count-index)*sizeof(TriggerEvent));
+            memmove(&_due[index], &_due[index+1], (_count-index)*sizeof(uint32_t));
+        }
+
+        /// @brief Index of the first event with the earliest due time, relative to now so that wrap around is harmless
+        size_t _earliest(uint32_t now) {
+            size_t earliest = 0;
+            for (size_t i=1; i<_count; i++) {
+                if ((int32_t)(_due[i] - now) < (int32_t)(_due[earliest] - now)) {
+                    earliest = i;
+                }
+            }
+            return earliest;
+        }
+
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define EVENT_TRIGGER 0
+#define EVENT_RELEASE 1
+#define EVENT_CC 2
+
+/// @brief Event produced by the acquisition stage and consumed by the output stage
+struct TriggerEvent {
+    /// @brief micros() when the event is detected
+    uint32_t timestamp;
+    /// @brief micros() of the first sample of the hit for a pad trigger, same as timestamp for the other events
+    uint32_t onset;
+    /// @brief EVENT_TRIGGER, EVENT_RELEASE or EVENT_CC
+    uint8_t type;
+    /// @brief Id of the sensor that produced the event
+    uint8_t sensor_id;
+    /// @brief Peak reading for trigger, raw reading for CC, 0 for release
+    uint16_t value;
+};
+
+/// @brief Fixed size FIFO of TriggerEvent. No heap allocation. When full, a new event takes the place of the oldest controller
+/// change, whose value is superseded by the later ones anyway. A release, which must never be lost or its note would stay on,
+/// takes the place of the oldest trigger if there is no controller change, and any other event is dropped.
+/// @tparam SIZE Maximum number of events waiting in the queue
+template <size_t SIZE>
+class EventQueue {
+    public:
+
+        /// @brief Append an event to the end of the queue
+        /// @return false if the queue is full and the event is dropped
+        bool push(const TriggerEvent &event) {
+            if (_count == SIZE) {
+                _dropped++;
+                if (!_evict(event.type)) {
+                    return false;
+                }
+            }
+            _events[_tail] = event;
+            _tail = (_tail + 1) % SIZE;
+            _count++;
+            if (_count > _high_water) {
+                _high_water = _count;
+            }
+            return true;
+        }
+
+        /// @brief Same as push, but build the event from its fields
+        bool push(uint32_t timestamp, uint8_t type, uint8_t sensor_id, uint16_t value) {
+            return push(timestamp, timestamp, type, sensor_id, value);
+        }
+
+        /// @brief Same as push, but build the event from its fields with an onset earlier than its detection
+        bool push(uint32_t timestamp, uint32_t onset, uint8_t type, uint8_t sensor_id, uint16_t value) {
+            TriggerEvent event = {timestamp, onset, type, sensor_id, value};
+            return push(event);
+        }
+
+        /// @brief Remove the oldest event from the queue
+        /// @param event Event removed from the queue
+        /// @return false if the queue is empty
+        bool pop(TriggerEvent &event) {
+            if (_count == 0) {
+                return false;
+            }
+            event = _events[_head];
+            _head = (_head + 1) % SIZE;
+            _count--;
+            return true;
+        }
+
+        /// @brief Number of events waiting in the queue
+        size_t size() {
+            return _count;
+        }
+
+        bool is_empty() {
+            return _count == 0;
+        }
+
+        /// @brief Largest number of events ever waiting in the queue
+        size_t get_high_water() {
+            return _high_water;
+        }
+
+        /// @brief Start the high-water mark over from the events waiting now
+        void reset_high_water() {
+            _high_water = _count;
+        }
+
+        /// @brief Number of events dropped because the queue was full
+        uint32_t get_dropped() {
+            return _dropped;
+        }
+
+    private:
+
+        TriggerEvent _events[SIZE];
+        size_t _head = 0;
+        size_t _tail = 0;
+        size_t _count = 0;
+        size_t _high_water = 0;
+        uint32_t _dropped = 0;
+
+        /// @brief Remove the oldest controller change, or the oldest trigger to make room for a release.
+        /// @return false if no event can be removed for an event of this type
+        bool _evict(uint8_t type) {
+            size_t victim = _find_oldest(EVENT_CC);
+            if ((victim == _count) && (type == EVENT_RELEASE)) {
+                victim = _find_oldest(EVENT_TRIGGER);
+            }
+            if (victim == _count) {
+                return false;
+            }
+            for (size_t k=victim; k+1<_count; k++) {
+                _events[(_head + k) % SIZE] = _events[(_head + k + 1) % SIZE];
+            }
+            _tail = (_tail + SIZE - 1) % SIZE;
+            _count--;
+            return true;
+        }
+
+        /// @brief Position from the head of the oldest event of a type, _count if none
+        size_t _find_oldest(uint8_t type) {
+            for (size_t k=0; k<_count; k++) {
+                if (_events[(_head + k) % SIZE].type == type) {
+                    return k;
+                }
+            }
+            return _count;
+        }
+
+};
@@ -0,0 +1,190 @@
+#include "flash-records.hpp"
+
+static_assert(FLASH_RECORDS_MAX_KEYS <= 0xFF, "Records hold the key in their low byte");
+
+FlashRecords::FlashRecords(uint32 start_address, uint16 page_size, uint16 format) {
+    _start_address = start_address;
+    _page_size = page_size;
+    _format = format;
+    _active = 0;
+    _end = FIRST_RECORD;
+    for (size_t i=0; i<FLASH_RECORDS_MAX_KEYS; i++) {
+        _record[i] = 0;
+    }
+}
+
+bool FlashRecords::begin() {
+    bool active[2];
+    bool receiving[2];
+    for (uint8 page=0; page<2; page++) {
+        active[page] = (_read(page, 1) == _format);
+        receiving[page] = (_read(page, 0) == PAGE_RECEIVING) && (_read(page, 1) == PAGE_ERASED);
+    }
+
+    bool found = true;
+    FLASH_Unlock();
+    if (active[0] || active[1]) {
+        _active = active[0] ? 0 : 1;
+        _erase_page(1 - _active); // Copy interrupted before the full page was erased, if any
+    }
+    else if ((receiving[0] || receiving[1]) && (_read(receiving[0] ? 1 : 0, 1) == PAGE_ERASED)) {
+        // Copy interrupted after the full page was erased, it is complete
+        _active = receiving[0] ? 0 : 1;
+        _write(_active, 1, _format);
+    }
+    else { // Blank, or written by another format
+        _erase_page(0);
+        _erase_page(1);
+        _active = 0;
+        _write(0, 1, _format);
+        found = false;
+    }
+    FLASH_Lock();
+
+    _scan();
+    return found;
+}
+
+bool FlashRecords::has(uint8 key) {
+    return (key < FLASH_RECORDS_MAX_KEYS) && (_record[key] != 0);
+}
+
+bool FlashRecords::read(uint8 key, void *data, size_t size) {
+    if (!has(key) || (_length(_read(_active, _record[key])) != size/2)) {
+        return false;
+    }
+    uint16 *values = (uint16 *)data;
+    for (size_t i=0; i<size/2; i++) {
+        values[i] = _read(_active, _record[key] + 1 + i);
+    }
+    return true;
+}
+
+bool FlashRecords::write(uint8 key, const void *data, size_t size) {
+    uint32 length = size/2;
+    if ((key >= FLASH_RECORDS_MAX_KEYS) || (length == 0) || (length > MAX_LENGTH)) {
+        return false;
+    }
+    const uint16 *values = (const uint16 *)data;
+    if (has(key) && (_length(_read(_active, _record[key])) == length)) {
+        bool same = true;
+        for (uint32 i=0; (i<length) && same; i++) {
+            same = (_read(_active, _record[key] + 1 + i) == values[i]);
+        }
+        if (same) {
+            return true;
+        }
+    }
+
+    FLASH_Unlock();
+    bool success = true;
+    if (_end + 1 + length > _page_size/2U) {
+        success = _transfer(key);
+    }
+    success = success && _write(_active, _end, (uint16)(length << 8) | key);
+    for (uint32 i=0; (i<length) && success; i++) {
+        success = _write(_active, _end + 1 + i, values[i]);
+    }
+    FLASH_Lock();
+
+    if (!success) { // Find out what was programmed
+        begin();
+        return false;
+    }
+    _record[key] = _end;
+    _end += 1 + length;
+    return true;
+}
+
+bool FlashRecords::erase() {
+    FLASH_Unlock();
+    bool success = _erase_page(0) && _erase_page(1) && _write(0, 1, _format);
+    FLASH_Lock();
+
+    _active = 0;
+    _scan();
+    return success;
+}
+
+size_t FlashRecords::bytes_used() {
+    return _end*2;
+}
+
+size_t FlashRecords::capacity() {
+    return _page_size;
+}
+
+uint16 FlashRecords::_read(uint8 page, uint32 offset) {
+    return *(volatile uint16 *)(uintptr_t)(_start_address + page*_page_size + offset*2);
+}
+
+bool FlashRecords::_write(uint8 page, uint32 offset, uint16 data) {
+    return FLASH_ProgramHalfWord(_start_address + page*_page_size + offset*2, data) == FLASH_COMPLETE;
+}
+
+bool FlashRecords::_erase_page(uint8 page) {
+    // Erasing takes about 20 ms with the CPU stalled, skip the pages already blank
+    for (uint32 offset=0; offset<_page_size/2U; offset++) {
+        if (_read(page, offset) != PAGE_ERASED) {
+            return FLASH_ErasePage(_start_address + page*_page_size) == FLASH_COMPLETE;
+        }
+    }
+    return true;
+}
+
+void FlashRecords::_scan() {
+    uint32 size = _page_size/2;
+
+    for (size_t i=0; i<FLASH_RECORDS_MAX_KEYS; i++) {
+        _record[i] = 0;
+    }
+    _end = FIRST_RECORD;
+    while (_end < size) {
+        uint16 header = _read(_active, _end);
+        if (header == PAGE_ERASED) {
+            return;
+        }
+        uint8 key = header & 0xFF;
+        uint16 length = _length(header);
+        if ((key >= FLASH_RECORDS_MAX_KEYS) || (length == 0) || (length > MAX_LENGTH) || (_end + 1 + length > size)) {
+            break;
+        }
+        _record[key] = _end;
+        _end += 1 + length;
+    }
+    // Corrupted record or no end marker, the next record goes to a new copy
+    _end = size;
+}
+
+bool FlashRecords::_transfer(int skip_key) {
+    uint8 target = 1 - _active;
+    uint32 end = FIRST_RECORD;
+    uint16 record[FLASH_RECORDS_MAX_KEYS];
+
+    bool success = _erase_page(target) && _write(target, 0, PAGE_RECEIVING);
+    for (size_t key=0; (key<FLASH_RECORDS_MAX_KEYS) && success; key++) {
+        record[key] = 0;
+        if ((_record[key] == 0) || ((int)key == skip_key)) {
+            continue;
+        }
+        uint16 length = _length(_read(_active, _record[key]));
+        for (uint32 i=0; (i<=length) && success; i++) {
+            success = _write(target, end + i, _read(_active, _record[key] + i));
+        }
+        record[key] = end;
+        end += 1 + length;
+    }
+    success = success && _erase_page(_active) && _write(target, 1, _format);
+    if (!success) {
+        return false;
+    }
+
+    _active = target;
+    _end = end;
+    memcpy(_record, record, sizeof(_record));
+    return true;
+}
+
+uint16 FlashRecords::_length(uint16 header) {
+    return header >> 8;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+/// @brief Number of keys a FlashRecords can hold
+#define FLASH_RECORDS_MAX_KEYS 32
+
+/// @brief Fixed size records stored by key in two flash pages of their own outside of the emulated EEPROM, for tables too
+/// large for it. Only the last record of every key is live, and a write that doesn't change it programs nothing.
+///
+/// Each page starts with two status half-words, PAGE_RECEIVING then the format given to the constructor, followed by
+/// records ended by erased flash (0xFFFF). A record is a header half-word (length << 8 | key), length being the number of
+/// data half-words from 1 to MAX_LENGTH, followed by the data.
+///
+/// Records are appended to the active page. When it is full, the last record of every key is copied to the other page,
+/// the full page is erased and only then the copy is marked active, so that begin() can finish or drop a copy interrupted
+/// by a reset. Pages of another format, left by an older firmware, are erased by begin().
+class FlashRecords {
+    public:
+
+        /// @param start_address Address of the first of the two flash pages
+        /// @param page_size Size of a flash page in bytes
+        /// @param format Layout version of the records, written in the page status. Neither 0xFFFF nor 0xEEEE.
+        FlashRecords(uint32 start_address, uint16 page_size, uint16 format);
+
+        /// @brief Find the active page and the last record of every key, formatting the pages if none is active.
+        /// @return false if the pages were formatted, every key being empty
+        bool begin();
+
+        /// @brief Check if a key has a record.
+        bool has(uint8 key);
+
+        /// @brief Copy the last record of a key.
+        /// @param size Size of data in bytes, even
+        /// @return false if the key has no record or a record of another size, data is unchanged then
+        bool read(uint8 key, void *data, size_t size);
+
+        /// @brief Store a record of a key, unless it is the same as its last one.
+        /// @param size Size of data in bytes, even and at most 2*MAX_LENGTH
+        /// @return false if the flash could not be programmed
+        bool write(uint8 key, const void *data, size_t size);
+
+        /// @brief Remove every record.
+        bool erase();
+
+        /// @brief Number of bytes used in the active page, including the status half-words.
+        size_t bytes_used();
+
+        /// @brief Number of bytes of the active page, the other page being reserved for copies.
+        size_t capacity();
+
+        /// @brief Longest record in half-words
+        static const uint16 MAX_LENGTH = 0x7F;
+
+    private:
+
+        static const uint16 PAGE_RECEIVING = 0xEEEE;
+        static const uint16 PAGE_ERASED = 0xFFFF;
+        /// @brief Half-word offset of the first record of a page
+        static const uint32 FIRST_RECORD = 2;
+
+        uint32 _start_address;
+        uint16 _page_size;
+        uint16 _format;
+        /// @brief Page holding the records, 0 or 1
+        uint8 _active;
+        /// @brief Half-word offset of the end of the records in the active page
+        uint32 _end;
+        /// @brief Key -> Half-word offset of the header of its last record in the active page, 0 if none
+        uint16 _record[FLASH_RECORDS_MAX_KEYS];
+
+        uint16 _read(uint8 page, uint32 offset);
+        bool _write(uint8 page, uint32 offset, uint16 data);
+        /// @brief Erase a page unless it is blank already
+        bool _erase_page(uint8 page);
+        /// @brief Find the last record of every key and the end of the records in the active page
+        void _scan();
+        /// @brief Copy the last record of every key but skip_key to the other page and make it the active page
+        bool _transfer(int skip_key);
+        static uint16 _length(uint16 header);
+
+};
@@ -0,0 +1,36 @@
+#include "hot-path.hpp"
+
+#if defined(__arm__)
+
+// Cortex-M3 debug registers, the DWT cycle counter runs once enabled in DEMCR even without a debugger
+#define DEMCR (*(volatile uint32_t *)0xE000EDFC)
+#define DEMCR_TRCENA (1 << 24)
+#define DWT_CTRL (*(volatile uint32_t *)0xE0001000)
+#define DWT_CTRL_CYCCNTENA (1 << 0)
+#define DWT_CYCCNT (*(volatile uint32_t *)0xE0001004)
+
+void cycle_counter_begin() {
+    DEMCR |= DEMCR_TRCENA;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+}
+
+uint32_t cycle_count() {
+    return DWT_CYCCNT;
+}
+
+#else
+
+// Host builds (simulator) count virtual time at the clock of the STM32F103
+
+#include <Arduino.h>
+
+static const uint32_t HOST_CYCLES_PER_MICROSECOND = 72;
+
+void cycle_counter_begin() {}
+
+uint32_t cycle_count() {
+    return micros()*HOST_CYCLES_PER_MICROSECOND;
+}
+
+#endif
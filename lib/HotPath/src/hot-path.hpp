@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+/// @brief Marks a function of the sampling and trigger hot path. In the latency build (ZYDP_HOT_PATH_RAM), it is
+/// optimised for speed and copied to RAM at startup, where it runs without flash wait states. Calls between flash and
+/// RAM are out of range of a branch, so that build also needs -mlong-calls.
+#if defined(ZYDP_HOT_PATH_RAM) && defined(__arm__)
+#define HOT_PATH __attribute__((section(".data.hot_path"), optimize("O2")))
+#define HOT_PATH_IN_RAM 1
+#else
+#define HOT_PATH
+#define HOT_PATH_IN_RAM 0
+#endif
+
+/// @brief Start the CPU cycle counter. Call once in setup.
+void cycle_counter_begin();
+
+/// @brief CPU cycles since cycle_counter_begin, wrapping around every minute at 72 MHz
+uint32_t cycle_count();
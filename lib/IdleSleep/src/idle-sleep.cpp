@@ -0,0 +1,63 @@
+#include "idle-sleep.hpp"
+#include <Arduino.h>
+
+#if defined(__arm__)
+
+static HardwareTimer *_timer = 0;
+
+/// @brief Only there to end WFI
+static void _wake_up() {}
+
+void idle_sleep_begin(int timer_num) {
+    static HardwareTimer timer(timer_num);
+    _timer = &timer;
+    timer.pause();
+    timer.setPrescaleFactor(CYCLES_PER_MICROSECOND);
+    timer.setOverflow(0xFFFF);
+    timer.setMode(TIMER_CH1, TIMER_OUTPUT_COMPARE);
+    timer.refresh();
+    timer.resume();
+}
+
+uint32_t idle_sleep_until(uint32_t deadline_micro) {
+    uint32_t start = micros();
+    int32_t remaining = deadline_micro - start;
+    if ((_timer == 0) || (remaining < IDLE_SLEEP_MIN_MICROS)) {
+        return 0;
+    }
+    if (remaining > 0xFFFF) {
+        remaining = 0xFFFF;
+    }
+
+    _timer->setCompare(TIMER_CH1, _timer->getCount() + remaining);
+    _timer->c_dev()->regs.gen->SR = ~TIMER_SR_CC1IF; // Match left over from an earlier sleep
+    _timer->attachInterrupt(TIMER_CH1, _wake_up);
+
+    // With interrupts masked, an interrupt becoming pending after the check still ends WFI and is served right after
+    noInterrupts();
+    if ((int32_t)(deadline_micro - micros()) > 0) {
+        asm volatile("wfi");
+    }
+    interrupts();
+
+    _timer->detachInterrupt(TIMER_CH1);
+    return micros() - start;
+}
+
+#else
+
+// Host builds (simulator) have no interrupts, the sleep lasts until the deadline or one SysTick period
+
+void idle_sleep_begin(int timer_num) {}
+
+uint32_t idle_sleep_until(uint32_t deadline_micro) {
+    uint32_t start = micros();
+    int32_t remaining = deadline_micro - start;
+    if (remaining < IDLE_SLEEP_MIN_MICROS) {
+        return 0;
+    }
+    delayMicroseconds((remaining < 1000) ? remaining : 1000);
+    return micros() - start;
+}
+
+#endif
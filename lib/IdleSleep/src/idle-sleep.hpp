@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+
+/// @brief Sleeps shorter than this are not worth the wake-up, in microseconds
+#define IDLE_SLEEP_MIN_MICROS 10
+
+/// @brief Start the wake-up timer of idle_sleep_until, counting microseconds. Call once in setup.
+/// @param timer_num General purpose timer not used for PWM
+void idle_sleep_begin(int timer_num);
+
+/// @brief Stop the CPU with WFI until deadline_micro, or until an earlier interrupt (USB, UART, SysTick every millisecond).
+/// Returns at once if the deadline is less than IDLE_SLEEP_MIN_MICROS away.
+/// @return Microseconds spent asleep
+uint32_t idle_sleep_until(uint32_t deadline_micro);
@@ -0,0 +1,198 @@
+#include "json-reader.hpp"
+
+JsonReader::JsonReader() {
+    begin(0, 0);
+}
+
+void JsonReader::begin(json_value_handler handler, void *context) {
+    _handler = handler;
+    _context = context;
+    _state = OBJECT_START;
+    _status = JSON_INCOMPLETE;
+    _key_length = 0;
+    _depth = 0;
+}
+
+int JsonReader::feed(char c) {
+    switch (_state) {
+        case OBJECT_START:
+            if (c == '{') {
+                _state = FIRST_MEMBER;
+            }
+            else if (!_is_whitespace(c)) {
+                _finish(JSON_ERROR_SYNTAX);
+            }
+            break;
+
+        case FIRST_MEMBER:
+        case MEMBER:
+            if (c == '"') {
+                _key_length = 0;
+                _state = KEY;
+            }
+            else if ((c == '}') && (_state == FIRST_MEMBER)) {
+                _finish(JSON_OK);
+            }
+            else if (!_is_whitespace(c)) {
+                _finish(JSON_ERROR_SYNTAX);
+            }
+            break;
+
+        case KEY:
+            if (c == '"') {
+                _key[_key_length] = '\0';
+                _state = COLON;
+            }
+            else if ((c == '\\') || (_key_length == JSON_MAX_KEY_LENGTH)) {
+                _finish(JSON_ERROR_KEY);
+            }
+            else {
+                _key[_key_length++] = c;
+            }
+            break;
+
+        case COLON:
+            if (c == ':') {
+                _depth = 0;
+                _state = VALUE;
+            }
+            else if (!_is_whitespace(c)) {
+                _finish(JSON_ERROR_SYNTAX);
+            }
+            break;
+
+        case VALUE:
+        case FIRST_ELEMENT:
+            if (c == '[') {
+                if (_depth == JSON_MAX_DEPTH) {
+                    _finish(JSON_ERROR_DEPTH);
+                }
+                else {
+                    _indices[_depth++] = 0;
+                    _state = FIRST_ELEMENT;
+                }
+            }
+            else if ((c == ']') && (_state == FIRST_ELEMENT)) {
+                _depth--;
+                _state = AFTER_VALUE;
+            }
+            else if (!_is_whitespace(c)) {
+                _value_start(c);
+            }
+            break;
+
+        case LITERAL:
+            if (c != _literal[_literal_length]) {
+                _finish(JSON_ERROR_SYNTAX);
+            }
+            else if (_literal[++_literal_length] == '\0') {
+                _value_end();
+            }
+            break;
+
+        case SIGN:
+        case NUMBER:
+            if ((c >= '0') && (c <= '9')) {
+                if (_value > 99999) {
+                    _finish(JSON_ERROR_VALUE);
+                }
+                else {
+                    _value = _value*10 + (c - '0');
+                    _state = NUMBER;
+                }
+            }
+            else if (_state == SIGN) {
+                _finish(JSON_ERROR_SYNTAX);
+            }
+            else {
+                // The number ends with the character that follows it
+                _value_end();
+                if (_state == AFTER_VALUE) {
+                    feed(c);
+                }
+            }
+            break;
+
+        case AFTER_VALUE:
+            if ((c == ']') && (_depth > 0)) {
+                _depth--;
+            }
+            else if ((c == ',') && (_depth > 0)) {
+                _indices[_depth-1]++;
+                _state = VALUE;
+            }
+            else if (c == ',') {
+                _state = MEMBER;
+            }
+            else if ((c == '}') && (_depth == 0)) {
+                _finish(JSON_OK);
+            }
+            else if (!_is_whitespace(c)) {
+                _finish(JSON_ERROR_SYNTAX);
+            }
+            break;
+
+        case FINISHED:
+            break;
+    }
+    return _status;
+}
+
+int JsonReader::status() {
+    return _status;
+}
+
+bool JsonReader::_is_whitespace(char c) {
+    return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n');
+}
+
+void JsonReader::_value_start(char c) {
+    _negative = false;
+    _value = 0;
+    if ((c == 't') || (c == 'f')) {
+        _literal = (c == 't') ? "true" : "false";
+        _literal_length = 1;
+        _value = (c == 't');
+        _state = LITERAL;
+    }
+    else if (c == '-') {
+        _negative = true;
+        _state = SIGN;
+    }
+    else if ((c >= '0') && (c <= '9')) {
+        _value = c - '0';
+        _state = NUMBER;
+    }
+    else {
+        _finish(JSON_ERROR_SYNTAX);
+    }
+}
+
+void JsonReader::_value_end() {
+    if (_negative) {
+        _value = -_value;
+    }
+    if ((_handler == 0) || !_handler(_key, _indices, _depth, _value, _context)) {
+        _finish(JSON_ERROR_VALUE);
+        return;
+    }
+    _state = AFTER_VALUE;
+}
+
+void JsonReader::_finish(int status) {
+    _status = status;
+    _state = FINISHED;
+}
+
+int json_read(const char *text, size_t length, json_value_handler handler, void *context) {
+    JsonReader reader;
+    reader.begin(handler, context);
+    for (size_t i=0; i<length; i++) {
+        int status = reader.feed(text[i]);
+        if (status != JSON_INCOMPLETE) {
+            return status;
+        }
+    }
+    // Text ended inside the object
+    return JSON_ERROR_SYNTAX;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define JSON_MAX_DEPTH 3
+#define JSON_MAX_KEY_LENGTH 31
+
+#define JSON_OK 0
+#define JSON_ERROR_SYNTAX 1
+#define JSON_ERROR_DEPTH 2
+#define JSON_ERROR_KEY 3
+#define JSON_ERROR_VALUE 4
+/// @brief Returned by JsonReader::feed until the object is closed or an error is found
+#define JSON_INCOMPLETE 5
+
+/// @brief Called for every scalar value found by json_read
+/// @param key Name of the top level member containing the value
+/// @param indices Index of the value in each nested array, outermost first
+/// @param depth Number of nested arrays around the value, 0 for a plain member
+/// @param value Integer value, true and false are passed as 1 and 0
+/// @param context Pointer passed to json_read
+/// @return false to reject the value and abort reading
+typedef bool (*json_value_handler)(const char *key, const int *indices, int depth, int32_t value, void *context);
+
+/// @brief Incremental reader of a JSON object whose members are integers, booleans or nested arrays of them, fed one
+/// character at a time as it arrives, so the text never has to be buffered. Each character costs a bounded amount of work
+/// and the whole state fits in the object, about 80 bytes, whatever the text.
+class JsonReader {
+    public:
+
+        JsonReader();
+
+        /// @brief Start reading a new object
+        /// @param handler Function called for every value
+        /// @param context Pointer passed to the handler
+        void begin(json_value_handler handler, void *context);
+
+        /// @brief Read the next character of the text
+        /// @return JSON_INCOMPLETE until the object is closed, then JSON_OK, or one of the JSON_ERROR_* codes as soon as
+        /// the text can't be valid. The result stays the same for the characters fed after it.
+        int feed(char c);
+
+        /// @brief Result of the characters fed so far, same as the last feed()
+        int status();
+
+    private:
+
+        enum State : uint8_t {
+            OBJECT_START, // Before '{'
+            FIRST_MEMBER, // After '{', a member or '}'
+            MEMBER, // After ',', a member
+            KEY,
+            COLON,
+            VALUE, // After ':' or ',' in an array
+            FIRST_ELEMENT, // After '[', a value or ']'
+            LITERAL,
+            SIGN, // After '-', a digit
+            NUMBER,
+            AFTER_VALUE, // ']', ',' or '}'
+            FINISHED
+        };
+
+        json_value_handler _handler;
+        void *_context;
+        State _state;
+        uint8_t _status;
+        uint8_t _key_length;
+        uint8_t _depth;
+        char _key[JSON_MAX_KEY_LENGTH+1];
+        int _indices[JSON_MAX_DEPTH];
+        /// @brief Literal being matched and number of its characters matched
+        const char *_literal;
+        uint8_t _literal_length;
+        bool _negative;
+        int32_t _value;
+
+        static bool _is_whitespace(char c);
+        /// @brief Start a value with its first character
+        void _value_start(char c);
+        /// @brief Pass the value read to the handler
+        void _value_end();
+        /// @brief Stop reading with a result
+        void _finish(int status);
+
+};
+
+/// @brief Read a JSON object whose members are integers, booleans or nested arrays of them, without any allocation.
+/// The text is read in a single pass and nesting is limited to JSON_MAX_DEPTH arrays, so the time taken is bounded by the length of the text.
+/// @param text JSON text, does not need to be null terminated
+/// @param length Length of the text
+/// @param handler Function called for every value
+/// @param context Pointer passed to the handler
+/// @return JSON_OK on success, otherwise one of the JSON_ERROR_* codes
+int json_read(const char *text, size_t length, json_value_handler handler, void *context);
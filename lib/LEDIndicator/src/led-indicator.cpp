@@ -1,6 +1,36 @@
 #include "led-indicator.hpp"
 #include <Arduino.h>
 
+static const LEDColor LED_OFF = {0, 0, 0};
+
+#if defined(__arm__)
+
+static HardwareTimer *_timer = 0;
+/// @brief Indicator played by the timer, a single one is supported
+static LEDIndicator *_timer_led = 0;
+
+static void _timer_handler() {
+    _timer_led->tick();
+}
+
+static void _mask() {
+    noInterrupts();
+}
+
+static void _unmask() {
+    interrupts();
+}
+
+#else
+
+// Host builds (simulator) have no timer interrupt, every blink stays on its first half period
+
+static void _mask() {}
+
+static void _unmask() {}
+
+#endif
+
 LEDIndicator::LEDIndicator(int red_pin, int green_pin, int blue_pin) {
     _red_pin = red_pin;
     _green_pin = green_pin;
@@ -10,85 +40,207 @@ LEDIndicator::LEDIndicator(int red_pin, int green_pin, int blue_pin) {
     pinMode(green_pin, OUTPUT);
     pinMode(blue_pin, OUTPUT);
 
+    _steady = LED_OFF;
+    _steady_half_period = 0;
+    _queue_head = 0;
+    _queue_count = 0;
+    _pins_state = 0xFF;
     off();
 }
 
-void LEDIndicator::on(int red, int green, int blue) {
-    _on(red, green, blue);
-    _blink = false;
+void LEDIndicator::begin(int timer_num) {
+#if defined(__arm__)
+    static HardwareTimer timer(timer_num);
+    _timer = &timer;
+    _timer_led = this;
+    timer.pause();
+    timer.setPeriod(1000000/LED_TICK_HZ);
+    timer.setMode(TIMER_CH1, TIMER_OUTPUT_COMPARE);
+    timer.setCompare(TIMER_CH1, 1);
+    timer.attachInterrupt(TIMER_CH1, _timer_handler);
+#endif
+
+    _mask();
+    _update();
+    _unmask();
 }
 
-void LEDIndicator::_on(int red, int green, int blue) {
-    digitalWrite(_red_pin, red);
-    digitalWrite(_green_pin, green);
-    digitalWrite(_blue_pin, blue);
-    _red_state = red;
-    _green_state = green;
-    _blue_state = blue;
-    _on_state = true;
+void LEDIndicator::on(int red, int green, int blue) {
+    on(_full_color(red, green, blue));
 }
 
-void LEDIndicator::_on() {
-    _on(_red_state, _green_state, _blue_state);
+void LEDIndicator::on(LEDColor color) {
+    _mask();
+    _steady = color;
+    _steady_half_period = 0;
+    _queue_count = 0;
+    _start_next();
+    _update();
+    _unmask();
 }
 
 void LEDIndicator::off() {
-    _off();
-    _blink = false;
+    on(LED_OFF);
 }
 
-void LEDIndicator::_off() {
-    digitalWrite(_red_pin, LOW);
-    digitalWrite(_green_pin, LOW);
-    digitalWrite(_blue_pin, LOW);
-    _on_state = false;
+void LEDIndicator::blink(int red, int green, int blue, int cycles, int period_millis, bool return_to_last_state) {
+    blink(_full_color(red, green, blue), cycles, period_millis, return_to_last_state);
 }
 
-void LEDIndicator::blink(int red, int green, int blue, int cycles, int period_millis, bool return_to_last_state) {
-    _blink_return_to_last_state = return_to_last_state;
-    if (return_to_last_state) {
-        _last_red_state = _red_state;
-        _last_green_state = _green_state;
-        _last_blue_state = _blue_state;
-        if (!_blink) {
-            _last_on_state = _on_state;
-        }
-        else {
-            _last_on_state = false;
+void LEDIndicator::blink(LEDColor color, int cycles, int period_millis, bool return_to_last_state) {
+    uint16_t half_period = (period_millis < 2) ? 1 : period_millis/2;
+
+    _mask();
+    if (cycles >= LED_ENDLESS_CYCLES) {
+        _steady = color;
+        _steady_half_period = half_period;
+        _queue_count = 0;
+    }
+    else {
+        Blink &blink = _queue[_queue_head];
+        blink.color = color;
+        blink.cycles = (cycles < 1) ? 1 : cycles;
+        blink.half_period = half_period;
+        blink.return_to_last_state = return_to_last_state;
+        _queue_count = 1;
+    }
+    _start_next();
+    _update();
+    _unmask();
+}
+
+void LEDIndicator::flash(LEDColor color, int cycles, int period_millis) {
+    _mask();
+    if (_queue_count < LED_QUEUE_SIZE) {
+        Blink &blink = _queue[(_queue_head + _queue_count) % LED_QUEUE_SIZE];
+        blink.color = color;
+        blink.cycles = (cycles < 1) ? 1 : cycles;
+        blink.half_period = (period_millis < 2) ? 1 : period_millis/2;
+        blink.return_to_last_state = true;
+        _queue_count++;
+        if (_queue_count == 1) {
+            _start_next();
+            _update();
         }
     }
-    
-    _blink = true;
-    _cycles = cycles;
-    _blink_period = period_millis/2;
-    
-    _completed_cycles = 0;
-    _on(red, green, blue);
-    _last_timestamp = millis();
+    _unmask();
 }
 
 bool LEDIndicator::is_on() {
-    return _on_state;
-} 
-
-void LEDIndicator::poll() {
-    if (_blink && ((millis() - _last_timestamp) > (_blink_period)) && (_completed_cycles < _cycles)) {
-        if (is_on()) {
-            _off();
-            _last_timestamp = millis();
-        }
-        else {
-            if (_completed_cycles == (_cycles-1)) {
-                _blink = false;
-                if (_blink_return_to_last_state && _last_on_state) {
-                    on(_last_red_state, _last_green_state, _last_blue_state);
-                }
-            }
-            else {
-                _on();
-            }
-            _completed_cycles++;
-            _last_timestamp = millis();
-        }
+    return (_shown.red != 0) || (_shown.green != 0) || (_shown.blue != 0);
+}
+
+void LEDIndicator::tick() {
+    if (--_ticks_left_ms == 0) {
+        _ticks_left_ms = LED_TICK_HZ/1000;
+        _step_ms();
+    }
+
+    _pwm_phase = (_pwm_phase+1 == LED_MAX_LEVEL) ? 0 : _pwm_phase+1;
+    _write_pins((_shown.red > _pwm_phase) | ((_shown.green > _pwm_phase) << 1) | ((_shown.blue > _pwm_phase) << 2));
+
+    if (!_needs_timer()) {
+        _timer_stop();
+    }
+}
+
+void LEDIndicator::_start_next() {
+    if (_queue_count > 0) {
+        const Blink &blink = _queue[_queue_head];
+        _halves_left = 2*blink.cycles;
+        _half_left_ms = blink.half_period;
+        _shown = blink.color;
+    }
+    else {
+        _halves_left = 0;
+        _half_left_ms = _steady_half_period;
+        _shown = _steady;
+    }
+}
+
+void LEDIndicator::_step_ms() {
+    if ((_half_left_ms == 0) || (--_half_left_ms != 0)) {
+        return;
+    }
+
+    if (_halves_left == 0) {
+        // Endless blink of the steady colour
+        _half_left_ms = _steady_half_period;
+        _shown = is_on() ? LED_OFF : _steady;
+        return;
+    }
+
+    const Blink &blink = _queue[_queue_head];
+    _halves_left--;
+    if (_halves_left != 0) {
+        _half_left_ms = blink.half_period;
+        _shown = ((_halves_left % 2) == 0) ? blink.color : LED_OFF;
+        return;
+    }
+
+    if (!blink.return_to_last_state) {
+        _steady = LED_OFF;
+        _steady_half_period = 0;
+    }
+    _queue_head = (_queue_head + 1) % LED_QUEUE_SIZE;
+    _queue_count--;
+    _start_next();
+}
+
+void LEDIndicator::_write_pins(uint8_t state) {
+    uint8_t changed = state ^ _pins_state;
+    if (changed & 1) {
+        digitalWrite(_red_pin, (state & 1) ? HIGH : LOW);
+    }
+    if (changed & 2) {
+        digitalWrite(_green_pin, (state & 2) ? HIGH : LOW);
+    }
+    if (changed & 4) {
+        digitalWrite(_blue_pin, (state & 4) ? HIGH : LOW);
+    }
+    _pins_state = state;
+}
+
+void LEDIndicator::_update() {
+    _ticks_left_ms = LED_TICK_HZ/1000;
+    _pwm_phase = 0;
+    _write_pins((_shown.red != 0) | ((_shown.green != 0) << 1) | ((_shown.blue != 0) << 2));
+
+    if (_needs_timer()) {
+        _timer_start();
+    }
+    else {
+        _timer_stop();
+    }
+}
+
+bool LEDIndicator::_needs_timer() {
+    return (_half_left_ms != 0) || _is_dimmed(_shown);
+}
+
+void LEDIndicator::_timer_start() {
+#if defined(__arm__)
+    if (_timer != 0) {
+        _timer->refresh();
+        _timer->resume();
     }
-}
\ No newline at end of file
+#endif
+}
+
+void LEDIndicator::_timer_stop() {
+#if defined(__arm__)
+    if (_timer != 0) {
+        _timer->pause();
+    }
+#endif
+}
+
+LEDColor LEDIndicator::_full_color(int red, int green, int blue) {
+    LEDColor color = {(uint8_t)(red ? LED_MAX_LEVEL : 0), (uint8_t)(green ? LED_MAX_LEVEL : 0), (uint8_t)(blue ? LED_MAX_LEVEL : 0)};
+    return color;
+}
+
+bool LEDIndicator::_is_dimmed(LEDColor color) {
+    return ((color.red != 0) && (color.red < LED_MAX_LEVEL)) || ((color.green != 0) && (color.green < LED_MAX_LEVEL)) ||
+        ((color.blue != 0) && (color.blue < LED_MAX_LEVEL));
+}
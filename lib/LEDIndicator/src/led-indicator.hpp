@@ -1,4 +1,26 @@
-/// @brief Class for common cathode RGB LED
+#pragma once
+
+#include <stdint.h>
+
+/// @brief Brightness of a colour channel, from 0 (off) to LED_MAX_LEVEL (fully on)
+#define LED_MAX_LEVEL 7
+/// @brief Blinks waiting to be played after the current one
+#define LED_QUEUE_SIZE 4
+/// @brief Timer interrupt rate. A software PWM frame lasts LED_MAX_LEVEL ticks, about 285 Hz.
+#define LED_TICK_HZ 2000
+/// @brief Blinks of this many cycles or more, such as INT_MAX, never end
+#define LED_ENDLESS_CYCLES 0x8000
+
+/// @brief Colour made of a brightness level per channel, 0 to LED_MAX_LEVEL
+struct LEDColor {
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+};
+
+/// @brief Class for common cathode RGB LED.
+/// Blinks and dimmed colours are played by a timer interrupt, so nothing has to be polled. The timer only runs while a
+/// blink plays or a dimmed colour is shown, a steady colour at full level costs nothing.
 class LEDIndicator {
     public:
 
@@ -7,53 +29,85 @@ class LEDIndicator {
         /// @param blue_pin Pin number connected to blue lead
         LEDIndicator(int red_pin, int green_pin, int blue_pin);
 
-        /// @brief Turn on the indicator LED with the provided red, green and blue color state
+        /// @brief Attach the timer playing the blinks and dimmed colours. Call once in setup, for a single indicator.
+        /// @param timer_num General purpose timer not used for anything else
+        void begin(int timer_num);
+
+        /// @brief Turn on the indicator LED with the provided red, green and blue color state, 0 or 1 each
         void on(int red, int green, int blue);
 
+        /// @brief Show a colour steadily, stopping every blink
+        void on(LEDColor color);
+
         /// @brief  Turn off the indicator LED
         void off();
 
-        /// @brief Start blinking the indicator LED
+        /// @brief Start blinking the indicator LED, replacing every blink in progress or queued
         /// @param red The color of blinking LED
         /// @param green The color of blinking LED
         /// @param blue The color of blinking LED
-        /// @param cycles Number of cycles
+        /// @param cycles Number of cycles, LED_ENDLESS_CYCLES or more to blink until the next on(), off() or blink()
         /// @param period_millis Period of the blink
         /// @param return_to_last_state Whether or not to return to the original state after finish blinking
         void blink(int red, int green, int blue, int cycles, int period_millis, bool return_to_last_state);
 
+        /// @brief Same as blink, with a dimmed colour
+        void blink(LEDColor color, int cycles, int period_millis, bool return_to_last_state);
+
+        /// @brief Queue a blink after the ones in progress, then return to the steady colour. Meant for status
+        /// feedback, it only copies the blink and is dropped if LED_QUEUE_SIZE blinks are already waiting.
+        void flash(LEDColor color, int cycles, int period_millis);
+
         /// @brief Check if the LED is currently on or not
         bool is_on();
 
-        /// @brief This function must be ran if blink is to be used
-        void poll();
+        /// @brief Timer interrupt handler, public for the interrupt trampoline only
+        void tick();
 
     private:
 
+        struct Blink {
+            LEDColor color;
+            uint16_t cycles;
+            uint16_t half_period;
+            bool return_to_last_state;
+        };
+
         int _red_pin;
         int _green_pin;
         int _blue_pin;
 
-        int _red_state;
-        int _green_state;
-        int _blue_state;
-        bool _on_state;
-
-        int _last_red_state;
-        int _last_green_state;
-        int _last_blue_state;
-        bool _last_on_state;
-
-        bool _blink;
-        bool _blink_return_to_last_state;
-        int _blink_period;
-        int _completed_cycles;
-        int _cycles;
-        unsigned long _last_timestamp;
-        
-        void _on(int red, int green, int blue);
-        void _on();
-
-        void _off();
-
-};
\ No newline at end of file
+        // Shared with the interrupt, changed with interrupts masked
+        /// @brief Colour shown when no blink plays
+        LEDColor _steady;
+        /// @brief Half period of the endless blink of the steady colour in milliseconds, 0 if steady
+        volatile uint16_t _steady_half_period;
+        Blink _queue[LED_QUEUE_SIZE];
+        volatile uint8_t _queue_head;
+        volatile uint8_t _queue_count;
+
+        // Playback, in the interrupt only once the timer runs
+        /// @brief Colour shown during the current half period
+        LEDColor _shown;
+        /// @brief Half periods left in the current blink, 0 for the steady colour
+        uint16_t _halves_left;
+        uint16_t _half_left_ms;
+        uint8_t _ticks_left_ms;
+        uint8_t _pwm_phase;
+        /// @brief Bit 0 red, bit 1 green, bit 2 blue, as last written to the pins
+        uint8_t _pins_state;
+
+        /// @brief Start the first half period of the queued blink, or show the steady colour
+        void _start_next();
+        void _step_ms();
+        void _write_pins(uint8_t state);
+        /// @brief Write the pins for the colour shown and start or stop the timer as needed
+        void _update();
+        bool _needs_timer();
+        void _timer_start();
+        void _timer_stop();
+
+        static LEDColor _full_color(int red, int green, int blue);
+        static bool _is_dimmed(LEDColor color);
+
+};
@@ -0,0 +1,122 @@
+#include "load-generator.hpp"
+#include <Arduino.h>
+#include <hot-path.hpp>
+
+LoadGenerator::LoadGenerator() {
+    _running = false;
+    _hits = 0;
+    _random = 1;
+}
+
+void LoadGenerator::start(const LoadParams &params) {
+    _params = params;
+    if (_params.peak_max < _params.peak_min) {
+        _params.peak_max = _params.peak_min;
+    }
+    _period_micros = 1000000/((params.rate_hz == 0) ? 1 : params.rate_hz);
+    _hits = 0;
+    _start_micros = micros();
+    _random = _start_micros | 1;
+
+    int num_inputs = 0;
+    for (size_t i=0; i<LOAD_GENERATOR_INPUTS; i++) {
+        num_inputs += (_params.inputs >> i) & 1;
+    }
+    int position = 0;
+    for (size_t i=0; i<LOAD_GENERATOR_INPUTS; i++) {
+        _hit_peak[i] = 0;
+        _hit_count[i] = 0;
+        if (((_params.inputs >> i) & 1) == 0) {
+            continue;
+        }
+        switch (_params.pattern) {
+            case LOAD_PATTERN_ROLL:
+                _next_hit[i] = _start_micros + _period_micros*position/num_inputs;
+                break;
+            case LOAD_PATTERN_RANDOM:
+                _next_hit[i] = _start_micros + _next_random(_period_micros);
+                break;
+            default:
+                _next_hit[i] = _start_micros;
+                break;
+        }
+        position++;
+    }
+    _running = true;
+}
+
+void LoadGenerator::stop() {
+    _running = false;
+}
+
+bool LoadGenerator::is_running() {
+    return _running;
+}
+
+bool LoadGenerator::is_over() {
+    return get_elapsed_micros() > _params.duration_ms*1000 + _params.rise_us + _params.decay_us + LOAD_TAIL_MICROS;
+}
+
+HOT_PATH uint16_t LoadGenerator::sample(size_t input, uint16_t reading) {
+    if (!_running || (input >= LOAD_GENERATOR_INPUTS) || (((_params.inputs >> input) & 1) == 0)) {
+        return reading;
+    }
+
+    uint32_t now = micros();
+    // Every hit due since the previous sample, the last one being the one sounding
+    while (((int32_t)(now - _next_hit[input]) >= 0) && (_next_hit[input] - _start_micros < _params.duration_ms*1000)) {
+        _hit_start[input] = _next_hit[input];
+        _hit_peak[input] = _next_peak(input);
+        _hits++;
+        _next_hit[input] += _interval();
+    }
+
+    uint32_t elapsed = now - _hit_start[input];
+    if ((_hit_peak[input] == 0) || (elapsed >= (uint32_t)_params.rise_us + _params.decay_us)) {
+        return 0;
+    }
+    if (elapsed < _params.rise_us) {
+        return (uint32_t)_hit_peak[input]*elapsed/_params.rise_us;
+    }
+    return (uint32_t)_hit_peak[input]*(_params.rise_us + _params.decay_us - elapsed)/_params.decay_us;
+}
+
+uint16_t LoadGenerator::sample_source(size_t input, uint16_t reading, void *context) {
+    return ((LoadGenerator *)context)->sample(input, reading);
+}
+
+uint32_t LoadGenerator::get_hits() {
+    return _hits;
+}
+
+uint32_t LoadGenerator::get_elapsed_micros() {
+    return micros() - _start_micros;
+}
+
+const LoadParams &LoadGenerator::get_params() {
+    return _params;
+}
+
+uint32_t LoadGenerator::_next_random(uint32_t range) {
+    // xorshift32
+    _random ^= _random << 13;
+    _random ^= _random >> 17;
+    _random ^= _random << 5;
+    return (range == 0) ? 0 : _random % range;
+}
+
+uint32_t LoadGenerator::_interval() {
+    if (_params.pattern == LOAD_PATTERN_RANDOM) {
+        return _period_micros/2 + _next_random(_period_micros);
+    }
+    return _period_micros;
+}
+
+uint16_t LoadGenerator::_next_peak(size_t input) {
+    uint32_t span = _params.peak_max - _params.peak_min;
+    if (_params.pattern == LOAD_PATTERN_RANDOM) {
+        return _params.peak_min + _next_random(span + 1);
+    }
+    int level = _hit_count[input]++ % PEAK_LEVELS;
+    return _params.peak_min + span*level/(PEAK_LEVELS-1);
+}
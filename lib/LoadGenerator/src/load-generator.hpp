@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/// @brief Number of inputs that can be driven, as many as a PadBank holds
+#define LOAD_GENERATOR_INPUTS 32
+
+/// @brief Every input hit at the rate, one after another, evenly spread over the period
+#define LOAD_PATTERN_ROLL 0
+/// @brief Every input hit at the same time, at the rate
+#define LOAD_PATTERN_UNISON 1
+/// @brief Every input hit on its own at random intervals, from half to one and a half period, averaging the rate
+#define LOAD_PATTERN_RANDOM 2
+
+/// @brief Hits played by a LoadGenerator
+struct LoadParams {
+    /// @brief LOAD_PATTERN_ROLL, LOAD_PATTERN_UNISON or LOAD_PATTERN_RANDOM
+    uint8_t pattern;
+    /// @brief Bit i set for every input i hit
+    uint32_t inputs;
+    /// @brief Hits per second of every input
+    uint16_t rate_hz;
+    /// @brief Peak readings of the hits. The roll and unison patterns step from the softest to the hardest in 8 levels,
+    /// the random pattern picks any reading in between.
+    uint16_t peak_min;
+    uint16_t peak_max;
+    /// @brief Time of the linear rise of a hit to its peak, in microseconds
+    uint16_t rise_us;
+    /// @brief Time of the linear decay of a hit from its peak, in microseconds
+    uint16_t decay_us;
+    /// @brief Time during which hits are started, in milliseconds
+    uint32_t duration_ms;
+};
+
+/// @brief Synthetic piezo signals replacing the ADC readings of a PadBank, to measure how many hits per second the
+/// detection and output stages sustain. Hits are scheduled in time from start(), and the reading of an input is computed
+/// whenever it is sampled, so hits falling between two samples are missed like real ones. A hit starting before the
+/// previous one has decayed replaces it.
+class LoadGenerator {
+    public:
+
+        /// @brief Stopped, every reading is passed through
+        LoadGenerator();
+
+        /// @brief Start playing hits at once, replacing the hits of a previous start
+        void start(const LoadParams &params);
+
+        /// @brief Stop playing, every reading goes back to the ADC.
+        void stop();
+
+        bool is_running();
+
+        /// @brief Check if the duration has elapsed and the last hits have had LOAD_TAIL_MICROS to cool down and be sent.
+        bool is_over();
+
+        /// @brief Reading of an input at the current time.
+        /// @param reading Reading of the ADC, returned for the inputs not driven
+        uint16_t sample(size_t input, uint16_t reading);
+
+        /// @brief Adapter for PadBank::set_sample_source, the context being the LoadGenerator
+        static uint16_t sample_source(size_t input, uint16_t reading, void *context);
+
+        /// @brief Number of hits started since start(), sampled or not
+        uint32_t get_hits();
+
+        /// @brief Microseconds since start()
+        uint32_t get_elapsed_micros();
+
+        const LoadParams &get_params();
+
+    private:
+
+        static const uint32_t LOAD_TAIL_MICROS = 50000;
+        static const int PEAK_LEVELS = 8;
+
+        LoadParams _params;
+        bool _running;
+        uint32_t _start_micros;
+        uint32_t _period_micros;
+        uint32_t _hits;
+        uint32_t _random;
+
+        /// @brief micros() of the next hit of every input
+        uint32_t _next_hit[LOAD_GENERATOR_INPUTS];
+        /// @brief micros() of the start of the last hit of every input
+        uint32_t _hit_start[LOAD_GENERATOR_INPUTS];
+        /// @brief Peak of the last hit of every input, 0 before the first hit
+        uint16_t _hit_peak[LOAD_GENERATOR_INPUTS];
+        /// @brief Number of hits of every input, for the peak steps
+        uint16_t _hit_count[LOAD_GENERATOR_INPUTS];
+
+        uint32_t _next_random(uint32_t range);
+        /// @brief Time from a hit to the next one of an input
+        uint32_t _interval();
+        uint16_t _next_peak(size_t input);
+
+};
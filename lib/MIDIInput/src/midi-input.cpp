@@ -0,0 +1,142 @@
+#include "midi-input.hpp"
+
+bool MIDIParser::parse(uint8 byte, MIDIMessage &message) {
+    if (byte >= 0xF8) { // Real-time, may appear anywhere
+        if ((byte == 0xF9) || (byte == 0xFD)) { // Undefined
+            _dropped_bytes++;
+            return false;
+        }
+        message.status = byte;
+        message.data1 = 0;
+        message.data2 = 0;
+        message.length = 1;
+        return true;
+    }
+
+    if (byte & 0x80) {
+        _dropped_bytes += _received; // Message cut short by a new status byte
+        _in_sysex = false;
+        _received = 0;
+
+        if (byte == 0xF0) {
+            _in_sysex = true;
+            _status = 0;
+            _dropped_bytes++;
+            return false;
+        }
+        if ((byte == 0xF7) || (byte == 0xF4) || (byte == 0xF5)) { // Stray end of exclusive or undefined
+            _status = 0;
+            _dropped_bytes++;
+            return false;
+        }
+
+        _status = byte;
+        _running = (byte < 0xF0); // System common messages cancel the running status
+        if (_data_length(byte) != 0) {
+            return false;
+        }
+        message.status = byte;
+        message.data1 = 0;
+        message.data2 = 0;
+        message.length = 1;
+        _status = 0;
+        return true;
+    }
+
+    if (_in_sysex || (_status == 0)) {
+        _dropped_bytes++;
+        return false;
+    }
+
+    _data[_received++] = byte;
+    uint8 length = _data_length(_status);
+    if (_received < length) {
+        return false;
+    }
+
+    message.status = _status;
+    message.data1 = _data[0];
+    message.data2 = (length == 2) ? _data[1] : 0;
+    message.length = 1 + length;
+    _received = 0;
+    if (!_running) {
+        _status = 0;
+    }
+    return true;
+}
+
+void MIDIParser::reset() {
+    _status = 0;
+    _received = 0;
+    _running = false;
+    _in_sysex = false;
+}
+
+uint32 MIDIParser::get_dropped_bytes() {
+    return _dropped_bytes;
+}
+
+uint8 MIDIParser::_data_length(uint8 status) {
+    switch (status & 0xF0) {
+        case 0xC0:
+        case 0xD0:
+            return 1;
+        case 0xF0:
+            switch (status) {
+                case 0xF1:
+                case 0xF3:
+                    return 1;
+                case 0xF2:
+                    return 2;
+                default:
+                    return 0;
+            }
+        default:
+            return 2;
+    }
+}
+
+uint32 midi_usb_packet(const MIDIMessage &message) {
+    uint8 code_index;
+
+    if (message.status < 0xF0) { // Channel message, the code index is the message type
+        code_index = message.status >> 4;
+    }
+    else if (message.length == 1) { // Real-time or tune request
+        code_index = (message.status >= 0xF8) ? 0xF : 0x5;
+    }
+    else { // System common with 1 or 2 data bytes
+        code_index = message.length;
+    }
+
+    return code_index | ((uint32)message.status << 8) | ((uint32)message.data1 << 16) | ((uint32)message.data2 << 24);
+}
+
+bool midi_usb_message(uint32 packet, MIDIMessage &message) {
+    uint8 code_index = packet & 0x0F;
+
+    message.status = (packet >> 8) & 0xFF;
+    message.data1 = (packet >> 16) & 0x7F;
+    message.data2 = (packet >> 24) & 0x7F;
+
+    if (code_index >= 0x8) { // Channel message or single byte
+        if (!(message.status & 0x80) || (message.status == 0xF0) || (message.status == 0xF7)) {
+            return false;
+        }
+        message.length = (code_index == 0xF) ? 1 : (((code_index == 0xC) || (code_index == 0xD)) ? 2 : 3);
+    }
+    else if ((code_index == 0x2) || (code_index == 0x3) || ((code_index == 0x5) && (message.status != 0xF7))) { // System common
+        message.length = (code_index == 0x5) ? 1 : code_index;
+    }
+    else { // Reserved or system exclusive
+        return false;
+    }
+
+    if (message.length < 3) {
+        message.data2 = 0;
+    }
+    if (message.length < 2) {
+        message.data1 = 0;
+    }
+    return true;
+}
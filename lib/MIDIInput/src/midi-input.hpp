@@ -0,0 +1,52 @@
+#pragma once
+
+#include <Arduino.h>
+
+/// @brief Complete MIDI message, always with its status byte
+struct MIDIMessage {
+    uint8 status;
+    uint8 data1;
+    uint8 data2;
+    /// @brief Number of bytes including the status byte, 1 to 3
+    uint8 length;
+};
+
+/// @brief Non-blocking MIDI byte stream parser, fed one byte at a time.
+/// Running status is expanded so that every message comes out with its status byte and can be interleaved with
+/// other streams. Real-time bytes are returned as soon as they arrive, even in the middle of another message,
+/// without breaking the running status. System exclusive messages are skipped.
+class MIDIParser {
+    public:
+
+        /// @brief Feed one received byte.
+        /// @param message Completed message, only written when true is returned
+        /// @return true if the byte completed a message
+        bool parse(uint8 byte, MIDIMessage &message);
+
+        /// @brief Forget the running status and any partial message.
+        void reset();
+
+        /// @brief Number of bytes that were not part of a complete message (system exclusive, data without status, ...)
+        uint32 get_dropped_bytes();
+
+    private:
+
+        uint8 _status = 0;
+        uint8 _data[2];
+        uint8 _received = 0;
+        /// @brief Running status can be reused by the next message, only true for channel messages
+        bool _running = false;
+        bool _in_sysex = false;
+        uint32 _dropped_bytes = 0;
+
+        /// @brief Number of data bytes following a status byte
+        static uint8 _data_length(uint8 status);
+
+};
+
+/// @brief USB MIDI event packet of a message on cable 0, in the layout expected by USBMIDI::writePacket
+uint32 midi_usb_packet(const MIDIMessage &message);
+
+/// @brief Message carried by a USB MIDI event packet, in the layout returned by USBMIDI::readPacket
+/// @return false for system exclusive and reserved packets
+bool midi_usb_message(uint32 packet, MIDIMessage &message);
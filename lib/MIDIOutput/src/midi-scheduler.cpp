@@ -0,0 +1,240 @@
+#include "midi-scheduler.hpp"
+#include <hot-path.hpp>
+
+TransmitBudget::TransmitBudget(uint16 bytes_per_ms, uint16 burst_bytes) {
+    _bytes_per_ms = bytes_per_ms;
+    _burst_bytes = burst_bytes;
+    _tokens = (uint32)burst_bytes*1000;
+    _last_micros = micros();
+}
+
+bool TransmitBudget::take(uint16 length) {
+    uint32 now = micros();
+    uint32 elapsed = now - _last_micros;
+    _last_micros = now;
+
+    uint32 capacity = (uint32)_burst_bytes*1000;
+    // Beyond the time needed to refill the bucket, the elapsed time doesn't matter and could overflow the product
+    if (elapsed >= capacity/_bytes_per_ms) {
+        _tokens = capacity;
+    }
+    else {
+        _tokens += elapsed*_bytes_per_ms;
+        if (_tokens > capacity) {
+            _tokens = capacity;
+        }
+    }
+
+    if (_tokens < (uint32)length*1000) {
+        return false;
+    }
+    _tokens -= (uint32)length*1000;
+    return true;
+}
+
+MIDIScheduler::MIDIScheduler() {
+    memset(_transports, 0, sizeof(_transports));
+}
+
+void MIDIScheduler::set_writer(int transport, MIDIWriter writer) {
+    _transports[transport].writer = writer;
+}
+
+HOT_PATH void MIDIScheduler::send(int transport, const MIDIMessage &message) {
+    Transport &t = _transports[transport];
+
+    if (t.writer == NULL) {
+        t.stats.dropped++;
+        return;
+    }
+
+    if (_is_note_on(message)) {
+        _push_note_on(t, message);
+    }
+    else if (_is_note_off(message)) {
+        _push_note_off(t, message);
+    }
+    else if (_priority(message) == MIDI_PRIORITY_CONTROL) {
+        _push_control(t, message);
+    }
+    else if (!_push(t.fifo[_priority(message)], message)) {
+        t.stats.dropped++;
+    }
+
+    size_t waiting = pending(transport);
+    if (waiting > t.stats.pending_max) {
+        t.stats.pending_max = waiting;
+    }
+
+    _flush(t);
+}
+
+void MIDIScheduler::poll() {
+    for (int i=0; i<MIDI_NUM_TRANSPORTS; i++) {
+        _flush(_transports[i]);
+    }
+}
+
+size_t MIDIScheduler::pending(int transport) {
+    const Transport &t = _transports[transport];
+    return t.fifo[MIDI_PRIORITY_NOTE_ON].count + t.note_off_count + t.fifo[MIDI_PRIORITY_NOTE_OFF].count + t.control_count;
+}
+
+const MIDITransportStats &MIDIScheduler::get_stats(int transport) {
+    return _transports[transport].stats;
+}
+
+HOT_PATH void MIDIScheduler::_flush(Transport &transport) {
+    if (transport.writer == NULL) {
+        return;
+    }
+
+    if (!_flush_fifo(transport, transport.fifo[MIDI_PRIORITY_NOTE_ON]) || !_flush_note_offs(transport) || !_flush_fifo(transport, transport.fifo[MIDI_PRIORITY_NOTE_OFF])) {
+        return;
+    }
+
+    while (transport.control_count != 0) {
+        if (!transport.writer(transport.control[0])) {
+            return;
+        }
+        transport.control_count--;
+        memmove(&transport.control[0], &transport.control[1], transport.control_count*sizeof(MIDIMessage));
+        transport.stats.sent++;
+    }
+}
+
+HOT_PATH bool MIDIScheduler::_flush_fifo(Transport &transport, Fifo &fifo) {
+    while (fifo.count != 0) {
+        if (!transport.writer(fifo.messages[fifo.head])) {
+            return false;
+        }
+        fifo.head = (fifo.head + 1) % MIDI_SCHEDULER_FIFO_SIZE;
+        fifo.count--;
+        transport.stats.sent++;
+    }
+    return true;
+}
+
+HOT_PATH bool MIDIScheduler::_flush_note_offs(Transport &transport) {
+    for (uint8 channel=0; (channel<16) && (transport.note_off_count != 0); channel++) {
+        for (uint8 i=0; i<16; i++) {
+            while (transport.note_offs[channel][i] != 0) {
+                uint8 bit = __builtin_ctz(transport.note_offs[channel][i]);
+                MIDIMessage message;
+                message.status = 0x80 | channel;
+                message.data1 = (i << 3) | bit;
+                message.data2 = 0;
+                message.length = 3;
+                if (!transport.writer(message)) {
+                    return false;
+                }
+                bitClear(transport.note_offs[channel][i], bit);
+                transport.note_off_count--;
+                transport.stats.sent++;
+            }
+        }
+    }
+    return true;
+}
+
+HOT_PATH bool MIDIScheduler::_push(Fifo &fifo, const MIDIMessage &message) {
+    if (fifo.count == MIDI_SCHEDULER_FIFO_SIZE) {
+        return false;
+    }
+    fifo.messages[(fifo.head + fifo.count) % MIDI_SCHEDULER_FIFO_SIZE] = message;
+    fifo.count++;
+    return true;
+}
+
+uint8 MIDIScheduler::_cancel_note_ons(Fifo &fifo, uint8 channel, uint8 note) {
+    uint8 kept = 0;
+    for (uint8 i=0; i<fifo.count; i++) {
+        const MIDIMessage &message = fifo.messages[(fifo.head + i) % MIDI_SCHEDULER_FIFO_SIZE];
+        if (_is_note_on(message) && ((message.status & 0x0F) == channel) && (message.data1 == note)) {
+            continue;
+        }
+        fifo.messages[(fifo.head + kept) % MIDI_SCHEDULER_FIFO_SIZE] = message;
+        kept++;
+    }
+    uint8 cancelled = fifo.count - kept;
+    fifo.count = kept;
+    return cancelled;
+}
+
+HOT_PATH void MIDIScheduler::_push_note_on(Transport &transport, const MIDIMessage &message) {
+    uint8 channel = message.status & 0x0F;
+    uint8 note = message.data1 & 0x7F;
+
+    // Sent after the pending note off of the same note, otherwise that note off would cut it
+    int priority = bitRead(transport.note_offs[channel][note >> 3], note & 0x07) ? MIDI_PRIORITY_NOTE_OFF : MIDI_PRIORITY_NOTE_ON;
+    if (!_push(transport.fifo[priority], message)) {
+        transport.stats.dropped++;
+    }
+}
+
+HOT_PATH void MIDIScheduler::_push_note_off(Transport &transport, const MIDIMessage &message) {
+    uint8 channel = message.status & 0x0F;
+    uint8 note = message.data1 & 0x7F;
+
+    // Note ons still queued behind an earlier note off would be sent after this one and never end, they are too late anyway
+    transport.stats.dropped += _cancel_note_ons(transport.fifo[MIDI_PRIORITY_NOTE_OFF], channel, note);
+
+    if (!bitRead(transport.note_offs[channel][note >> 3], note & 0x07)) {
+        bitSet(transport.note_offs[channel][note >> 3], note & 0x07);
+        transport.note_off_count++;
+    }
+}
+
+void MIDIScheduler::_push_control(Transport &transport, const MIDIMessage &message) {
+    for (uint8 i=0; i<transport.control_count; i++) {
+        if (_same_control(transport.control[i], message)) {
+            transport.control[i] = message;
+            transport.stats.coalesced++;
+            return;
+        }
+    }
+
+    if (transport.control_count == MIDI_SCHEDULER_CONTROL_SLOTS) {
+        transport.stats.dropped++;
+        return;
+    }
+    transport.control[transport.control_count++] = message;
+}
+
+bool MIDIScheduler::_is_note_on(const MIDIMessage &message) {
+    return ((message.status & 0xF0) == 0x90) && (message.data2 != 0);
+}
+
+bool MIDIScheduler::_is_note_off(const MIDIMessage &message) {
+    return ((message.status & 0xF0) == 0x80) || (((message.status & 0xF0) == 0x90) && (message.data2 == 0));
+}
+
+int MIDIScheduler::_priority(const MIDIMessage &message) {
+    if (message.status >= 0xF8) {
+        return MIDI_PRIORITY_NOTE_ON;
+    }
+    switch (message.status & 0xF0) {
+        case 0x90:
+            return (message.data2 != 0) ? MIDI_PRIORITY_NOTE_ON : MIDI_PRIORITY_NOTE_OFF;
+        case 0xA0:
+        case 0xB0:
+        case 0xD0:
+        case 0xE0:
+            return MIDI_PRIORITY_CONTROL;
+        default:
+            return MIDI_PRIORITY_NOTE_OFF;
+    }
+}
+
+bool MIDIScheduler::_same_control(const MIDIMessage &a, const MIDIMessage &b) {
+    if (a.status != b.status) {
+        return false;
+    }
+    switch (a.status & 0xF0) {
+        case 0xA0: // Per note
+        case 0xB0: // Per controller
+            return a.data1 == b.data1;
+        default: // Per channel
+            return true;
+    }
+}
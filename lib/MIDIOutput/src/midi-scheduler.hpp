@@ -0,0 +1,122 @@
+#pragma once
+
+#include <Arduino.h>
+#include <midi-input.hpp>
+
+#define MIDI_TRANSPORT_USB 0
+#define MIDI_TRANSPORT_UART 1
+#define MIDI_NUM_TRANSPORTS 2
+
+/// @brief Note ons and real-time messages
+#define MIDI_PRIORITY_NOTE_ON 0
+/// @brief Note offs, then every message that must keep its order (program change, system common)
+#define MIDI_PRIORITY_NOTE_OFF 1
+/// @brief Controllers, pressure and pitch bend, where only the latest value of each controller matters
+#define MIDI_PRIORITY_CONTROL 2
+#define MIDI_NUM_PRIORITIES 3
+
+#define MIDI_SCHEDULER_FIFO_SIZE 32
+#define MIDI_SCHEDULER_CONTROL_SLOTS 16
+
+/// @brief Write a message to a transport without blocking.
+/// @return false if the transport has no room for it, the message is then retried later
+typedef bool (*MIDIWriter)(const MIDIMessage &message);
+
+/// @brief Token bucket limiting a transport to its bandwidth, for transports that can't tell how much room they have left.
+class TransmitBudget {
+    public:
+
+        /// @param bytes_per_ms Sustained bandwidth
+        /// @param burst_bytes Largest burst, usually the size of the transmit buffer
+        TransmitBudget(uint16 bytes_per_ms, uint16 burst_bytes);
+
+        /// @brief Spend length bytes of the budget
+        /// @return false if the budget is too low, nothing is spent then
+        bool take(uint16 length);
+
+    private:
+
+        uint16 _bytes_per_ms;
+        uint16 _burst_bytes;
+        /// @brief Available budget in 1/1000 byte
+        uint32 _tokens;
+        uint32 _last_micros;
+
+};
+
+/// @brief Sending statistics of a transport
+struct MIDITransportStats {
+    uint32 sent;
+    /// @brief Control messages replaced by a newer value of the same controller before being sent
+    uint32 coalesced;
+    /// @brief Messages dropped because their queue was full
+    uint32 dropped;
+    /// @brief Largest number of messages waiting
+    uint16 pending_max;
+};
+
+/// @brief Output scheduler sharing the bandwidth of every MIDI transport by priority.
+/// Each transport has its own queues and writer, so a saturated transport never delays the others. Note ons go first,
+/// then note offs, then controllers. A note on never overtakes a pending note off of the same note. Control messages
+/// waiting for bandwidth are coalesced so that only the latest value of a controller is sent.
+///
+/// Waiting note offs are kept as one bit per channel and note, so they can't be dropped and no note is left hanging
+/// when a transport is saturated. They are sent with a velocity of 0.
+class MIDIScheduler {
+    public:
+
+        MIDIScheduler();
+
+        /// @brief Set the function writing messages to a transport. Messages for a transport without writer are dropped.
+        void set_writer(int transport, MIDIWriter writer);
+
+        /// @brief Queue a message on a transport and send as many waiting messages as it accepts.
+        void send(int transport, const MIDIMessage &message);
+
+        /// @brief Send as many waiting messages as every transport accepts.
+        void poll();
+
+        /// @brief Number of messages waiting for a transport
+        size_t pending(int transport);
+
+        const MIDITransportStats &get_stats(int transport);
+
+    private:
+
+        struct Fifo {
+            MIDIMessage messages[MIDI_SCHEDULER_FIFO_SIZE];
+            uint8 head;
+            uint8 count;
+        };
+
+        struct Transport {
+            MIDIWriter writer;
+            Fifo fifo[MIDI_PRIORITY_CONTROL];
+            /// @brief Channel -> Note bit set of pending note offs
+            uint8 note_offs[16][16];
+            uint16 note_off_count;
+            /// @brief Pending control messages, oldest first
+            MIDIMessage control[MIDI_SCHEDULER_CONTROL_SLOTS];
+            uint8 control_count;
+            MIDITransportStats stats;
+        };
+
+        Transport _transports[MIDI_NUM_TRANSPORTS];
+
+        void _flush(Transport &transport);
+        bool _flush_fifo(Transport &transport, Fifo &fifo);
+        bool _flush_note_offs(Transport &transport);
+        bool _push(Fifo &fifo, const MIDIMessage &message);
+        /// @brief Remove the note ons of a channel and note waiting in a queue
+        uint8 _cancel_note_ons(Fifo &fifo, uint8 channel, uint8 note);
+        void _push_note_on(Transport &transport, const MIDIMessage &message);
+        void _push_note_off(Transport &transport, const MIDIMessage &message);
+        void _push_control(Transport &transport, const MIDIMessage &message);
+
+        static int _priority(const MIDIMessage &message);
+        static bool _is_note_on(const MIDIMessage &message);
+        static bool _is_note_off(const MIDIMessage &message);
+        /// @brief Two control messages address the same controller
+        static bool _same_control(const MIDIMessage &a, const MIDIMessage &b);
+
+};
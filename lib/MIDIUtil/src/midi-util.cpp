@@ -1,7 +1,8 @@
 #include "midi-util.hpp"
+#include <hot-path.hpp>
 #include <cmath>
 
-int midi_lin_vel_map(int input, int lower_input, int upper_input) {
+HOT_PATH int midi_lin_vel_map(int input, int lower_input, int upper_input) {
     if (input <= lower_input) {
         return 0;
     }
@@ -20,12 +21,23 @@ int midi_lin_vel_map(int input) {
     return midi_lin_vel_map(input, 0, 4096);
 }
 
-int midi_exp_vel_map(int input, double a) {
+HOT_PATH int midi_exp_vel_map(int input, double a) {
     double exponent = -a*input + log2(127);
     return round(-exp2(exponent)+127);
 }
 
-int midi_exp_pow_vel_map(int input, double a, double b) {
+HOT_PATH int midi_exp_pow_vel_map(int input, double a, double b) {
     double exponent = -a*pow(input, b) + log2(127);
     return round(-exp2(exponent)+127);
-}
\ No newline at end of file
+}
+
+HOT_PATH int attack_area_to_peak(uint32_t area, int num_samples) {
+    if (num_samples <= 0) {
+        return 0;
+    }
+    uint32_t result = area*157/(100*num_samples);
+    if (result > 4095) {
+        return 4095;
+    }
+    return result;
+}
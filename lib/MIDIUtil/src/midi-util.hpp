@@ -1,3 +1,5 @@
+#include <stdint.h>
+
 #define SNARE_GM2 38
 #define BASS_DRUM_GM2 36
 #define HIHAT_CLOSED_GM2 42
@@ -27,4 +29,11 @@ int midi_exp_vel_map(int input, double a);
 /// @param a Coefficient a in the equation
 /// @param b Power that the input is raised to
 /// @return MIDI velocity
-int midi_exp_pow_vel_map(int input, double a, double b);
\ No newline at end of file
+int midi_exp_pow_vel_map(int input, double a, double b);
+
+/// @brief Convert the area under an attack transient into an equivalent peak reading, so that the same velocity curves can be used.
+/// The mean of the window is scaled by pi/2, the peak to mean ratio of a half sine pulse.
+/// @param area Sum of raw readings over the attack window
+/// @param num_samples Number of samples in the attack window
+/// @return Equivalent peak reading, limited to 4095
+int attack_area_to_peak(uint32_t area, int num_samples);
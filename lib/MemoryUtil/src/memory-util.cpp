@@ -0,0 +1,96 @@
+#include "memory-util.hpp"
+#include <stdint.h>
+
+#if defined(__arm__)
+
+#include <malloc.h>
+
+extern "C" char *sbrk(int incr);
+
+static const uint8_t STACK_PAINT_PATTERN = 0xA5;
+static const size_t STACK_PAINT_GUARD = 64; // Bytes below the current stack pointer that are left untouched
+
+static char *_paint_start = 0;
+static char *_paint_end = 0;
+
+static inline __attribute__((always_inline)) char *_stack_pointer() {
+    return (char *)__builtin_frame_address(0);
+}
+
+void memory_paint_stack() {
+    _paint_start = sbrk(0);
+    _paint_end = _stack_pointer() - STACK_PAINT_GUARD;
+    for (char *ptr = _paint_start; ptr < _paint_end; ptr++) {
+        *ptr = STACK_PAINT_PATTERN;
+    }
+}
+
+size_t memory_min_free() {
+    char *heap_end = sbrk(0);
+    char *ptr = (heap_end > _paint_start) ? heap_end : _paint_start;
+    while ((ptr < _paint_end) && (*(uint8_t *)ptr == STACK_PAINT_PATTERN)) {
+        ptr++;
+    }
+    return ptr - heap_end;
+}
+
+size_t memory_free() {
+    return _stack_pointer() - sbrk(0);
+}
+
+size_t memory_heap_used() {
+    return mallinfo().uordblks;
+}
+
+size_t memory_heap_size() {
+    return mallinfo().arena;
+}
+
+#else
+
+// Host builds (simulator) have no single region shared by the heap and the stack. The stack is painted for a fixed size
+// below the caller of memory_paint_stack() instead, and free is what is left of it, so only the changes of free and
+// min_free between two reports are meaningful. The heap is the one of the whole program, simulator included.
+
+#include <malloc.h>
+
+static const uint8_t STACK_PAINT_PATTERN = 0xA5;
+static const size_t STACK_PAINT_GUARD = 256; // Bytes below the current stack pointer that are left untouched
+static const size_t STACK_PAINT_SIZE = 65536;
+
+static char *_paint_start = 0;
+static char *_paint_end = 0;
+
+static inline __attribute__((always_inline)) char *_stack_pointer() {
+    return (char *)__builtin_frame_address(0);
+}
+
+void memory_paint_stack() {
+    _paint_end = _stack_pointer() - STACK_PAINT_GUARD;
+    _paint_start = _paint_end - STACK_PAINT_SIZE;
+    for (volatile char *ptr = _paint_start; ptr < _paint_end; ptr++) {
+        *ptr = STACK_PAINT_PATTERN;
+    }
+}
+
+size_t memory_min_free() {
+    char *ptr = _paint_start;
+    while ((ptr < _paint_end) && (*(volatile uint8_t *)ptr == STACK_PAINT_PATTERN)) {
+        ptr++;
+    }
+    return ptr - _paint_start;
+}
+
+size_t memory_free() {
+    return _stack_pointer() - _paint_start;
+}
+
+size_t memory_heap_used() {
+    return mallinfo2().uordblks;
+}
+
+size_t memory_heap_size() {
+    return mallinfo2().arena;
+}
+
+#endif
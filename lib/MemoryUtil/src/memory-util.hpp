@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+
+/// @brief Fill the free RAM between the heap and the stack with a known pattern. Call once at the start of setup.
+void memory_paint_stack();
+
+/// @brief Smallest amount of free RAM between the heap and the stack since memory_paint_stack was called, in bytes.
+size_t memory_min_free();
+
+/// @brief Current amount of free RAM between the heap and the stack, in bytes.
+size_t memory_free();
+
+/// @brief Bytes of heap currently allocated.
+size_t memory_heap_used();
+
+/// @brief Bytes of RAM ever taken by the heap. The heap never shrinks, so this is its high-water mark.
+size_t memory_heap_size();
@@ -0,0 +1,803 @@
+#pragma once
+
+#include <Arduino.h>
+#include <event-queue.hpp>
+#include <hot-path.hpp>
+#include <midi-util.hpp>
+#include <signal-stats.hpp>
+
+#define VEL_ESTIMATOR_PEAK 0
+#define VEL_ESTIMATOR_AREA 1
+
+/// @brief Input is not sampled
+#define PAD_MODE_OFF 0
+/// @brief Piezo trigger. EVENT_TRIGGER with the peak reading, then EVENT_RELEASE once fully cool-down
+#define PAD_MODE_TRIGGER 1
+/// @brief Continuous controller. EVENT_CC with the averaged reading every time it moves by more than threshold_high
+#define PAD_MODE_CONTROLLER 2
+/// @brief On/off switch. EVENT_TRIGGER when the average rises above threshold_high, EVENT_RELEASE when it falls below threshold_low
+#define PAD_MODE_SWITCH 3
+
+/// @brief Input working normally
+#define PAD_HEALTH_OK 0
+/// @brief Trigger input stuck at the full scale of the ADC, e.g. a piezo shorted to the supply
+#define PAD_HEALTH_RAIL 1
+/// @brief Trigger input whose average has not fallen below threshold_low for the stuck time
+#define PAD_HEALTH_STUCK 2
+/// @brief Trigger input whose idle noise is above the noise limit, e.g. the floating input of a disconnected piezo
+#define PAD_HEALTH_NOISY 3
+
+/// @brief Mux address of an input wired directly to an analog pin
+#define PAD_DIRECT 0xFF
+
+/// @brief Replacement of the ADC readings of a PadBank, for tests without hitting the pads.
+/// @param input Index of the input sampled
+/// @param reading Reading of the ADC, still taken so that the sampling timing is unchanged
+/// @return Reading run through the detection
+typedef uint16_t (*pad_sample_source)(size_t input, uint16_t reading, void *context);
+
+/// @brief Bank of N sensor inputs. By default input i is channel i of a 16 channel multiplexer on one analog pin, any input
+/// can be moved to a direct analog pin with set_input. The state of every input is stored in parallel arrays and the whole
+/// bank is sampled in one sweep without virtual dispatch, skipping the inputs that are off.
+/// Detected events are pushed into an EventQueue with the input index as sensor id.
+/// Trigger inputs that get stuck or noisy are excluded from the detection and only probed every PROBE_PERIOD until they are
+/// quiet again for RECOVERY_TIME, so they neither send notes nor take the sampling time of the other inputs.
+/// @tparam N Number of inputs in the bank, at most 32
+/// @tparam BUFFER_SIZE Longest moving average window of an input, in samples
+template <size_t N, size_t BUFFER_SIZE>
+class PadBank {
+    public:
+
+        /// @brief Default time the average of a pad must stay below threshold_low before it is considered fully cool-down, in microseconds
+        static const int COOLDOWN_TIME = 15000;
+        /// @brief Default settling time of the multiplexer after changing address in microseconds
+        static const int MUX_SETTLE_TIME = 50;
+        /// @brief Longest attack window usable by VEL_ESTIMATOR_AREA
+        static const int MAX_ATTACK_WINDOW = 16;
+        /// @brief Longest time taken by analogRead and the detection of a single input in microseconds
+        static const int INPUT_READ_TIME = 20;
+        /// @brief Default time without the average of a trigger input below threshold_low before it is stuck, in microseconds
+        static const uint32_t STUCK_TIME = 1000000;
+        /// @brief Default idle noise RMS above which a trigger input is noisy, in LSB
+        static const uint16_t NOISE_LIMIT = 48;
+        /// @brief Idle samples needed before the noise of an input is trusted, about twice the averaging of SignalStats
+        static const uint32_t NOISE_MIN_SAMPLES = 64;
+        /// @brief Sampling period of a faulty input in microseconds
+        static const uint32_t PROBE_PERIOD = 20000;
+        /// @brief Time a faulty input must stay below threshold_low and within the noise limit before it is sampled again, in microseconds
+        static const uint32_t RECOVERY_TIME = 1000000;
+        /// @brief An average within this many LSB of the full scale is PAD_HEALTH_RAIL rather than PAD_HEALTH_STUCK
+        static const uint16_t RAIL_MARGIN = 32;
+
+        /// @brief Every input starts off. Input i is channel i of the multiplexer, inputs from 16 on must be given a direct pin with set_input.
+        /// @param mux_pin Analog pin connected to the multiplexer output.
+        /// @param select_pins Select pins of the multiplexer, least significant bit first.
+        PadBank(int mux_pin, const int select_pins[4]) {
+            static_assert(N <= 32, "PadBank supports at most 32 inputs");
+            static_assert(BUFFER_SIZE > 0, "PadBank buffer size must be at least 1");
+
+            pinMode(mux_pin, INPUT);
+            _mux_pin = mux_pin;
+            for (size_t i=0; i<16; i++) {
+                _settle_time[i] = MUX_SETTLE_TIME;
+            }
+            _max_settle_time = MUX_SETTLE_TIME;
+            for (size_t i=0; i<4; i++) {
+                _select_pins[i] = select_pins[i];
+                pinMode(select_pins[i], OUTPUT);
+                digitalWrite(select_pins[i], LOW);
+            }
+            _mux_address = 0;
+            _sample_source = 0;
+            _sample_source_context = 0;
+            _stuck_time = STUCK_TIME;
+            _noise_limit = NOISE_LIMIT;
+            _faulty = 0;
+
+            for (size_t i=0; i<N; i++) {
+                _pin[i] = mux_pin;
+                _input_address[i] = (i < 16) ? i : PAD_DIRECT;
+                _mode[i] = PAD_MODE_OFF;
+                set_threshold(i, 4095, 4095);
+                _note_num[i] = 0;
+                _window[i] = BUFFER_SIZE;
+                _cooldown_time[i] = COOLDOWN_TIME;
+                _sample_period[i] = 0;
+                _vel_estimator[i] = VEL_ESTIMATOR_PEAK;
+                _attack_window[i] = 1;
+                _pad_sample_time[i] = 0;
+                _faults[i] = 0;
+                _reset(i);
+            }
+        }
+
+        /// @brief Sample every input once and push the detected events into the queue.
+        /// @return Bit i is set for every input i triggered or changed in this sweep, 0 if none.
+        template <size_t QUEUE_SIZE>
+        uint32_t poll(EventQueue<QUEUE_SIZE> &queue) {
+            uint32_t triggered = 0;
+
+            for (size_t i=0; i<N; i++) {
+                if ((_mode[i] != PAD_MODE_OFF) && _sample_pad(i, queue)) {
+                    bitSet(triggered, i);
+                }
+            }
+
+            return triggered;
+        }
+
+        /// @brief Same as poll function, but with a delay of sampling period between sweeps.
+        /// @param sample_period_micro Sampling period of every input in microseconds
+        template <size_t QUEUE_SIZE>
+        uint32_t poll(EventQueue<QUEUE_SIZE> &queue, uint32_t sample_period_micro) {
+            if ((micros()-_last_sample_time) > sample_period_micro) {
+                _last_sample_time = micros();
+                return poll(queue);
+            }
+            else {
+                return 0;
+            }
+        }
+
+        /// @brief Sample only the inputs that are due. Pads in burst mode (signal rising up to the trigger, or in the attack window)
+        /// are sampled every burst_period_micro and before any other input, idle, triggered and cooling down pads every
+        /// idle_period_micro, so the ADC time is spent on the hits being measured. Controllers and switches are sampled every
+        /// idle_period_micro. Inputs that are off cost nothing.
+        /// @param burst_period_micro Sampling period of pads in burst mode in microseconds, unless set per input with set_sample_period
+        /// @param idle_period_micro Sampling period of idle pads in microseconds, unless set per controller or switch with set_sample_period
+        /// @return Bit i is set for every input i triggered or changed in this call, 0 if none.
+        template <size_t QUEUE_SIZE>
+        uint32_t poll(EventQueue<QUEUE_SIZE> &queue, uint32_t burst_period_micro, uint32_t idle_period_micro) {
+            return _poll_due(queue, burst_period_micro, idle_period_micro, false, 0);
+        }
+
+        /// @brief Same as poll function, but return before sampling an input that could not be finished by deadline_micro.
+        /// The inputs left are sampled first by the next call.
+        /// @param deadline_micro micros() value by which the call must return
+        template <size_t QUEUE_SIZE>
+        uint32_t poll(EventQueue<QUEUE_SIZE> &queue, uint32_t burst_period_micro, uint32_t idle_period_micro, uint32_t deadline_micro) {
+            return _poll_due(queue, burst_period_micro, idle_period_micro, true, deadline_micro);
+        }
+
+        /// @brief Time until poll with the same periods has an input to sample, in microseconds. 0 if one is already due,
+        /// INT32_MAX if every input is off.
+        int32_t time_to_next_sample(uint32_t burst_period_micro, uint32_t idle_period_micro) {
+            uint32_t now = micros();
+            int32_t next = INT32_MAX;
+
+            for (size_t i=0; i<N; i++) {
+                if (_mode[i] == PAD_MODE_OFF) {
+                    continue;
+                }
+                // poll samples an input once more than its period has elapsed
+                int32_t remaining = _pad_sample_time[i] + _input_period(i, burst_period_micro, idle_period_micro) + 1 - now;
+                if (remaining <= 0) {
+                    return 0;
+                }
+                if (remaining < next) {
+                    next = remaining;
+                }
+            }
+
+            return next;
+        }
+
+        /// @brief Connect an input to a multiplexer channel or to a direct analog pin.
+        /// @param pin Analog pin read for this input
+        /// @param mux_address Multiplexer channel, PAD_DIRECT if the input is not behind the multiplexer
+        void set_input(size_t pad, int pin, int mux_address) {
+            pinMode(pin, INPUT);
+            _pin[pad] = pin;
+            _input_address[pad] = mux_address;
+            if (_mode[pad] != PAD_MODE_OFF) {
+                _reset(pad);
+            }
+        }
+
+        /// @brief Select how an input is interpreted, PAD_MODE_OFF, PAD_MODE_TRIGGER, PAD_MODE_CONTROLLER or PAD_MODE_SWITCH.
+        void set_mode(size_t pad, int mode) {
+            if (mode == _mode[pad]) {
+                return;
+            }
+            _mode[pad] = mode;
+            if (mode != PAD_MODE_OFF) {
+                _reset(pad);
+            }
+            else {
+                _health[pad] = PAD_HEALTH_OK;
+                bitClear(_faulty, pad);
+            }
+        }
+
+        int get_mode(size_t pad) {
+            return _mode[pad];
+        }
+
+        /// @brief Check if a pad is currently sampled at burst rate.
+        bool is_burst(size_t pad) {
+            return _burst[pad];
+        }
+
+        /// @brief Get the peak level of the signal in the moving average window of a pad.
+        int get_max(size_t pad) {
+            uint16_t max = 0;
+            for (size_t j=0; j<_window[pad]; j++) {
+                if (_samples[pad][j] > max) {
+                    max = _samples[pad][j];
+                }
+            }
+            return max;
+        }
+
+        /// @brief The state of the pad will be true for the duration between trigger is detected to stable state is reached. Otherwise, it will be false.
+        bool get_state(size_t pad) {
+            return _state[pad];
+        }
+
+        /// @brief Get MIDI note number, or CC number for controllers and switches, assigned to an input.
+        int get_note_num(size_t pad) {
+            return _note_num[pad];
+        }
+
+        /// @brief Assign new MIDI note number, or CC number for controllers and switches, to an input.
+        void set_note_num(size_t pad, int new_note_num) {
+            _note_num[pad] = new_note_num;
+        }
+
+        /// @brief Set the high-going and low-going threshold of a pad. For a controller, threshold_high is the change in reading needed to send a new value.
+        void set_threshold(size_t pad, int threshold_high, int threshold_low) {
+            _threshold_high[pad] = threshold_high;
+            _threshold_low[pad] = threshold_low;
+        }
+
+        /// @brief Set the number of samples in the moving average of a pad, 1 to BUFFER_SIZE.
+        void set_window(size_t pad, int window) {
+            window = constrain(window, 1, (int)BUFFER_SIZE);
+            if (window == _window[pad]) {
+                return;
+            }
+            _window[pad] = window;
+            _index[pad] = 0;
+            _sum[pad] = 0;
+            for (int j=0; j<window; j++) {
+                _sum[pad] += _samples[pad][j];
+            }
+        }
+
+        /// @brief Set the time the average of a pad must stay below threshold_low before it is considered fully cool-down, in microseconds.
+        void set_cooldown_time(size_t pad, uint16_t cooldown_time_micro) {
+            _cooldown_time[pad] = cooldown_time_micro;
+        }
+
+        /// @brief Set the burst sampling period of a pad, or the sampling period of a controller or switch, in microseconds.
+        /// 0 to use the period given to poll.
+        void set_sample_period(size_t pad, uint32_t sample_period_micro) {
+            _sample_period[pad] = sample_period_micro;
+        }
+
+        /// @brief Select how the trigger reading of a pad is estimated.
+        /// @param estimator VEL_ESTIMATOR_PEAK: peak of the moving average buffer when the average crosses threshold_high.
+        /// VEL_ESTIMATOR_AREA: area of the first attack_window samples after a sample crosses threshold_high, converted to an equivalent peak.
+        /// @param attack_window Number of samples integrated by VEL_ESTIMATOR_AREA, 1 to MAX_ATTACK_WINDOW.
+        void set_velocity_estimator(size_t pad, int estimator, int attack_window) {
+            _vel_estimator[pad] = estimator;
+            _attack_window[pad] = constrain(attack_window, 1, MAX_ATTACK_WINDOW);
+        }
+
+        /// @brief Set the time waited for the multiplexer to settle after switching to a channel, in microseconds.
+        void set_settle_time(size_t mux_address, uint8_t settle_time_micro) {
+            _settle_time[mux_address] = settle_time_micro;
+            _max_settle_time = 0;
+            for (size_t i=0; i<16; i++) {
+                if (_settle_time[i] > _max_settle_time) {
+                    _max_settle_time = _settle_time[i];
+                }
+            }
+        }
+
+        uint8_t get_settle_time(size_t mux_address) {
+            return _settle_time[mux_address];
+        }
+
+        /// @brief Longest time taken to sample a single input in microseconds, multiplexer settling included
+        int input_sample_time() {
+            return _max_settle_time + INPUT_READ_TIME;
+        }
+
+        /// @brief Self-test measuring how long the multiplexer output takes to settle after switching to a channel. The channel is
+        /// entered from every other channel whose reading differs from it by more than 4 times the tolerance, and read back to back
+        /// until max_time_micro. Blocks for about 50 times max_time_micro, and leaves the multiplexer on the measured channel.
+        /// @param tolerance Largest difference from the settled reading, in LSB
+        /// @return Time after the switch of the end of the last read outside of the tolerance in the worst transition,
+        /// in microseconds. -1 if no other channel differs enough from this one to be measured.
+        int measure_settle_time(size_t mux_address, uint16_t tolerance, uint16_t max_time_micro) {
+            // Settled reading of every channel
+            uint16_t level[16];
+            for (size_t channel=0; channel<16; channel++) {
+                _set_mux_address(channel, max_time_micro);
+                uint32_t sum = 0;
+                for (int j=0; j<8; j++) {
+                    sum += analogRead(_mux_pin);
+                }
+                level[channel] = sum / 8;
+            }
+
+            int worst = -1;
+            for (size_t from=0; from<16; from++) {
+                if (abs((int)level[from] - (int)level[mux_address]) <= 4*tolerance) {
+                    continue;
+                }
+                _set_mux_address(from, max_time_micro);
+                _set_mux_address(mux_address, 0);
+                uint32_t start = micros();
+                uint32_t elapsed;
+                int settle = 0;
+                do {
+                    uint16_t sample = analogRead(_mux_pin);
+                    elapsed = micros() - start;
+                    if (abs((int)sample - (int)level[mux_address]) > tolerance) {
+                        settle = elapsed;
+                    }
+                } while (elapsed < max_time_micro);
+                if (settle > worst) {
+                    worst = settle;
+                }
+            }
+            return worst;
+        }
+
+        /// @brief Signal quality statistics of a pad.
+        SignalStats &get_stats(size_t pad) {
+            return _stats[pad];
+        }
+
+        /// @brief Number of inputs in the bank.
+        size_t size() {
+            return N;
+        }
+
+        /// @brief Set the limits of the health monitoring of the trigger inputs.
+        /// @param stuck_time_micro Time without the average below threshold_low before an input is stuck, 0 to turn the monitoring off
+        /// @param noise_rms Idle noise RMS above which an input is noisy, in LSB, at most 256
+        void set_health_limits(uint32_t stuck_time_micro, uint16_t noise_rms) {
+            _stuck_time = stuck_time_micro;
+            _noise_limit = noise_rms;
+            for (size_t i=0; i<N; i++) {
+                if ((_stuck_time == 0) && (_health[i] != PAD_HEALTH_OK)) {
+                    _reset(i);
+                }
+            }
+        }
+
+        /// @brief Health of an input, PAD_HEALTH_OK, PAD_HEALTH_RAIL, PAD_HEALTH_STUCK or PAD_HEALTH_NOISY
+        int get_health(size_t pad) {
+            return _health[pad];
+        }
+
+        /// @brief Bit i is set for every input i excluded from the detection because of its health
+        uint32_t get_faulty() {
+            return _faulty;
+        }
+
+        /// @brief Number of times an input was excluded since startup
+        uint16_t get_fault_count(size_t pad) {
+            return _faults[pad];
+        }
+
+        /// @brief Run every reading taken by poll through a source, 0 to go back to the ADC readings alone.
+        void set_sample_source(pad_sample_source source, void *context) {
+            _sample_source = source;
+            _sample_source_context = context;
+        }
+
+        /// @brief Number of input samples taken by poll since startup, wrapping around.
+        uint32_t get_sample_count() {
+            return _sample_count;
+        }
+
+        /// @brief Longest onset window of a trigger since startup in microseconds: the time between the last sample of the pad
+        /// below the onset level and the first above it, within which the hit began. The time from a hit to its event varies
+        /// by up to this much, whatever is done with the onset afterwards.
+        uint32_t get_onset_window_max() {
+            return _onset_window_max;
+        }
+
+        /// @brief Mean onset window of the triggers since startup in microseconds
+        float get_onset_window_mean() {
+            return (_onset_count == 0) ? 0 : (float)_onset_window_sum/_onset_count;
+        }
+
+    private:
+
+        uint16_t _samples[N][BUFFER_SIZE];
+        uint32_t _sum[N];
+        uint16_t _threshold_high[N];
+        uint16_t _threshold_low[N];
+        uint8_t _window[N];
+        uint16_t _cooldown_time[N];
+        uint16_t _sample_period[N];
+        /// @brief Triggered and waiting for the average to stay below threshold_low for _cooldown_time
+        bool _cooldown[N];
+        /// @brief micros() of the first sample of the current run below threshold_low of a pad cooling down
+        uint32_t _cooldown_start[N];
+        bool _state[N];
+        uint8_t _note_num[N];
+        uint8_t _vel_estimator[N];
+        uint8_t _attack_window[N];
+        uint8_t _attack_remaining[N];
+        uint32_t _attack_area[N];
+        /// @brief Last value sent by a controller
+        uint16_t _last_value[N];
+        SignalStats _stats[N];
+
+        uint8_t _mode[N];
+        uint8_t _pin[N];
+        pad_sample_source _sample_source;
+        void *_sample_source_context;
+        uint8_t _health[N];
+        /// @brief micros() of the last sample of an input below threshold_low, or of a faulty input out of the recovery limits
+        uint32_t _health_time[N];
+        uint16_t _faults[N];
+        uint32_t _faulty;
+        uint32_t _stuck_time;
+        uint16_t _noise_limit;
+        uint8_t _input_address[N];
+
+        uint8_t _index[N];
+        bool _burst[N];
+        uint32_t _pad_sample_time[N];
+        uint32_t _last_sample_time = 0;
+        /// @brief Input sampled first by the next poll, after a poll stopped by its deadline
+        size_t _first_input = 0;
+        uint32_t _sample_count = 0;
+        /// @brief micros() of the first sample above threshold_low of a hit not triggered yet
+        uint32_t _onset_time[N];
+        bool _onset_valid[N];
+        /// @brief Time since the previous sample of the input at _onset_time
+        uint16_t _onset_window[N];
+        /// @brief Time since the previous sample of the input being sampled
+        uint32_t _sample_interval = 0;
+        uint32_t _onset_window_max = 0;
+        uint64_t _onset_window_sum = 0;
+        uint32_t _onset_count = 0;
+
+        int _select_pins[4];
+        size_t _mux_address;
+        uint8_t _mux_pin;
+        /// @brief Mux address -> Settling time in microseconds
+        uint8_t _settle_time[16];
+        uint8_t _max_settle_time;
+
+        /// @brief Sample the inputs that are due, starting from _first_input, optionally stopping before deadline_micro.
+        template <size_t QUEUE_SIZE>
+        HOT_PATH uint32_t _poll_due(EventQueue<QUEUE_SIZE> &queue, uint32_t burst_period_micro, uint32_t idle_period_micro, bool has_deadline, uint32_t deadline_micro) {
+            uint32_t triggered = 0;
+            uint32_t burst_samples = 0;
+
+            for (size_t k=0; k<N; k++) {
+                size_t i = (_first_input + k) % N;
+                // Pads in burst mode are served before every other input, so that a hit keeps its rate when the other
+                // inputs cannot all be sampled in time. At most N of them per call, so that a call takes at most 2*N samples
+                // even when a pad is always due, with a burst period shorter than a sample or a noise above threshold_low.
+                for (size_t j=0; (j<N) && (burst_samples < N); j++) {
+                    if (!_burst[j]) {
+                        continue;
+                    }
+                    uint32_t sample_count = _sample_count;
+                    if (!_sample_if_due(j, queue, burst_period_micro, idle_period_micro, has_deadline, deadline_micro, triggered)) {
+                        _first_input = i;
+                        return triggered;
+                    }
+                    burst_samples += _sample_count - sample_count;
+                }
+                if ((_mode[i] == PAD_MODE_OFF) || _burst[i]) {
+                    continue;
+                }
+                if (!_sample_if_due(i, queue, burst_period_micro, idle_period_micro, has_deadline, deadline_micro, triggered)) {
+                    _first_input = i;
+                    return triggered;
+                }
+            }
+
+            _first_input = 0;
+            return triggered;
+        }
+
+        /// @brief Sample an input if its period has elapsed, setting its bit in triggered if it queued an event.
+        /// @return false if the deadline leaves no time for the sample
+        template <size_t QUEUE_SIZE>
+        HOT_PATH bool _sample_if_due(size_t i, EventQueue<QUEUE_SIZE> &queue, uint32_t burst_period_micro, uint32_t idle_period_micro, bool has_deadline, uint32_t deadline_micro, uint32_t &triggered) {
+            uint32_t now = micros();
+            if ((now-_pad_sample_time[i]) <= _input_period(i, burst_period_micro, idle_period_micro)) {
+                return true;
+            }
+            if (has_deadline && ((int32_t)(deadline_micro - now) < input_sample_time())) {
+                return false;
+            }
+            _sample_interval = now - _pad_sample_time[i];
+            _pad_sample_time[i] = now;
+            _sample_count++;
+            if (_sample_pad(i, queue)) {
+                bitSet(triggered, i);
+            }
+            return true;
+        }
+
+        /// @brief Sampling period of an input in its current state.
+        HOT_PATH uint32_t _input_period(size_t i, uint32_t burst_period_micro, uint32_t idle_period_micro) {
+            if (_health[i] != PAD_HEALTH_OK) {
+                return PROBE_PERIOD;
+            }
+            if (_burst[i]) {
+                return (_sample_period[i] != 0) ? _sample_period[i] : burst_period_micro;
+            }
+            if ((_mode[i] != PAD_MODE_TRIGGER) && (_sample_period[i] != 0)) {
+                return _sample_period[i];
+            }
+            return idle_period_micro;
+        }
+
+        /// @brief Clear the detection state of an input and fill its buffer with the current reading.
+        void _reset(size_t i) {
+            _cooldown[i] = false;
+            _state[i] = false;
+            _attack_remaining[i] = 0;
+            _attack_area[i] = 0;
+            _index[i] = 0;
+            _burst[i] = false;
+            _onset_valid[i] = false;
+            _health[i] = PAD_HEALTH_OK;
+            _health_time[i] = micros();
+            bitClear(_faulty, i);
+
+            _select_input(i);
+            _sum[i] = 0;
+            for (size_t j=0; j<BUFFER_SIZE; j++) {
+                _samples[i][j] = analogRead(_pin[i]);
+                if (j < _window[i]) {
+                    _sum[i] += _samples[i][j];
+                }
+            }
+            _last_value[i] = _sum[i] / _window[i];
+        }
+
+        /// @brief Sample a single input and run the detection of its mode.
+        /// @return true if a trigger or a controller change is queued
+        template <size_t QUEUE_SIZE>
+        HOT_PATH bool _sample_pad(size_t i, EventQueue<QUEUE_SIZE> &queue) {
+            bool triggered = false;
+
+            _select_input(i);
+            uint16_t sample = analogRead(_pin[i]);
+            if (_sample_source != 0) {
+                sample = _sample_source(i, sample, _sample_source_context);
+            }
+            _sum[i] = _sum[i] - _samples[i][_index[i]] + sample;
+            _samples[i][_index[i]] = sample;
+            _index[i] = (_index[i] + 1) % _window[i];
+            _stats[i].add_sample(sample);
+
+            // Comparing the sum against scaled thresholds is the same as comparing the average
+            bool above_high = _sum[i] > (uint32_t)_threshold_high[i]*_window[i];
+            bool below_low = _sum[i] < (uint32_t)_threshold_low[i]*_window[i];
+
+            if (_health[i] != PAD_HEALTH_OK) {
+                _probe_faulty(i, sample, below_low);
+                return false;
+            }
+
+            if (_mode[i] == PAD_MODE_CONTROLLER) {
+                uint16_t value = _sum[i] / _window[i];
+                if (abs((int)value - (int)_last_value[i]) > _threshold_high[i]) {
+                    _last_value[i] = value;
+                    queue.push(micros(), EVENT_CC, i, value);
+                    return true;
+                }
+                return false;
+            }
+
+            if (_mode[i] == PAD_MODE_SWITCH) {
+                if (above_high && !_state[i]) {
+                    _state[i] = true;
+                    queue.push(micros(), EVENT_TRIGGER, i, sample);
+                    return true;
+                }
+                if (below_low && _state[i]) {
+                    _state[i] = false;
+                    queue.push(micros(), EVENT_RELEASE, i, 0);
+                }
+                return false;
+            }
+
+            // Onset of a hit: first sample above the lowest threshold while the pad is armed
+            if (!_state[i] && !_cooldown[i]) {
+                uint16_t onset_level = (_threshold_low[i] < _threshold_high[i]) ? _threshold_low[i] : _threshold_high[i];
+                if (sample > onset_level) {
+                    if (!_onset_valid[i]) {
+                        _onset_time[i] = micros();
+                        _onset_window[i] = (_sample_interval < UINT16_MAX) ? _sample_interval : UINT16_MAX;
+                        _onset_valid[i] = true;
+                    }
+                }
+                else {
+                    _onset_valid[i] = false;
+                }
+            }
+
+            if (_attack_remaining[i] != 0) {
+                // Attack window of VEL_ESTIMATOR_AREA in progress
+                _attack_area[i] += sample;
+                _attack_remaining[i]--;
+                if (_attack_remaining[i] == 0) {
+                    triggered = _end_attack(i, queue);
+                }
+            }
+
+            if ((_vel_estimator[i] == VEL_ESTIMATOR_AREA) && !_cooldown[i] && !_state[i]) {
+                // Onset is detected on the raw sample instead of the lagging moving average
+                if (sample > _threshold_high[i]) {
+                    _cooldown[i] = true;
+                    _cooldown_start[i] = micros();
+                    _state[i] = true;
+                    _attack_area[i] = sample;
+                    _attack_remaining[i] = _attack_window[i] - 1;
+                    if (_attack_remaining[i] == 0) {
+                        triggered = _end_attack(i, queue);
+                    }
+                }
+            }
+            else if (above_high && !_cooldown[i] && !_state[i]) {
+                _cooldown[i] = true;
+                _cooldown_start[i] = micros();
+                _state[i] = true;
+                uint16_t peak = get_max(i);
+                uint32_t now = micros();
+                queue.push(now, _take_onset(i, now), EVENT_TRIGGER, i, peak);
+                _stats[i].add_trigger(peak);
+                triggered = true;
+            }
+            else if (below_low && !_cooldown[i] && _state[i]) {
+                _state[i] = false;
+                queue.push(micros(), EVENT_RELEASE, i, 0);
+            }
+            else if (below_low && _cooldown[i]) {
+                if (micros() - _cooldown_start[i] >= _cooldown_time[i]) {
+                    _cooldown[i] = false;
+                }
+            }
+            else if (!below_low && _cooldown[i]) {
+                _cooldown_start[i] = micros();
+            }
+
+            // Sample at burst rate from the rise of the signal up to the trigger and through the attack window. The cooldown is
+            // timed, so the rest of the hit is sampled at the idle rate without changing the detection.
+            _burst[i] = (!_state[i] && (sample > _threshold_low[i])) || (_attack_remaining[i] != 0);
+            if (!_burst[i] && !_state[i] && !_cooldown[i]) {
+                _stats[i].add_idle_sample(sample);
+            }
+
+            if (_stuck_time != 0) {
+                _check_health(i, below_low, queue);
+            }
+
+            return triggered;
+        }
+
+        /// @brief Exclude a trigger input that has been stuck for _stuck_time or is noisy, releasing its note if it is triggered.
+        template <size_t QUEUE_SIZE>
+        HOT_PATH void _check_health(size_t i, bool below_low, EventQueue<QUEUE_SIZE> &queue) {
+            uint32_t now = micros();
+            if (below_low) {
+                _health_time[i] = now;
+            }
+
+            uint8_t health;
+            if (now - _health_time[i] > _stuck_time) {
+                bool rail = _sum[i] >= (uint32_t)(SIGNAL_STATS_FULL_SCALE - RAIL_MARGIN)*_window[i];
+                health = rail ? PAD_HEALTH_RAIL : PAD_HEALTH_STUCK;
+            }
+            else if (_is_noisy(i)) {
+                health = PAD_HEALTH_NOISY;
+            }
+            else {
+                return;
+            }
+
+            if (_state[i]) {
+                queue.push(now, EVENT_RELEASE, i, 0);
+            }
+            _state[i] = false;
+            _cooldown[i] = false;
+            _attack_remaining[i] = 0;
+            _burst[i] = false;
+            _onset_valid[i] = false;
+            _health[i] = health;
+            _health_time[i] = now;
+            bitSet(_faulty, i);
+            if (_faults[i] != UINT16_MAX) {
+                _faults[i]++;
+            }
+        }
+
+        /// @brief Take a probe sample of a faulty input, and put it back in the detection once it has been below threshold_low
+        /// and within the noise limit for RECOVERY_TIME. Its moving average is kept up to date by the probes.
+        HOT_PATH void _probe_faulty(size_t i, uint16_t sample, bool below_low) {
+            uint32_t now = micros();
+            if (below_low) {
+                _stats[i].add_idle_sample(sample);
+            }
+            if (!below_low || _is_noisy(i)) {
+                _health_time[i] = now;
+            }
+            else if (now - _health_time[i] > RECOVERY_TIME) {
+                _health[i] = PAD_HEALTH_OK;
+                _health_time[i] = now;
+                bitClear(_faulty, i);
+            }
+        }
+
+        /// @brief Check if the idle noise of an input is above the noise limit, and high enough to reach threshold_low at 3 sigma.
+        /// Hits below a threshold_low raised out of their way are idle samples too, and must not make the input noisy.
+        HOT_PATH bool _is_noisy(size_t i) {
+            uint16_t limit = _threshold_low[i]/3;
+            if (limit < _noise_limit) {
+                limit = _noise_limit;
+            }
+            return (limit <= 256) && (_stats[i].get_idle_samples() >= NOISE_MIN_SAMPLES) && _stats[i].is_noise_above(limit);
+        }
+
+        /// @brief Finish the attack window of a pad. The trigger is queued if the mean of the window is above threshold_high,
+        /// otherwise it is treated as a noise spike and the pad is re-armed.
+        /// @return true if a trigger is queued
+        template <size_t QUEUE_SIZE>
+        HOT_PATH bool _end_attack(size_t pad, EventQueue<QUEUE_SIZE> &queue) {
+            if (_attack_area[pad] > (uint32_t)_threshold_high[pad]*_attack_window[pad]) {
+                uint16_t peak = attack_area_to_peak(_attack_area[pad], _attack_window[pad]);
+                uint32_t now = micros();
+                queue.push(now, _take_onset(pad, now), EVENT_TRIGGER, pad, peak);
+                _stats[pad].add_trigger(peak);
+                return true;
+            }
+            else {
+                _state[pad] = false;
+                _cooldown[pad] = false;
+                return false;
+            }
+        }
+
+        /// @brief Onset of the hit being triggered, now if the hit rose too fast for its onset to be sampled.
+        HOT_PATH uint32_t _take_onset(size_t pad, uint32_t now) {
+            uint32_t window = _onset_valid[pad] ? _onset_window[pad] : _sample_interval;
+            if (window > _onset_window_max) {
+                _onset_window_max = window;
+            }
+            _onset_window_sum += window;
+            _onset_count++;
+
+            if (!_onset_valid[pad]) {
+                return now;
+            }
+            _onset_valid[pad] = false;
+            return _onset_time[pad];
+        }
+
+        /// @brief Route the input to its analog pin, switching the multiplexer if the input is behind it.
+        HOT_PATH void _select_input(size_t i) {
+            if ((_input_address[i] != PAD_DIRECT) && (_input_address[i] != _mux_address)) {
+                _set_mux_address(_input_address[i], _settle_time[_input_address[i]]);
+            }
+        }
+
+        /// @brief Drive only the select pins that differ from the current address, then wait for the mux to settle.
+        HOT_PATH void _set_mux_address(size_t mux_address, uint16_t settle_time_micro) {
+            size_t changed = _mux_address ^ mux_address;
+            for (size_t i=0; i<4; i++) {
+                if (bitRead(changed, i)) {
+                    digitalWrite(_select_pins[i], bitRead(mux_address, i));
+                }
+            }
+            _mux_address = mux_address;
+            delay_us(settle_time_micro);
+        }
+
+};
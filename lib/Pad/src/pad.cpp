@@ -10,17 +10,22 @@ Pad::Pad(int pin_num, float threshold_high, float threshold_low, int buffer_size
     _threshold_high = threshold_high;
     _threshold_low = threshold_low;
     _midi_note_num = midi_note_num;
+    _window = buffer_size;
 }
 
 Pad::Pad(int pin_num, float threshold_high, float threshold_low, int buffer_size) : Pad(pin_num, threshold_high, threshold_low, buffer_size, 0) {}
 
 int Pad::poll() {
-    buffer.add(analogRead(pin));
-    float current_avg = buffer.getAverage();
+    uint16_t sample = analogRead(pin);
+    buffer.add(sample);
+    stats.add_sample(sample);
+    float current_avg = buffer.getAverageLast(_window);
     if ((current_avg > _threshold_high) && (_cooldown == 0) && !_state) {
         _cooldown = _cooldown_time;
         _state = true;
-        on_trigger(get_max());
+        int peak = get_max();
+        stats.add_trigger(peak);
+        on_trigger(peak);
         return 1;
     }
     else if ((current_avg < _threshold_low) && (_cooldown == 0) && _state) {
@@ -32,6 +37,10 @@ int Pad::poll() {
         _cooldown -= 1;
         return 3;
     }
+    else if ((current_avg < _threshold_low) && !_state) {
+        stats.add_idle_sample(sample);
+        return 0;
+    }
     else if (!(current_avg < _threshold_low) && (_cooldown != 0)) {
         _cooldown = _cooldown_time;
         return 0;
@@ -52,7 +61,7 @@ int Pad::poll(uint sample_period_micro) {
 }
 
 int Pad::get_max() {
-    return buffer.getMaxInBuffer();
+    return buffer.getMaxInBufferLast(_window);
 }
 
 bool Pad::get_state() {
@@ -67,6 +76,19 @@ void Pad::set_note_num(int new_note_num) {
     _midi_note_num = new_note_num;
 }
 
+void Pad::set_threshold(float threshold_high, float threshold_low) {
+    _threshold_high = threshold_high;
+    _threshold_low = threshold_low;
+}
+
+void Pad::set_window(int window) {
+    _window = constrain(window, 1, (int)buffer.getSize());
+}
+
+void Pad::set_cooldown_time(int cooldown_time) {
+    _cooldown_time = constrain(cooldown_time, 1, 255);
+}
+
 void Pad::on_trigger(int pad_input) {}
 void Pad::on_cooldown() {}
 
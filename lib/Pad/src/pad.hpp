@@ -1,10 +1,13 @@
 #include <RunningAverage.h>
+#include <signal-stats.hpp>
 
 class Pad {
     public:
 
         uint8_t pin;
         RunningAverage buffer;
+        /// @brief Signal quality statistics of the pad
+        SignalStats stats;
 
         /// @param pin_num Analog pin for the pad.
         /// @param threshold_high High-going threshold. Used to decide if a trigger occured.
@@ -35,6 +38,15 @@ class Pad {
         /// @brief Assign new MIDI note number to this pad.
         void set_note_num(int new_note_num);
 
+        /// @brief Set the high-going and low-going threshold of this pad.
+        void set_threshold(float threshold_high, float threshold_low);
+
+        /// @brief Set the number of latest samples in the moving average, 1 to buffer_size.
+        void set_window(int window);
+
+        /// @brief Set the number of samples below threshold_low before the pad is considered fully cool-down.
+        void set_cooldown_time(int cooldown_time);
+
         // Overload the following functions to be executed in poll when pad triggered and fully cool-down.
         virtual void on_trigger(int pad_input);
         virtual void on_cooldown();
@@ -47,7 +59,8 @@ class Pad {
         float _threshold_low;
         int _midi_note_num;
         uint32 _last_sample_time = 0;
-        const int _cooldown_time = 32;
+        int _cooldown_time = 32;
+        int _window;
 
 };
 
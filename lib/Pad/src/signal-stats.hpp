@@ -0,0 +1,150 @@
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+#define SIGNAL_STATS_HIST_BUCKETS 8
+#define SIGNAL_STATS_FULL_SCALE 4095
+
+/// @brief Running signal quality statistics of a sensor, updated sample by sample with integer arithmetic only.
+/// Baseline and noise are exponential moving averages over about 32 idle samples, so they follow the current state of
+/// the sensor instead of its whole history.
+class SignalStats {
+    public:
+
+        /// @brief Account for every sample read from the sensor.
+        void add_sample(uint16_t sample) {
+            if (sample >= SIGNAL_STATS_FULL_SCALE) {
+                _clips++;
+            }
+        }
+
+        /// @brief Account for a sample read while the sensor is at rest, used for the baseline and the noise.
+        void add_idle_sample(uint16_t sample) {
+            int32_t value = (int32_t)sample << 4;
+            if (_idle_samples == 0) {
+                _baseline = value;
+            }
+            int32_t deviation = value - _baseline;
+            _baseline += deviation >> 5;
+            // Spikes are limited to 256 LSB so that a single one can't overflow or dominate the variance
+            deviation = _constrain_deviation(deviation);
+            _noise_var += (deviation*deviation - _noise_var) >> 5;
+            if (_idle_samples != UINT32_MAX) {
+                _idle_samples++;
+            }
+        }
+
+        /// @brief Account for a detected trigger.
+        /// @param peak Trigger reading sent with the trigger event
+        void add_trigger(uint16_t peak) {
+            _triggers++;
+            _peak_sum += peak;
+            if ((_triggers == 1) || (peak < _peak_min)) {
+                _peak_min = peak;
+            }
+            if (peak > _peak_max) {
+                _peak_max = peak;
+            }
+            int bucket = (uint32_t)peak*SIGNAL_STATS_HIST_BUCKETS/(SIGNAL_STATS_FULL_SCALE+1);
+            if (_peak_hist[bucket] != UINT16_MAX) {
+                _peak_hist[bucket]++;
+            }
+        }
+
+        /// @brief Forget every statistic.
+        void reset() {
+            *this = SignalStats();
+        }
+
+        /// @brief Idle level of the signal in LSB
+        float get_baseline() {
+            return _baseline / 16.0;
+        }
+
+        /// @brief RMS of the idle signal around the baseline in LSB
+        float get_noise_rms() {
+            return sqrt((float)_noise_var) / 16.0;
+        }
+
+        /// @brief Mean trigger peak above the baseline over the noise RMS in dB, 0 if unknown
+        float get_snr_db() {
+            float signal = get_peak_mean() - get_baseline();
+            float noise = get_noise_rms();
+            if ((_triggers == 0) || (signal <= 0)) {
+                return 0;
+            }
+            // Noise below one LSB is quantization, not a measurement
+            if (noise < 1) {
+                noise = 1;
+            }
+            return 20*log10(signal/noise);
+        }
+
+        /// @brief Mean trigger peak in LSB
+        float get_peak_mean() {
+            return (_triggers == 0) ? 0 : (float)_peak_sum/_triggers;
+        }
+
+        /// @brief Lowest trigger peak in LSB
+        uint16_t get_peak_min() {
+            return _peak_min;
+        }
+
+        /// @brief Highest trigger peak in LSB
+        uint16_t get_peak_max() {
+            return _peak_max;
+        }
+
+        /// @brief Number of triggers with a peak in each 1/SIGNAL_STATS_HIST_BUCKETS of the full scale
+        uint16_t get_peak_hist(int bucket) {
+            return _peak_hist[bucket];
+        }
+
+        /// @brief Number of samples at full scale
+        uint32_t get_clips() {
+            return _clips;
+        }
+
+        /// @brief Number of triggers detected
+        uint32_t get_triggers() {
+            return _triggers;
+        }
+
+        /// @brief Number of samples used for the baseline and the noise
+        uint32_t get_idle_samples() {
+            return _idle_samples;
+        }
+
+        /// @brief Check if the RMS of the idle signal is above a limit, without the square root of get_noise_rms.
+        /// @param rms_limit Limit in LSB, at most 256
+        bool is_noise_above(uint16_t rms_limit) {
+            return _noise_var > ((int32_t)rms_limit*rms_limit << 8);
+        }
+
+    private:
+
+        /// @brief Baseline in 1/16 LSB
+        int32_t _baseline = 0;
+        /// @brief Variance of the idle signal in 1/256 LSB^2
+        int32_t _noise_var = 0;
+        uint32_t _idle_samples = 0;
+        uint32_t _clips = 0;
+        uint32_t _triggers = 0;
+        uint32_t _peak_sum = 0;
+        uint16_t _peak_min = 0;
+        uint16_t _peak_max = 0;
+        uint16_t _peak_hist[SIGNAL_STATS_HIST_BUCKETS] = {};
+
+        static int32_t _constrain_deviation(int32_t deviation) {
+            const int32_t limit = 256 << 4;
+            if (deviation > limit) {
+                return limit;
+            }
+            if (deviation < -limit) {
+                return -limit;
+            }
+            return deviation;
+        }
+
+};
@@ -0,0 +1,216 @@
+#include "preset-library.hpp"
+
+static_assert(PRESET_KIT_SIZE % 2 == 0, "Full records pack 2 notes per half-word");
+
+PresetLibrary::PresetLibrary(uint32 start_address, uint16 num_pages, uint16 page_size) {
+    _start_address = start_address;
+    _num_pages = num_pages;
+    _page_size = page_size;
+    _end = FIRST_RECORD;
+    for (size_t i=0; i<PRESET_KIT_SIZE; i++) {
+        _base[i] = 0;
+    }
+}
+
+void PresetLibrary::begin() {
+    uint32 size = capacity()/2;
+    _end = FIRST_RECORD;
+    _num_kits = 0;
+
+    if (_read(0) != LIBRARY_HEADER) { // Blank, or not a library of this kit size
+        erase();
+        return;
+    }
+
+    while (_end < size) {
+        uint16 header = _read(_end);
+        if (header == RECORD_END) {
+            break;
+        }
+        // Every bank starts with a full kit, the other kits of the bank are encoded against it
+        bool bank_start = (_num_kits % PRESET_BANK_SIZE) == 0;
+        uint32 length = _record_length(header);
+        if ((bank_start != (header == RECORD_FULL)) || !_is_valid(_end, length)) { // Corrupted record, the library ends before it
+            break;
+        }
+        if (header == RECORD_FULL) {
+            _decode(_end, _base, _base);
+        }
+        _end += length;
+        _num_kits++;
+    }
+}
+
+int PresetLibrary::num_kits() {
+    return _num_kits;
+}
+
+int PresetLibrary::num_banks() {
+    return (_num_kits + PRESET_BANK_SIZE - 1) / PRESET_BANK_SIZE;
+}
+
+bool PresetLibrary::load_bank(int bank, uint8 kits[PRESET_BANK_SIZE][PRESET_KIT_SIZE]) {
+    if ((bank < 0) || (bank >= num_banks())) {
+        return false;
+    }
+
+    // Skip the records of the previous banks, only the headers are read
+    uint32 offset = FIRST_RECORD;
+    int first_kit = bank*PRESET_BANK_SIZE;
+    for (int kit=0; kit<first_kit; kit++) {
+        offset += _record_length(_read(offset));
+    }
+
+    _decode(offset, kits[0], kits[0]);
+    offset += _record_length(_read(offset));
+    for (int slot=1; slot<PRESET_BANK_SIZE; slot++) {
+        if (first_kit + slot < _num_kits) {
+            _decode(offset, kits[0], kits[slot]);
+            offset += _record_length(_read(offset));
+        }
+        else {
+            memcpy(kits[slot], kits[0], PRESET_KIT_SIZE);
+        }
+    }
+    return true;
+}
+
+bool PresetLibrary::append_kit(const uint8 notes[PRESET_KIT_SIZE]) {
+    uint16 record[1 + PRESET_KIT_SIZE];
+    uint32 length = 0;
+
+    for (size_t i=0; i<PRESET_KIT_SIZE; i++) {
+        if (notes[i] > MAX_NOTE) {
+            return false;
+        }
+    }
+
+    if ((_num_kits % PRESET_BANK_SIZE) == 0) { // First kit of a bank becomes the base of the next kits
+        record[length++] = RECORD_FULL;
+        for (size_t i=0; i<PRESET_KIT_SIZE; i+=2) {
+            record[length++] = notes[i] | (notes[i+1] << 8);
+        }
+    }
+    else {
+        record[length++] = 0;
+        for (size_t i=0; i<PRESET_KIT_SIZE; i++) {
+            if (notes[i] != _base[i]) {
+                record[length++] = (i << 8) | notes[i];
+                record[0]++;
+            }
+        }
+    }
+
+    // The end marker must stay inside the region
+    if ((_end + length)*2 >= capacity()) {
+        return false;
+    }
+
+    FLASH_Unlock();
+    bool success = true;
+    for (uint32 i=0; (i<length) && success; i++) {
+        success = _write(_end + i, record[i]);
+    }
+    FLASH_Lock();
+    if (!success) {
+        return false;
+    }
+
+    if (record[0] == RECORD_FULL) {
+        memcpy(_base, notes, PRESET_KIT_SIZE);
+    }
+    _end += length;
+    _num_kits++;
+    return true;
+}
+
+bool PresetLibrary::erase() {
+    FLASH_Unlock();
+    bool success = true;
+    for (uint16 page=0; (page<_num_pages) && success; page++) {
+        success = _erase_page(page);
+    }
+    success = success && _write(0, LIBRARY_HEADER);
+    FLASH_Lock();
+
+    _end = FIRST_RECORD;
+    _num_kits = 0;
+    return success;
+}
+
+size_t PresetLibrary::bytes_used() {
+    return (_end + 1)*2;
+}
+
+size_t PresetLibrary::capacity() {
+    return (size_t)_num_pages*_page_size;
+}
+
+uint16 PresetLibrary::_read(uint32 offset) {
+    return *(volatile uint16 *)(uintptr_t)(_start_address + offset*2);
+}
+
+bool PresetLibrary::_write(uint32 offset, uint16 data) {
+    return FLASH_ProgramHalfWord(_start_address + offset*2, data) == FLASH_COMPLETE;
+}
+
+bool PresetLibrary::_erase_page(uint16 page) {
+    // Erasing takes about 20 ms with the CPU stalled, skip the pages already blank
+    uint32 first = (uint32)page*_page_size/2;
+    for (uint32 offset=first; offset<first + _page_size/2U; offset++) {
+        if (_read(offset) != RECORD_END) {
+            return FLASH_ErasePage(_start_address + page*_page_size) == FLASH_COMPLETE;
+        }
+    }
+    return true;
+}
+
+bool PresetLibrary::_is_valid(uint32 offset, uint32 length) {
+    if ((length == 0) || (offset + length > capacity()/2)) {
+        return false;
+    }
+    uint16 header = _read(offset);
+    for (uint32 i=1; i<length; i++) {
+        uint16 data = _read(offset + i);
+        if (header == RECORD_FULL) {
+            if (((data & 0xFF) > MAX_NOTE) || ((data >> 8) > MAX_NOTE)) {
+                return false;
+            }
+        }
+        else if (((data >> 8) >= PRESET_KIT_SIZE) || ((data & 0xFF) > MAX_NOTE)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32 PresetLibrary::_record_length(uint16 header) {
+    if (header == RECORD_FULL) {
+        return 1 + PRESET_KIT_SIZE/2;
+    }
+    if (header <= PRESET_KIT_SIZE) {
+        return 1 + header;
+    }
+    return 0;
+}
+
+void PresetLibrary::_decode(uint32 offset, const uint8 base[PRESET_KIT_SIZE], uint8 notes[PRESET_KIT_SIZE]) {
+    uint16 header = _read(offset++);
+
+    if (header == RECORD_FULL) {
+        for (size_t i=0; i<PRESET_KIT_SIZE; i+=2) {
+            uint16 packed = _read(offset++);
+            notes[i] = packed & 0xFF;
+            notes[i+1] = packed >> 8;
+        }
+        return;
+    }
+
+    if (notes != base) {
+        memcpy(notes, base, PRESET_KIT_SIZE);
+    }
+    for (uint16 i=0; i<header; i++) {
+        uint16 delta = _read(offset++);
+        notes[delta >> 8] = delta & 0xFF; // Checked by begin()
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+/// @brief Number of notes in a kit, one per sensor. Must be even
+#define PRESET_KIT_SIZE 18
+/// @brief Number of kits (slots) in a bank
+#define PRESET_BANK_SIZE 4
+
+/// @brief Library of kits stored in its own region of flash, outside of the emulated EEPROM.
+/// Kits are grouped by PRESET_BANK_SIZE into banks. The first kit of every bank is stored in full and the other kits
+/// of the bank only store the notes that differ from it, so a kit that changes two pads costs 6 bytes instead of 20.
+///
+/// The region starts with the header half-word LIBRARY_HEADER, and begin() erases a region starting with anything else,
+/// such as leftover flash or a library written with another kit size. It is followed by half-word records, ended by erased
+/// flash (0xFFFF):
+/// - RECORD_FULL followed by PRESET_KIT_SIZE/2 half-words of packed notes: full kit, 2 notes per half-word, low byte first.
+///   The first kit of every bank.
+/// - n (0 to PRESET_KIT_SIZE) followed by n half-words of (sensor << 8 | note): kit differing from the bank base in n notes
+/// The library ends before the first record breaking these rules or holding a note above 127.
+class PresetLibrary {
+    public:
+
+        /// @param start_address Address of the first flash page of the library
+        /// @param num_pages Number of flash pages reserved for the library
+        /// @param page_size Size of a flash page in bytes
+        PresetLibrary(uint32 start_address, uint16 num_pages, uint16 page_size);
+
+        /// @brief Scan the flash region to find the number of kits and the end of the library, erasing the region if it
+        /// doesn't start with the library header.
+        void begin();
+
+        /// @brief Number of kits stored in the library.
+        int num_kits();
+
+        /// @brief Number of banks stored in the library, the last one possibly incomplete.
+        int num_banks();
+
+        /// @brief Decode every kit of a bank. Kits missing from an incomplete bank are copies of its base kit.
+        /// @param bank Bank index in the library
+        /// @param kits Decoded notes of the bank
+        /// @return false if the bank is not in the library
+        bool load_bank(int bank, uint8 kits[PRESET_BANK_SIZE][PRESET_KIT_SIZE]);
+
+        /// @brief Append a kit at the end of the library, encoded against the base kit of its bank.
+        /// @return false if a note is above 127, the library is full or the flash could not be programmed
+        bool append_kit(const uint8 notes[PRESET_KIT_SIZE]);
+
+        /// @brief Erase the whole library.
+        bool erase();
+
+        /// @brief Number of bytes used by the library, including the end marker.
+        size_t bytes_used();
+
+        /// @brief Number of bytes reserved for the library.
+        size_t capacity();
+
+    private:
+
+        static const uint16 LIBRARY_HEADER = 0x5000 | PRESET_KIT_SIZE;
+        static const uint16 RECORD_FULL = 0x8000 | PRESET_KIT_SIZE;
+        static const uint16 RECORD_END = 0xFFFF;
+        static const uint8 MAX_NOTE = 127;
+        /// @brief Half-word offset of the first record
+        static const uint32 FIRST_RECORD = 1;
+
+        uint32 _start_address;
+        uint16 _num_pages;
+        uint16 _page_size;
+        /// @brief Half-word offset of the end marker
+        uint32 _end;
+        int _num_kits = 0;
+        /// @brief Base kit of the last bank, used to encode the next appended kit
+        uint8 _base[PRESET_KIT_SIZE];
+
+        uint16 _read(uint32 offset);
+        bool _write(uint32 offset, uint16 data);
+        /// @brief Erase a page unless it is blank already
+        bool _erase_page(uint16 page);
+        /// @brief Check that the record at offset fits in the region and only holds notes up to MAX_NOTE
+        bool _is_valid(uint32 offset, uint32 length);
+        /// @brief Number of half-words of the record at offset, header included
+        uint32 _record_length(uint16 header);
+        /// @brief Decode the record at offset on top of base. A full record replaces every note.
+        void _decode(uint32 offset, const uint8 base[PRESET_KIT_SIZE], uint8 notes[PRESET_KIT_SIZE]);
+
+};
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <Arduino.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/// @brief Function run by a task. Tasks are not preempted, so it must return quickly.
+typedef void (*TaskFunction)();
+
+/// @brief Timing counters of a task since the last reset_stats, in microseconds
+struct TaskStats {
+    uint32_t runs;
+    /// @brief Runs that finished more than the task deadline after their release
+    uint32_t deadline_misses;
+    /// @brief Longest time from a release to the start of its run
+    uint32_t max_lateness;
+    uint32_t max_run_time;
+    uint64_t total_run_time;
+};
+
+/// @brief Fixed size cooperative scheduler. No heap allocation, tasks are added once at startup and run to completion.
+///
+/// A periodic task is released every period, an event task by signal(). Either one can move its next release with
+/// release_at(). run() starts the released task with the highest priority (0 is the highest), the one released first
+/// among equals, so a lower priority task is deferred as long as a higher priority one is ready.
+///
+/// A task already released again when its run ends, such as a sensor sweep falling behind, yields to every task released
+/// before that end. Each of them runs once before it, so a task released continuously can't starve the others, and a
+/// released task waits at most for one run of every other task. Times are micros() values and may wrap around.
+/// @tparam SIZE Maximum number of tasks
+template <size_t SIZE>
+class TaskScheduler {
+    public:
+
+        /// @brief Add a task released every period_micro, the first time at once
+        /// @param deadline_micro Longest time from a release to the end of its run before it counts as a deadline miss, 0 for none
+        /// @return Id of the task, -1 if the scheduler is full
+        int add_periodic(const char *name, TaskFunction function, uint8_t priority, uint32_t period_micro, uint32_t deadline_micro) {
+            int task = _add(name, function, priority, period_micro, deadline_micro);
+            if (task >= 0) {
+                _tasks[task].periodic = true;
+                _tasks[task].released = true;
+                _tasks[task].release = micros();
+            }
+            return task;
+        }
+
+        /// @brief Add a task released by signal() or release_at() only
+        /// @return Id of the task, -1 if the scheduler is full
+        int add_event(const char *name, TaskFunction function, uint8_t priority, uint32_t deadline_micro) {
+            return _add(name, function, priority, 0, deadline_micro);
+        }
+
+        /// @brief Release a task now, unless it is already released earlier. A task signalled several times before it
+        /// starts runs once.
+        void signal(int task) {
+            uint32_t now = micros();
+            Task &t = _tasks[task];
+            if (!t.released || ((int32_t)(t.release - now) > 0)) {
+                t.released = true;
+                t.release = now;
+            }
+        }
+
+        /// @brief Replace the next release of a task. A periodic task is then released every period after it. Called
+        /// by a task on itself, it replaces the release following the current run.
+        void release_at(int task, uint32_t release_micro) {
+            _tasks[task].released = true;
+            _tasks[task].release = release_micro;
+        }
+
+        /// @brief Run the released task with the highest priority, if any
+        /// @return false if no task is released yet
+        bool run() {
+            uint32_t now = micros();
+            int next = -1;
+            for (size_t i=0; i<_count; i++) {
+                const Task &t = _tasks[i];
+                if (!_is_released(t, now) || (t.yielding && _has_waiting(t, now))) {
+                    continue;
+                }
+                if ((next < 0) || (t.priority < _tasks[next].priority) ||
+                        ((t.priority == _tasks[next].priority) && ((int32_t)(t.release - _tasks[next].release) < 0))) {
+                    next = i;
+                }
+            }
+            if (next < 0) {
+                return false;
+            }
+
+            Task &task = _tasks[next];
+            uint32_t release = task.release;
+            // Set the next release before the run, so that the task can replace it
+            if (task.periodic) {
+                task.release += task.period;
+            }
+            else {
+                task.released = false;
+            }
+
+            uint32_t start = micros();
+            task.function();
+            uint32_t end = micros();
+
+            // Releases missed by an overrun are merged into one, the deadline miss is counted once
+            if (task.periodic && ((int32_t)(end - task.release) > (int32_t)task.period)) {
+                task.release = end;
+            }
+            task.yielding = _is_released(task, end);
+            task.yield_end = end;
+
+            TaskStats &stats = task.stats;
+            uint32_t lateness = start - release;
+            uint32_t run_time = end - start;
+            stats.runs++;
+            stats.total_run_time += run_time;
+            if (lateness > stats.max_lateness) {
+                stats.max_lateness = lateness;
+            }
+            if (run_time > stats.max_run_time) {
+                stats.max_run_time = run_time;
+            }
+            if ((task.deadline != 0) && ((end - release) > task.deadline)) {
+                stats.deadline_misses++;
+            }
+            return true;
+        }
+
+        /// @brief Time until the next release, in microseconds. 0 if a task is already released, INT32_MAX if none is.
+        int32_t time_to_next_release() {
+            uint32_t now = micros();
+            int32_t next = INT32_MAX;
+            for (size_t i=0; i<_count; i++) {
+                if (!_tasks[i].released) {
+                    continue;
+                }
+                int32_t remaining = (int32_t)(_tasks[i].release - now);
+                if (remaining <= 0) {
+                    return 0;
+                }
+                if (remaining < next) {
+                    next = remaining;
+                }
+            }
+            return next;
+        }
+
+        /// @brief Number of tasks added
+        size_t size() {
+            return _count;
+        }
+
+        const char *get_name(int task) {
+            return _tasks[task].name;
+        }
+
+        uint8_t get_priority(int task) {
+            return _tasks[task].priority;
+        }
+
+        /// @brief Period in microseconds, 0 for an event task
+        uint32_t get_period(int task) {
+            return _tasks[task].periodic ? _tasks[task].period : 0;
+        }
+
+        uint32_t get_deadline(int task) {
+            return _tasks[task].deadline;
+        }
+
+        const TaskStats &get_stats(int task) {
+            return _tasks[task].stats;
+        }
+
+        /// @brief Reset the counters of every task
+        void reset_stats() {
+            for (size_t i=0; i<_count; i++) {
+                _tasks[i].stats = TaskStats();
+            }
+        }
+
+    private:
+
+        struct Task {
+            const char *name;
+            TaskFunction function;
+            uint8_t priority;
+            bool periodic;
+            /// @brief The task runs once release is reached
+            bool released;
+            uint32_t release;
+            uint32_t period;
+            uint32_t deadline;
+            /// @brief Released again by the end of its last run, at yield_end
+            bool yielding;
+            uint32_t yield_end;
+            TaskStats stats;
+        };
+
+        Task _tasks[SIZE];
+        size_t _count = 0;
+
+        static bool _is_released(const Task &task, uint32_t now) {
+            return task.released && ((int32_t)(now - task.release) >= 0);
+        }
+
+        /// @brief Another task released before the end of the last run of a yielding task is waiting
+        bool _has_waiting(const Task &task, uint32_t now) {
+            for (size_t i=0; i<_count; i++) {
+                const Task &t = _tasks[i];
+                if ((&t != &task) && !t.yielding && _is_released(t, now) && ((int32_t)(task.yield_end - t.release) >= 0)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        int _add(const char *name, TaskFunction function, uint8_t priority, uint32_t period_micro, uint32_t deadline_micro) {
+            if (_count == SIZE) {
+                return -1;
+            }
+            Task &t = _tasks[_count];
+            t.name = name;
+            t.function = function;
+            t.priority = priority;
+            t.periodic = false;
+            t.released = false;
+            t.release = 0;
+            t.period = period_micro;
+            t.deadline = deadline_micro;
+            t.yielding = false;
+            t.yield_end = 0;
+            t.stats = TaskStats();
+            return _count++;
+        }
+
+};
@@ -0,0 +1,259 @@
+#include "velocity-table.hpp"
+#include <hot-path.hpp>
+
+static_assert(VELOCITY_TABLE_SENSORS <= 0xFF, "Records hold the sensor id in their low byte");
+
+VelocityTables::VelocityTables(uint32 start_address, uint16 page_size) {
+    _start_address = start_address;
+    _page_size = page_size;
+    _active = 0;
+    _end = FIRST_RECORD;
+    for (size_t i=0; i<VELOCITY_TABLE_SENSORS; i++) {
+        _table[i] = 0;
+    }
+}
+
+void VelocityTables::begin() {
+    bool active[2];
+    bool receiving[2];
+    for (uint8 page=0; page<2; page++) {
+        active[page] = (_read(page, 1) == PAGE_ACTIVE);
+        receiving[page] = (_read(page, 0) == PAGE_RECEIVING) && !active[page];
+    }
+
+    FLASH_Unlock();
+    if (active[0] || active[1]) {
+        _active = active[0] ? 0 : 1;
+        _erase_page(1 - _active); // Copy interrupted before the full page was erased, if any
+    }
+    else if (receiving[0] || receiving[1]) { // Copy interrupted after the full page was erased, it is complete
+        _active = receiving[0] ? 0 : 1;
+        _write(_active, 1, PAGE_ACTIVE);
+    }
+    else { // Blank or unknown content
+        _erase_page(0);
+        _erase_page(1);
+        _active = 0;
+        _write(0, 1, PAGE_ACTIVE);
+    }
+    FLASH_Lock();
+
+    _scan();
+}
+
+bool VelocityTables::has_table(int sensor) {
+    return (sensor >= 0) && (sensor < VELOCITY_TABLE_SENSORS) && (_table[sensor] != 0);
+}
+
+HOT_PATH int VelocityTables::velocity(int sensor, int reading) {
+    if ((sensor < 0) || (sensor >= VELOCITY_TABLE_SENSORS) || (_table[sensor] == 0)) {
+        return -1;
+    }
+    const volatile uint16 *points = (const volatile uint16 *)(uintptr_t)(_start_address + _active*_page_size + _table[sensor]*2);
+
+    if (reading <= points[0]) {
+        return 1;
+    }
+    if (reading >= points[VELOCITY_TABLE_POINTS-1]) {
+        return 127;
+    }
+
+    // points[low] <= reading < points[high], so the two points differ
+    int low = 0;
+    int high = VELOCITY_TABLE_POINTS-1;
+    while (high - low > 1) {
+        int mid = (low + high)/2;
+        if (points[mid] <= reading) {
+            low = mid;
+        }
+        else {
+            high = mid;
+        }
+    }
+    int low_velocity = _point_velocity(low);
+    int high_velocity = _point_velocity(high);
+    return low_velocity + (high_velocity - low_velocity)*(reading - points[low])/(points[high] - points[low]);
+}
+
+bool VelocityTables::get_table(int sensor, uint16 points[VELOCITY_TABLE_POINTS]) {
+    if (!has_table(sensor)) {
+        return false;
+    }
+    for (size_t i=0; i<VELOCITY_TABLE_POINTS; i++) {
+        points[i] = _read(_active, _table[sensor] + i);
+    }
+    return true;
+}
+
+bool VelocityTables::store(int sensor, const uint16 points[VELOCITY_TABLE_POINTS]) {
+    if ((sensor < 0) || (sensor >= VELOCITY_TABLE_SENSORS)) {
+        return false;
+    }
+
+    uint16 record[1 + VELOCITY_TABLE_POINTS];
+    record[0] = RECORD_TABLE | sensor;
+    for (size_t i=0; i<VELOCITY_TABLE_POINTS; i++) {
+        record[1 + i] = points[i];
+    }
+    if (!_append(record, 1 + VELOCITY_TABLE_POINTS, sensor)) {
+        return false;
+    }
+    _table[sensor] = _end - VELOCITY_TABLE_POINTS;
+    return true;
+}
+
+bool VelocityTables::clear(int sensor) {
+    if (!has_table(sensor)) {
+        return true;
+    }
+
+    uint16 record = RECORD_CLEAR | sensor;
+    if (!_append(&record, 1, sensor)) {
+        return false;
+    }
+    _table[sensor] = 0;
+    return true;
+}
+
+bool VelocityTables::erase() {
+    FLASH_Unlock();
+    bool success = _erase_page(0) && _erase_page(1) && _write(0, 1, PAGE_ACTIVE);
+    FLASH_Lock();
+
+    _active = 0;
+    _scan();
+    return success;
+}
+
+size_t VelocityTables::bytes_used() {
+    return _end*2;
+}
+
+size_t VelocityTables::capacity() {
+    return _page_size;
+}
+
+uint16 VelocityTables::_read(uint8 page, uint32 offset) {
+    return *(volatile uint16 *)(uintptr_t)(_start_address + page*_page_size + offset*2);
+}
+
+bool VelocityTables::_write(uint8 page, uint32 offset, uint16 data) {
+    return FLASH_ProgramHalfWord(_start_address + page*_page_size + offset*2, data) == FLASH_COMPLETE;
+}
+
+bool VelocityTables::_erase_page(uint8 page) {
+    // Erasing takes about 20 ms with the CPU stalled, skip the pages already blank
+    for (uint32 offset=0; offset<_page_size/2U; offset++) {
+        if (_read(page, offset) != PAGE_ERASED) {
+            return FLASH_ErasePage(_start_address + page*_page_size) == FLASH_COMPLETE;
+        }
+    }
+    return true;
+}
+
+void VelocityTables::_scan() {
+    uint32 size = _page_size/2;
+
+    for (size_t i=0; i<VELOCITY_TABLE_SENSORS; i++) {
+        _table[i] = 0;
+    }
+    _end = FIRST_RECORD;
+    while (_end < size) {
+        uint16 header = _read(_active, _end);
+        if (header == PAGE_ERASED) {
+            return;
+        }
+        uint16 sensor = header & ~RECORD_TYPE_MASK;
+        if (sensor >= VELOCITY_TABLE_SENSORS) {
+            break;
+        }
+        if (((header & RECORD_TYPE_MASK) == RECORD_TABLE) && (_end + 1 + VELOCITY_TABLE_POINTS <= size)) {
+            _table[sensor] = _end + 1;
+            _end += 1 + VELOCITY_TABLE_POINTS;
+        }
+        else if ((header & RECORD_TYPE_MASK) == RECORD_CLEAR) {
+            _table[sensor] = 0;
+            _end++;
+        }
+        else {
+            break;
+        }
+    }
+    // Corrupted record or no end marker, the next record goes to a new copy of the tables
+    _end = size;
+}
+
+bool VelocityTables::_append(const uint16 *record, uint32 length, int skip_sensor) {
+    FLASH_Unlock();
+    bool success = true;
+    if (_end + length > _page_size/2U) {
+        success = _transfer(skip_sensor);
+    }
+    for (uint32 i=0; (i<length) && success; i++) {
+        success = _write(_active, _end + i, record[i]);
+    }
+    FLASH_Lock();
+
+    if (!success) { // Find out what was programmed
+        begin();
+        return false;
+    }
+    _end += length;
+    return true;
+}
+
+bool VelocityTables::_transfer(int skip_sensor) {
+    uint8 target = 1 - _active;
+    uint32 end = FIRST_RECORD;
+    uint16 table[VELOCITY_TABLE_SENSORS];
+
+    bool success = _erase_page(target) && _write(target, 0, PAGE_RECEIVING);
+    for (size_t sensor=0; (sensor<VELOCITY_TABLE_SENSORS) && success; sensor++) {
+        table[sensor] = 0;
+        if ((_table[sensor] == 0) || ((int)sensor == skip_sensor)) {
+            continue;
+        }
+        success = _write(target, end, RECORD_TABLE | sensor);
+        for (size_t i=0; (i<VELOCITY_TABLE_POINTS) && success; i++) {
+            success = _write(target, end + 1 + i, _read(_active, _table[sensor] + i));
+        }
+        table[sensor] = end + 1;
+        end += 1 + VELOCITY_TABLE_POINTS;
+    }
+    success = success && _erase_page(_active) && _write(target, 1, PAGE_ACTIVE);
+    if (!success) {
+        return false;
+    }
+
+    _active = target;
+    _end = end;
+    memcpy(_table, table, sizeof(_table));
+    return true;
+}
+
+HOT_PATH int VelocityTables::_point_velocity(int i) {
+    return 1 + 126*i/(VELOCITY_TABLE_POINTS-1);
+}
+
+void velocity_table_build(uint16 *readings, int num_readings, uint16 points[VELOCITY_TABLE_POINTS]) {
+    // Insertion sort, a learning session holds a few dozen hits
+    for (int i=1; i<num_readings; i++) {
+        uint16 reading = readings[i];
+        int j = i;
+        for (; (j > 0) && (readings[j-1] > reading); j--) {
+            readings[j] = readings[j-1];
+        }
+        readings[j] = reading;
+    }
+
+    // Quantile i/(VELOCITY_TABLE_POINTS-1), interpolated between the two closest hits
+    for (int i=0; i<VELOCITY_TABLE_POINTS; i++) {
+        uint32 position = (uint32)i*(num_readings-1);
+        int index = position/(VELOCITY_TABLE_POINTS-1);
+        int fraction = position%(VELOCITY_TABLE_POINTS-1);
+        points[i] = readings[index];
+        if (fraction != 0) {
+            points[i] += (uint32)(readings[index+1] - readings[index])*fraction/(VELOCITY_TABLE_POINTS-1);
+        }
+    }
+}
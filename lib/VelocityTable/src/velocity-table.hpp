@@ -0,0 +1,102 @@
+#pragma once
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+/// @brief Number of sensors that can have a table, one per sensor id
+#define VELOCITY_TABLE_SENSORS 18
+/// @brief Number of points of a table. Point i gives the velocity 1 + 126*i/(VELOCITY_TABLE_POINTS-1)
+#define VELOCITY_TABLE_POINTS 16
+
+/// @brief Velocity response tables of single sensors, stored in two flash pages of their own outside of the emulated EEPROM.
+/// A table holds the trigger reading of every point, in increasing order, and the readings in between are interpolated, so
+/// velocity() costs a binary search over the points read straight from flash.
+///
+/// Each page starts with two status half-words, PAGE_RECEIVING then PAGE_ACTIVE, followed by half-word records ended by
+/// erased flash (0xFFFF):
+/// - RECORD_TABLE | sensor followed by VELOCITY_TABLE_POINTS readings: table of the sensor, replacing the previous one
+/// - RECORD_CLEAR | sensor: the sensor has no table anymore
+///
+/// Records are appended to the active page. When it is full, the last table of every sensor is copied to the other page,
+/// the full page is erased and only then the copy is marked active, so that begin() can finish or drop a copy interrupted by
+/// a reset.
+class VelocityTables {
+    public:
+
+        /// @param start_address Address of the first of the two flash pages
+        /// @param page_size Size of a flash page in bytes
+        VelocityTables(uint32 start_address, uint16 page_size);
+
+        /// @brief Find the active page and the last table of every sensor, formatting the pages if none is active.
+        void begin();
+
+        /// @brief Check if a sensor has a table.
+        bool has_table(int sensor);
+
+        /// @brief Map a trigger reading to a MIDI velocity with the table of a sensor.
+        /// @return Velocity from 1 to 127, -1 if the sensor has no table
+        int velocity(int sensor, int reading);
+
+        /// @brief Copy the points of the table of a sensor.
+        /// @return false if the sensor has no table
+        bool get_table(int sensor, uint16 points[VELOCITY_TABLE_POINTS]);
+
+        /// @brief Store the table of a sensor, replacing the previous one.
+        /// @param points Trigger readings, in increasing order
+        /// @return false if the flash could not be programmed
+        bool store(int sensor, const uint16 points[VELOCITY_TABLE_POINTS]);
+
+        /// @brief Remove the table of a sensor, it goes back to the velocity curves.
+        bool clear(int sensor);
+
+        /// @brief Remove every table.
+        bool erase();
+
+        /// @brief Number of bytes used in the active page, including the status half-words.
+        size_t bytes_used();
+
+        /// @brief Number of bytes of the active page, the other page being reserved for copies.
+        size_t capacity();
+
+    private:
+
+        static const uint16 PAGE_RECEIVING = 0xEEEE;
+        static const uint16 PAGE_ACTIVE = 0x5654;
+        static const uint16 PAGE_ERASED = 0xFFFF;
+        static const uint16 RECORD_TABLE = 0x5400;
+        static const uint16 RECORD_CLEAR = 0x4300;
+        static const uint16 RECORD_TYPE_MASK = 0xFF00;
+        /// @brief Half-word offset of the first record of a page
+        static const uint32 FIRST_RECORD = 2;
+
+        uint32 _start_address;
+        uint16 _page_size;
+        /// @brief Page holding the tables, 0 or 1
+        uint8 _active;
+        /// @brief Half-word offset of the end of the records in the active page
+        uint32 _end;
+        /// @brief Sensor -> Half-word offset of the points of its last table in the active page, 0 if none
+        uint16 _table[VELOCITY_TABLE_SENSORS];
+
+        uint16 _read(uint8 page, uint32 offset);
+        bool _write(uint8 page, uint32 offset, uint16 data);
+        /// @brief Erase a page unless it is blank already
+        bool _erase_page(uint8 page);
+        /// @brief Find the last table of every sensor and the end of the records in the active page
+        void _scan();
+        /// @brief Append a record of length half-words, copying the tables to the other page first if it doesn't fit
+        bool _append(const uint16 *record, uint32 length, int skip_sensor);
+        /// @brief Copy the last table of every sensor but skip_sensor to the other page and make it the active page
+        bool _transfer(int skip_sensor);
+        /// @brief Velocity given by point i of a table
+        static int _point_velocity(int i);
+
+};
+
+/// @brief Build a table from the trigger readings of hits played from the softest to the hardest on a sensor. Point i is
+/// the reading at the quantile i/(VELOCITY_TABLE_POINTS-1) of the hits, so the softest hit gives the velocity 1, the hardest
+/// 127, and every velocity range gets the same share of the hits, whatever the sensitivity of the sensor.
+/// @param readings Readings of the hits, sorted in place
+/// @param num_readings Number of hits, at least 2
+/// @param points Table built
+void velocity_table_build(uint16 *readings, int num_readings, uint16 points[VELOCITY_TABLE_POINTS]);
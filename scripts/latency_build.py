@@ -0,0 +1,4 @@
+# PlatformIO pre script of the latency build: link time optimisation needs -flto on the link command as well
+Import("env")
+
+env.Append(LINKFLAGS=["-flto"])
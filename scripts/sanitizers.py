@@ -0,0 +1,5 @@
+# PlatformIO pre script of the fuzz build of the simulator: the sanitizers need their flags on the link command as well
+Import("env")
+
+SANITIZER_FLAGS = ["-fsanitize=address,undefined", "-fno-omit-frame-pointer"]
+env.Append(CCFLAGS=SANITIZER_FLAGS, LINKFLAGS=SANITIZER_FLAGS)
@@ -0,0 +1,62 @@
+# PlatformIO post script: flash and RAM usage of the firmware, and the size of the hot path placed in RAM, written to
+# size-report.json in the build directory and printed next to the reports of the other firmware environments.
+Import("env")
+
+import json
+import os
+import subprocess
+
+FLASH_SECTIONS = (".text", ".rodata", ".ARM.exidx", ".data", ".init_array", ".fini_array")
+RAM_SECTIONS = (".data", ".bss")
+RAM_START = 0x20000000
+
+
+def section_sizes(elf):
+    output = subprocess.check_output([env.subst("$SIZETOOL"), "-A", elf]).decode()
+    sizes = {}
+    for line in output.splitlines():
+        fields = line.split()
+        if (len(fields) == 3) and fields[0].startswith("."):
+            sizes[fields[0]] = sizes.get(fields[0], 0) + int(fields[1])
+    return sizes
+
+
+def hot_path_size(elf):
+    # Functions linked at a RAM address are the ones marked HOT_PATH in the latency build
+    nm = env.subst("$CC").replace("gcc", "nm")
+    output = subprocess.check_output([nm, "-S", "-C", elf]).decode()
+    size = 0
+    for line in output.splitlines():
+        fields = line.split(None, 3)
+        if (len(fields) == 4) and (fields[2] in "tT") and (int(fields[0], 16) >= RAM_START):
+            size += int(fields[1], 16)
+    return size
+
+
+def size_report(target, source, env):
+    elf = str(target[0])
+    sizes = section_sizes(elf)
+    report = {
+        "env": env["PIOENV"],
+        "flash": sum(sizes.get(name, 0) for name in FLASH_SECTIONS),
+        "ram": sum(sizes.get(name, 0) for name in RAM_SECTIONS),
+        "hot_path_ram": hot_path_size(elf),
+    }
+    build_dir = env.subst("$BUILD_DIR")
+    with open(os.path.join(build_dir, "size-report.json"), "w") as file:
+        json.dump(report, file)
+
+    reports = []
+    builds_dir = os.path.dirname(build_dir)
+    for name in sorted(os.listdir(builds_dir)):
+        path = os.path.join(builds_dir, name, "size-report.json")
+        if os.path.isfile(path):
+            with open(path) as file:
+                reports.append(json.load(file))
+    print("%-28s %8s %8s %13s" % ("Environment", "Flash", "RAM", "Hot path RAM"))
+    for entry in reports:
+        print("%-28s %8d %8d %13d" % (entry["env"], entry["flash"], entry["ram"], entry["hot_path_ram"]))
+    print("Cycles per sweep are measured on the device, see sweep_cycles in the 't' serial command")
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", size_report)
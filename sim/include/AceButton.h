@@ -0,0 +1,66 @@
+#pragma once
+
+// Host stand-in for the AceButton library. Button events are scripted with sim_button() instead of being
+// decoded from pin levels, and delivered to the event handler from check().
+
+#include <Arduino.h>
+
+namespace ace_button {
+
+class AceButton;
+
+class ButtonConfig {
+    public:
+        typedef void (*EventHandler)(AceButton *button, uint8_t eventType, uint8_t buttonState);
+
+        static const uint16_t kFeatureClick = 0x01;
+        static const uint16_t kFeatureDoubleClick = 0x02;
+        static const uint16_t kFeatureLongPress = 0x04;
+        static const uint16_t kFeatureRepeatPress = 0x08;
+        static const uint16_t kFeatureSuppressAfterClick = 0x10;
+        static const uint16_t kFeatureSuppressAfterDoubleClick = 0x20;
+        static const uint16_t kFeatureSuppressAfterLongPress = 0x40;
+        static const uint16_t kFeatureSuppressAfterRepeatPress = 0x80;
+        static const uint16_t kFeatureSuppressClickBeforeDoubleClick = 0x100;
+
+        static ButtonConfig *getSystemButtonConfig();
+
+        void setEventHandler(EventHandler handler) { _handler = handler; }
+        EventHandler getEventHandler() { return _handler; }
+        void setClickDelay(uint16_t delay) {}
+        void setDoubleClickDelay(uint16_t delay) {}
+        void setLongPressDelay(uint16_t delay) {}
+        void setFeature(uint16_t features) {}
+        void clearFeature(uint16_t features) {}
+
+    private:
+        EventHandler _handler = 0;
+};
+
+class AceButton {
+    public:
+        static const uint8_t kEventPressed = 0;
+        static const uint8_t kEventReleased = 1;
+        static const uint8_t kEventClicked = 2;
+        static const uint8_t kEventDoubleClicked = 3;
+        static const uint8_t kEventLongPressed = 4;
+        static const uint8_t kEventRepeatPressed = 5;
+        static const uint8_t kEventLongReleased = 6;
+
+        void init(uint8_t pin, uint8_t defaultReleasedState=HIGH, uint8_t id=0) {
+            _pin = pin;
+            _id = id;
+        }
+
+        uint8_t getPin() { return _pin; }
+        uint8_t getId() { return _id; }
+
+        /// @brief Deliver the scripted events of this button whose time has come
+        void check();
+
+    private:
+        uint8_t _pin = 0;
+        uint8_t _id = 0;
+};
+
+}
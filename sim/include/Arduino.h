@@ -0,0 +1,145 @@
+#pragma once
+
+// Host stand-in for the Arduino STM32 (maple) core, used by the simulator build.
+// Nothing here touches hardware: every call is backed by the virtual clock and scripted world in sim.hpp.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <deque>
+#include <utility>
+
+typedef uint8_t uint8;
+typedef uint16_t uint16;
+typedef uint32_t uint32;
+typedef uint64_t uint64;
+typedef int8_t int8;
+typedef int16_t int16;
+typedef int32_t int32;
+typedef int64_t int64;
+typedef unsigned int uint;
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define DEC 10
+#define HEX 16
+
+enum WiringPinMode {
+    OUTPUT,
+    OUTPUT_OPEN_DRAIN,
+    INPUT,
+    INPUT_ANALOG,
+    INPUT_PULLUP,
+    INPUT_PULLDOWN,
+    INPUT_FLOATING,
+    PWM,
+    PWM_OPEN_DRAIN,
+};
+
+enum {
+    PA0, PA1, PA2, PA3, PA4, PA5, PA6, PA7, PA8, PA9, PA10, PA11, PA12, PA13, PA14, PA15,
+    PB0, PB1, PB2, PB3, PB4, PB5, PB6, PB7, PB8, PB9, PB10, PB11, PB12, PB13, PB14, PB15,
+    PC13, PC14, PC15,
+    BOARD_NR_GPIO_PINS
+};
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define constrain(amt, low, high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+void pinMode(uint8 pin, WiringPinMode mode);
+inline void pinMode(uint8 pin, int mode) { pinMode(pin, (WiringPinMode)mode); }
+void digitalWrite(uint8 pin, uint8 val);
+uint32 digitalRead(uint8 pin);
+uint16 analogRead(uint8 pin);
+void pwmWrite(uint8 pin, uint16 duty_cycle);
+
+uint32 micros();
+uint32 millis();
+void delay(unsigned long ms);
+void delay_us(uint32 us);
+void delayMicroseconds(uint32 us);
+
+void noInterrupts();
+void interrupts();
+
+class String {
+    public:
+        String() {}
+        String(const char *str) : _str(str) {}
+        String &operator+=(char c) { _str += c; return *this; }
+        String &operator+=(const char *str) { _str += str; return *this; }
+        const char *c_str() const { return _str.c_str(); }
+        unsigned int length() const { return _str.length(); }
+    private:
+        std::string _str;
+};
+
+class Print {
+    public:
+        virtual ~Print() {}
+        virtual size_t write(uint8 ch) = 0;
+        virtual size_t write(const uint8 *buffer, size_t size);
+        size_t write(const char *str);
+
+        size_t print(const char *str);
+        size_t print(char c);
+        size_t print(unsigned char n, int base=DEC);
+        size_t print(int n, int base=DEC);
+        size_t print(unsigned int n, int base=DEC);
+        size_t print(long n, int base=DEC);
+        size_t print(unsigned long n, int base=DEC);
+        size_t print(double n, int digits=2);
+        size_t print(const String &str);
+
+        size_t println();
+        template <class T> size_t println(T value) { size_t n = print(value); return n + println(); }
+        template <class T> size_t println(T value, int base) { size_t n = print(value, base); return n + println(); }
+};
+
+/// @brief Stream whose received bytes are scripted with a timestamp. Reads only see bytes whose time has come,
+/// and the blocking reads advance the virtual clock while they wait, as they would stall the real loop.
+class Stream : public Print {
+    public:
+        virtual int available();
+        virtual int read();
+        virtual int peek();
+        void setTimeout(unsigned long timeout_millis) { _timeout = timeout_millis; }
+        size_t readBytes(char *buffer, size_t length);
+        size_t readBytesUntil(char terminator, char *buffer, size_t length);
+        String readStringUntil(char terminator);
+
+        /// @brief Simulator only: schedule bytes to be received at a virtual time in nanoseconds
+        void sim_receive(uint64 time_ns, uint8 ch);
+
+    protected:
+        unsigned long _timeout = 1000;
+
+    private:
+        std::deque<std::pair<uint64, uint8> > _rx;
+        int _timed_read();
+};
+
+class HardwareSerial : public Stream {
+    public:
+        HardwareSerial(const char *name) : _name(name) {}
+        void begin(uint32 baud);
+        void end() {}
+        size_t write(uint8 ch);
+        using Print::write;
+        int availableForWrite();
+        const char *get_name() { return _name; }
+    private:
+        const char *_name;
+};
+
+extern HardwareSerial Serial1;
+
+void setup();
+void loop();
@@ -0,0 +1,44 @@
+#pragma once
+
+// Host stand-in for the STM32F1 emulated EEPROM and the flash programming functions it exports. The EEPROM content
+// lives in RAM and starts erased for every scenario. The flash is mapped at its real address (SIM_FLASH_BASE) so that
+// the firmware can read it through plain pointers.
+
+#include <Arduino.h>
+
+enum {
+    EEPROM_OK = ((uint16)0x0000),
+    EEPROM_OUT_SIZE = ((uint16)0x0081),
+    EEPROM_BAD_ADDRESS = ((uint16)0x0082),
+    EEPROM_BAD_FLASH = ((uint16)0x0083),
+    EEPROM_NOT_INIT = ((uint16)0x0084),
+    EEPROM_SAME_VALUE = ((uint16)0x0085),
+    EEPROM_NO_VALID_PAGE = ((uint16)0x00AB),
+};
+
+typedef enum {
+    FLASH_BUSY = 1,
+    FLASH_ERROR_PG,
+    FLASH_ERROR_WRP,
+    FLASH_ERROR_OPT,
+    FLASH_COMPLETE,
+    FLASH_TIMEOUT,
+    FLASH_BAD_ADDRESS,
+} FLASH_Status;
+
+void FLASH_Unlock();
+void FLASH_Lock();
+FLASH_Status FLASH_ErasePage(uint32 page_address);
+FLASH_Status FLASH_ProgramHalfWord(uint32 address, uint16 data);
+
+class EEPROMClass {
+    public:
+        uint16 init() { return EEPROM_OK; }
+        uint16 format();
+        uint16 read(uint16 address);
+        uint16 write(uint16 address, uint16 data);
+        uint16 update(uint16 address, uint16 data);
+        uint16 count(uint16 *count);
+};
+
+extern EEPROMClass EEPROM;
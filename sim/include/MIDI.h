@@ -0,0 +1,46 @@
+#pragma once
+
+// Host stand-in for the FortySevenEffects MIDI library. Messages are written byte by byte to the serial port
+// without running status, like the library default settings.
+
+#include <Arduino.h>
+
+namespace midi {
+
+template <class SerialPort>
+class MidiInterface {
+    public:
+        MidiInterface(SerialPort &serial) : _serial(serial) {}
+
+        void begin(int in_channel=1) {
+            _serial.begin(31250);
+        }
+
+        void sendNoteOn(uint8 note, uint8 velocity, uint8 channel) {
+            _send(0x90, note, velocity, channel);
+        }
+
+        void sendNoteOff(uint8 note, uint8 velocity, uint8 channel) {
+            _send(0x80, note, velocity, channel);
+        }
+
+        void sendControlChange(uint8 controller, uint8 value, uint8 channel) {
+            _send(0xB0, controller, value, channel);
+        }
+
+    private:
+        SerialPort &_serial;
+
+        void _send(uint8 status, uint8 data1, uint8 data2, uint8 channel) {
+            if ((channel == 0) || (channel > 16)) {
+                return;
+            }
+            _serial.write(status | ((channel-1) & 0x0F));
+            _serial.write(data1 & 0x7F);
+            _serial.write(data2 & 0x7F);
+        }
+};
+
+}
+
+#define MIDI_CREATE_INSTANCE(Type, SerialPort, Name) midi::MidiInterface<Type> Name((Type&)SerialPort);
@@ -0,0 +1,28 @@
+#pragma once
+
+// Host stand-in for the RunningAverage library, implementing the subset used by Pad.
+
+#include <Arduino.h>
+
+class RunningAverage {
+    public:
+        explicit RunningAverage(uint16_t size);
+        ~RunningAverage();
+
+        void clear();
+        void add(float value) { addValue(value); }
+        void addValue(float value);
+        float getAverage();
+        float getMaxInBuffer();
+        float getAverageLast(uint16_t count);
+        float getMaxInBufferLast(uint16_t count);
+        bool bufferIsFull() { return _count == _size; }
+        uint16_t getSize() { return _size; }
+
+    private:
+        uint16_t _size;
+        uint16_t _count = 0;
+        uint16_t _index = 0;
+        float _sum = 0;
+        float *_buffer;
+};
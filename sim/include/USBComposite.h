@@ -0,0 +1,44 @@
+#pragma once
+
+// Host stand-in for the USBComposite library, see sim.hpp for the timing model.
+
+#include <Arduino.h>
+
+class USBMIDI {
+    public:
+        void registerComponent() {}
+        void writePacket(uint32 packet);
+        void sendNoteOn(unsigned int channel, unsigned int note, unsigned int velocity);
+        void sendNoteOff(unsigned int channel, unsigned int note, unsigned int velocity);
+        void sendControlChange(unsigned int channel, unsigned int controller, unsigned int value);
+        void sendProgramChange(unsigned int channel, unsigned int program);
+        uint32 available();
+        uint32 readPacket();
+
+        /// @brief Simulator only: schedule a packet to be received from the host at a virtual time in nanoseconds
+        void sim_receive(uint64 time_ns, uint32 packet);
+
+    private:
+        std::deque<std::pair<uint64, uint32> > _rx;
+};
+
+class USBCompositeSerial : public Stream {
+    public:
+        void registerComponent() {}
+        size_t write(uint8 ch);
+        using Print::write;
+        operator bool() { return true; }
+};
+
+class USBCompositeDevice {
+    public:
+        void clear() {}
+        void setVendorId(uint16 vendor_id) {}
+        void setProductId(uint16 product_id) {}
+        void setManufacturerString(const char *manufacturer) {}
+        void setProductString(const char *product) {}
+        bool begin() { return true; }
+        bool isReady() { return true; }
+};
+
+extern USBCompositeDevice USBComposite;
@@ -0,0 +1,120 @@
+#pragma once
+
+// Scripted world of the simulator. All times are virtual and deterministic: the clock only moves when the
+// firmware calls into the core stand-ins, each call costing the time given by the SIM_*_NS constants below.
+
+#include <Arduino.h>
+#include <vector>
+
+// ===== Wiring, mirrors the constants of src/main.cpp =====
+
+const int SIM_MUX_PIN = PA0;
+const int SIM_SELECT_PINS[4] = {PB1, PB0, PA7, PA6};
+const int SIM_MUX_CHANNELS = 16;
+const uint32 SIM_FLASH_BASE = 0x08000000;
+const uint32 SIM_FLASH_SIZE = 64*1024;
+const uint32 SIM_FLASH_PAGE_SIZE = 1024;
+const uint32 SIM_EEPROM_SLOTS = SIM_FLASH_PAGE_SIZE/4 - 1; // Emulated EEPROM writes that fit in a page, the first slot is the page status
+
+// ===== Cost model =====
+
+const uint64 SIM_ANALOG_READ_NS = 7000;       // 55.5 cycle sample time at 12 MHz ADC clock plus conversion and call overhead
+const uint64 SIM_DIGITAL_IO_NS = 300;
+const uint64 SIM_MICROS_NS = 150;
+const uint64 SIM_BUTTON_CHECK_NS = 400;
+const uint64 SIM_LOOP_OVERHEAD_NS = 1000;     // Everything in loop() that is not modelled by a call below
+const uint64 SIM_FLASH_WRITE_NS = 52500;      // Typical half-word program time of the STM32F103
+const uint64 SIM_FLASH_ERASE_NS = 20000000;   // Typical page erase time of the STM32F103
+
+const uint64 SIM_UART_BYTE_NS = 320000;       // 10 bits at 31250 baud
+const uint32 SIM_UART_TX_BUFFER = 64;         // Bytes buffered by the core before Serial1.write blocks
+const uint64 SIM_USB_BYTE_NS = 15625;         // 64 byte packet per 1 ms full speed frame
+const uint32 SIM_USB_CDC_TX_BUFFER = 256;
+const uint32 SIM_USB_MIDI_TX_BUFFER = 64;
+
+const uint64 SIM_MUX_SETTLE_TAU_NS = 5000;    // RC time constant of the mux output after an address change
+
+// ===== Virtual clock =====
+
+uint64 sim_now_ns();
+void sim_advance_ns(uint64 ns);
+void sim_advance_to_ns(uint64 time_ns);
+
+// ===== Scripted inputs =====
+
+/// @brief Strike the piezo on a mux channel. The signal rises as a quarter sine then decays exponentially.
+void sim_hit_mux(uint64 time_us, int channel, int peak, uint32 decay_us=2000);
+
+/// @brief Strike the piezo connected directly to an analog pin (kick pedal).
+void sim_hit_pin(uint64 time_us, int pin, int peak, uint32 decay_us=2000);
+
+/// @brief Set the steady level of an analog pin from a given time (CC pedal).
+void sim_level_pin(uint64 time_us, int pin, int level);
+
+/// @brief Set the steady level of a mux channel from a given time.
+void sim_level_mux(uint64 time_us, int channel, int level);
+
+/// @brief Deliver an AceButton event to a button at a given time.
+void sim_button(uint64 time_us, int button_id, uint8 event_type);
+
+/// @brief Send text from the host over the USB serial port, paced at one 64 byte packet per frame.
+void sim_serial_input(uint64 time_us, const char *text);
+
+/// @brief Receive a channel message from the host on the USB MIDI interface.
+void sim_usb_midi_input(uint64 time_us, uint8 status, uint8 data1, uint8 data2=0);
+
+/// @brief Receive MIDI bytes on the UART input from a downstream unit, back to back at 31250 baud. Each byte is
+/// available once its last bit has arrived.
+void sim_uart_input(uint64 time_us, const uint8 *bytes, size_t length);
+
+/// @brief Amplitude of the idle noise added to every analog reading, in LSB.
+void sim_set_noise(int amplitude);
+
+/// @brief Fraction of every hit that leaks into the neighbouring mux channels.
+void sim_set_crosstalk(double fraction);
+
+/// @brief RC time constant of the mux output after switching to a channel, SIM_MUX_SETTLE_TAU_NS unless set.
+void sim_set_mux_settle_tau(int channel, uint64 tau_ns);
+
+// ===== Recorded outputs =====
+
+#define SIM_TRANSPORT_USB 0
+#define SIM_TRANSPORT_UART 1
+
+struct SimMidiEvent {
+    uint64 time_ns;
+    uint8 transport;
+    uint8 status;
+    uint8 data1;
+    uint8 data2;
+};
+
+struct SimSensorStats {
+    uint32 reads;
+    uint32 missed_deadlines;
+    uint64 last_read_ns;
+    uint64 max_gap_ns;
+};
+
+const std::vector<SimMidiEvent> &sim_midi_events();
+
+/// @brief Sampling statistics of each mux channel, followed by the direct analog pins at SIM_MUX_CHANNELS + pin.
+const SimSensorStats &sim_sensor_stats(int sensor);
+
+/// @brief Forget the sampling statistics, so that only the readings after this call are measured.
+void sim_reset_sensor_stats();
+
+/// @brief Gap between two readings of a sensor above which a sample deadline is counted as missed.
+void sim_set_deadline_us(uint32 deadline_us);
+
+/// @brief Everything the firmware printed on the USB serial port.
+const std::string &sim_serial_output();
+
+/// @brief Number of times the emulated EEPROM filled its page and copied its variables to the other page.
+uint32 sim_eeprom_transfers();
+
+/// @brief Number of scripted hits.
+uint32 sim_hit_count();
+
+/// @brief Start time of every scripted hit in nanoseconds, in the order they were scripted.
+const std::vector<uint64> &sim_hit_times();
@@ -0,0 +1,835 @@
+#include <sim.hpp>
+#include <USBComposite.h>
+#include <AceButton.h>
+#include <EEPROM.h>
+#include <RunningAverage.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <map>
+
+// ===== World state =====
+
+struct SimHit {
+    uint64 time_ns;
+    int peak;
+    uint32 decay_us;
+};
+
+struct SimLevel {
+    uint64 time_ns;
+    int level;
+};
+
+struct SimSignal {
+    std::vector<SimHit> hits;
+    std::vector<SimLevel> levels;
+    size_t first_active_hit = 0;
+};
+
+struct SimButtonEvent {
+    uint64 time_ns;
+    int button_id;
+    uint8 event_type;
+    bool delivered;
+};
+
+struct SimTxChannel {
+    uint64 ns_per_byte;
+    uint32 capacity;
+    uint64 busy_until_ns;
+};
+
+struct SimWorld {
+    uint64 now_ns = 0;
+    uint32 rng_state = 0x2545F491;
+    int noise_amplitude = 8;
+    double crosstalk = 0;
+
+    uint8 pin_level[BOARD_NR_GPIO_PINS] = {};
+    SimSignal mux_signal[SIM_MUX_CHANNELS];
+    SimSignal pin_signal[BOARD_NR_GPIO_PINS];
+    uint32 hit_count = 0;
+    std::vector<uint64> hit_times_ns;
+
+    int mux_channel = 0;
+    uint64 mux_switch_ns = 0;
+    double mux_switch_value = 0;
+    double mux_value = 0;
+    uint64 mux_settle_tau_ns[SIM_MUX_CHANNELS] = {};
+
+    SimSensorStats stats[SIM_MUX_CHANNELS + BOARD_NR_GPIO_PINS] = {};
+    uint64 deadline_ns = 2000000;
+
+    std::vector<SimButtonEvent> button_events;
+
+    SimTxChannel uart_tx = {SIM_UART_BYTE_NS, SIM_UART_TX_BUFFER, 0};
+    SimTxChannel usb_cdc_tx = {SIM_USB_BYTE_NS, SIM_USB_CDC_TX_BUFFER, 0};
+    SimTxChannel usb_midi_tx = {SIM_USB_BYTE_NS, SIM_USB_MIDI_TX_BUFFER, 0};
+    uint8 uart_message[3] = {};
+    int uart_message_length = 0;
+
+    std::vector<SimMidiEvent> midi_events;
+    std::string serial_output;
+
+    std::map<uint16, uint16> eeprom;
+    uint32 eeprom_slots_used = 0;
+    uint32 eeprom_transfers = 0;
+};
+
+/// @brief Constructed on first use, so that the firmware global constructors can already read pins
+static SimWorld &world() {
+    static SimWorld instance;
+    return instance;
+}
+
+// ===== Virtual clock =====
+
+uint64 sim_now_ns() {
+    return world().now_ns;
+}
+
+void sim_advance_ns(uint64 ns) {
+    world().now_ns += ns;
+}
+
+void sim_advance_to_ns(uint64 time_ns) {
+    if (time_ns > world().now_ns) {
+        world().now_ns = time_ns;
+    }
+}
+
+uint32 micros() {
+    sim_advance_ns(SIM_MICROS_NS);
+    return (uint32)(sim_now_ns() / 1000);
+}
+
+uint32 millis() {
+    sim_advance_ns(SIM_MICROS_NS);
+    return (uint32)(sim_now_ns() / 1000000);
+}
+
+void delay(unsigned long ms) {
+    sim_advance_ns((uint64)ms * 1000000);
+}
+
+void delay_us(uint32 us) {
+    sim_advance_ns((uint64)us * 1000);
+}
+
+void delayMicroseconds(uint32 us) {
+    delay_us(us);
+}
+
+void noInterrupts() {}
+void interrupts() {}
+
+// ===== Analog world =====
+
+static uint32 sim_random() {
+    uint32 x = world().rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    world().rng_state = x;
+    return x;
+}
+
+static void add_hit(SimSignal &signal, uint64 time_ns, int peak, uint32 decay_us) {
+    SimHit hit = {time_ns, peak, decay_us};
+    std::vector<SimHit>::iterator it = signal.hits.begin();
+    while ((it != signal.hits.end()) && (it->time_ns <= time_ns)) {
+        ++it;
+    }
+    signal.hits.insert(it, hit);
+    signal.first_active_hit = 0;
+}
+
+/// @brief Noise free value of a signal. A hit rises as a quarter sine over 500 us and then decays exponentially.
+static double signal_value(SimSignal &signal, uint64 time_ns) {
+    const double rise_ns = 500000;
+    double value = 0;
+
+    for (size_t i=signal.first_active_hit; i<signal.hits.size(); i++) {
+        const SimHit &hit = signal.hits[i];
+        if (hit.time_ns > time_ns) {
+            break;
+        }
+        double dt = (double)(time_ns - hit.time_ns);
+        double decay_ns = hit.decay_us * 1000.0;
+        if (dt < rise_ns) {
+            value += hit.peak * sin(M_PI/2 * dt/rise_ns);
+        }
+        else if (dt < rise_ns + 12*decay_ns) {
+            value += hit.peak * exp(-(dt - rise_ns)/decay_ns);
+        }
+        else if (i == signal.first_active_hit) {
+            signal.first_active_hit++;
+        }
+    }
+
+    // Levels are sorted by time, the last one already reached is the steady level
+    for (size_t i=0; (i<signal.levels.size()) && (signal.levels[i].time_ns <= time_ns); i++) {
+        if ((i+1 == signal.levels.size()) || (signal.levels[i+1].time_ns > time_ns)) {
+            value += signal.levels[i].level;
+        }
+    }
+
+    return value;
+}
+
+static double mux_channel_value(int channel, uint64 time_ns) {
+    SimWorld &w = world();
+    double value = signal_value(w.mux_signal[channel], time_ns);
+    if (w.crosstalk != 0) {
+        if (channel > 0) {
+            value += w.crosstalk * signal_value(w.mux_signal[channel-1], time_ns);
+        }
+        if (channel < SIM_MUX_CHANNELS-1) {
+            value += w.crosstalk * signal_value(w.mux_signal[channel+1], time_ns);
+        }
+    }
+    return value;
+}
+
+/// @brief Voltage on the mux output, charging towards the selected channel since the last address change
+static double mux_output(uint64 time_ns) {
+    SimWorld &w = world();
+    double target = mux_channel_value(w.mux_channel, time_ns);
+    uint64 tau_ns = (w.mux_settle_tau_ns[w.mux_channel] != 0) ? w.mux_settle_tau_ns[w.mux_channel] : SIM_MUX_SETTLE_TAU_NS;
+    double settle = exp(-(double)(time_ns - w.mux_switch_ns) / tau_ns);
+    return target + (w.mux_switch_value - target) * settle;
+}
+
+static void update_mux_address() {
+    SimWorld &w = world();
+    int channel = 0;
+    for (int i=0; i<4; i++) {
+        channel |= (w.pin_level[SIM_SELECT_PINS[i]] ? 1 : 0) << i;
+    }
+    if (channel != w.mux_channel) {
+        w.mux_switch_value = mux_output(w.now_ns);
+        w.mux_switch_ns = w.now_ns;
+        w.mux_channel = channel;
+    }
+}
+
+static void record_read(int sensor) {
+    SimWorld &w = world();
+    SimSensorStats &stats = w.stats[sensor];
+    if (stats.reads != 0) {
+        uint64 gap = w.now_ns - stats.last_read_ns;
+        if (gap > stats.max_gap_ns) {
+            stats.max_gap_ns = gap;
+        }
+        if (gap > w.deadline_ns) {
+            stats.missed_deadlines++;
+        }
+    }
+    stats.reads++;
+    stats.last_read_ns = w.now_ns;
+}
+
+void pinMode(uint8 pin, WiringPinMode mode) {}
+
+void digitalWrite(uint8 pin, uint8 val) {
+    sim_advance_ns(SIM_DIGITAL_IO_NS);
+    world().pin_level[pin] = val ? HIGH : LOW;
+    update_mux_address();
+}
+
+uint32 digitalRead(uint8 pin) {
+    sim_advance_ns(SIM_DIGITAL_IO_NS);
+    return world().pin_level[pin];
+}
+
+void pwmWrite(uint8 pin, uint16 duty_cycle) {
+    sim_advance_ns(SIM_DIGITAL_IO_NS);
+}
+
+uint16 analogRead(uint8 pin) {
+    SimWorld &w = world();
+    double value;
+    if (pin == SIM_MUX_PIN) {
+        value = mux_output(w.now_ns);
+        record_read(w.mux_channel);
+    }
+    else {
+        value = signal_value(w.pin_signal[pin], w.now_ns);
+        record_read(SIM_MUX_CHANNELS + pin);
+    }
+    if (w.noise_amplitude > 0) {
+        value += sim_random() % (w.noise_amplitude + 1);
+    }
+    sim_advance_ns(SIM_ANALOG_READ_NS);
+
+    if (value < 0) {
+        return 0;
+    }
+    if (value > 4095) {
+        return 4095;
+    }
+    return (uint16)value;
+}
+
+// ===== Scripted inputs =====
+
+void sim_hit_mux(uint64 time_us, int channel, int peak, uint32 decay_us) {
+    add_hit(world().mux_signal[channel], time_us*1000, peak, decay_us);
+    world().hit_count++;
+    world().hit_times_ns.push_back(time_us*1000);
+}
+
+void sim_hit_pin(uint64 time_us, int pin, int peak, uint32 decay_us) {
+    add_hit(world().pin_signal[pin], time_us*1000, peak, decay_us);
+    world().hit_count++;
+    world().hit_times_ns.push_back(time_us*1000);
+}
+
+static void add_level(std::vector<SimLevel> &levels, uint64 time_us, int level) {
+    SimLevel entry = {time_us*1000, level};
+    std::vector<SimLevel>::iterator it = levels.begin();
+    while ((it != levels.end()) && (it->time_ns <= entry.time_ns)) {
+        ++it;
+    }
+    levels.insert(it, entry);
+}
+
+void sim_level_pin(uint64 time_us, int pin, int level) {
+    add_level(world().pin_signal[pin].levels, time_us, level);
+}
+
+void sim_level_mux(uint64 time_us, int channel, int level) {
+    add_level(world().mux_signal[channel].levels, time_us, level);
+}
+
+void sim_button(uint64 time_us, int button_id, uint8 event_type) {
+    SimButtonEvent event = {time_us*1000, button_id, event_type, false};
+    world().button_events.push_back(event);
+}
+
+void sim_set_noise(int amplitude) {
+    world().noise_amplitude = amplitude;
+}
+
+void sim_set_crosstalk(double fraction) {
+    world().crosstalk = fraction;
+}
+
+void sim_set_mux_settle_tau(int channel, uint64 tau_ns) {
+    world().mux_settle_tau_ns[channel] = tau_ns;
+}
+
+// ===== Recorded outputs =====
+
+const std::vector<SimMidiEvent> &sim_midi_events() {
+    return world().midi_events;
+}
+
+const SimSensorStats &sim_sensor_stats(int sensor) {
+    return world().stats[sensor];
+}
+
+void sim_reset_sensor_stats() {
+    for (int sensor=0; sensor<SIM_MUX_CHANNELS + BOARD_NR_GPIO_PINS; sensor++) {
+        SimSensorStats empty = {};
+        world().stats[sensor] = empty;
+    }
+}
+
+void sim_set_deadline_us(uint32 deadline_us) {
+    world().deadline_ns = (uint64)deadline_us * 1000;
+}
+
+const std::string &sim_serial_output() {
+    return world().serial_output;
+}
+
+uint32 sim_hit_count() {
+    return world().hit_count;
+}
+
+const std::vector<uint64> &sim_hit_times() {
+    return world().hit_times_ns;
+}
+
+/// @brief Queue bytes into a transmitter, blocking while its buffer is full
+/// @return Time at which the last byte is on the wire
+static uint64 tx_push(SimTxChannel &channel, uint32 length) {
+    SimWorld &w = world();
+    for (uint32 i=0; i<length; i++) {
+        if (channel.busy_until_ns < w.now_ns) {
+            channel.busy_until_ns = w.now_ns;
+        }
+        uint64 full_backlog = (uint64)channel.capacity * channel.ns_per_byte;
+        if (channel.busy_until_ns - w.now_ns >= full_backlog) {
+            sim_advance_to_ns(channel.busy_until_ns - full_backlog + channel.ns_per_byte);
+        }
+        channel.busy_until_ns += channel.ns_per_byte;
+    }
+    return channel.busy_until_ns;
+}
+
+static void record_midi(uint64 time_ns, uint8 transport, uint8 status, uint8 data1, uint8 data2) {
+    SimMidiEvent event = {time_ns, transport, status, data1, data2};
+    world().midi_events.push_back(event);
+}
+
+// ===== Print and Stream =====
+
+size_t Print::write(const uint8 *buffer, size_t size) {
+    size_t n = 0;
+    while (size--) {
+        n += write(*buffer++);
+    }
+    return n;
+}
+
+size_t Print::write(const char *str) {
+    return write((const uint8 *)str, strlen(str));
+}
+
+size_t Print::print(const char *str) {
+    return write(str);
+}
+
+size_t Print::print(char c) {
+    return write((uint8)c);
+}
+
+size_t Print::print(unsigned char n, int base) {
+    return print((unsigned long)n, base);
+}
+
+size_t Print::print(int n, int base) {
+    return print((long)n, base);
+}
+
+size_t Print::print(unsigned int n, int base) {
+    return print((unsigned long)n, base);
+}
+
+size_t Print::print(long n, int base) {
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), (base == HEX) ? "%lX" : "%ld", n);
+    return write(buffer);
+}
+
+size_t Print::print(unsigned long n, int base) {
+    char buffer[24];
+    snprintf(buffer, sizeof(buffer), (base == HEX) ? "%lX" : "%lu", n);
+    return write(buffer);
+}
+
+size_t Print::print(double n, int digits) {
+    char buffer[48];
+    snprintf(buffer, sizeof(buffer), "%.*f", digits, n);
+    return write(buffer);
+}
+
+size_t Print::print(const String &str) {
+    return write(str.c_str());
+}
+
+size_t Print::println() {
+    return write("\r\n");
+}
+
+void Stream::sim_receive(uint64 time_ns, uint8 ch) {
+    _rx.push_back(std::make_pair(time_ns, ch));
+}
+
+int Stream::available() {
+    int count = 0;
+    for (size_t i=0; (i<_rx.size()) && (_rx[i].first <= sim_now_ns()); i++) {
+        count++;
+    }
+    return count;
+}
+
+int Stream::read() {
+    if (_rx.empty() || (_rx.front().first > sim_now_ns())) {
+        return -1;
+    }
+    int ch = _rx.front().second;
+    _rx.pop_front();
+    return ch;
+}
+
+int Stream::peek() {
+    if (_rx.empty() || (_rx.front().first > sim_now_ns())) {
+        return -1;
+    }
+    return _rx.front().second;
+}
+
+int Stream::_timed_read() {
+    uint64 deadline_ns = sim_now_ns() + (uint64)_timeout * 1000000;
+    while (true) {
+        int ch = read();
+        if (ch >= 0) {
+            return ch;
+        }
+        if (!_rx.empty() && (_rx.front().first <= deadline_ns)) {
+            sim_advance_to_ns(_rx.front().first);
+        }
+        else {
+            sim_advance_to_ns(deadline_ns);
+            return -1;
+        }
+    }
+}
+
+size_t Stream::readBytes(char *buffer, size_t length) {
+    size_t count = 0;
+    while (count < length) {
+        int ch = _timed_read();
+        if (ch < 0) {
+            break;
+        }
+        buffer[count++] = (char)ch;
+    }
+    return count;
+}
+
+size_t Stream::readBytesUntil(char terminator, char *buffer, size_t length) {
+    size_t count = 0;
+    while (count < length) {
+        int ch = _timed_read();
+        if ((ch < 0) || (ch == terminator)) {
+            break;
+        }
+        buffer[count++] = (char)ch;
+    }
+    return count;
+}
+
+String Stream::readStringUntil(char terminator) {
+    String result;
+    int ch = _timed_read();
+    while ((ch >= 0) && (ch != terminator)) {
+        result += (char)ch;
+        ch = _timed_read();
+    }
+    return result;
+}
+
+// ===== UART =====
+
+HardwareSerial Serial1("Serial1");
+
+void HardwareSerial::begin(uint32 baud) {}
+
+int HardwareSerial::availableForWrite() {
+    SimWorld &w = world();
+    uint64 backlog = (w.uart_tx.busy_until_ns > w.now_ns) ? (w.uart_tx.busy_until_ns - w.now_ns) : 0;
+    return w.uart_tx.capacity - (int)((backlog + w.uart_tx.ns_per_byte - 1) / w.uart_tx.ns_per_byte);
+}
+
+size_t HardwareSerial::write(uint8 ch) {
+    SimWorld &w = world();
+    uint64 done_ns = tx_push(w.uart_tx, 1);
+
+    // Decode the MIDI messages going out, each is stamped with the time its last byte leaves the wire
+    if (ch >= 0xF8) { // Real-time, does not interrupt the message in progress
+        record_midi(done_ns, SIM_TRANSPORT_UART, ch, 0, 0);
+    }
+    else if (ch & 0x80) {
+        w.uart_message[0] = ch;
+        w.uart_message_length = 1;
+    }
+    else if ((w.uart_message_length == 1) || (w.uart_message_length == 2)) {
+        w.uart_message[w.uart_message_length++] = ch;
+        uint8 type = w.uart_message[0] & 0xF0;
+        bool two_bytes = (type == 0xC0) || (type == 0xD0);
+        if (two_bytes || (w.uart_message_length == 3)) {
+            record_midi(done_ns, SIM_TRANSPORT_UART, w.uart_message[0], w.uart_message[1], two_bytes ? 0 : w.uart_message[2]);
+            w.uart_message_length = 1; // Running status
+        }
+    }
+    return 1;
+}
+
+// ===== USB =====
+
+USBCompositeDevice USBComposite;
+
+static void usb_midi_send(uint8 status, uint8 data1, uint8 data2) {
+    uint64 done_ns = tx_push(world().usb_midi_tx, 4);
+    record_midi(done_ns, SIM_TRANSPORT_USB, status, data1 & 0x7F, data2 & 0x7F);
+}
+
+void USBMIDI::writePacket(uint32 packet) {
+    usb_midi_send((packet >> 8) & 0xFF, (packet >> 16) & 0xFF, (packet >> 24) & 0xFF);
+}
+
+void USBMIDI::sendNoteOn(unsigned int channel, unsigned int note, unsigned int velocity) {
+    usb_midi_send(0x90 | (channel & 0x0F), note, velocity);
+}
+
+void USBMIDI::sendNoteOff(unsigned int channel, unsigned int note, unsigned int velocity) {
+    usb_midi_send(0x80 | (channel & 0x0F), note, velocity);
+}
+
+void USBMIDI::sendControlChange(unsigned int channel, unsigned int controller, unsigned int value) {
+    usb_midi_send(0xB0 | (channel & 0x0F), controller, value);
+}
+
+void USBMIDI::sendProgramChange(unsigned int channel, unsigned int program) {
+    usb_midi_send(0xC0 | (channel & 0x0F), program, 0);
+}
+
+uint32 USBMIDI::available() {
+    uint32 count = 0;
+    for (size_t i=0; (i<_rx.size()) && (_rx[i].first <= sim_now_ns()); i++) {
+        count++;
+    }
+    return count;
+}
+
+uint32 USBMIDI::readPacket() {
+    if (_rx.empty() || (_rx.front().first > sim_now_ns())) {
+        return 0;
+    }
+    uint32 packet = _rx.front().second;
+    _rx.pop_front();
+    return packet;
+}
+
+void USBMIDI::sim_receive(uint64 time_ns, uint32 packet) {
+    _rx.push_back(std::make_pair(time_ns, packet));
+}
+
+size_t USBCompositeSerial::write(uint8 ch) {
+    tx_push(world().usb_cdc_tx, 1);
+    world().serial_output += (char)ch;
+    return 1;
+}
+
+extern USBCompositeSerial CompositeSerial;
+
+void sim_serial_input(uint64 time_us, const char *text) {
+    uint64 time_ns = time_us * 1000;
+    for (size_t i=0; text[i] != '\0'; i++) {
+        // 64 byte packets, one per 1 ms frame
+        CompositeSerial.sim_receive(time_ns + (i/64)*1000000, (uint8)text[i]);
+    }
+}
+
+extern USBMIDI CompositeMIDI;
+
+void sim_usb_midi_input(uint64 time_us, uint8 status, uint8 data1, uint8 data2) {
+    // Channel messages only, the code index is the message type
+    CompositeMIDI.sim_receive(time_us*1000, (status >> 4) | ((uint32)status << 8) | ((uint32)data1 << 16) | ((uint32)data2 << 24));
+}
+
+void sim_uart_input(uint64 time_us, const uint8 *bytes, size_t length) {
+    for (size_t i=0; i<length; i++) {
+        Serial1.sim_receive(time_us*1000 + (i+1)*SIM_UART_BYTE_NS, bytes[i]);
+    }
+}
+
+// ===== Buttons =====
+
+ace_button::ButtonConfig *ace_button::ButtonConfig::getSystemButtonConfig() {
+    static ButtonConfig instance;
+    return &instance;
+}
+
+void ace_button::AceButton::check() {
+    sim_advance_ns(SIM_BUTTON_CHECK_NS);
+    std::vector<SimButtonEvent> &events = world().button_events;
+    for (size_t i=0; i<events.size(); i++) {
+        if (!events[i].delivered && (events[i].button_id == _id) && (events[i].time_ns <= sim_now_ns())) {
+            events[i].delivered = true;
+            ButtonConfig::EventHandler handler = ButtonConfig::getSystemButtonConfig()->getEventHandler();
+            if (handler) {
+                handler(this, events[i].event_type, LOW);
+            }
+        }
+    }
+}
+
+// ===== EEPROM =====
+
+EEPROMClass EEPROM;
+
+uint16 EEPROMClass::format() {
+    world().eeprom.clear();
+    world().eeprom_slots_used = 0;
+    sim_advance_ns(2 * SIM_FLASH_ERASE_NS);
+    return EEPROM_OK;
+}
+
+uint16 EEPROMClass::read(uint16 address) {
+    std::map<uint16, uint16>::iterator it = world().eeprom.find(address);
+    if (it == world().eeprom.end()) {
+        return 0xFFFF;
+    }
+    return it->second;
+}
+
+uint16 EEPROMClass::write(uint16 address, uint16 data) {
+    SimWorld &w = world();
+    if (w.eeprom_slots_used >= SIM_EEPROM_SLOTS) {
+        // Page full: the last value of every other variable is copied to the other page, then the full page is erased
+        uint32 copied = w.eeprom.size() - w.eeprom.count(address);
+        if (copied >= SIM_EEPROM_SLOTS) {
+            return EEPROM_OUT_SIZE;
+        }
+        sim_advance_ns(2*SIM_FLASH_ERASE_NS + copied*SIM_FLASH_WRITE_NS);
+        w.eeprom_slots_used = copied;
+        w.eeprom_transfers++;
+    }
+    w.eeprom[address] = data;
+    w.eeprom_slots_used++;
+    sim_advance_ns(SIM_FLASH_WRITE_NS);
+    return FLASH_COMPLETE;
+}
+
+uint16 EEPROMClass::update(uint16 address, uint16 data) {
+    if (read(address) == data) {
+        return EEPROM_SAME_VALUE;
+    }
+    return write(address, data);
+}
+
+uint16 EEPROMClass::count(uint16 *count) {
+    *count = world().eeprom.size();
+    return EEPROM_OK;
+}
+
+uint32 sim_eeprom_transfers() {
+    return world().eeprom_transfers;
+}
+
+// ===== Flash =====
+
+/// @brief Map the flash at its real address before any firmware code runs, erased
+struct SimFlash {
+    SimFlash() {
+        void *memory = mmap((void *)(uintptr_t)SIM_FLASH_BASE, SIM_FLASH_SIZE, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+        if (memory != (void *)(uintptr_t)SIM_FLASH_BASE) {
+            fprintf(stderr, "sim: cannot map the flash at 0x%08X\n", SIM_FLASH_BASE);
+            exit(1);
+        }
+        memset(memory, 0xFF, SIM_FLASH_SIZE);
+    }
+};
+
+static SimFlash sim_flash;
+
+static bool flash_address_valid(uint32 address) {
+    return (address >= SIM_FLASH_BASE) && (address < SIM_FLASH_BASE + SIM_FLASH_SIZE);
+}
+
+void FLASH_Unlock() {}
+void FLASH_Lock() {}
+
+FLASH_Status FLASH_ErasePage(uint32 page_address) {
+    if (!flash_address_valid(page_address) || ((page_address % SIM_FLASH_PAGE_SIZE) != 0)) {
+        return FLASH_BAD_ADDRESS;
+    }
+    memset((void *)(uintptr_t)page_address, 0xFF, SIM_FLASH_PAGE_SIZE);
+    sim_advance_ns(SIM_FLASH_ERASE_NS);
+    return FLASH_COMPLETE;
+}
+
+FLASH_Status FLASH_ProgramHalfWord(uint32 address, uint16 data) {
+    if (!flash_address_valid(address) || ((address % 2) != 0)) {
+        return FLASH_BAD_ADDRESS;
+    }
+    volatile uint16 *cell = (volatile uint16 *)(uintptr_t)address;
+    sim_advance_ns(SIM_FLASH_WRITE_NS);
+    // Like the real flash, a half-word can only be programmed once after an erase
+    if (*cell != 0xFFFF) {
+        return FLASH_ERROR_PG;
+    }
+    *cell = data;
+    return FLASH_COMPLETE;
+}
+
+// ===== RunningAverage =====
+
+RunningAverage::RunningAverage(uint16_t size) {
+    _size = size;
+    _buffer = new float[size];
+    clear();
+}
+
+RunningAverage::~RunningAverage() {
+    delete[] _buffer;
+}
+
+void RunningAverage::clear() {
+    _count = 0;
+    _index = 0;
+    _sum = 0;
+    for (uint16_t i=0; i<_size; i++) {
+        _buffer[i] = 0;
+    }
+}
+
+void RunningAverage::addValue(float value) {
+    _sum -= _buffer[_index];
+    _buffer[_index] = value;
+    _sum += value;
+    _index = (_index + 1) % _size;
+    if (_count < _size) {
+        _count++;
+    }
+}
+
+float RunningAverage::getAverage() {
+    if (_count == 0) {
+        return NAN;
+    }
+    return _sum / _count;
+}
+
+float RunningAverage::getMaxInBuffer() {
+    if (_count == 0) {
+        return NAN;
+    }
+    float max = _buffer[0];
+    for (uint16_t i=1; i<_count; i++) {
+        if (_buffer[i] > max) {
+            max = _buffer[i];
+        }
+    }
+    return max;
+}
+
+float RunningAverage::getAverageLast(uint16_t count) {
+    if (count > _count) {
+        count = _count;
+    }
+    if (count == 0) {
+        return NAN;
+    }
+    float sum = 0;
+    for (uint16_t i=0; i<count; i++) {
+        sum += _buffer[(_index + _size - 1 - i) % _size];
+    }
+    return sum / count;
+}
+
+float RunningAverage::getMaxInBufferLast(uint16_t count) {
+    if (count > _count) {
+        count = _count;
+    }
+    if (count == 0) {
+        return NAN;
+    }
+    float max = _buffer[(_index + _size - 1) % _size];
+    for (uint16_t i=1; i<count; i++) {
+        float value = _buffer[(_index + _size - 1 - i) % _size];
+        if (value > max) {
+            max = value;
+        }
+    }
+    return max;
+}
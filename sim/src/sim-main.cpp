@@ -0,0 +1,876 @@
+#include <sim.hpp>
+#include <AceButton.h>
+#include <json-reader.hpp>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <string>
+#include <algorithm>
+#include <chrono>
+
+// Runs setup()/loop() of src/main.cpp against scripted scenarios in virtual time and reports what came out.
+// Every scenario runs in its own forked process, so that it starts from freshly constructed firmware globals.
+
+const int KICK_PIN = PA1;
+const int CC_PIN = PA2;
+const int NUM_PADS = 12;
+const int NUM_SENSORS = 18; // 16 mux channels, kick and CC pedal
+
+const uint32 LOOP_HISTOGRAM_SIZE = 20000; // 1 us bins
+
+struct Scenario {
+    const char *name;
+    const char *description;
+    uint32 duration_ms;
+    void (*build)();
+};
+
+struct Options {
+    bool midi_log = false;
+    bool serial_log = false;
+    bool strict = false;
+    uint32 deadline_us = 2000;
+    uint32 fuzz_inputs = 0;
+    uint32 seed = 1;
+};
+
+// ===== Scenario helpers =====
+
+/// @brief Pseudo random but repeatable peak for the n-th hit of a sensor
+static int hit_peak(int sensor, int n) {
+    return 400 + ((sensor*337 + n*1231) % 3200);
+}
+
+/// @brief Roll on a set of pads, every pad hit at rate_hz with its own phase offset
+static void roll(uint64 start_us, uint32 length_ms, int rate_hz, int num_pads, bool with_kick) {
+    uint64 period_us = 1000000 / rate_hz;
+    int n = 0;
+    for (uint64 t=0; t<(uint64)length_ms*1000; t+=period_us, n++) {
+        for (int pad=0; pad<num_pads; pad++) {
+            sim_hit_mux(start_us + t + pad*(period_us/(num_pads+1)), pad, hit_peak(pad, n));
+        }
+        if (with_kick) {
+            sim_hit_pin(start_us + t + period_us/2, KICK_PIN, hit_peak(12, n));
+        }
+    }
+}
+
+/// @brief A complete 's' command with every bank filled
+static std::string full_config_command() {
+    std::string json = "s{\"uart_midi_enabled\":true,\"midi_channel_num\":1,\"vel_map_profile\":1,\"kick_vel_map_profile\":1,\"cc_ped_enabled\":false,\"kick_ped_enabled\":true,\"mapping_bank\":[";
+    for (int bank=0; bank<4; bank++) {
+        json += (bank == 0) ? "[" : ",[";
+        for (int slot=0; slot<4; slot++) {
+            json += (slot == 0) ? "[" : ",[";
+            for (int sensor=0; sensor<NUM_SENSORS; sensor++) {
+                if (sensor != 0) {
+                    json += ",";
+                }
+                if (sensor < NUM_PADS) {
+                    json += std::to_string(36 + bank*4 + slot + sensor);
+                }
+                else {
+                    json += (sensor == NUM_SENSORS-1) ? "4" : "36";
+                }
+            }
+            json += "]";
+        }
+        json += "]";
+    }
+    json += "]}";
+    return json;
+}
+
+// ===== Scenarios =====
+
+static void scenario_idle() {}
+
+static void scenario_single_hits() {
+    for (int pad=0; pad<NUM_PADS; pad++) {
+        sim_hit_mux(100000 + pad*150000, pad, 600 + pad*250);
+    }
+    sim_hit_pin(100000 + NUM_PADS*150000, KICK_PIN, 2500);
+}
+
+static void scenario_drum_roll() {
+    roll(100000, 2000, 20, NUM_PADS, true);
+}
+
+static void scenario_mux_settle() {
+    // A faster front end than the default wait assumes, the snare channel being slower. The unused channels are wired to
+    // a reference level, without which the idle pads reading 0 have no transition to measure. Settling is measured, then
+    // every pad rolls.
+    for (int channel=0; channel<16; channel++) {
+        sim_set_mux_settle_tau(channel, (channel == 6) ? 6000 : 2000);
+    }
+    for (int channel=12; channel<16; channel++) {
+        sim_level_mux(0, channel, 3000);
+    }
+    sim_serial_input(20000, "u");
+    roll(300000, 2000, 20, NUM_PADS, true);
+}
+
+static void scenario_idle_sleep() {
+    // Same roll as drum_roll with the CPU sleeping between sample ticks, then the duty cycle is queried
+    sim_serial_input(20000, "s{\"idle_sleep\":true}");
+    sim_serial_input(90000, "t");
+    roll(100000, 2000, 20, NUM_PADS, true);
+    sim_serial_input(2300000, "t");
+}
+
+static void scenario_task_stats() {
+    // Every task kept busy during a roll: merged MIDI, the slot button and its LED blink, then the task timing is queried
+    static const uint8 downstream[] = {0x99, 38, 100, 38, 0};
+    for (int repeat=0; repeat<60; repeat++) {
+        sim_uart_input(100000 + repeat*30000, downstream, sizeof(downstream));
+    }
+    roll(100000, 2000, 20, NUM_PADS, true);
+    sim_serial_input(50000, "k");
+    sim_button(600000, 1, ace_button::AceButton::kEventClicked);
+    sim_button(1200000, 1, ace_button::AceButton::kEventClicked);
+    sim_serial_input(2300000, "k");
+}
+
+static void scenario_omni_roll() {
+    sim_serial_input(20000, "s{\"midi_channel_num\":0}");
+    roll(100000, 1000, 12, 6, true);
+}
+
+static void scenario_midi_saturation() {
+    // Omni mode fans every hit and pedal move out to 16 channels, far more than the UART can carry
+    sim_serial_input(20000, "s{\"midi_channel_num\":0,\"cc_ped_enabled\":true}");
+    for (int ms=0; ms<1200; ms++) {
+        int phase = ms % 400;
+        sim_level_pin(100000 + ms*1000, CC_PIN, (phase < 200) ? phase*20 : (400-phase)*20);
+    }
+    roll(100000, 1200, 16, 6, true);
+    sim_serial_input(1400000, "b");
+}
+
+static void scenario_config_push() {
+    static std::string command = full_config_command();
+    roll(100000, 2500, 16, 4, true);
+    sim_serial_input(50000, "m");
+    sim_serial_input(400000, "m");
+    sim_serial_input(500000, "g");
+    sim_serial_input(1000000, command.c_str());
+    sim_serial_input(2000000, "g");
+    sim_serial_input(2900000, "m");
+}
+
+static void scenario_bank_switch() {
+    // Long ringing hits, with the bank and slot changed while they are still sounding
+    for (int pad=0; pad<4; pad++) {
+        sim_hit_mux(100000 + pad*2000, pad, 3000, 30000);
+    }
+    sim_button(110000, 0, ace_button::AceButton::kEventClicked);
+    sim_hit_pin(300000, KICK_PIN, 3000, 30000);
+    sim_hit_mux(302000, 6, 3000, 30000);
+    sim_button(310000, 2, ace_button::AceButton::kEventClicked);
+    sim_button(600000, 1, ace_button::AceButton::kEventClicked);
+}
+
+static void scenario_cc_pedal() {
+    sim_serial_input(20000, "s{\"cc_ped_enabled\":true}");
+    for (int ms=0; ms<1500; ms++) {
+        int phase = ms % 1000;
+        sim_level_pin(100000 + ms*1000, CC_PIN, (phase < 500) ? phase*8 : (1000-phase)*8);
+    }
+    roll(100000, 1500, 16, 4, true);
+}
+
+static void scenario_edit_mode() {
+    sim_button(50000, 0, ace_button::AceButton::kEventDoubleClicked);
+    roll(100000, 1000, 16, NUM_PADS, true);
+    sim_button(600000, 1, ace_button::AceButton::kEventClicked);
+    sim_button(1200000, 3, ace_button::AceButton::kEventClicked);
+}
+
+static void scenario_trigger_tuning() {
+    // Pad 1 is muted by a threshold above full scale, pad 2 gets a short window and area velocity, then the result is saved
+    sim_serial_input(300000, "p{\"sensor\":0,\"threshold_high\":4095,\"threshold_low\":4000}");
+    sim_serial_input(400000, "p{\"sensor\":1,\"window_us\":1000,\"cooldown_us\":4000,\"estimator\":1,\"sample_period\":250}");
+    sim_serial_input(500000, "p{\"sensor\":18,\"window_us\":1000}");
+    roll(100000, 1000, 16, 4, true);
+    sim_serial_input(1200000, "w");
+}
+
+static void scenario_preset_library() {
+    // 10 kits uploaded to the preset library, each changing pad 1 of the bank base kit, then paged through with the buttons
+    for (int kit=0; kit<10; kit++) {
+        std::string command = "a{\"notes\":[" + std::to_string(60 + kit) + ",41,36,41,43,47,38,47,49,46,42,51,0,0,0,0,36,4]}";
+        static std::string commands[10];
+        commands[kit] = command;
+        sim_serial_input(20000 + kit*20000, commands[kit].c_str());
+    }
+    sim_serial_input(250000, "l");
+    for (int press=0; press<5; press++) {
+        sim_button(300000 + press*100000, 0, ace_button::AceButton::kEventClicked);
+        sim_hit_mux(350000 + press*100000, 0, 2000);
+    }
+    sim_button(820000, 3, ace_button::AceButton::kEventClicked);
+    sim_hit_mux(850000, 0, 2000);
+}
+
+static void scenario_velocity_learn() {
+    // Pad 3 only reaches a third of the full scale. Its velocity table is learnt from 12 hits, softest to hardest, then it is
+    // played next to pad 4, which keeps its velocity curve, and the table is queried
+    sim_button(50000, 4, ace_button::AceButton::kEventLongPressed);
+    sim_hit_mux(100000, 2, 1500);
+    for (int hit=0; hit<12; hit++) {
+        sim_hit_mux(200000 + hit*60000, 2, 400 + hit*100);
+    }
+    sim_button(1000000, 1, ace_button::AceButton::kEventClicked);
+    sim_button(1050000, 3, ace_button::AceButton::kEventClicked);
+    sim_serial_input(1100000, "v");
+    static const int PEAKS[] = {500, 900, 1400};
+    for (int hit=0; hit<3; hit++) {
+        sim_hit_mux(1200000 + hit*100000, 2, PEAKS[hit]);
+        sim_hit_mux(1250000 + hit*100000, 3, PEAKS[hit]);
+    }
+}
+
+static void scenario_diagnostics() {
+    // Pad 1 clips, the others are hit at increasing strength, then the statistics are queried
+    sim_set_noise(24);
+    for (int hit=0; hit<8; hit++) {
+        sim_hit_mux(100000 + hit*100000, 0, 6000);
+        sim_hit_mux(150000 + hit*100000, 1 + (hit % 4), 300 + hit*400);
+    }
+    sim_hit_pin(950000, KICK_PIN, 2500);
+    sim_serial_input(1000000, "d");
+}
+
+static void scenario_extra_pads() {
+    // Mux channels 13 to 16 enabled as pads from the sensor table, mapped, then rolled with the 12 original pads
+    static std::string commands[4];
+    for (int i=0; i<4; i++) {
+        commands[i] = "p{\"sensor\":" + std::to_string(NUM_PADS + i) + ",\"type\":1}";
+        sim_serial_input(20000 + i*10000, commands[i].c_str());
+    }
+    sim_serial_input(70000, "s{\"mapping_bank\":[[[43,41,36,41,43,47,38,47,49,46,42,51,55,57,52,53,36,4]]]}");
+    roll(100000, 1500, 16, NUM_PADS + 4, true);
+    sim_serial_input(1700000, "d");
+}
+
+static void scenario_midi_merge() {
+    // A downstream unit plays on channel 10 with running status, a clock tick lands in the middle of a message and
+    // a system exclusive message is skipped, while 4 local pads and the kick roll
+    static const uint8 downstream[] = {
+        0x99, 38, 100, 42, 80, 38, 0, 42, 0,
+        0x99, 36, 0xF8, 90, 36, 0,
+        0xF0, 0x7E, 0x7F, 0x09, 0x01, 0xF7,
+        0xB9, 4, 64
+    };
+    for (int repeat=0; repeat<40; repeat++) {
+        sim_uart_input(100000 + repeat*30000, downstream, sizeof(downstream));
+    }
+    roll(100000, 1200, 16, 4, true);
+    sim_serial_input(1400000, "t");
+}
+
+static void scenario_program_change() {
+    // Kits switched by the host while long hits are still ringing: slot 2 over USB, then bank 1 slot 0 from a
+    // MIDI interface on the UART input. A Program Change on another channel is ignored.
+    static const uint8 bank_select[] = {0xB0, 0, 1, 0xC0, 0};
+    for (int step=0; step<4; step++) {
+        for (int pad=0; pad<4; pad++) {
+            sim_hit_mux(100000 + step*200000 + pad*2000, pad, 3000, 30000);
+        }
+    }
+    sim_usb_midi_input(110000, 0xC0, 2);
+    sim_uart_input(310000, bank_select, sizeof(bank_select));
+    sim_usb_midi_input(510000, 0xC5, 3);
+}
+
+/// @brief Single hits of varied strength, at varied times within the sampling period
+static void varied_hits() {
+    static const int PEAKS[] = {500, 3800, 900, 2200, 600, 3000};
+    for (int hit=0; hit<24; hit++) {
+        uint64 time_us = 100000 + hit*40000 + (hit*7919 % 1000);
+        sim_hit_mux(time_us, hit % NUM_PADS, PEAKS[hit % 6]);
+    }
+}
+
+static void scenario_varied_hits() {
+    varied_hits();
+}
+
+static void scenario_constant_latency() {
+    sim_serial_input(20000, "s{\"output_delay_us\":3000}");
+    varied_hits();
+    sim_serial_input(1100000, "t");
+}
+
+static void scenario_delay_overflow() {
+    // At 20 ms of delay a fast pedal sweep and every pad hit at once fill the delay line: pedal values are dropped first,
+    // and notes are sent early in order rather than released ahead of their trigger
+    sim_serial_input(20000, "s{\"output_delay_us\":20000,\"cc_ped_enabled\":true}");
+    for (int step=0; step<4000; step++) {
+        int phase = step % 20;
+        sim_level_pin(100000 + step*250, CC_PIN, (phase < 10) ? phase*400 : (20-phase)*400);
+    }
+    for (int n=0; n<20; n++) {
+        for (int pad=0; pad<NUM_PADS; pad++) {
+            sim_hit_mux(100000 + n*50000 + pad*100, pad, hit_peak(pad, n));
+        }
+    }
+    sim_serial_input(1300000, "t");
+}
+
+static void scenario_load_test() {
+    sim_serial_input(20000, "h{\"pattern\":1,\"rate_hz\":20,\"duration_ms\":600}");
+    sim_serial_input(800000, "h{\"pattern\":2,\"pads\":1023,\"rate_hz\":25,\"rise_us\":300,\"decay_us\":1500,\"duration_ms\":600}");
+}
+
+static void scenario_sensor_fault() {
+    // Channel 5 shorted to the supply, channel 6 stuck above its thresholds, both fixed at 1.8 s
+    sim_level_mux(100000, 5, 4095);
+    sim_level_mux(100000, 6, 600);
+    sim_level_mux(1800000, 5, 0);
+    sim_level_mux(1800000, 6, 0);
+    roll(20000, 3000, 10, 4, true);
+    sim_serial_input(1500000, "d");
+    sim_serial_input(3300000, "d");
+}
+
+const Scenario SCENARIOS[] = {
+    {"idle", "No input, baseline loop timing", 1000, scenario_idle},
+    {"single_hits", "Every pad and the kick hit once, one after another", 2200, scenario_single_hits},
+    {"drum_roll", "Every pad and the kick rolling at 20 Hz for 2 s", 2500, scenario_drum_roll},
+    {"mux_settle", "Multiplexer settling measured over serial, then every pad and the kick rolling", 2500, scenario_mux_settle},
+    {"idle_sleep", "Every pad and the kick rolling with idle sleep, then the duty cycle queried over serial", 2500, scenario_idle_sleep},
+    {"task_stats", "Every task busy during a roll, then the deadline misses and lateness of each task queried over serial", 2500, scenario_task_stats},
+    {"omni_roll", "Omni mode pushed over serial, then 6 pads and kick rolling", 1500, scenario_omni_roll},
+    {"midi_saturation", "Omni mode with the CC pedal sweeping during a roll, then the MIDI output statistics queried", 1500, scenario_midi_saturation},
+    {"config_push", "Config read and written over serial in the middle of a roll", 3000, scenario_config_push},
+    {"bank_switch", "Bank and slot switched while hits are still sounding", 1000, scenario_bank_switch},
+    {"cc_pedal", "CC pedal sweeping while 4 pads and the kick roll", 2000, scenario_cc_pedal},
+    {"edit_mode", "Playing every pad while in edit bank mode", 1500, scenario_edit_mode},
+    {"preset_library", "Kits uploaded to the preset library and selected with the bank button", 1000, scenario_preset_library},
+    {"velocity_learn", "Velocity table of a weak pad learnt with the buttons, then played next to a pad using its curve", 1600, scenario_velocity_learn},
+    {"diagnostics", "Clipping and varied hits, then the signal diagnostics queried over serial", 1100, scenario_diagnostics},
+    {"extra_pads", "Unused mux channels enabled as pads over serial, then every pad and the kick rolling", 1800, scenario_extra_pads},
+    {"midi_merge", "MIDI from a downstream unit merged into the outputs while 4 pads and the kick roll", 1500, scenario_midi_merge},
+    {"program_change", "Bank and slot switched by Program Change and Bank Select while hits are still sounding", 1000, scenario_program_change},
+    {"varied_hits", "Single hits of varied strength sent as soon as detected", 1200, scenario_varied_hits},
+    {"constant_latency", "Same hits with the constant latency mode at 3 ms", 1200, scenario_constant_latency},
+    {"trigger_tuning", "Trigger parameters of single pads edited over serial during a roll", 1500, scenario_trigger_tuning},
+    {"sensor_fault", "A shorted and a stuck pad excluded from the scan during a roll, then put back once fixed", 3500, scenario_sensor_fault},
+    {"delay_overflow", "Constant latency mode at 20 ms with the delay line overflowing, then the delay counters queried", 1400, scenario_delay_overflow},
+    {"load_test", "Synthetic hits on every pad at once, then random hits at 25 Hz on 10 pads, reported over serial", 1600, scenario_load_test},
+};
+const int NUM_SCENARIOS = sizeof(SCENARIOS)/sizeof(SCENARIOS[0]);
+
+// ===== Fuzzing =====
+
+// Mutated 's', 'p' and 'a' commands sent one after another during a roll. Like the device, each text is cut at its first
+// '}', so that what follows is never run as other commands. Every text must get exactly one S or E answer, and whatever
+// was accepted must leave the configuration and the MIDI output in range.
+
+struct FuzzInput {
+    uint64 time_us;
+    std::string text;
+};
+
+static std::vector<FuzzInput> fuzz_inputs;
+/// @brief Time after the answer to the last input, in microseconds
+static uint64 fuzz_end_us;
+static uint32 fuzz_state;
+
+/// @brief Repeatable pseudo random number from 0 to range-1 (xorshift32)
+static uint32 fuzz_random(uint32 range) {
+    fuzz_state ^= fuzz_state << 13;
+    fuzz_state ^= fuzz_state >> 17;
+    fuzz_state ^= fuzz_state << 5;
+    return fuzz_state % range;
+}
+
+/// @brief Valid commands the inputs are mutated from
+static std::vector<std::string> fuzz_seeds() {
+    std::vector<std::string> seeds;
+    seeds.push_back(full_config_command());
+    seeds.push_back("s{\"midi_channel_num\":3,\"vel_map_profile\":2,\"kick_vel_map_profile\":0,\"cc_ped_enabled\":true}");
+    seeds.push_back("s{\"mux_settle_us\":[50,60,70,80],\"output_delay_us\":1000,\"idle_sleep\":false}");
+    seeds.push_back("s{\"trigger_params\":[[60,30,500,4000,10000,0,0,4,1],[80,40,250,1000,4000,2,1,2,1]]}");
+    seeds.push_back("p{\"sensor\":6,\"threshold_high\":60,\"window_us\":1000,\"curve\":2}");
+    seeds.push_back("p{\"sensor\":12,\"type\":1}");
+    seeds.push_back("a{\"notes\":[43,41,36,41,43,47,38,47,49,46,42,51,0,0,0,0,36,4]}");
+    return seeds;
+}
+
+/// @brief Fragments aimed at the limits of the reader
+static const char *const FUZZ_FRAGMENTS[] = {
+    "[[[[", "]]]]", "[]", "99999999999", "-", "-0", "true", "fals", "\"\"", "\"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\"", ",,", ":",
+    "\\", " \r\n\t", "{"
+};
+const int NUM_FUZZ_FRAGMENTS = sizeof(FUZZ_FRAGMENTS)/sizeof(FUZZ_FRAGMENTS[0]);
+/// @brief Numbers just out of the ranges of the values, or at their ends
+static const char *const FUZZ_NUMBERS[] = {"-1", "0", "1", "2", "3", "16", "17", "127", "128", "200", "255", "256", "4095", "4096", "20001", "65535", "65536", "99999"};
+const int NUM_FUZZ_NUMBERS = sizeof(FUZZ_NUMBERS)/sizeof(FUZZ_NUMBERS[0]);
+static const char FUZZ_STRUCTURE[] = "{}[]\",:-0123456789tf \n";
+
+/// @brief Apply 1 to 4 random mutations to a command, keeping its command character
+static std::string fuzz_mutate(std::string text) {
+    int mutations = 1 + fuzz_random(4);
+    for (int m=0; m<mutations; m++) {
+        size_t pos = 1 + fuzz_random(text.size());
+        switch (fuzz_random(7)) {
+            case 0:
+                if (pos < text.size()) {
+                    text[pos] = FUZZ_STRUCTURE[fuzz_random(sizeof(FUZZ_STRUCTURE)-1)];
+                }
+                break;
+            case 1:
+                if (pos < text.size()) {
+                    text[pos] = (char)(1 + fuzz_random(255));
+                }
+                break;
+            case 2:
+                text.insert(pos, FUZZ_FRAGMENTS[fuzz_random(NUM_FUZZ_FRAGMENTS)]);
+                break;
+            case 3:
+                text.erase(pos, 1 + fuzz_random(16));
+                break;
+            case 4: {
+                // Repeated range, for long texts, long arrays and deep nesting
+                std::string range = text.substr(pos, 1 + fuzz_random(64));
+                for (int repeat=fuzz_random(48); repeat>0; repeat--) {
+                    text.insert(pos, range);
+                }
+                break;
+            }
+            case 5:
+                text.resize(pos);
+                break;
+            case 6: {
+                // Next number or literal replaced, the text stays valid JSON
+                size_t start = text.find_first_of("0123456789tf", pos);
+                if (start != std::string::npos) {
+                    size_t end = text.find_first_of(",]}", start);
+                    text.replace(start, (end == std::string::npos) ? std::string::npos : end - start, FUZZ_NUMBERS[fuzz_random(NUM_FUZZ_NUMBERS)]);
+                }
+                break;
+            }
+        }
+    }
+    return text;
+}
+
+static void fuzz_generate(const Options &options) {
+    std::vector<std::string> seeds = fuzz_seeds();
+    fuzz_state = (options.seed == 0) ? 1 : options.seed;
+    uint64 time_us = 100000;
+    for (uint32 i=0; i<options.fuzz_inputs; i++) {
+        FuzzInput input;
+        input.time_us = time_us;
+        input.text = fuzz_mutate(seeds[fuzz_random(seeds.size())]);
+        size_t end = input.text.find('}', 1);
+        if (end != std::string::npos) {
+            input.text.resize(end + 1);
+        }
+        // Room for the text at 64 bytes per ms and its answer, or for the receive timeout of the device
+        time_us += 100000 + (input.text.size()/64)*1000 + ((end == std::string::npos) ? 1000000 : 0);
+        fuzz_inputs.push_back(input);
+    }
+    fuzz_end_us = time_us;
+}
+
+static void scenario_fuzz() {
+    for (size_t i=0; i<fuzz_inputs.size(); i++) {
+        sim_serial_input(fuzz_inputs[i].time_us, fuzz_inputs[i].text.c_str());
+    }
+    sim_serial_input(fuzz_end_us, "g");
+    roll(100000, (fuzz_end_us - 100000)/1000, 8, 4, true);
+}
+
+/// @brief Check a value of the configuration sent by the 'g' command against the ranges the firmware relies on
+static bool fuzz_config_value(const char *key, const int *indices, int depth, int32_t value, void *context) {
+    std::string name = key;
+    if ((name == "uart_midi_enabled") || (name == "cc_ped_enabled") || (name == "kick_ped_enabled") || (name == "idle_sleep")) {
+        return (value == 0) || (value == 1);
+    }
+    if (name == "midi_channel_num") {
+        return (value >= 0) && (value <= 16);
+    }
+    if ((name == "vel_map_profile") || (name == "kick_vel_map_profile")) {
+        return (value >= 0) && (value <= 2);
+    }
+    if (name == "mapping_bank") {
+        return (value >= 0) && (value <= 127);
+    }
+    if (name == "trigger_params") {
+        return (indices[0] < NUM_SENSORS) && (value >= 0) && (value <= 65535);
+    }
+    if (name == "mux_settle_us") {
+        return (value >= 4) && (value <= 200);
+    }
+    return name == "output_delay_us";
+}
+
+static bool fuzz_any_value(const char *key, const int *indices, int depth, int32_t value, void *context) {
+    return true;
+}
+
+/// @brief Worst host time taken by the reader per byte of any input, in nanoseconds. The virtual clock doesn't count
+/// parsing, so it is measured apart, keeping the fastest of a few repetitions of each input to leave out the host noise.
+static double fuzz_parse_ns_per_byte() {
+    const int REPETITIONS = 20;
+    double worst = 0;
+    for (size_t i=0; i<fuzz_inputs.size(); i++) {
+        const std::string &text = fuzz_inputs[i].text;
+        std::chrono::steady_clock::duration fastest = std::chrono::hours(1);
+        for (int r=0; r<REPETITIONS; r++) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            json_read(text.c_str() + 1, text.size() - 1, fuzz_any_value, 0);
+            fastest = std::min(fastest, std::chrono::steady_clock::now() - start);
+        }
+        worst = std::max(worst, std::chrono::duration<double, std::nano>(fastest).count()/text.size());
+    }
+    return worst;
+}
+
+/// @brief Check the answers, the final configuration and the MIDI output of a fuzz run
+/// @return Number of violations found
+static int report_fuzz() {
+    const std::string &output = sim_serial_output();
+    uint32 accepted = 0;
+    uint32 rejected = 0;
+    std::string config;
+    size_t start = 0;
+    while (start < output.size()) {
+        size_t end = output.find('\n', start);
+        if (end == std::string::npos) {
+            end = output.size();
+        }
+        std::string line = output.substr(start, end - start);
+        if (!line.empty() && (line[line.size()-1] == '\r')) {
+            line.resize(line.size()-1);
+        }
+        accepted += (line == "S");
+        rejected += (line == "E");
+        if (line.compare(0, 21, "{\"uart_midi_enabled\":") == 0) {
+            config = line;
+        }
+        start = end + 1;
+    }
+
+    size_t longest = 0;
+    uint32 unterminated = 0;
+    for (size_t i=0; i<fuzz_inputs.size(); i++) {
+        longest = std::max(longest, fuzz_inputs[i].text.size());
+        unterminated += (fuzz_inputs[i].text[fuzz_inputs[i].text.size()-1] != '}');
+    }
+    printf("  fuzz inputs %zu, longest %zu bytes, %u without '}': %u accepted, %u rejected\n", fuzz_inputs.size(), longest,
+        unterminated, accepted, rejected);
+    printf("  json reader state %zu bytes, worst %.1f ns per byte on the host\n", sizeof(JsonReader), fuzz_parse_ns_per_byte());
+
+    int violations = 0;
+    if (accepted + rejected != fuzz_inputs.size()) {
+        printf("  VIOLATION: %u answers to %zu inputs\n", accepted + rejected, fuzz_inputs.size());
+        violations++;
+    }
+    if (config.empty() || (json_read(config.c_str(), config.size(), fuzz_config_value, 0) != JSON_OK)) {
+        printf("  VIOLATION: configuration out of range: %s\n", config.c_str());
+        violations++;
+    }
+    const std::vector<SimMidiEvent> &events = sim_midi_events();
+    for (size_t i=0; i<events.size(); i++) {
+        uint8 type = events[i].status & 0xF0;
+        bool known = (type == 0x80) || (type == 0x90) || (type == 0xB0) || (type == 0xC0);
+        if (!known || (events[i].data1 > 127) || (events[i].data2 > 127)) {
+            printf("  VIOLATION: midi %02x %d %d at %.3f ms\n", events[i].status, events[i].data1, events[i].data2, events[i].time_ns/1e6);
+            violations++;
+        }
+    }
+    printf("  violations: %d\n", violations);
+    return violations;
+}
+
+// ===== Reporting =====
+
+static const char *midi_type_name(uint8 status) {
+    switch (status & 0xF0) {
+        case 0x80: return "note_off";
+        case 0x90: return "note_on";
+        case 0xB0: return "cc";
+        case 0xC0: return "program";
+        default: return "other";
+    }
+}
+
+static uint32 percentile(const uint32 *histogram, uint64 total, double fraction) {
+    uint64 target = (uint64)(total * fraction);
+    uint64 count = 0;
+    for (uint32 i=0; i<=LOOP_HISTOGRAM_SIZE; i++) {
+        count += histogram[i];
+        if (count > target) {
+            return i;
+        }
+    }
+    return LOOP_HISTOGRAM_SIZE;
+}
+
+/// @brief Count notes left on at the end of the scenario, for one transport
+static int report_stuck_notes(uint8 transport, const char *name) {
+    bool note_on[16][128] = {};
+    const std::vector<SimMidiEvent> &events = sim_midi_events();
+    for (size_t i=0; i<events.size(); i++) {
+        if (events[i].transport != transport) {
+            continue;
+        }
+        uint8 type = events[i].status & 0xF0;
+        uint8 channel = events[i].status & 0x0F;
+        if ((type == 0x90) && (events[i].data2 > 0)) {
+            note_on[channel][events[i].data1] = true;
+        }
+        else if ((type == 0x80) || (type == 0x90)) {
+            note_on[channel][events[i].data1] = false;
+        }
+    }
+
+    int stuck = 0;
+    for (int channel=0; channel<16; channel++) {
+        for (int note=0; note<128; note++) {
+            if (note_on[channel][note]) {
+                if (stuck == 0) {
+                    printf("  stuck notes %s:", name);
+                }
+                printf(" ch%d/%d", channel+1, note);
+                stuck++;
+            }
+        }
+    }
+    if (stuck != 0) {
+        printf("\n");
+    }
+    return stuck;
+}
+
+/// @brief Latency from every hit to its USB note on, matched in time order. Only meaningful when every hit gives exactly
+/// one note on, so nothing is printed otherwise.
+static void report_hit_latency() {
+    std::vector<uint64> hits = sim_hit_times();
+    std::vector<uint64> notes;
+    const std::vector<SimMidiEvent> &events = sim_midi_events();
+    for (size_t i=0; i<events.size(); i++) {
+        if ((events[i].transport == SIM_TRANSPORT_USB) && ((events[i].status & 0xF0) == 0x90) && (events[i].data2 > 0)) {
+            notes.push_back(events[i].time_ns);
+        }
+    }
+    if (hits.empty() || (hits.size() != notes.size())) {
+        return;
+    }
+
+    std::sort(hits.begin(), hits.end());
+    std::sort(notes.begin(), notes.end());
+    int64_t min_ns = INT64_MAX;
+    int64_t max_ns = INT64_MIN;
+    int64_t total_ns = 0;
+    for (size_t i=0; i<hits.size(); i++) {
+        int64_t latency = (int64_t)(notes[i] - hits[i]);
+        min_ns = std::min(min_ns, latency);
+        max_ns = std::max(max_ns, latency);
+        total_ns += latency;
+    }
+    printf("  hit to usb note_on us: min %.1f mean %.1f max %.1f spread %.1f\n", min_ns/1e3, total_ns/1e3/hits.size(), max_ns/1e3, (max_ns-min_ns)/1e3);
+}
+
+static int run_scenario(const Scenario &scenario, const Options &options) {
+    static uint32 histogram[LOOP_HISTOGRAM_SIZE+1];
+    uint64 loops = 0;
+    uint64 total_ns = 0;
+    uint64 max_ns = 0;
+
+    sim_set_deadline_us(options.deadline_us);
+    scenario.build();
+
+    setup();
+    sim_reset_sensor_stats();
+    uint64 setup_ns = sim_now_ns();
+    uint64 end_ns = setup_ns + (uint64)scenario.duration_ms * 1000000;
+
+    while (sim_now_ns() < end_ns) {
+        uint64 start_ns = sim_now_ns();
+        loop();
+        sim_advance_ns(SIM_LOOP_OVERHEAD_NS);
+        uint64 loop_ns = sim_now_ns() - start_ns;
+
+        uint32 bin = loop_ns / 1000;
+        histogram[(bin < LOOP_HISTOGRAM_SIZE) ? bin : LOOP_HISTOGRAM_SIZE]++;
+        total_ns += loop_ns;
+        if (loop_ns > max_ns) {
+            max_ns = loop_ns;
+        }
+        loops++;
+    }
+
+    printf("== %s: %s\n", scenario.name, scenario.description);
+    printf("  virtual time %.1f ms (setup %.1f ms), %llu loop iterations\n", (end_ns)/1e6, setup_ns/1e6, (unsigned long long)loops);
+    printf("  loop us: mean %.1f p50 %u p90 %u p99 %u p99.9 %u max %.1f\n", total_ns/1e3/loops,
+        percentile(histogram, loops, 0.5), percentile(histogram, loops, 0.9), percentile(histogram, loops, 0.99),
+        percentile(histogram, loops, 0.999), max_ns/1e3);
+
+    const uint32 BUCKETS[] = {10, 50, 100, 500, 1000, 2000, 5000};
+    const int NUM_BUCKETS = sizeof(BUCKETS)/sizeof(BUCKETS[0]);
+    printf("  loop histogram:");
+    uint32 lower = 0;
+    for (int b=0; b<=NUM_BUCKETS; b++) {
+        uint32 upper = (b < NUM_BUCKETS) ? BUCKETS[b] : LOOP_HISTOGRAM_SIZE+1;
+        uint64 count = 0;
+        for (uint32 i=lower; (i<upper) && (i<=LOOP_HISTOGRAM_SIZE); i++) {
+            count += histogram[i];
+        }
+        if (b < NUM_BUCKETS) {
+            printf(" <%u:%llu", upper, (unsigned long long)count);
+        }
+        else {
+            printf(" >=%u:%llu", lower, (unsigned long long)count);
+        }
+        lower = upper;
+    }
+    printf("\n");
+
+    uint32 missed = 0;
+    uint64 worst_gap_ns = 0;
+    int worst_sensor = -1;
+    for (int sensor=0; sensor<SIM_MUX_CHANNELS + BOARD_NR_GPIO_PINS; sensor++) {
+        const SimSensorStats &stats = sim_sensor_stats(sensor);
+        missed += stats.missed_deadlines;
+        if (stats.max_gap_ns > worst_gap_ns) {
+            worst_gap_ns = stats.max_gap_ns;
+            worst_sensor = sensor;
+        }
+    }
+    printf("  sample deadline %u us: %u missed, worst gap %.1f us on ", options.deadline_us, missed, worst_gap_ns/1e3);
+    if (worst_sensor < SIM_MUX_CHANNELS) {
+        printf("mux channel %d\n", worst_sensor);
+    }
+    else {
+        printf("pin %d\n", worst_sensor - SIM_MUX_CHANNELS);
+    }
+
+    uint32 counts[2][3] = {};
+    const std::vector<SimMidiEvent> &events = sim_midi_events();
+    for (size_t i=0; i<events.size(); i++) {
+        uint8 type = events[i].status & 0xF0;
+        int kind = (type == 0x90) ? 0 : ((type == 0x80) ? 1 : 2);
+        counts[events[i].transport][kind]++;
+        if (options.midi_log) {
+            printf("  midi %12.3f ms %-4s %-8s ch%-2d %3d %3d\n", events[i].time_ns/1e6,
+                (events[i].transport == SIM_TRANSPORT_USB) ? "usb" : "uart", midi_type_name(events[i].status),
+                (events[i].status & 0x0F) + 1, events[i].data1, events[i].data2);
+        }
+    }
+    printf("  hits %u, usb note_on %u note_off %u other %u, uart note_on %u note_off %u other %u\n", sim_hit_count(),
+        counts[0][0], counts[0][1], counts[0][2], counts[1][0], counts[1][1], counts[1][2]);
+    report_hit_latency();
+    if (sim_eeprom_transfers() != 0) {
+        printf("  eeprom page transfers: %u\n", sim_eeprom_transfers());
+    }
+
+    int stuck = report_stuck_notes(SIM_TRANSPORT_USB, "usb") + report_stuck_notes(SIM_TRANSPORT_UART, "uart");
+    printf("  stuck notes: %d\n", stuck);
+
+    if (options.serial_log) {
+        printf("  serial output:\n%s\n", sim_serial_output().c_str());
+    }
+
+    if (options.fuzz_inputs != 0) {
+        return (report_fuzz() != 0) ? 1 : 0;
+    }
+    return (options.strict && (stuck != 0)) ? 1 : 0;
+}
+
+static void usage(const char *program) {
+    printf("Usage: %s [--scenario NAME]... [--midi-log] [--serial-log] [--deadline-us N] [--strict] [--fuzz N [--seed S]] [--list]\n", program);
+    printf("  --scenario NAME   Run only the named scenario, can be repeated. Default: every scenario\n");
+    printf("  --midi-log        Print every MIDI message with its virtual timestamp\n");
+    printf("  --serial-log      Print everything written to the USB serial port\n");
+    printf("  --deadline-us N   Gap between two readings of a sensor counted as a missed deadline (default 2000)\n");
+    printf("  --strict          Exit with status 1 if any scenario leaves stuck notes\n");
+    printf("  --fuzz N          Send N mutated s, p and a commands during a roll instead of the scenarios, exit with status 1\n");
+    printf("                    if any gets no single S or E answer or leaves the configuration or MIDI output out of range\n");
+    printf("  --seed S          Seed of the mutations (default 1)\n");
+    printf("  --list            List the scenarios\n");
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    std::vector<int> selected;
+
+    for (int i=1; i<argc; i++) {
+        std::string arg = argv[i];
+        if ((arg == "--scenario") && (i+1 < argc)) {
+            std::string name = argv[++i];
+            int found = -1;
+            for (int s=0; s<NUM_SCENARIOS; s++) {
+                if (name == SCENARIOS[s].name) {
+                    found = s;
+                }
+            }
+            if (found < 0) {
+                fprintf(stderr, "Unknown scenario %s\n", name.c_str());
+                return 2;
+            }
+            selected.push_back(found);
+        }
+        else if (arg == "--midi-log") {
+            options.midi_log = true;
+        }
+        else if (arg == "--serial-log") {
+            options.serial_log = true;
+        }
+        else if ((arg == "--deadline-us") && (i+1 < argc)) {
+            options.deadline_us = atoi(argv[++i]);
+        }
+        else if (arg == "--strict") {
+            options.strict = true;
+        }
+        else if ((arg == "--fuzz") && (i+1 < argc)) {
+            options.fuzz_inputs = atoi(argv[++i]);
+        }
+        else if ((arg == "--seed") && (i+1 < argc)) {
+            options.seed = strtoul(argv[++i], 0, 0);
+        }
+        else if (arg == "--list") {
+            for (int s=0; s<NUM_SCENARIOS; s++) {
+                printf("%-12s %s\n", SCENARIOS[s].name, SCENARIOS[s].description);
+            }
+            return 0;
+        }
+        else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (options.fuzz_inputs != 0) {
+        fuzz_generate(options);
+        Scenario fuzz = {"fuzz", "Mutated configuration commands sent over serial during a roll", (uint32)(fuzz_end_us/1000 + 300), scenario_fuzz};
+        return run_scenario(fuzz, options);
+    }
+
+    if (selected.empty()) {
+        for (int s=0; s<NUM_SCENARIOS; s++) {
+            selected.push_back(s);
+        }
+    }
+
+    int status = 0;
+    for (size_t i=0; i<selected.size(); i++) {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            int result = run_scenario(SCENARIOS[selected[i]], options);
+            fflush(stdout);
+            _exit(result);
+        }
+        int child_status = 0;
+        waitpid(pid, &child_status, 0);
+        if (!WIFEXITED(child_status) || (WEXITSTATUS(child_status) != 0)) {
+            status = 1;
+        }
+    }
+    return status;
+}
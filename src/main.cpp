@@ -2,14 +2,24 @@
 #include <USBComposite.h>
 #include <MIDI.h>
 #include <AceButton.h>
-#include <ArduinoJson.h>
-#include <limits>
 
-#include <pad.hpp>
-#include <ccontroller.hpp>
+#include <pad-bank.hpp>
 #include <midi-util.hpp>
 #include <led-indicator.hpp>
 #include <EEPROM-util.hpp>
+#include <event-queue.hpp>
+#include <delay-line.hpp>
+#include <json-reader.hpp>
+#include <memory-util.hpp>
+#include <preset-library.hpp>
+#include <midi-input.hpp>
+#include <midi-scheduler.hpp>
+#include <idle-sleep.hpp>
+#include <hot-path.hpp>
+#include <task-scheduler.hpp>
+#include <velocity-table.hpp>
+#include <flash-records.hpp>
+#include <load-generator.hpp>
 
 USBMIDI CompositeMIDI;
 USBCompositeSerial CompositeSerial;
@@ -23,19 +33,81 @@ const int PADS_THRESH_HIGH = 100;
 const int PADS_THRESH_LOW = 70;
 const int SNARE_THRESH_HIGH = 50;
 const int SNARE_THRESH_LOW = 70;
-const int PADS_SAMPLING_PERIOD = 470;
+const int PADS_SAMPLING_PERIOD = 235; // Sampling period of pads in burst mode, from the rise of a hit to its trigger
+const int PADS_IDLE_SAMPLING_PERIOD = 470; // Sampling period of pads that are not being hit
+const int PADS_WINDOW_TIME = 4700; // Moving average, PADS_BUFFER_SIZE samples at PADS_IDLE_SAMPLING_PERIOD
+const int PADS_MIN_WINDOW_TIME = PADS_SAMPLING_PERIOD; // A single sample
+const int PADS_COOLDOWN_TIME = 15000;
+const int PADS_MIN_COOLDOWN_TIME = 1000; // Two idle samples
 
 const int SELECT_PINS[4] = {PB1, PB0, PA7, PA6};
 const int MUX_PADS_PIN = PA0;
-const int PADS_NOTE_NUM[12] = {43, 41, 36, 41, 43, 47, 38, 47, 49, 46, 42, 51};
 
 const int KICK_THRESH_HIGH = 100;
 const int KICK_THRESH_LOW = 70;
-const int KICK_PEDAL_PIN = PA1;
-const int KICK_NOTE_NUM = BASS_DRUM_GM2;
 
-const int CC_THRESH_CHANGE=1;
-const int CC_PEDAL_PIN = PA2;
+const int CC_THRESH_CHANGE = 41; // 1% of full scale
+const int CC_SAMPLING_PERIOD = 0; // Same as idle pads
+
+/// @brief Sensor ids 0-15 are the multiplexer channels, the next ids are the analog pins wired directly
+const int NUM_MUX_SENSORS = 16;
+const int NUM_DIRECT_SENSORS = 2;
+const int DIRECT_SENSOR_PINS[NUM_DIRECT_SENSORS] = {PA1, PA2}; // Kick pedal and CC pedal jacks
+const int NUM_SENSORS = NUM_MUX_SENSORS + NUM_DIRECT_SENSORS;
+
+/// @brief Sensor types of the sensor table
+const int SENSOR_NONE = 0;
+const int SENSOR_PAD = 1;
+const int SENSOR_PEDAL = 2; // Trigger pedal, uses the kick velocity curve and is enabled by f_kick_ped_enabled
+const int SENSOR_CC = 3; // Continuous controller pedal, enabled by f_cc_ped_enabled
+const int SENSOR_SWITCH = 4; // On/off pedal or button, sends CC 127/0
+
+const int EVENT_QUEUE_SIZE = 32;
+const int MIDI_MERGE_MAX_BYTES = 32; // Bytes merged per loop, bounds the time spent forwarding a burst
+const int MIDI_CONTROL_MAX_PACKETS = 16; // USB MIDI packets read per loop
+const uint8 MIDI_CC_BANK_SELECT = 0;
+const uint32 MIDI_BYTE_MICROS = 320; // 10 bits at 31250 baud
+const uint16 USB_MIDI_BYTES_PER_MS = 64; // One 64 byte packet per full speed frame
+const uint16 USB_MIDI_BUFFER_SIZE = 64;
+const uint16 USB_SERIAL_BYTES_PER_MS = 64; // One 64 byte packet per full speed frame
+const uint16 USB_SERIAL_BUFFER_SIZE = 256; // Transmit buffer of the USB serial port, writing more blocks
+const uint16 SERIAL_REPLY_PART_MAX = 96; // Longest part of a reply sent by a run of the serial task, in bytes
+const uint16 MAX_OUTPUT_DELAY = 20000; // Longest delay of the constant latency mode in microseconds
+const uint8 MUX_SETTLE_DEFAULT = 50; // Multiplexer settling time in microseconds until measured
+const uint8 MAX_MUX_SETTLE_TIME = 200; // Longest settling time measured and accepted, in microseconds
+const uint16 MUX_SETTLE_TOLERANCE = 8; // A channel is settled once its reading stays within this many LSB of the settled reading
+const uint8 MUX_SETTLE_MARGIN = 4; // Added to the measured settling time, in microseconds
+const uint8 MIN_MUX_SETTLE_TIME = MUX_SETTLE_MARGIN; // Shortest settling time accepted, a read right after the switch still sees the previous channel
+const int IDLE_SLEEP_TIMER = 4; // General purpose timer used to wake up from idle sleep
+const int LED_TIMER = 3; // General purpose timer playing the LED blinks
+const uint32 IDLE_WAKE_MARGIN = 5; // Wake up this many microseconds before the next sample is due
+const uint32 MCU_RUN_CURRENT_UA = 36000; // Typical supply current of the STM32F103 at 72 MHz with the peripherals enabled, from the datasheet
+const uint32 MCU_SLEEP_CURRENT_UA = 14400; // Same in sleep mode
+const uint32 OUTPUT_DELAY_LATE_MICROS = 100; // Events sent later than this after their due time, sending included, are counted as late
+const uint32 JSON_RECV_MAX_LENGTH = 2559; // Longest JSON text accepted by the 's', 'p' and 'a' commands
+const int JSON_RECV_MAX_BYTES = 64; // Bytes of JSON text read per run of the serial task, bounds the time spent parsing
+const uint32 JSON_RECV_TIMEOUT = 1000000; // The whole JSON text must arrive within this many microseconds of the command
+const int VELOCITY_LEARN_MIN_HITS = 8; // Hits needed to build a velocity table
+const int VELOCITY_LEARN_MAX_HITS = 64; // Hits recorded per sensor in velocity learn mode, the next ones are ignored
+const uint32 LOAD_TEST_MAX_DURATION = 60000; // Longest load test accepted by the 'h' command, in milliseconds
+const uint16 LOAD_TEST_MAX_RATE = 1000; // Highest hit rate per pad accepted by the 'h' command, in hertz
+const uint32 SENSOR_FAULT_FLASH_PERIOD = 2000; // The LED flashes this often while a sensor is excluded, in milliseconds
+const int SENSOR_HEALTH_LOG_SIZE = 8; // Health changes kept for the 'd' command
+
+const int NUM_TASKS = 8;
+const uint8 TASK_PRIORITY_ACQUISITION = 0; // Sensor sampling, ahead of every other task
+const uint8 TASK_PRIORITY_OUTPUT = 1; // Sending the detected events
+const uint8 TASK_PRIORITY_MIDI_INPUT = 2; // MIDI merge and Program Change
+const uint8 TASK_PRIORITY_UI = 3; // Buttons and serial commands, deferred while any other task is ready
+const uint32 MIDI_OUTPUT_RETRY_PERIOD = 100; // Period of the output task while messages wait for bandwidth, in microseconds
+const uint32 MIDI_MERGE_PERIOD = 1000; // 3 bytes at 31250 baud, the receive buffer holds 64
+const uint32 MIDI_CONTROL_PERIOD = 1000; // One USB frame
+const uint32 BUTTON_PERIOD = 5000;
+const uint32 SERIAL_COMMAND_PERIOD = 1000;
+const uint32 SENSOR_HEALTH_PERIOD = 100000;
+const uint32 OUTPUT_DEADLINE = 1000; // Deadlines of the tasks from their release, in microseconds
+const uint32 MIDI_INPUT_DEADLINE = 2000;
+const uint32 UI_DEADLINE = 20000;
 
 const int NUM_BUTTONS = 5;
 const int BUTTON1_PIN = PB5;
@@ -50,17 +122,26 @@ const int LED_BLUE_PIN = PA15;
 const int LED_BLINK_FAST_PERIOD = 100;
 const int LED_BLINK_SLOW_PERIOD = 200;
 const int LED_BLINK_VSLOW_PERIOD = 1000;
-const int LED_SLOT_COLOR[4][3] = {{1,0,0},{0,1,0},{0,0,1},{1,0,1}}; 
-
-const int PADS_TYPE[12] = {0,1,0,1,0,0,2,0,0,0,0,0};
-const double VEL_MAP_COEFF_BIG[3] = {0.0025, 0.0012, 0.0006};
-const double VEL_MAP_COEFF_SMALL[3] = {0.0009, 0.0006, 0.0003};
-const double VEL_MAP_COEFF_SNARE[3] = {0.006, 0.0037, 0.0024};
-const double VEL_MAP_COEFF_KICK[3] = {0.0025, 0.0012, 0.0006};
+const LEDColor LED_SLOT_COLOR[4] = {{LED_MAX_LEVEL,0,0},{0,LED_MAX_LEVEL,0},{0,0,LED_MAX_LEVEL},{LED_MAX_LEVEL,0,LED_MAX_LEVEL}};
+const LEDColor LED_WHITE = {LED_MAX_LEVEL, LED_MAX_LEVEL, LED_MAX_LEVEL};
+const LEDColor LED_CLIP_COLOR = {LED_MAX_LEVEL, 2, 0}; // Amber flash, a hit reached the full scale of the ADC
+const LEDColor LED_OVERFLOW_COLOR = {2, 2, 2}; // Dim white flash, events were dropped by a full queue
+const LEDColor LED_LEARN_COLOR = {0, LED_MAX_LEVEL, LED_MAX_LEVEL}; // Velocity learn mode
+const LEDColor LED_LEARN_FAILED_COLOR = {LED_MAX_LEVEL, 0, 0}; // Flash, too few hits to build a velocity table
+const LEDColor LED_FAULT_COLOR = {2, 0, 0}; // Dim red double flash, a sensor is stuck or noisy and excluded from the scan
+
+const int VEL_MAP_NUM_PROFILES = 3;
+const double VEL_MAP_COEFF_BIG[VEL_MAP_NUM_PROFILES] = {0.0025, 0.0012, 0.0006};
+const double VEL_MAP_COEFF_SMALL[VEL_MAP_NUM_PROFILES] = {0.0009, 0.0006, 0.0003};
+const double VEL_MAP_COEFF_SNARE[VEL_MAP_NUM_PROFILES] = {0.006, 0.0037, 0.0024};
+const double VEL_MAP_COEFF_KICK[VEL_MAP_NUM_PROFILES] = {0.0025, 0.0012, 0.0006};
+/// @brief Default number of samples integrated by VEL_ESTIMATOR_AREA
+const int PADS_ATTACK_WINDOW = 8;
 
 const int INTERFACE_MAIN = 0;
 const int INTERFACE_SETTINGS = 1;
 const int INTERFACE_EDIT_BANK = 2;
+const int INTERFACE_VELOCITY_LEARN = 3;
 const int SETTINGS_CHANNEL = 0;
 const int SETTINGS_UART_MIDI_ENABLE = 1;
 const int SETTINGS_KICK_ENABLE = 2;
@@ -68,8 +149,21 @@ const int SETTINGS_CC_ENABLE = 3;
 const int SETTINGS_VEL_CURVE = 4;
 const int SETTINGS_KICK_VEL_CURVE = 5;
 
-const uint32 FLASH_SIGNATURE = 0xA07C9C9A;
+const uint32 FLASH_SIGNATURE = 0xA07C9CA0;
+const uint32 FLASH_SIGNATURE_V1 = 0xA07C9C9A; // Configuration of the first release, 12 pads and the two pedals
 const uint16 CONFIG_ADDRESS = sizeof(FLASH_SIGNATURE)/2;
+const uint16 EEPROM_NUM_VARIABLES = EEPROM_PAGE_SIZE/4 - 1; // Every variable takes an address and a value, the first slot is the page status
+
+const int NUM_CONFIG_BANKS = 4; // Banks stored in configStructure, the banks after them come from the preset library
+const uint16 PRESET_LIBRARY_PAGES = 4;
+const uint32 PRESET_LIBRARY_ADDRESS = EEPROM_START_ADDRESS - PRESET_LIBRARY_PAGES*EEPROM_PAGE_SIZE; // Just below the emulated EEPROM
+const uint16 VELOCITY_TABLE_PAGES = 2;
+const uint32 VELOCITY_TABLE_ADDRESS = PRESET_LIBRARY_ADDRESS - VELOCITY_TABLE_PAGES*EEPROM_PAGE_SIZE; // Just below the preset library
+const uint16 CONFIG_TABLE_PAGES = 2;
+const uint32 CONFIG_TABLE_ADDRESS = VELOCITY_TABLE_ADDRESS - CONFIG_TABLE_PAGES*EEPROM_PAGE_SIZE; // Just below the velocity tables
+const uint16 CONFIG_TABLE_FORMAT = 0x4355; // Layout of triggerParams and of the mapping banks, change it with them
+const uint8 CONFIG_KEY_TRIGGER_PARAMS = 0; // Key of the sensor table entry of sensor 0, followed by the other sensors
+const uint8 CONFIG_KEY_MAPPING_BANK = NUM_SENSORS; // Key of mapping bank 0, followed by the other banks
 
 // ===== Flags =====
 
@@ -81,8 +175,11 @@ int f_kick_vel_map_profile = 1;
 bool f_cc_ped_enabled = false;
 bool f_kick_ped_enabled = true;
 
+int f_output_delay = 0; // Delay from hit onset to MIDI output in microseconds, 0 to send every event as soon as detected
+bool f_idle_sleep = false; // Sleep between sample ticks when there is nothing else to do
+
 int f_interface_level = 0; // Ranged from 0-1
-int f_bank = 0; // Ranged from 0-3
+int f_bank = 0; // Ranged from 0 to num_banks()-1
 int f_slot = 0; // Ranged from 0-3
 int f_settings_index = 0; // Ranged from 0-5
 
@@ -91,6 +188,33 @@ bool f_sensor_selected = false;
 
 // ===== Configuration storage struct =====
 
+/// @brief Entry of the sensor table: type and trigger detection parameters of a single sensor
+struct triggerParams {
+  /// @brief High-going threshold in ADC counts. For a CC pedal, change in ADC counts needed to send a new value
+  uint16 threshold_high;
+  /// @brief Low-going threshold in ADC counts
+  uint16 threshold_low;
+  /// @brief Sampling period while being hit in microseconds. For a CC pedal or a switch, sampling period. 0 for the default,
+  /// otherwise at least the time taken by a sample
+  uint16 sample_period;
+  /// @brief Time covered by the moving average in microseconds, from PADS_MIN_WINDOW_TIME to PADS_BUFFER_SIZE samples of the
+  /// idle sampling period
+  uint16 window;
+  /// @brief Time the average must stay below threshold_low before a new trigger is accepted, at least PADS_MIN_COOLDOWN_TIME,
+  /// in microseconds
+  uint16 cooldown;
+  /// @brief SENSOR_NONE, SENSOR_PAD, SENSOR_PEDAL, SENSOR_CC or SENSOR_SWITCH
+  uint8 type : 3;
+  /// @brief Velocity curve. 0:Big pad, 1:small pad, 2:snare pad, 3:kick pedal
+  uint8 curve : 3;
+  /// @brief VEL_ESTIMATOR_PEAK or VEL_ESTIMATOR_AREA, pads only
+  uint8 estimator : 2;
+  /// @brief Number of samples integrated by VEL_ESTIMATOR_AREA
+  uint8 attack_window;
+};
+
+const int TRIGGER_PARAMS_NUM_FIELDS = 9;
+
 struct configStructure {
   bool uart_midi_enabled = f_uart_midi_enabled;
   uint8 midi_channel_num = f_midi_channel_num;
@@ -98,27 +222,99 @@ struct configStructure {
   uint8 kick_vel_map_profile = f_kick_vel_map_profile;
   bool cc_ped_enabled = f_cc_ped_enabled;
   bool kick_ped_enabled = f_kick_ped_enabled;
-  /// @brief Bank -> Slot -> Pads
-  uint8 mapping_bank[4][4][12] = {
+  /// @brief Constant latency mode delay in microseconds, 0 if off
+  uint16 output_delay = f_output_delay;
+  /// @brief Mux address -> Time waited for the multiplexer to settle after switching to it, in microseconds
+  uint8 mux_settle_time[NUM_MUX_SENSORS] = {
+    MUX_SETTLE_DEFAULT, MUX_SETTLE_DEFAULT, MUX_SETTLE_DEFAULT, MUX_SETTLE_DEFAULT, MUX_SETTLE_DEFAULT, MUX_SETTLE_DEFAULT, MUX_SETTLE_DEFAULT, MUX_SETTLE_DEFAULT,
+    MUX_SETTLE_DEFAULT, MUX_SETTLE_DEFAULT, MUX_SETTLE_DEFAULT, MUX_SETTLE_DEFAULT, MUX_SETTLE_DEFAULT, MUX_SETTLE_DEFAULT, MUX_SETTLE_DEFAULT, MUX_SETTLE_DEFAULT
+  };
+  bool idle_sleep = f_idle_sleep;
+  // The tables below are stored in config_tables, everything above in the emulated EEPROM
+  /// @brief Sensor table, indexed by sensor id
+  triggerParams trigger_params[NUM_SENSORS] = {
+    {PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_SAMPLING_PERIOD, PADS_WINDOW_TIME, PADS_COOLDOWN_TIME, SENSOR_PAD, 0, VEL_ESTIMATOR_PEAK, PADS_ATTACK_WINDOW},
+    {PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_SAMPLING_PERIOD, PADS_WINDOW_TIME, PADS_COOLDOWN_TIME, SENSOR_PAD, 1, VEL_ESTIMATOR_PEAK, PADS_ATTACK_WINDOW},
+    {PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_SAMPLING_PERIOD, PADS_WINDOW_TIME, PADS_COOLDOWN_TIME, SENSOR_PAD, 0, VEL_ESTIMATOR_PEAK, PADS_ATTACK_WINDOW},
+    {PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_SAMPLING_PERIOD, PADS_WINDOW_TIME, PADS_COOLDOWN_TIME, SENSOR_PAD, 1, VEL_ESTIMATOR_PEAK, PADS_ATTACK_WINDOW},
+    {PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_SAMPLING_PERIOD, PADS_WINDOW_TIME, PADS_COOLDOWN_TIME, SENSOR_PAD, 0, VEL_ESTIMATOR_PEAK, PADS_ATTACK_WINDOW},
+    {PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_SAMPLING_PERIOD, PADS_WINDOW_TIME, PADS_COOLDOWN_TIME, SENSOR_PAD, 0, VEL_ESTIMATOR_PEAK, PADS_ATTACK_WINDOW},
+    {SNARE_THRESH_HIGH, SNARE_THRESH_LOW, PADS_SAMPLING_PERIOD, PADS_WINDOW_TIME, PADS_COOLDOWN_TIME, SENSOR_PAD, 2, VEL_ESTIMATOR_PEAK, PADS_ATTACK_WINDOW},
+    {PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_SAMPLING_PERIOD, PADS_WINDOW_TIME, PADS_COOLDOWN_TIME, SENSOR_PAD, 0, VEL_ESTIMATOR_PEAK, PADS_ATTACK_WINDOW},
+    {PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_SAMPLING_PERIOD, PADS_WINDOW_TIME, PADS_COOLDOWN_TIME, SENSOR_PAD, 0, VEL_ESTIMATOR_PEAK, PADS_ATTACK_WINDOW},
+    {PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_SAMPLING_PERIOD, PADS_WINDOW_TIME, PADS_COOLDOWN_TIME, SENSOR_PAD, 0, VEL_ESTIMATOR_PEAK, PADS_ATTACK_WINDOW},
+    {PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_SAMPLING_PERIOD, PADS_WINDOW_TIME, PADS_COOLDOWN_TIME, SENSOR_PAD, 0, VEL_ESTIMATOR_PEAK, PADS_ATTACK_WINDOW},
+    {PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_SAMPLING_PERIOD, PADS_WINDOW_TIME, PADS_COOLDOWN_TIME, SENSOR_PAD, 0, VEL_ESTIMATOR_PEAK, PADS_ATTACK_WINDOW},
+    {PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_SAMPLING_PERIOD, PADS_WINDOW_TIME, PADS_COOLDOWN_TIME, SENSOR_NONE, 0, VEL_ESTIMATOR_PEAK, PADS_ATTACK_WINDOW},
+    {PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_SAMPLING_PERIOD, PADS_WINDOW_TIME, PADS_COOLDOWN_TIME, SENSOR_NONE, 0, VEL_ESTIMATOR_PEAK, PADS_ATTACK_WINDOW},
+    {PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_SAMPLING_PERIOD, PADS_WINDOW_TIME, PADS_COOLDOWN_TIME, SENSOR_NONE, 0, VEL_ESTIMATOR_PEAK, PADS_ATTACK_WINDOW},
+    {PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_SAMPLING_PERIOD, PADS_WINDOW_TIME, PADS_COOLDOWN_TIME, SENSOR_NONE, 0, VEL_ESTIMATOR_PEAK, PADS_ATTACK_WINDOW},
+    {KICK_THRESH_HIGH, KICK_THRESH_LOW, PADS_SAMPLING_PERIOD, PADS_WINDOW_TIME, PADS_COOLDOWN_TIME, SENSOR_PEDAL, 3, VEL_ESTIMATOR_PEAK, PADS_ATTACK_WINDOW},
+    {CC_THRESH_CHANGE, 0, CC_SAMPLING_PERIOD, PADS_IDLE_SAMPLING_PERIOD, PADS_MIN_COOLDOWN_TIME, SENSOR_CC, 0, VEL_ESTIMATOR_PEAK, 1}
+  };
+  /// @brief Bank -> Slot -> Sensor. Note number, or CC number for CC pedals and switches
+  uint8 mapping_bank[4][4][NUM_SENSORS] = {
     {
-      {43, 41, 36, 41, 43, 47, 38, 47, 49, 46, 42, 51},
-      {43, 41, 37, 41, 43, 47, 38, 47, 49, 46, 42, 51},
-      {46, 37, 38, 41, 43, 42, 50, 45, 49, 54, 57, 51},
-      {46, 37, 38, 41, 43, 42, 50, 45, 49, 55, 57, 51}
+      {43, 41, 36, 41, 43, 47, 38, 47, 49, 46, 42, 51, 0, 0, 0, 0, 36, 4},
+      {43, 41, 37, 41, 43, 47, 38, 47, 49, 46, 42, 51, 0, 0, 0, 0, 36, 4},
+      {46, 37, 38, 41, 43, 42, 50, 45, 49, 54, 57, 51, 0, 0, 0, 0, 36, 4},
+      {46, 37, 38, 41, 43, 42, 50, 45, 49, 55, 57, 51, 0, 0, 0, 0, 36, 4}
     }
   };
-  uint8 mapping_bank_kick[4][4] = {{36, 36, 36, 36}};
-  uint8 mapping_bank_cc[4][4] = {{4, 4, 4, 4}};
+};
+
+/// @brief Size of the part of configStructure stored in the emulated EEPROM, in bytes
+const size_t CONFIG_EEPROM_SIZE = offsetof(configStructure, trigger_params);
+// Every write to the emulated EEPROM takes a slot, and a full page costs a transfer stalling the CPU for 40 ms, so the
+// settings stored there must leave most of the slots free
+static_assert(CONFIG_ADDRESS + CONFIG_EEPROM_SIZE/2 <= EEPROM_NUM_VARIABLES/4, "configStructure takes too much of the emulated EEPROM");
+static_assert(CONFIG_EEPROM_SIZE % 2 == 0, "The emulated EEPROM stores half-words");
+static_assert(sizeof(triggerParams) % 2 == 0, "Flash records store half-words");
+static_assert(CONFIG_KEY_MAPPING_BANK + NUM_CONFIG_BANKS <= FLASH_RECORDS_MAX_KEYS, "Too many configuration tables for FlashRecords");
+static_assert(sizeof(configStructure::mapping_bank[0]) <= 2*FlashRecords::MAX_LENGTH, "Mapping bank too large for a flash record");
+static_assert(PRESET_KIT_SIZE == NUM_SENSORS, "Preset library kits must hold one note per sensor");
+static_assert(VELOCITY_TABLE_SENSORS == NUM_SENSORS, "Velocity tables are indexed by sensor id");
+
+/// @brief Layout of the configuration saved by FLASH_SIGNATURE_V1
+struct legacyConfigStructure {
+  bool uart_midi_enabled;
+  uint8 midi_channel_num;
+  uint8 vel_map_profile;
+  uint8 kick_vel_map_profile;
+  bool cc_ped_enabled;
+  bool kick_ped_enabled;
+  uint8 mapping_bank[4][4][12];
+  uint8 mapping_bank_kick[4][4];
+  uint8 mapping_bank_cc[4][4];
 };
 
 configStructure config;
 
 // ===== Global functions declaration =====
 
-void global_poll();
-int global_poll_return();
-void pads_triggered(bool is_triggered, int note_number, int channel_number, int raw_reading, int vel_map_profile, int pad_type);
-void send_note_event(bool is_note_on, int note_number, int channel_number, int velocity);
+void acquisition_task();
+void output_task();
+void button_task();
+void edit_bank_task();
+void sensor_health_task();
+uint32 acquisition_poll();
+void process_events();
+void output_event(TriggerEvent event);
+void delay_event(const TriggerEvent &event);
+void release_delayed_events();
+void midi_merge_poll();
+void forward_midi_message(const MIDIMessage &message);
+void midi_control_poll();
+void midi_control_message(const MIDIMessage &message);
+void select_bank_slot(int bank, int slot);
+void show_bank_slot();
+void send_midi_message(const MIDIMessage &message);
+bool usb_midi_write(const MIDIMessage &message);
+bool uart_midi_write(const MIDIMessage &message);
+bool send_stage_timing(int part);
+void idle_sleep_poll();
+HOT_PATH void pads_triggered(bool is_triggered, int sensor_id, int note_number, int channel_number, int raw_reading, int vel_map_profile, int pad_type);
+HOT_PATH void send_note_event(bool is_note_on, int note_number, int channel_number, int velocity);
 void controller_changed(int cc_number, int channel_number, int raw_reading);
 void send_cc_event(int cc_number, int channel_number, int cc_value);
 
@@ -137,81 +333,184 @@ void button3_pressed();
 void button3_long_pressed();
 void button4_pressed();
 void button5_pressed();
+void button5_long_pressed();
 
+int num_banks();
+uint8 *active_mapping(int sensor_id);
 void load_bank_mapping();
-void edit_bank_mapping();
-
-void send_json_config();
-void send_json_config(configStructure config);
+int sensor_mode(int sensor_id);
+void load_trigger_params();
+void load_mux_settle_time();
+void measure_mux_settle_time();
+int loudest_sensor(uint32 triggered);
+void edit_bank_mapping(uint32 triggered);
+void velocity_learn_select(uint32 triggered);
+void velocity_learn_finish();
+void velocity_learn_clear();
+
+/// @brief Print part `part` of a serial reply, at most SERIAL_REPLY_PART_MAX bytes
+/// @return true if more parts follow
+typedef bool (*serial_reply_writer)(int part);
+bool serial_reply_begin(serial_reply_writer writer);
+void serial_reply_poll();
+bool send_json_config(int part);
+void send_json_array(const uint8 *values, size_t length);
+void receive_json_begin(char command, json_value_handler handler, void *context);
+void receive_json_poll();
 void receive_json_config();
+void receive_json_config_end(bool success);
+bool config_value_handler(const char *key, const int *indices, int depth, int32_t value, void *context);
+bool trigger_params_set_field(triggerParams *params, int field, int32_t value);
+void receive_json_trigger_params();
+void receive_json_trigger_params_end(bool success);
+bool trigger_params_value_handler(const char *key, const int *indices, int depth, int32_t value, void *context);
+bool send_memory_report(int part);
+bool send_signal_diagnostics(int part);
+bool send_midi_output_stats(int part);
+void send_transport_stats(const MIDITransportStats &stats, size_t pending);
+void send_task_stats();
+bool send_task_stats(int part);
+void send_signal_stats(int sensor_id, SignalStats &stats, int half);
+void send_health_log(int half);
+void reset_signal_diagnostics();
+bool send_preset_library(int part);
+void receive_json_preset();
+void receive_json_preset_end(bool success);
+bool preset_value_handler(const char *key, const int *indices, int depth, int32_t value, void *context);
+void erase_preset_library();
+bool send_velocity_tables(int part);
+void erase_velocity_tables();
+void receive_json_load_test();
+void receive_json_load_test_end(bool success);
+bool load_test_value_handler(const char *key, const int *indices, int depth, int32_t value, void *context);
+uint32 load_test_triggers();
+void load_test_poll();
+bool send_load_test_report(int part);
 void serial_command_poll();
 
 void write_config_struct(uint16 addr, configStructure *config);
 void read_config_struct(uint16 addr, configStructure *config);
+void read_config_struct(uint16 addr, void *config, size_t size_bytes);
+void migrate_legacy_config();
 void save_all_config();
 void load_all_config();
 
-// ===== Pads initialization =====
+// ===== Event queue initialization =====
 
-class MIDIPad: public Pad {
-  public:
-    MIDIPad(int pin_num, float threshold_high, float threshold_low, int buffer_size, int midi_note_num) : Pad(pin_num, threshold_high, threshold_low, buffer_size, midi_note_num) {}
+/// @brief Events detected by the acquisition stage, waiting to be sent by the output stage
+EventQueue<EVENT_QUEUE_SIZE> event_queue;
 
-    void on_trigger(int pad_input) {
-      pads_triggered(true, get_note_num(), f_midi_channel_num, pad_input, f_kick_vel_map_profile, 3);
-      CompositeSerial.print("Triggered: ");
-      CompositeSerial.println(get_max());
-    }
+uint32 acquisition_last_micros = 0;
+uint32 acquisition_max_micros = 0;
+uint32 output_last_micros = 0;
+uint32 output_max_micros = 0;
+uint32 output_max_latency_micros = 0;
 
-    void on_cooldown() {
-      pads_triggered(false, get_note_num(), f_midi_channel_num, 0, f_kick_vel_map_profile, 3);
-    }
-};
+/// @brief CPU cycles of the acquisition calls that sampled at least one input, since the previous report
+uint64_t sweep_cycles_sum = 0;
+uint32 sweep_count = 0;
+uint32 sweep_samples = 0;
+uint32 sweep_max_cycles = 0;
 
-class MIDIMuxPad: public MuxPad {
-  public:
-    MIDIMuxPad(int pin_num, float threshold_high, float threshold_low, int buffer_size, int midi_note_num, const int select_pins[4], int mux_address) : MuxPad(pin_num, threshold_high, threshold_low, buffer_size, midi_note_num, select_pins, mux_address) {}
+/// @brief Note or CC number and MIDI channel of the last trigger of every sensor. Its release is sent to the same
+/// note even if the bank, slot or channel changed in between, so a switch never leaves a note hanging.
+uint8 sounding_number[NUM_SENSORS];
+uint8 sounding_channel[NUM_SENSORS];
 
-    void on_trigger(int pad_input) {
-      pads_triggered(true, get_note_num(), f_midi_channel_num, pad_input, f_vel_map_profile, PADS_TYPE[get_mux_address()]);
-      CompositeSerial.print("Triggered: ");
-      CompositeSerial.println(get_max());
-    }
+// ===== MIDI output initialization =====
 
-    void on_cooldown() {
-      pads_triggered(false, get_note_num(), f_midi_channel_num, 0, f_vel_map_profile, PADS_TYPE[get_mux_address()]);
-    }
-};
+/// @brief Every MIDI message is sent through the scheduler, which shares the bandwidth of each transport by priority
+MIDIScheduler midi_scheduler;
+TransmitBudget usb_midi_budget(USB_MIDI_BYTES_PER_MS, USB_MIDI_BUFFER_SIZE);
 
-MIDIMuxPad pads_array[] = {
-  MIDIMuxPad(MUX_PADS_PIN, PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_BUFFER_SIZE, PADS_NOTE_NUM[0], SELECT_PINS, 0),
-  MIDIMuxPad(MUX_PADS_PIN, PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_BUFFER_SIZE, PADS_NOTE_NUM[1], SELECT_PINS, 1),
-  MIDIMuxPad(MUX_PADS_PIN, PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_BUFFER_SIZE, PADS_NOTE_NUM[2], SELECT_PINS, 2),
-  MIDIMuxPad(MUX_PADS_PIN, PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_BUFFER_SIZE, PADS_NOTE_NUM[3], SELECT_PINS, 3),
-  MIDIMuxPad(MUX_PADS_PIN, PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_BUFFER_SIZE, PADS_NOTE_NUM[4], SELECT_PINS, 4),
-  MIDIMuxPad(MUX_PADS_PIN, PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_BUFFER_SIZE, PADS_NOTE_NUM[5], SELECT_PINS, 5),
-  MIDIMuxPad(MUX_PADS_PIN, SNARE_THRESH_HIGH, SNARE_THRESH_LOW, PADS_BUFFER_SIZE, PADS_NOTE_NUM[6], SELECT_PINS, 6),
-  MIDIMuxPad(MUX_PADS_PIN, PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_BUFFER_SIZE, PADS_NOTE_NUM[7], SELECT_PINS, 7),
-  MIDIMuxPad(MUX_PADS_PIN, PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_BUFFER_SIZE, PADS_NOTE_NUM[8], SELECT_PINS, 8),
-  MIDIMuxPad(MUX_PADS_PIN, PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_BUFFER_SIZE, PADS_NOTE_NUM[9], SELECT_PINS, 9),
-  MIDIMuxPad(MUX_PADS_PIN, PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_BUFFER_SIZE, PADS_NOTE_NUM[10], SELECT_PINS, 10),
-  MIDIMuxPad(MUX_PADS_PIN, PADS_THRESH_HIGH, PADS_THRESH_LOW, PADS_BUFFER_SIZE, PADS_NOTE_NUM[11], SELECT_PINS, 11)
-};
+// ===== Constant latency output initialization =====
 
-MIDIPad kick_pad(KICK_PEDAL_PIN, KICK_THRESH_HIGH, KICK_THRESH_LOW, PADS_BUFFER_SIZE, KICK_NOTE_NUM);
+/// @brief Events held until their onset plus f_output_delay in constant latency mode
+DelayLine<EVENT_QUEUE_SIZE> delay_line;
 
-// ===== CC initialization =====
+uint32 detection_max_lag_micros = 0;
+uint32 delay_released = 0;
+uint32 delay_late = 0;
+/// @brief Events sent before their due time to make room in a full delay line
+uint32 delay_early = 0;
+/// @brief Time from the due time of a delayed event to the end of its sending
+uint32 delay_max_error_micros = 0;
+uint64_t delay_error_sum_micros = 0;
 
-class MIDICController: public CController {
-  public:
-    MIDICController(int pin_num, float threshold_percent, int midi_cc_num): CController(pin_num, threshold_percent, midi_cc_num) {}
+// ===== MIDI merge initialization =====
 
-    void on_change(int controller_input) {
-      controller_changed(get_cc_num(), f_midi_channel_num, controller_input);
-    }
+/// @brief Parser of the MIDI stream received on the UART input from the next unit of the chain
+MIDIParser merge_parser;
+
+uint32 merge_messages = 0;
+uint32 merge_last_poll_micros = 0;
+uint32 merge_max_poll_gap_micros = 0;
+uint32 merge_last_latency_micros = 0;
+uint32 merge_max_latency_micros = 0;
+
+// ===== MIDI control initialization =====
+
+/// @brief Bank of the last Bank Select received, applied by the next Program Change. -1 keeps the current bank.
+int midi_bank_select = -1;
+
+// ===== Idle sleep initialization =====
+
+uint64_t idle_sleep_micros = 0;
+/// @brief micros() and idle_sleep_micros at the previous report, the duty cycle is measured between two reports
+uint32 idle_report_micros = 0;
+uint64_t idle_report_sleep_micros = 0;
+
+// ===== Sensors initialization =====
+
+/// @brief Every sensor input, sensor id i being input i. Inputs are configured from config.trigger_params
+PadBank<NUM_SENSORS, PADS_BUFFER_SIZE> pads_bank(MUX_PADS_PIN, SELECT_PINS);
+
+// ===== Preset library initialization =====
+
+PresetLibrary preset_library(PRESET_LIBRARY_ADDRESS, PRESET_LIBRARY_PAGES, EEPROM_PAGE_SIZE);
+
+/// @brief Kits of the active bank when it comes from the preset library, decoded when the bank is selected
+uint8 preset_bank[PRESET_BANK_SIZE][PRESET_KIT_SIZE];
+/// @brief Bank decoded in preset_bank, -1 if none
+int preset_bank_loaded = -1;
+
+// ===== Velocity tables initialization =====
+
+VelocityTables velocity_tables(VELOCITY_TABLE_ADDRESS, EEPROM_PAGE_SIZE);
+FlashRecords config_tables(CONFIG_TABLE_ADDRESS, EEPROM_PAGE_SIZE, CONFIG_TABLE_FORMAT);
+
+/// @brief Trigger readings of the sensor selected in INTERFACE_VELOCITY_LEARN, recorded since it was selected
+uint16 learn_readings[VELOCITY_LEARN_MAX_HITS];
+int learn_hits = 0;
+
+// ===== Load test initialization =====
+
+/// @brief Synthetic hits replacing the readings of the pads under test while a load test runs
+LoadGenerator load_generator;
+LoadParams load_test_recv;
+
+/// @brief Counters when the load test started, the report gives their change
+uint32 load_test_start_triggers;
+uint32 load_test_start_queue_dropped;
+uint32 load_test_start_delay_dropped;
+MIDITransportStats load_test_start_usb;
+MIDITransportStats load_test_start_uart;
+
+// ===== Sensor health initialization =====
+
+/// @brief Change of the health of a sensor, see PAD_HEALTH_*
+struct sensorHealthEvent {
+  uint32 time_millis;
+  uint8 sensor_id;
+  uint8 health;
 };
 
-MIDICController cc_pedal(CC_PEDAL_PIN, CC_THRESH_CHANGE, 4);
+/// @brief Last SENSOR_HEALTH_LOG_SIZE health changes, oldest first from health_log_count
+sensorHealthEvent health_log[SENSOR_HEALTH_LOG_SIZE];
+uint32 health_log_count = 0;
+/// @brief Health of every sensor when the health task last checked
+uint8 sensor_health[NUM_SENSORS];
+uint32 health_flash_millis = 0;
 
 // ===== LED initialization =====
 
@@ -221,77 +520,435 @@ LEDIndicator led(LED_RED_PIN, LED_GREEN_PIN, LED_BLUE_PIN);
 
 ace_button::AceButton buttons[NUM_BUTTONS];
 
+// ===== Serial reply initialization =====
+
+// A reply longer than the USB serial transmit buffer would block the serial task until the host has read most of it,
+// holding the sampling for tens of milliseconds. Replies are written by parts instead, one per run of the serial task and
+// only while the host keeps up, and the next command is only read once the reply is over.
+
+/// @brief Reply being sent, 0 if none
+serial_reply_writer serial_reply = 0;
+/// @brief Next part of serial_reply
+int serial_reply_part;
+TransmitBudget serial_reply_budget(USB_SERIAL_BYTES_PER_MS, USB_SERIAL_BUFFER_SIZE);
+
+// ===== Task scheduler initialization =====
+
+/// @brief Runs every stage as a task, see setup() for the task table
+TaskScheduler<NUM_TASKS> scheduler;
+
+int acquisition_task_id;
+int output_task_id;
+int edit_bank_task_id;
+
+/// @brief Sensors triggered since the last run of the bank edit task
+uint32 edit_triggered = 0;
+/// @brief Events dropped by the event queue and the delay line when the output task last checked
+uint32 output_dropped = 0;
+
 // ===== Global functions =====
 
-/// @brief Placeholder function for any polling call
-void global_poll() {
-  for (size_t i=0; i<12; i++) {
-    pads_array[i].poll(PADS_SAMPLING_PERIOD);
+/// @brief Acquisition task, with the highest priority. Sample the inputs that are due, send the delayed events due before
+/// another input could be sampled and hand the detected events to the output task. Released again when the next input
+/// or delayed event is due.
+HOT_PATH void acquisition_task() {
+  uint32 triggered = acquisition_poll();
+  release_delayed_events();
+
+  if (!event_queue.is_empty()) {
+    scheduler.signal(output_task_id);
+  }
+  if ((triggered != 0) && ((f_interface_level == INTERFACE_EDIT_BANK) || (f_interface_level == INTERFACE_VELOCITY_LEARN))) {
+    edit_triggered |= triggered;
+    scheduler.signal(edit_bank_task_id);
+  }
+
+  int32_t next = pads_bank.time_to_next_sample(PADS_SAMPLING_PERIOD, PADS_IDLE_SAMPLING_PERIOD);
+  // When the inputs due cannot all be sampled within their period, something is due again at once. Leave the time of a
+  // sample to the lower priority tasks, which would otherwise never run.
+  if (next <= 0) {
+    next = pads_bank.input_sample_time();
+  }
+  int32_t delay_remaining;
+  uint32 now = micros();
+  if (delay_line.next_due(now, delay_remaining) && (delay_remaining - pads_bank.input_sample_time() < next)) {
+    next = delay_remaining - pads_bank.input_sample_time();
+  }
+  // Inputs turned on by a new configuration are picked up within an idle period
+  if (next > PADS_IDLE_SAMPLING_PERIOD) {
+    next = PADS_IDLE_SAMPLING_PERIOD;
+  }
+  scheduler.release_at(acquisition_task_id, now + next);
+}
+
+/// @brief Output task. Send the detected events and the MIDI messages waiting for bandwidth, retrying every
+/// MIDI_OUTPUT_RETRY_PERIOD until none is left.
+HOT_PATH void output_task() {
+  process_events();
+  midi_scheduler.poll();
+
+  // Let the acquisition task stop its sweeps for the events moved to the delay line
+  if (!delay_line.is_empty()) {
+    scheduler.signal(acquisition_task_id);
   }
 
-  if (f_kick_ped_enabled) {
-    kick_pad.poll(PADS_SAMPLING_PERIOD);
+  if ((midi_scheduler.pending(MIDI_TRANSPORT_USB) != 0) || (midi_scheduler.pending(MIDI_TRANSPORT_UART) != 0)) {
+    scheduler.release_at(output_task_id, micros() + MIDI_OUTPUT_RETRY_PERIOD);
   }
-  
-  if (f_cc_ped_enabled) {
-    cc_pedal.poll();
+
+  uint32 dropped = event_queue.get_dropped() + delay_line.get_dropped();
+  if (dropped != output_dropped) {
+    output_dropped = dropped;
+    led.flash(LED_OVERFLOW_COLOR, 1, LED_BLINK_FAST_PERIOD);
   }
+}
 
+void button_task() {
   for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
     buttons[i].check();
   }
+}
+
+/// @brief Bank edit task, released by the acquisition task when a sensor is hit in INTERFACE_EDIT_BANK or INTERFACE_VELOCITY_LEARN
+void edit_bank_task() {
+  uint32 triggered = edit_triggered;
+  edit_triggered = 0;
+  if (f_interface_level == INTERFACE_EDIT_BANK) {
+    edit_bank_mapping(triggered);
+  }
+  else if (f_interface_level == INTERFACE_VELOCITY_LEARN) {
+    velocity_learn_select(triggered);
+  }
+}
+
+/// @brief Sensor health task. Log the sensors excluded from the scan by the pad bank and put back once recovered, and flash
+/// the LED when one is excluded and then every SENSOR_FAULT_FLASH_PERIOD while any is.
+void sensor_health_task() {
+  uint32 now = millis();
+  bool new_fault = false;
+  for (int i=0; i<NUM_SENSORS; i++) {
+    uint8 health = pads_bank.get_health(i);
+    if (health == sensor_health[i]) {
+      continue;
+    }
+    sensorHealthEvent &event = health_log[health_log_count % SENSOR_HEALTH_LOG_SIZE];
+    event.time_millis = now;
+    event.sensor_id = i;
+    event.health = health;
+    health_log_count++;
+    sensor_health[i] = health;
+    new_fault = new_fault || (health != PAD_HEALTH_OK);
+  }
+
+  if (new_fault || ((pads_bank.get_faulty() != 0) && (now - health_flash_millis >= SENSOR_FAULT_FLASH_PERIOD))) {
+    led.flash(LED_FAULT_COLOR, 2, LED_BLINK_SLOW_PERIOD);
+    health_flash_millis = now;
+  }
+}
+
+/// @brief Idle stage, when no task is released. In idle sleep mode, sleep until the next task release. USB, UART and SysTick
+/// interrupts end the sleep early, and waking up IDLE_WAKE_MARGIN early keeps the sampling exactly periodic.
+void idle_sleep_poll() {
+  if (!f_idle_sleep) {
+    return;
+  }
+
+  int32_t remaining = scheduler.time_to_next_release();
+  if (remaining > (int32_t)IDLE_WAKE_MARGIN) {
+    idle_sleep_micros += idle_sleep_until(micros() + remaining - IDLE_WAKE_MARGIN);
+  }
+}
+
+/// @brief Acquisition stage. Sample every sensor once and queue the detected events without sending anything.
+/// @return Bit i is set for every sensor i triggered/changed in this sweep
+HOT_PATH uint32 acquisition_poll() {
+  uint32 start_time = micros();
+  uint32 start_cycles = cycle_count();
+  uint32 start_samples = pads_bank.get_sample_count();
+
+  uint32 triggered;
+  int32_t remaining;
+  if (delay_line.next_due(start_time, remaining)) {
+    // Leave the sweep unfinished rather than sending a delayed event late
+    triggered = pads_bank.poll(event_queue, PADS_SAMPLING_PERIOD, PADS_IDLE_SAMPLING_PERIOD, start_time + remaining);
+  }
+  else {
+    triggered = pads_bank.poll(event_queue, PADS_SAMPLING_PERIOD, PADS_IDLE_SAMPLING_PERIOD);
+  }
+
+  acquisition_last_micros = micros() - start_time;
+  if (acquisition_last_micros > acquisition_max_micros) {
+    acquisition_max_micros = acquisition_last_micros;
+  }
+
+  uint32 samples = pads_bank.get_sample_count() - start_samples;
+  if (samples != 0) {
+    uint32 cycles = cycle_count() - start_cycles;
+    sweep_cycles_sum += cycles;
+    sweep_count++;
+    sweep_samples += samples;
+    if (cycles > sweep_max_cycles) {
+      sweep_max_cycles = cycles;
+    }
+  }
+
+  return triggered;
+}
+
+/// @brief Output stage. Map, compute velocity and send every event waiting in the queue. In constant latency mode, the events
+/// are moved to the delay line instead.
+HOT_PATH void process_events() {
+  if (event_queue.is_empty()) {
+    return;
+  }
+
+  uint32 start_time = micros();
+
+  TriggerEvent event;
+  while (event_queue.pop(event)) {
+    uint32 latency = start_time - event.timestamp;
+    if (latency > output_max_latency_micros) {
+      output_max_latency_micros = latency;
+    }
+    uint32 detection_lag = event.timestamp - event.onset;
+    if (detection_lag > detection_max_lag_micros) {
+      detection_max_lag_micros = detection_lag;
+    }
+    if (f_output_delay == 0) {
+      output_event(event);
+    }
+    else {
+      delay_event(event);
+    }
+  }
+
+  output_last_micros = micros() - start_time;
+  if (output_last_micros > output_max_micros) {
+    output_max_micros = output_last_micros;
+  }
+}
+
+/// @brief Map a single event to its MIDI note/CC and send it
+HOT_PATH void output_event(TriggerEvent event) {
+  bool is_triggered = (event.type == EVENT_TRIGGER);
+  const triggerParams &params = config.trigger_params[event.sensor_id];
+  int number = pads_bank.get_note_num(event.sensor_id);
+  int channel = f_midi_channel_num;
+
+  if (event.type == EVENT_TRIGGER) {
+    sounding_number[event.sensor_id] = number;
+    sounding_channel[event.sensor_id] = channel;
+  }
+  else if (event.type == EVENT_RELEASE) {
+    number = sounding_number[event.sensor_id];
+    channel = sounding_channel[event.sensor_id];
+  }
 
-  led.poll();
+  switch (event.type) {
+    case EVENT_TRIGGER:
+    case EVENT_RELEASE:
+      if (params.type == SENSOR_SWITCH) {
+        controller_changed(number, channel, is_triggered ? 4095 : 0);
+        break;
+      }
+      pads_triggered(is_triggered, event.sensor_id, number, channel, event.value, (params.type == SENSOR_PEDAL) ? f_kick_vel_map_profile : f_vel_map_profile, params.curve);
+      if (is_triggered) {
+        if (serial_reply == 0) { // Not in the middle of a reply
+          CompositeSerial.print("Triggered: ");
+          CompositeSerial.println(event.value);
+        }
+        if (event.value >= SIGNAL_STATS_FULL_SCALE) {
+          led.flash(LED_CLIP_COLOR, 1, LED_BLINK_FAST_PERIOD);
+        }
+        if ((f_interface_level == INTERFACE_VELOCITY_LEARN) && f_sensor_selected && (event.sensor_id == f_selected_sensor_id) &&
+            (learn_hits < VELOCITY_LEARN_MAX_HITS)) {
+          learn_readings[learn_hits++] = event.value;
+        }
+      }
+      break;
+    case EVENT_CC:
+      controller_changed(number, f_midi_channel_num, event.value);
+      break;
+  }
+}
 
-  serial_command_poll();
+/// @brief Hold an event in the delay line. When it is full, a controller change is dropped rather than a note: the oldest
+/// one waiting makes room, or the new one is dropped if it is a controller change too. Otherwise the earliest event is sent
+/// ahead of its time, so that the events still leave in order and no release overtakes its trigger.
+HOT_PATH void delay_event(const TriggerEvent &event) {
+  if (delay_line.is_full() && (event.type != EVENT_CC) && !delay_line.drop(EVENT_CC)) {
+    TriggerEvent earliest;
+    uint32 due;
+    delay_line.pop(micros(), earliest, due);
+    delay_early++;
+    output_event(earliest);
+  }
+  delay_line.push(event, event.onset + f_output_delay);
 }
 
-/// @brief Same as global_poll, but return the pad/pedal that is triggered/changed
-/// @retval 0-11: Pad 1 to 12
-/// @retval 12: Kick pedal
-/// @retval 13: CC pedal
-/// @retval -1: Nothing happened
-int global_poll_return() {
-  for (size_t i=0; i<12; i++) {
-    if (pads_array[i].poll(PADS_SAMPLING_PERIOD) == 1) {
-      return i;
+/// @brief Constant latency stage. Send the delayed events that are due. An event due in less than the time needed to sample
+/// one input is waited for, the acquisition stage stopping early for it, so that every event leaves at its onset plus f_output_delay.
+void release_delayed_events() {
+  int32_t remaining;
+  while (delay_line.next_due(micros(), remaining) && (remaining <= pads_bank.input_sample_time())) {
+    TriggerEvent event;
+    uint32 due;
+    while (!delay_line.pop_due(micros(), event, due)) {}
+    output_event(event);
+
+    uint32 error = micros() - due;
+    delay_released++;
+    delay_error_sum_micros += error;
+    if (error > delay_max_error_micros) {
+      delay_max_error_micros = error;
+    }
+    if (error > OUTPUT_DELAY_LATE_MICROS) {
+      delay_late++;
     }
   }
+}
+
+/// @brief Merge stage. Forward the MIDI messages received on the UART input to the USB and UART outputs, so that a chain
+/// of units appears to the computer as a single USB device. At most MIDI_MERGE_MAX_BYTES are handled per call.
+void midi_merge_poll() {
+  uint32 start_time = micros();
+  int available = Serial1.available();
+
+  if (available == 0) {
+    merge_last_poll_micros = start_time;
+    return;
+  }
+
+  // Time the oldest waiting byte may have spent in the receive buffer
+  uint32 poll_gap = start_time - merge_last_poll_micros;
+  if (poll_gap > merge_max_poll_gap_micros) {
+    merge_max_poll_gap_micros = poll_gap;
+  }
+  merge_last_poll_micros = start_time;
 
-  if (f_kick_ped_enabled) {
-    if (kick_pad.poll(PADS_SAMPLING_PERIOD) == 1) {
-      return 12;
+  if (available > MIDI_MERGE_MAX_BYTES) {
+    available = MIDI_MERGE_MAX_BYTES;
+  }
+
+  MIDIMessage message;
+  for (int i=0; i<available; i++) {
+    if (merge_parser.parse(Serial1.read(), message)) {
+      midi_control_message(message);
+      forward_midi_message(message);
+      merge_messages++;
+      // The bytes read after this message were already received, so its last byte arrived at least that long ago
+      merge_last_latency_micros = micros() - start_time + (available-1-i)*MIDI_BYTE_MICROS;
+      if (merge_last_latency_micros > merge_max_latency_micros) {
+        merge_max_latency_micros = merge_last_latency_micros;
+      }
     }
   }
+}
 
-  if (f_cc_ped_enabled) {
-    if (cc_pedal.poll() == 1) {
-      return 13;
+/// @brief Send a received message unchanged on both USB and UART MIDI interface
+void forward_midi_message(const MIDIMessage &message) {
+  send_midi_message(message);
+}
+
+/// @brief Control stage. Apply the Program Change and Bank Select messages received on the USB MIDI interface, at most
+/// MIDI_CONTROL_MAX_PACKETS per call. Those received on the UART input are applied by the merge stage.
+void midi_control_poll() {
+  MIDIMessage message;
+  for (int i=0; (i<MIDI_CONTROL_MAX_PACKETS) && CompositeMIDI.available(); i++) {
+    if (midi_usb_message(CompositeMIDI.readPacket(), message)) {
+      midi_control_message(message);
     }
   }
+}
 
-  for (uint8_t i = 0; i < NUM_BUTTONS; i++) {
-    buttons[i].check();
+/// @brief Select the bank and slot from a message on the MIDI channel of the unit, any channel in omni mode.
+/// Bank Select (CC 0) picks the bank used by the following Program Changes, programs 0-3 select the slot of that bank.
+/// Ignored outside of INTERFACE_MAIN and when out of range.
+void midi_control_message(const MIDIMessage &message) {
+  if ((message.status >= 0xF0) || (f_interface_level != INTERFACE_MAIN)) {
+    return;
+  }
+  if ((f_midi_channel_num != 0) && ((message.status & 0x0F) != f_midi_channel_num-1)) {
+    return;
+  }
+
+  switch (message.status & 0xF0) {
+    case 0xB0:
+      if (message.data1 == MIDI_CC_BANK_SELECT) {
+        midi_bank_select = message.data2;
+      }
+      break;
+    case 0xC0:
+      select_bank_slot((midi_bank_select >= 0) ? midi_bank_select : f_bank, message.data1);
+      break;
+  }
+}
+
+/// @brief Switch to a bank and slot the same way as the buttons. Sounding notes are released on their own note.
+void select_bank_slot(int bank, int slot) {
+  if ((bank >= num_banks()) || (slot >= 4) || ((bank == f_bank) && (slot == f_slot))) {
+    return;
+  }
+  f_bank = bank;
+  f_slot = slot;
+  load_bank_mapping();
+  show_bank_slot();
+}
+
+/// @brief Show the slot colour, after blinking it once per bank number
+void show_bank_slot() {
+  led.on(LED_SLOT_COLOR[f_slot]);
+  led.blink(LED_SLOT_COLOR[f_slot], f_bank+1, LED_BLINK_SLOW_PERIOD, true);
+}
+
+/// @brief Queue a message on both USB and UART MIDI interface, it is sent as soon as the bandwidth of each allows
+void send_midi_message(const MIDIMessage &message) {
+  midi_scheduler.send(MIDI_TRANSPORT_USB, message);
+  if (f_uart_midi_enabled) {
+    midi_scheduler.send(MIDI_TRANSPORT_UART, message);
+  }
+  if ((midi_scheduler.pending(MIDI_TRANSPORT_USB) != 0) || (midi_scheduler.pending(MIDI_TRANSPORT_UART) != 0)) {
+    scheduler.signal(output_task_id);
   }
+}
 
-  led.poll();
-  
-  serial_command_poll();
+/// @brief MIDIWriter of the USB MIDI interface, limited to the bandwidth of the USB frames so that it never blocks
+bool usb_midi_write(const MIDIMessage &message) {
+  if (!usb_midi_budget.take(4)) {
+    return false;
+  }
+  CompositeMIDI.writePacket(midi_usb_packet(message));
+  return true;
+}
 
-  return -1;
+/// @brief MIDIWriter of the UART MIDI interface, only writing what fits in the transmit buffer so that it never blocks.
+/// Every message is written with its status byte, without running status.
+bool uart_midi_write(const MIDIMessage &message) {
+  if (Serial1.availableForWrite() < message.length) {
+    return false;
+  }
+  Serial1.write(message.status);
+  if (message.length > 1) {
+    Serial1.write(message.data1);
+  }
+  if (message.length > 2) {
+    Serial1.write(message.data2);
+  }
+  return true;
 }
 
 /// @brief Placeholder function called when pads are triggered/cooled down
 /// @param is_triggered true:trigger, false:cooled down
+/// @param sensor_id Sensor triggered, its learnt velocity table replaces the velocity curve if it has one
 /// @param note_number MIDI note number
 /// @param channel_number MIDI channel number 1-16. If 0, send to all channel
 /// @param raw_reading Raw analogRead value from the pad
 /// @param vel_map_profile Index of velocity mapping coefficient array. 0:soft, 1:medium, 2:hard
 /// @param pad_type 0:Big pad, 1:small pad, 2:snare pad, 3:kick pedal
-void pads_triggered(bool is_triggered, int note_number, int channel_number, int raw_reading, int vel_map_profile, int pad_type) {
-  int velocity;
+void pads_triggered(bool is_triggered, int sensor_id, int note_number, int channel_number, int raw_reading, int vel_map_profile, int pad_type) {
+  int velocity = is_triggered ? velocity_tables.velocity(sensor_id, raw_reading) : 0;
 
-  if (is_triggered) {
+  if (velocity < 0) {
     switch (pad_type) {
       case 0:
         velocity = midi_exp_vel_map(raw_reading, VEL_MAP_COEFF_BIG[vel_map_profile]);
@@ -309,9 +966,6 @@ void pads_triggered(bool is_triggered, int note_number, int channel_number, int
         velocity = 0;
     }  
   }
-  else {
-    velocity = 0;
-  }
 
   switch (channel_number) {
     case 0:
@@ -330,18 +984,12 @@ void pads_triggered(bool is_triggered, int note_number, int channel_number, int
 /// @param channel_number MIDI channel number
 /// @param velocity MIDI note velocity
 void send_note_event(bool is_note_on, int note_number, int channel_number, int velocity) {
-  if (is_note_on) {
-    CompositeMIDI.sendNoteOn(channel_number-1, note_number, velocity); //USBComposite library accepts channel 0-15 but MIDI library accepts 1-16
-    if (f_uart_midi_enabled) {
-      UARTMIDI.sendNoteOn(note_number, velocity, channel_number);
-    }
-  }
-  else {
-    CompositeMIDI.sendNoteOff(channel_number-1, note_number, 0);
-    if (f_uart_midi_enabled) {
-      UARTMIDI.sendNoteOff(note_number, 0, channel_number);
-    }
-  }
+  MIDIMessage message;
+  message.status = (is_note_on ? 0x90 : 0x80) | ((channel_number-1) & 0x0F);
+  message.data1 = note_number & 0x7F;
+  message.data2 = is_note_on ? (velocity & 0x7F) : 0;
+  message.length = 3;
+  send_midi_message(message);
 }
 
 /// @brief Placeholder function called when controller changed
@@ -365,10 +1013,12 @@ void controller_changed(int cc_number, int channel_number, int raw_reading) {
 /// @param channel_number MIDI channel number
 /// @param cc_value MIDI CC value
 void send_cc_event(int cc_number, int channel_number, int cc_value) {
-  CompositeMIDI.sendControlChange(channel_number-1, cc_number, cc_value);
-  if (f_uart_midi_enabled) {
-    UARTMIDI.sendControlChange(cc_number, cc_value, channel_number);
-  }
+  MIDIMessage message;
+  message.status = 0xB0 | ((channel_number-1) & 0x0F);
+  message.data1 = cc_number & 0x7F;
+  message.data2 = cc_value & 0x7F;
+  message.length = 3;
+  send_midi_message(message);
 }
 
 /// @brief Shift integer by offset while staying within certain range
@@ -444,6 +1094,9 @@ void handle_button_event(ace_button::AceButton* button, uint8_t eventType, uint8
         case 2:
           button3_long_pressed();
           break;
+        case 4:
+          button5_long_pressed();
+          break;
       }
       break;   
     case ace_button::AceButton::kEventLongReleased:
@@ -453,29 +1106,197 @@ void handle_button_event(ace_button::AceButton* button, uint8_t eventType, uint8
   }
 }
 
+/// @brief Number of banks reachable with the buttons: the banks of configStructure followed by the preset library
+int num_banks() {
+  return NUM_CONFIG_BANKS + preset_library.num_banks();
+}
+
+/// @brief Note or CC number assigned to a sensor in the current bank and slot
+uint8 *active_mapping(int sensor_id) {
+  if (f_bank >= NUM_CONFIG_BANKS) {
+    return &preset_bank[f_slot][sensor_id];
+  }
+  return &config.mapping_bank[f_bank][f_slot][sensor_id];
+}
+
+/// @brief Apply the mapping of the current bank and slot. A preset library bank is only decoded when it changes,
+/// edits made in edit bank mode to a preset library bank are kept until another bank is selected.
 void load_bank_mapping() {
-  for (int i=0; i<12; i++) {
-    pads_array[i].set_note_num(config.mapping_bank[f_bank][f_slot][i]);
+  if ((f_bank >= NUM_CONFIG_BANKS) && (preset_bank_loaded != f_bank)) {
+    preset_library.load_bank(f_bank - NUM_CONFIG_BANKS, preset_bank);
+    preset_bank_loaded = f_bank;
+  }
+
+  for (int i=0; i<NUM_SENSORS; i++) {
+    pads_bank.set_note_num(i, *active_mapping(i));
   }
-  kick_pad.set_note_num(config.mapping_bank_kick[f_bank][f_slot]);
-  cc_pedal.set_cc_num(config.mapping_bank_cc[f_bank][f_slot]);
 }
 
-void edit_bank_mapping() {
-  if (!f_sensor_selected) {
-    int id = global_poll_return();
-    if (id != -1) {
-      f_selected_sensor_id = id;
-      f_sensor_selected = true;
+/// @brief Detection mode of a sensor input from its type in the sensor table and the pedal enable flags
+int sensor_mode(int sensor_id) {
+  switch (config.trigger_params[sensor_id].type) {
+    case SENSOR_PAD:
+      return PAD_MODE_TRIGGER;
+    case SENSOR_PEDAL:
+      return f_kick_ped_enabled ? PAD_MODE_TRIGGER : PAD_MODE_OFF;
+    case SENSOR_CC:
+      return f_cc_ped_enabled ? PAD_MODE_CONTROLLER : PAD_MODE_OFF;
+    case SENSOR_SWITCH:
+      return PAD_MODE_SWITCH;
+    default:
+      return PAD_MODE_OFF;
+  }
+}
+
+/// @brief Apply the sensor table in config to the live sensor inputs
+void load_trigger_params() {
+  for (int i=0; i<NUM_SENSORS; i++) {
+    const triggerParams &params = config.trigger_params[i];
+    pads_bank.set_threshold(i, params.threshold_high, params.threshold_low);
+    // The moving average of a pad covers params.window at the idle sampling period, the rate of a pad once triggered, so
+    // that the release and the cooldown keep their timing. The rising signal is averaged over a shorter time at burst rate.
+    uint32 period = PADS_IDLE_SAMPLING_PERIOD;
+    if ((sensor_mode(i) != PAD_MODE_TRIGGER) && (params.sample_period != 0)) {
+      period = params.sample_period;
     }
+    pads_bank.set_window(i, (params.window + period/2)/period);
+    pads_bank.set_cooldown_time(i, params.cooldown);
+    pads_bank.set_sample_period(i, params.sample_period);
+    pads_bank.set_velocity_estimator(i, params.estimator, params.attack_window);
+    pads_bank.set_mode(i, sensor_mode(i));
   }
-  else {
-    global_poll();
+}
+
+/// @brief Apply the multiplexer settling times in config to the scan
+void load_mux_settle_time() {
+  for (int i=0; i<NUM_MUX_SENSORS; i++) {
+    pads_bank.set_settle_time(i, config.mux_settle_time[i]);
+  }
+}
+
+/// @brief Settling self-test. Measure the settling time of every multiplexer channel and use it, plus MUX_SETTLE_MARGIN, in place
+/// of the current one. A channel can only be measured when another channel reads a different level, otherwise its settling time is
+/// kept. Idle piezos all read close to 0, so one spare channel must be held at a reference level, e.g. wired to 3.3 V through a
+/// 10k resistor. The scan stops for about 70 ms plus 0.4 ms per transition measured: 80 ms with a single reference channel, 105 ms
+/// with four, up to 165 ms if every channel reads a different level. Saved with the other settings by the 'w' command.
+void measure_mux_settle_time() {
+  int measured[NUM_MUX_SENSORS];
+  int worst = 0;
+
+  for (int i=0; i<NUM_MUX_SENSORS; i++) {
+    measured[i] = pads_bank.measure_settle_time(i, MUX_SETTLE_TOLERANCE, MAX_MUX_SETTLE_TIME);
+    if (measured[i] >= 0) {
+      int settle_time = measured[i] + MUX_SETTLE_MARGIN;
+      config.mux_settle_time[i] = (settle_time < MAX_MUX_SETTLE_TIME) ? settle_time : MAX_MUX_SETTLE_TIME;
+    }
+    if (measured[i] > worst) {
+      worst = measured[i];
+    }
+  }
+  load_mux_settle_time();
+
+  CompositeSerial.print("{\"measured_us\":[");
+  for (int i=0; i<NUM_MUX_SENSORS; i++) {
+    if (i != 0) {
+      CompositeSerial.print(',');
+    }
+    CompositeSerial.print(measured[i]);
+  }
+  CompositeSerial.print("],\"worst_us\":");
+  CompositeSerial.print(worst);
+  CompositeSerial.print(",\"mux_settle_us\":");
+  send_json_array(config.mux_settle_time, NUM_MUX_SENSORS);
+  CompositeSerial.println("}");
+}
+
+/// @brief Pick the sensor that was hit among the sensors triggered in the same sweep, the others being most likely crosstalk.
+/// The pad or trigger pedal with the highest peak wins, CC pedals and switches are only picked alone.
+/// @param triggered Bit i is set for every sensor i triggered
+/// @return Sensor id, -1 if none
+int loudest_sensor(uint32 triggered) {
+  int id = -1;
+  int loudest_peak = -1;
+
+  for (int i=0; i<NUM_SENSORS; i++) {
+    if (!bitRead(triggered, i)) {
+      continue;
+    }
+    if (pads_bank.get_mode(i) == PAD_MODE_TRIGGER) {
+      if (pads_bank.get_max(i) > loudest_peak) {
+        id = i;
+        loudest_peak = pads_bank.get_max(i);
+      }
+    }
+    else if (id == -1) {
+      id = i;
+    }
+  }
+
+  return id;
+}
+
+/// @brief Same sweep as INTERFACE_MAIN, the first sensor hit is selected for editing
+void edit_bank_mapping(uint32 triggered) {
+  if (!f_sensor_selected && (triggered != 0)) {
+    f_selected_sensor_id = loudest_sensor(triggered);
+    f_sensor_selected = true;
+    CompositeSerial.print("Selected sensor: ");
+    CompositeSerial.println(f_selected_sensor_id);
+  }
+}
+
+/// @brief Same sweep as INTERFACE_MAIN, the first pad or trigger pedal hit is selected for learning. Its next hits, played from
+/// the softest to the hardest, are recorded by output_event().
+void velocity_learn_select(uint32 triggered) {
+  if (f_sensor_selected || (triggered == 0)) {
+    return;
+  }
+  int id = loudest_sensor(triggered);
+  if (pads_bank.get_mode(id) != PAD_MODE_TRIGGER) {
+    return;
+  }
+  f_selected_sensor_id = id;
+  f_sensor_selected = true;
+  learn_hits = 0;
+  led.on(LED_LEARN_COLOR);
+  CompositeSerial.print("Learning sensor: ");
+  CompositeSerial.println(f_selected_sensor_id);
+}
+
+/// @brief Build the velocity table of the selected sensor from the hits recorded and store it, then wait for the next sensor to
+/// be hit. Flashes white once stored, red if fewer than VELOCITY_LEARN_MIN_HITS hits were recorded.
+void velocity_learn_finish() {
+  if (!f_sensor_selected) {
+    return;
+  }
+
+  bool stored = false;
+  if (learn_hits >= VELOCITY_LEARN_MIN_HITS) {
+    uint16 points[VELOCITY_TABLE_POINTS];
+    velocity_table_build(learn_readings, learn_hits, points);
+    stored = velocity_tables.store(f_selected_sensor_id, points);
+  }
+  CompositeSerial.print(stored ? "Velocity table stored, hits: " : "Velocity table not stored, hits: ");
+  CompositeSerial.println(learn_hits);
+
+  f_sensor_selected = false;
+  learn_hits = 0;
+  led.blink(LED_LEARN_COLOR, LED_ENDLESS_CYCLES, LED_BLINK_VSLOW_PERIOD, true);
+  led.flash(stored ? LED_WHITE : LED_LEARN_FAILED_COLOR, 3, LED_BLINK_FAST_PERIOD);
+}
+
+/// @brief Remove the velocity table of the selected sensor, which goes back to its velocity curve, and forget its recorded hits
+void velocity_learn_clear() {
+  if (f_sensor_selected) {
+    velocity_tables.clear(f_selected_sensor_id);
+    learn_hits = 0;
+    led.flash(LED_WHITE, 1, LED_BLINK_FAST_PERIOD);
   }
 }
 
+/// @brief Write the settings to the EEPROM and the tables to config_tables. Only what changed is programmed.
 void write_config_struct(uint16 addr, configStructure *config) {
-  size_t size = sizeof(configStructure)/2;
+  size_t size = CONFIG_EEPROM_SIZE/2;
 
   uint16 *ptr = (uint16 *)config;
 
@@ -486,10 +1307,34 @@ void write_config_struct(uint16 addr, configStructure *config) {
       CompositeSerial.println(status);
     }
   }
+
+  bool stored = true;
+  for (int i=0; i<NUM_SENSORS; i++) {
+    stored = config_tables.write(CONFIG_KEY_TRIGGER_PARAMS + i, &config->trigger_params[i], sizeof(triggerParams)) && stored;
+  }
+  for (int bank=0; bank<NUM_CONFIG_BANKS; bank++) {
+    stored = config_tables.write(CONFIG_KEY_MAPPING_BANK + bank, config->mapping_bank[bank], sizeof(config->mapping_bank[bank])) && stored;
+  }
+  if (!stored) {
+    CompositeSerial.println("Config tables could not be written to flash");
+  }
 }
 
+/// @brief Read the settings from the EEPROM and the tables from config_tables. Tables missing from flash keep their value.
 void read_config_struct(uint16 addr, configStructure *config) {
-  size_t size = sizeof(configStructure)/2;
+  read_config_struct(addr, config, CONFIG_EEPROM_SIZE);
+
+  for (int i=0; i<NUM_SENSORS; i++) {
+    config_tables.read(CONFIG_KEY_TRIGGER_PARAMS + i, &config->trigger_params[i], sizeof(triggerParams));
+  }
+  for (int bank=0; bank<NUM_CONFIG_BANKS; bank++) {
+    config_tables.read(CONFIG_KEY_MAPPING_BANK + bank, config->mapping_bank[bank], sizeof(config->mapping_bank[bank]));
+  }
+}
+
+/// @brief Read size_bytes of configuration from the EEPROM
+void read_config_struct(uint16 addr, void *config, size_t size_bytes) {
+  size_t size = size_bytes/2;
 
   uint16 *ptr = (uint16 *)config;
 
@@ -498,6 +1343,29 @@ void read_config_struct(uint16 addr, configStructure *config) {
   }
 }
 
+/// @brief Convert the configuration saved by FLASH_SIGNATURE_V1 into config. The mappings and flags are kept,
+/// the kick and CC pedal mappings move to their direct input sensor ids and the sensor table is reset to the defaults.
+void migrate_legacy_config() {
+  legacyConfigStructure legacy = {};
+  read_config_struct(CONFIG_ADDRESS, &legacy, sizeof(legacyConfigStructure));
+
+  config.uart_midi_enabled = legacy.uart_midi_enabled;
+  config.midi_channel_num = legacy.midi_channel_num;
+  config.vel_map_profile = legacy.vel_map_profile;
+  config.kick_vel_map_profile = legacy.kick_vel_map_profile;
+  config.cc_ped_enabled = legacy.cc_ped_enabled;
+  config.kick_ped_enabled = legacy.kick_ped_enabled;
+  for (int bank=0; bank<4; bank++) {
+    for (int slot=0; slot<4; slot++) {
+      for (int i=0; i<12; i++) {
+        config.mapping_bank[bank][slot][i] = legacy.mapping_bank[bank][slot][i];
+      }
+      config.mapping_bank[bank][slot][NUM_MUX_SENSORS] = legacy.mapping_bank_kick[bank][slot];
+      config.mapping_bank[bank][slot][NUM_MUX_SENSORS+1] = legacy.mapping_bank_cc[bank][slot];
+    }
+  }
+}
+
 void save_all_config() {
   config.uart_midi_enabled = f_uart_midi_enabled;
   config.midi_channel_num = f_midi_channel_num;
@@ -505,12 +1373,22 @@ void save_all_config() {
   config.kick_vel_map_profile = f_kick_vel_map_profile;
   config.cc_ped_enabled = f_cc_ped_enabled;
   config.kick_ped_enabled = f_kick_ped_enabled;
+  config.output_delay = f_output_delay;
+  config.idle_sleep = f_idle_sleep;
   write_config_struct(CONFIG_ADDRESS, &config);
   configStructure tempconfig;
-  CompositeSerial.println();
-  CompositeSerial.println("Updated config:");
   read_config_struct(CONFIG_ADDRESS, &tempconfig);
-  send_json_config(tempconfig);
+  // Compare what was stored only, not the padding between the regions
+  if ((memcmp(&tempconfig, &config, CONFIG_EEPROM_SIZE) != 0) ||
+      (memcmp(tempconfig.trigger_params, config.trigger_params, sizeof(config.trigger_params)) != 0) ||
+      (memcmp(tempconfig.mapping_bank, config.mapping_bank, sizeof(config.mapping_bank)) != 0)) {
+    CompositeSerial.println();
+    CompositeSerial.println("Config read back differs from the one saved");
+  }
+  else if (serial_reply_begin(send_json_config)) { // What was read back is config, which the reply streams
+    CompositeSerial.println();
+    CompositeSerial.println("Updated config:");
+  }
 }
 
 void load_all_config() {
@@ -520,7 +1398,11 @@ void load_all_config() {
   f_kick_vel_map_profile = config.kick_vel_map_profile;
   f_cc_ped_enabled = config.cc_ped_enabled;
   f_kick_ped_enabled = config.kick_ped_enabled;
+  f_output_delay = config.output_delay;
+  f_idle_sleep = config.idle_sleep;
   load_bank_mapping();
+  load_trigger_params();
+  load_mux_settle_time();
 }
 
 // ===== Button functions =====
@@ -528,21 +1410,20 @@ void load_all_config() {
 void button1_pressed() {
   switch (f_interface_level) {
     case INTERFACE_MAIN:
-      f_bank = integer_up(f_bank, 4);
+      f_bank = integer_up(f_bank, num_banks());
       load_bank_mapping();
-      led.on(LED_SLOT_COLOR[f_slot][0], LED_SLOT_COLOR[f_slot][1], LED_SLOT_COLOR[f_slot][2]);
-      led.blink(LED_SLOT_COLOR[f_slot][0], LED_SLOT_COLOR[f_slot][1], LED_SLOT_COLOR[f_slot][2], f_bank+1, LED_BLINK_SLOW_PERIOD, true);
+      show_bank_slot();
       break;
     case INTERFACE_SETTINGS:
       f_settings_index = integer_up(f_settings_index, 6);
-      led.blink(1,1,1,f_settings_index+1, LED_BLINK_SLOW_PERIOD, true);
+      led.blink(LED_WHITE, f_settings_index+1, LED_BLINK_SLOW_PERIOD, true);
   }
 }
 
 void button1_long_pressed() {
   if (f_interface_level == INTERFACE_MAIN) {
     f_interface_level = INTERFACE_SETTINGS;
-    led.on(1,1,1);
+    led.on(LED_WHITE);
   }
 }
 
@@ -550,7 +1431,7 @@ void button1_double_clicked() {
   if (f_interface_level == INTERFACE_MAIN) {
     f_interface_level = INTERFACE_EDIT_BANK;
     //infinite blink led
-    led.blink(LED_SLOT_COLOR[f_slot][0], LED_SLOT_COLOR[f_slot][1], LED_SLOT_COLOR[f_slot][2], std::numeric_limits<int>::max(), LED_BLINK_VSLOW_PERIOD, true);
+    led.blink(LED_SLOT_COLOR[f_slot], LED_ENDLESS_CYCLES, LED_BLINK_VSLOW_PERIOD, true);
   }
 }
 
@@ -559,8 +1440,7 @@ void button2_pressed() {
     case INTERFACE_MAIN:
       f_slot = 0;
       load_bank_mapping();
-      led.on(LED_SLOT_COLOR[f_slot][0], LED_SLOT_COLOR[f_slot][1], LED_SLOT_COLOR[f_slot][2]);
-      led.blink(LED_SLOT_COLOR[f_slot][0], LED_SLOT_COLOR[f_slot][1], LED_SLOT_COLOR[f_slot][2], f_bank+1, LED_BLINK_SLOW_PERIOD, true);
+      show_bank_slot();
       break;
     case INTERFACE_SETTINGS:
       switch (f_settings_index) {
@@ -569,12 +1449,14 @@ void button2_pressed() {
           break;
         case SETTINGS_KICK_ENABLE:
           f_kick_ped_enabled = !f_kick_ped_enabled;
+          load_trigger_params();
           break;
         case SETTINGS_UART_MIDI_ENABLE:
           f_uart_midi_enabled = !f_uart_midi_enabled;
           break;
         case SETTINGS_CC_ENABLE:
           f_cc_ped_enabled = !f_cc_ped_enabled;
+          load_trigger_params();
           break;
         case SETTINGS_VEL_CURVE:
           f_vel_map_profile = integer_up(f_vel_map_profile, 3);
@@ -586,26 +1468,14 @@ void button2_pressed() {
       break;
     case INTERFACE_EDIT_BANK:
       if (f_sensor_selected) {
-        if (f_selected_sensor_id < 12) { // Pads selected
-          int note_num = config.mapping_bank[f_bank][f_slot][f_selected_sensor_id];
-          note_num = integer_up(note_num, 128);
-          config.mapping_bank[f_bank][f_slot][f_selected_sensor_id] = note_num;
-          pads_array[f_selected_sensor_id].set_note_num(note_num);
-        }
-        else if (f_selected_sensor_id == 12) { // Kick pedal selected
-          int note_num = config.mapping_bank_kick[f_bank][f_slot];
-          note_num = integer_up(note_num, 128);
-          config.mapping_bank_kick[f_bank][f_slot] = note_num;
-          kick_pad.set_note_num(note_num);
-        }
-        else if (f_selected_sensor_id == 13) { // CC pedal selected
-          int cc_num = config.mapping_bank_cc[f_bank][f_slot];
-          cc_num = integer_up(cc_num, 128);
-          config.mapping_bank_cc[f_bank][f_slot] = cc_num;
-          cc_pedal.set_cc_num(cc_num);
-        }
+        uint8 *mapping = active_mapping(f_selected_sensor_id);
+        *mapping = integer_up(*mapping, 128);
+        load_bank_mapping();
       }
       break;
+    case INTERFACE_VELOCITY_LEARN:
+      velocity_learn_finish();
+      break;
   }
 }
 
@@ -613,24 +1483,9 @@ void button2_long_pressed() {
   switch (f_interface_level) {
     case INTERFACE_EDIT_BANK:
       if (f_sensor_selected) {
-        if (f_selected_sensor_id < 12) { // Pads selected
-          int note_num = config.mapping_bank[f_bank][f_slot][f_selected_sensor_id];
-          note_num = integer_shifter(note_num, 12, 128);
-          config.mapping_bank[f_bank][f_slot][f_selected_sensor_id] = note_num;
-          pads_array[f_selected_sensor_id].set_note_num(note_num);
-        }
-        else if (f_selected_sensor_id == 12) { // Kick pedal selected
-          int note_num = config.mapping_bank_kick[f_bank][f_slot];
-          note_num = integer_shifter(note_num, 12, 128);
-          config.mapping_bank_kick[f_bank][f_slot] = note_num;
-          kick_pad.set_note_num(note_num);
-        }
-        else if (f_selected_sensor_id == 13) { // CC pedal selected
-          int cc_num = config.mapping_bank_cc[f_bank][f_slot];
-          cc_num = integer_shifter(cc_num, 12, 128);
-          config.mapping_bank_cc[f_bank][f_slot] = cc_num;
-          cc_pedal.set_cc_num(cc_num);
-        }
+        uint8 *mapping = active_mapping(f_selected_sensor_id);
+        *mapping = integer_shifter(*mapping, 12, 128);
+        load_bank_mapping();
       }
       break;
   }
@@ -641,8 +1496,7 @@ void button3_pressed() {
     case INTERFACE_MAIN:
       f_slot = 1;
       load_bank_mapping();
-      led.on(LED_SLOT_COLOR[f_slot][0], LED_SLOT_COLOR[f_slot][1], LED_SLOT_COLOR[f_slot][2]);
-      led.blink(LED_SLOT_COLOR[f_slot][0], LED_SLOT_COLOR[f_slot][1], LED_SLOT_COLOR[f_slot][2], f_bank+1, LED_BLINK_SLOW_PERIOD, true);
+      show_bank_slot();
       break;
     case INTERFACE_SETTINGS:
       switch (f_settings_index) {
@@ -651,12 +1505,14 @@ void button3_pressed() {
           break;
         case SETTINGS_KICK_ENABLE:
           f_kick_ped_enabled = !f_kick_ped_enabled;
+          load_trigger_params();
           break;
         case SETTINGS_UART_MIDI_ENABLE:
           f_uart_midi_enabled = !f_uart_midi_enabled;
           break;
         case SETTINGS_CC_ENABLE:
           f_cc_ped_enabled = !f_cc_ped_enabled;
+          load_trigger_params();
           break;
         case SETTINGS_VEL_CURVE:
           f_vel_map_profile = integer_down(f_vel_map_profile, 3);
@@ -668,26 +1524,14 @@ void button3_pressed() {
       break;
     case INTERFACE_EDIT_BANK:
       if (f_sensor_selected) {
-        if (f_selected_sensor_id < 12) { // Pads selected
-          int note_num = config.mapping_bank[f_bank][f_slot][f_selected_sensor_id];
-          note_num = integer_down(note_num, 128);
-          config.mapping_bank[f_bank][f_slot][f_selected_sensor_id] = note_num;
-          pads_array[f_selected_sensor_id].set_note_num(note_num);
-        }
-        else if (f_selected_sensor_id == 12) { // Kick pedal selected
-          int note_num = config.mapping_bank_kick[f_bank][f_slot];
-          note_num = integer_down(note_num, 128);
-          config.mapping_bank_kick[f_bank][f_slot] = note_num;
-          kick_pad.set_note_num(note_num);
-        }
-        else if (f_selected_sensor_id == 13) { // CC pedal selected
-          int cc_num = config.mapping_bank_cc[f_bank][f_slot];
-          cc_num = integer_down(cc_num, 128);
-          config.mapping_bank_cc[f_bank][f_slot] = cc_num;
-          cc_pedal.set_cc_num(cc_num);
-        }
+        uint8 *mapping = active_mapping(f_selected_sensor_id);
+        *mapping = integer_down(*mapping, 128);
+        load_bank_mapping();
       }
       break;
+    case INTERFACE_VELOCITY_LEARN:
+      velocity_learn_clear();
+      break;
   }  
 }
 
@@ -695,24 +1539,9 @@ void button3_long_pressed() {
   switch (f_interface_level) {
     case INTERFACE_EDIT_BANK:
       if (f_sensor_selected) {
-        if (f_selected_sensor_id < 12) { // Pads selected
-          int note_num = config.mapping_bank[f_bank][f_slot][f_selected_sensor_id];
-          note_num = integer_shifter(note_num, -12, 128);
-          config.mapping_bank[f_bank][f_slot][f_selected_sensor_id] = note_num;
-          pads_array[f_selected_sensor_id].set_note_num(note_num);
-        }
-        else if (f_selected_sensor_id == 12) { // Kick pedal selected
-          int note_num = config.mapping_bank_kick[f_bank][f_slot];
-          note_num = integer_shifter(note_num, -12, 128);
-          config.mapping_bank_kick[f_bank][f_slot] = note_num;
-          kick_pad.set_note_num(note_num);
-        }
-        else if (f_selected_sensor_id == 13) { // CC pedal selected
-          int cc_num = config.mapping_bank_cc[f_bank][f_slot];
-          cc_num = integer_shifter(cc_num, -12, 128);
-          config.mapping_bank_cc[f_bank][f_slot] = cc_num;
-          cc_pedal.set_cc_num(cc_num);
-        }
+        uint8 *mapping = active_mapping(f_selected_sensor_id);
+        *mapping = integer_shifter(*mapping, -12, 128);
+        load_bank_mapping();
       }
       break;
   }
@@ -723,20 +1552,18 @@ void button4_pressed() {
     case INTERFACE_MAIN:
       f_slot = 2;
       load_bank_mapping();
-      led.on(LED_SLOT_COLOR[f_slot][0], LED_SLOT_COLOR[f_slot][1], LED_SLOT_COLOR[f_slot][2]);
-      led.blink(LED_SLOT_COLOR[f_slot][0], LED_SLOT_COLOR[f_slot][1], LED_SLOT_COLOR[f_slot][2], f_bank+1, LED_BLINK_SLOW_PERIOD, true);
+      show_bank_slot();
       break;
     case INTERFACE_SETTINGS:
       f_interface_level = INTERFACE_MAIN;
-      led.on(LED_SLOT_COLOR[f_slot][0], LED_SLOT_COLOR[f_slot][1], LED_SLOT_COLOR[f_slot][2]);
-      led.blink(LED_SLOT_COLOR[f_slot][0], LED_SLOT_COLOR[f_slot][1], LED_SLOT_COLOR[f_slot][2], f_bank+1, LED_BLINK_SLOW_PERIOD, true);
+      show_bank_slot();
       break;
     case INTERFACE_EDIT_BANK:
+    case INTERFACE_VELOCITY_LEARN:
       f_interface_level = INTERFACE_MAIN;
       f_sensor_selected = false;
       f_selected_sensor_id = 0;
-      led.on(LED_SLOT_COLOR[f_slot][0], LED_SLOT_COLOR[f_slot][1], LED_SLOT_COLOR[f_slot][2]);
-      led.blink(LED_SLOT_COLOR[f_slot][0], LED_SLOT_COLOR[f_slot][1], LED_SLOT_COLOR[f_slot][2], f_bank+1, LED_BLINK_SLOW_PERIOD, true);
+      show_bank_slot();
       break;
   }  
 }
@@ -746,70 +1573,205 @@ void button5_pressed() {
     case INTERFACE_MAIN:
       f_slot = 3;
       load_bank_mapping();
-      led.on(LED_SLOT_COLOR[f_slot][0], LED_SLOT_COLOR[f_slot][1], LED_SLOT_COLOR[f_slot][2]);
-      led.blink(LED_SLOT_COLOR[f_slot][0], LED_SLOT_COLOR[f_slot][1], LED_SLOT_COLOR[f_slot][2], f_bank+1, LED_BLINK_SLOW_PERIOD, true);
+      show_bank_slot();
       break;
     case INTERFACE_SETTINGS:
       save_all_config();
-      led.blink(1,1,1,5, LED_BLINK_FAST_PERIOD, true); //Blink quickly for 5 cycles to indicate saved
+      led.blink(LED_WHITE, 5, LED_BLINK_FAST_PERIOD, true); //Blink quickly for 5 cycles to indicate saved
       break;
   }  
 }
 
-// ===== Serial configuration =====
-
-void send_json_config() {
-  send_json_config(config);
+void button5_long_pressed() {
+  if (f_interface_level == INTERFACE_MAIN) {
+    f_interface_level = INTERFACE_VELOCITY_LEARN;
+    f_sensor_selected = false;
+    learn_hits = 0;
+    led.blink(LED_LEARN_COLOR, LED_ENDLESS_CYCLES, LED_BLINK_VSLOW_PERIOD, true);
+  }
 }
 
-void send_json_config(configStructure config) {
-  JsonDocument doc;
-
-  doc["uart_midi_enabled"] = config.uart_midi_enabled;
-  doc["midi_channel_num"] = config.midi_channel_num;
-  doc["vel_map_profile"] = config.vel_map_profile;
-  doc["kick_vel_map_profile"] = config.kick_vel_map_profile;
-  doc["cc_ped_enabled"] = config.cc_ped_enabled;
-  doc["kick_ped_enabled"] = config.kick_ped_enabled;
+// ===== Serial configuration =====
 
-  for (int bank=0; bank<4; bank++) {
-    for (int slot=0; slot<4; slot++) {
-      for (int i=0; i<12; i++) {
-        doc["mapping_bank"][bank][slot][i] = config.mapping_bank[bank][slot][i];
-      }
-      doc["mapping_bank_kick"][bank][slot] = config.mapping_bank_kick[bank][slot];
-      doc["mapping_bank_cc"][bank][slot] = config.mapping_bank_cc[bank][slot];
-    }
+/// @brief Start sending a reply
+/// @return false if another reply is still being sent, which is left to finish
+bool serial_reply_begin(serial_reply_writer writer) {
+  if (serial_reply != 0) {
+    return false;
   }
+  serial_reply = writer;
+  serial_reply_part = 0;
+  return true;
+}
 
-  serializeJson(doc, CompositeSerial);
+/// @brief Send the next part of the reply if the transmit buffer has room for it
+void serial_reply_poll() {
+  if (!serial_reply_budget.take(SERIAL_REPLY_PART_MAX)) {
+    return;
+  }
+  if (!serial_reply(serial_reply_part++)) {
+    serial_reply = 0;
+  }
 }
 
-void receive_json_config() {
-  JsonDocument doc;
-
-  String raw_recv = CompositeSerial.readStringUntil('}');
-  raw_recv += '}';
-
-  const auto deser_err = deserializeJson(doc, raw_recv);
-  if (!deser_err) {
-    config.uart_midi_enabled = doc["uart_midi_enabled"];
-    config.midi_channel_num = doc["midi_channel_num"];
-    config.vel_map_profile = doc["vel_map_profile"];
-    config.kick_vel_map_profile = doc["kick_vel_map_profile"];
-    config.cc_ped_enabled = doc["cc_ped_enabled"];
-    config.kick_ped_enabled = doc["kick_ped_enabled"];
-
-    for (int bank=0; bank<4; bank++) {
-      for (int slot=0; slot<4; slot++) {
-        for (int i=0; i<12; i++) {
-          config.mapping_bank[bank][slot][i] = doc["mapping_bank"][bank][slot][i];
-        }
-        config.mapping_bank_kick[bank][slot] = doc["mapping_bank_kick"][bank][slot];
-        config.mapping_bank_cc[bank][slot] = doc["mapping_bank_cc"][bank][slot];
-      }
-    } 
-    
+/// @brief Stream config as JSON straight to the serial port, without building a document in RAM. Parts: the settings in
+/// 3, then every slot of every bank, then every sensor of the sensor table.
+bool send_json_config(int part) {
+  const int MAPPING_PART = 3;
+  const int TRIGGER_PART = MAPPING_PART + 4*4;
+  const int END_PART = TRIGGER_PART + NUM_SENSORS;
+
+  if (part == 0) {
+    CompositeSerial.print("{\"uart_midi_enabled\":");
+    CompositeSerial.print(config.uart_midi_enabled ? "true" : "false");
+    CompositeSerial.print(",\"midi_channel_num\":");
+    CompositeSerial.print((int)config.midi_channel_num);
+    CompositeSerial.print(",\"vel_map_profile\":");
+    CompositeSerial.print((int)config.vel_map_profile);
+    CompositeSerial.print(",\"kick_vel_map_profile\":");
+    CompositeSerial.print((int)config.kick_vel_map_profile);
+  }
+  else if (part == 1) {
+    CompositeSerial.print(",\"cc_ped_enabled\":");
+    CompositeSerial.print(config.cc_ped_enabled ? "true" : "false");
+    CompositeSerial.print(",\"kick_ped_enabled\":");
+    CompositeSerial.print(config.kick_ped_enabled ? "true" : "false");
+    CompositeSerial.print(",\"output_delay_us\":");
+    CompositeSerial.print((int)config.output_delay);
+    CompositeSerial.print(",\"idle_sleep\":");
+    CompositeSerial.print(config.idle_sleep ? "true" : "false");
+  }
+  else if (part == 2) {
+    CompositeSerial.print(",\"mux_settle_us\":");
+    send_json_array(config.mux_settle_time, NUM_MUX_SENSORS);
+  }
+  else if (part < TRIGGER_PART) {
+    int bank = (part - MAPPING_PART)/4;
+    int slot = (part - MAPPING_PART)%4;
+    if (slot == 0) {
+      CompositeSerial.print(bank == 0 ? ",\"mapping_bank\":[[" : "],[");
+    }
+    else {
+      CompositeSerial.print(',');
+    }
+    send_json_array(config.mapping_bank[bank][slot], NUM_SENSORS);
+  }
+  else if (part < END_PART) {
+    int i = part - TRIGGER_PART;
+    const triggerParams &params = config.trigger_params[i];
+    CompositeSerial.print(i == 0 ? "]],\"trigger_params\":[[" : ",[");
+    CompositeSerial.print((int)params.threshold_high);
+    CompositeSerial.print(',');
+    CompositeSerial.print((int)params.threshold_low);
+    CompositeSerial.print(',');
+    CompositeSerial.print((int)params.sample_period);
+    CompositeSerial.print(',');
+    CompositeSerial.print((int)params.window);
+    CompositeSerial.print(',');
+    CompositeSerial.print((int)params.cooldown);
+    CompositeSerial.print(',');
+    CompositeSerial.print((int)params.curve);
+    CompositeSerial.print(',');
+    CompositeSerial.print((int)params.estimator);
+    CompositeSerial.print(',');
+    CompositeSerial.print((int)params.attack_window);
+    CompositeSerial.print(',');
+    CompositeSerial.print((int)params.type);
+    CompositeSerial.print(']');
+  }
+  else {
+    CompositeSerial.print("]}");
+    return false;
+  }
+  return true;
+}
+
+/// @brief Stream an array of integers as JSON
+void send_json_array(const uint8 *values, size_t length) {
+  CompositeSerial.print('[');
+  for (size_t i=0; i<length; i++) {
+    if (i != 0) {
+      CompositeSerial.print(',');
+    }
+    CompositeSerial.print((int)values[i]);
+  }
+  CompositeSerial.print(']');
+}
+
+// The JSON text of the 's', 'p' and 'a' commands is parsed as it arrives, at most JSON_RECV_MAX_BYTES per run of the
+// serial task, so a slow, endless or malformed text never holds the other tasks for longer than that. The text ends at
+// its first '}'. Once it is known to be invalid, the rest is skipped up to that '}' and answered with E, as is a text
+// longer than JSON_RECV_MAX_LENGTH or not complete within JSON_RECV_TIMEOUT. Values are range checked by the handlers
+// and only applied once the whole text is read successfully.
+//
+// RAM of this path from the 'm' report of the config_push scenario of the simulator, before any command (at 50 ms and
+// 400 ms into a roll) and after 'g', 's' with the full configuration and 'g' again: min_free 62216 and 62216 bytes, so
+// sending and receiving the configuration goes no deeper in the stack than the rest of the firmware. json_reader and
+// config_recv (80 and 530 bytes on the host) are static, and nothing here allocates from the heap. The heap_used and
+// heap_size of the simulator (105696 and 135168 bytes, then 119360 and 278528) are those of the simulator itself, which
+// grows its serial log. These are host figures; the device reports its own with the same command.
+
+JsonReader json_reader;
+/// @brief Command whose JSON text is being received, 0 if none
+char json_recv_command = 0;
+uint32 json_recv_length;
+uint32 json_recv_start_micros;
+/// @brief Longest run of the serial task receiving JSON text, applying it included
+uint32 json_recv_max_cycles = 0;
+
+void receive_json_begin(char command, json_value_handler handler, void *context) {
+  json_reader.begin(handler, context);
+  json_recv_command = command;
+  json_recv_length = 0;
+  json_recv_start_micros = micros();
+}
+
+void receive_json_poll() {
+  uint32 start_cycles = cycle_count();
+  bool ended = false;
+  for (int i=0; (i<JSON_RECV_MAX_BYTES) && !ended && CompositeSerial.available(); i++) {
+    char c = CompositeSerial.read();
+    json_recv_length++;
+    json_reader.feed(c);
+    ended = (c == '}');
+  }
+
+  if (ended || (micros() - json_recv_start_micros > JSON_RECV_TIMEOUT)) {
+    bool success = ended && (json_reader.status() == JSON_OK) && (json_recv_length <= JSON_RECV_MAX_LENGTH);
+    switch (json_recv_command) {
+      case 's':
+        receive_json_config_end(success);
+        break;
+      case 'p':
+        receive_json_trigger_params_end(success);
+        break;
+      case 'a':
+        receive_json_preset_end(success);
+        break;
+      case 'h':
+        receive_json_load_test_end(success);
+        break;
+    }
+    json_recv_command = 0;
+  }
+
+  uint32 cycles = cycle_count() - start_cycles;
+  if (cycles > json_recv_max_cycles) {
+    json_recv_max_cycles = cycles;
+  }
+}
+
+/// @brief Configuration being received, only copied into config once the whole JSON is read successfully
+configStructure config_recv;
+
+void receive_json_config() {
+  config_recv = config;
+  receive_json_begin('s', config_value_handler, &config_recv);
+}
+
+void receive_json_config_end(bool success) {
+  if (success) {
+    config = config_recv;
     load_all_config();
     CompositeSerial.println("S");
   }
@@ -818,18 +1780,916 @@ void receive_json_config() {
   }
 }
 
+/// @brief Store a value read from the JSON configuration into the configStructure passed as context
+/// @return false if the key is unknown or the indices are out of range
+bool config_value_handler(const char *key, const int *indices, int depth, int32_t value, void *context) {
+  configStructure *target = (configStructure *)context;
+
+  if (depth == 0) {
+    bool is_bool = (value == 0) || (value == 1);
+    // The velocity map profiles index VEL_MAP_COEFF_*
+    bool is_profile = (value >= 0) && (value < VEL_MAP_NUM_PROFILES);
+    if ((strcmp(key, "uart_midi_enabled") == 0) && is_bool) {
+      target->uart_midi_enabled = value;
+    }
+    else if ((strcmp(key, "midi_channel_num") == 0) && (value >= 0) && (value <= 16)) {
+      target->midi_channel_num = value;
+    }
+    else if ((strcmp(key, "vel_map_profile") == 0) && is_profile) {
+      target->vel_map_profile = value;
+    }
+    else if ((strcmp(key, "kick_vel_map_profile") == 0) && is_profile) {
+      target->kick_vel_map_profile = value;
+    }
+    else if ((strcmp(key, "cc_ped_enabled") == 0) && is_bool) {
+      target->cc_ped_enabled = value;
+    }
+    else if ((strcmp(key, "kick_ped_enabled") == 0) && is_bool) {
+      target->kick_ped_enabled = value;
+    }
+    else if ((strcmp(key, "output_delay_us") == 0) && (value >= 0) && (value <= MAX_OUTPUT_DELAY)) {
+      target->output_delay = value;
+    }
+    else if ((strcmp(key, "idle_sleep") == 0) && is_bool) {
+      target->idle_sleep = value;
+    }
+    else {
+      return false;
+    }
+    return true;
+  }
+
+  if ((depth == 1) && (strcmp(key, "mux_settle_us") == 0)) {
+    if ((indices[0] >= NUM_MUX_SENSORS) || (value < MIN_MUX_SETTLE_TIME) || (value > MAX_MUX_SETTLE_TIME)) {
+      return false;
+    }
+    target->mux_settle_time[indices[0]] = value;
+    return true;
+  }
+
+  if ((depth == 2) && (strcmp(key, "trigger_params") == 0)) {
+    if ((indices[0] >= NUM_SENSORS) || (indices[1] >= TRIGGER_PARAMS_NUM_FIELDS)) {
+      return false;
+    }
+    return trigger_params_set_field(&target->trigger_params[indices[0]], indices[1], value);
+  }
+
+  if ((indices[0] >= 4) || ((depth >= 2) && (indices[1] >= 4)) || (value < 0) || (value > 127)) {
+    return false;
+  }
+  if ((depth == 3) && (strcmp(key, "mapping_bank") == 0) && (indices[2] < NUM_SENSORS)) {
+    target->mapping_bank[indices[0]][indices[1]][indices[2]] = value;
+  }
+  // Mappings of the kick and CC pedal from configurations saved before the sensor table
+  else if ((depth == 2) && (strcmp(key, "mapping_bank_kick") == 0)) {
+    target->mapping_bank[indices[0]][indices[1]][NUM_MUX_SENSORS] = value;
+  }
+  else if ((depth == 2) && (strcmp(key, "mapping_bank_cc") == 0)) {
+    target->mapping_bank[indices[0]][indices[1]][NUM_MUX_SENSORS+1] = value;
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+/// @brief Names of the triggerParams fields, in the order of the JSON arrays
+const char *const TRIGGER_PARAMS_FIELDS[TRIGGER_PARAMS_NUM_FIELDS] = {"threshold_high", "threshold_low", "sample_period", "window_us", "cooldown_us", "curve", "estimator", "attack_window", "type"};
+
+/// @brief Set a field of a triggerParams by its index in TRIGGER_PARAMS_FIELDS
+/// @return false if the field or the value is out of range
+bool trigger_params_set_field(triggerParams *params, int field, int32_t value) {
+  switch (field) {
+    case 0:
+    case 1:
+      if ((value < 0) || (value > 4095)) {
+        return false;
+      }
+      if (field == 0) {
+        params->threshold_high = value;
+      }
+      else {
+        params->threshold_low = value;
+      }
+      return true;
+    case 2:
+      // 0 for the default period. A shorter period than a sample would keep the input always due.
+      if ((value < 0) || (value > 65535) || ((value != 0) && (value < pads_bank.input_sample_time()))) {
+        return false;
+      }
+      params->sample_period = value;
+      return true;
+    case 3:
+      if ((value < PADS_MIN_WINDOW_TIME) || (value > 65535)) {
+        return false;
+      }
+      params->window = value;
+      return true;
+    case 4:
+      if ((value < PADS_MIN_COOLDOWN_TIME) || (value > 65535)) {
+        return false;
+      }
+      params->cooldown = value;
+      return true;
+    case 5:
+      if ((value < 0) || (value > 3)) {
+        return false;
+      }
+      params->curve = value;
+      return true;
+    case 6:
+      if ((value != VEL_ESTIMATOR_PEAK) && (value != VEL_ESTIMATOR_AREA)) {
+        return false;
+      }
+      params->estimator = value;
+      return true;
+    case 7:
+      if ((value < 1) || (value > PadBank<NUM_SENSORS, PADS_BUFFER_SIZE>::MAX_ATTACK_WINDOW)) {
+        return false;
+      }
+      params->attack_window = value;
+      return true;
+    case 8:
+      if ((value < SENSOR_NONE) || (value > SENSOR_SWITCH)) {
+        return false;
+      }
+      params->type = value;
+      return true;
+    default:
+      return false;
+  }
+}
+
+/// @brief Trigger parameters of a single sensor being received by the 'p' command
+struct triggerParamsEdit {
+  int sensor_id;
+  int32_t values[TRIGGER_PARAMS_NUM_FIELDS];
+  bool is_set[TRIGGER_PARAMS_NUM_FIELDS];
+};
+
+triggerParamsEdit trigger_params_recv;
+
+/// @brief Edit the sensor table entry of a single sensor, e.g. {"sensor":6,"threshold_high":60,"window_us":1000} or {"sensor":12,"type":1}
+/// Fields that are not given are kept. The new parameters apply immediately and are saved to flash with the 'w' command.
+void receive_json_trigger_params() {
+  trigger_params_recv.sensor_id = -1;
+  for (int i=0; i<TRIGGER_PARAMS_NUM_FIELDS; i++) {
+    trigger_params_recv.is_set[i] = false;
+  }
+  receive_json_begin('p', trigger_params_value_handler, &trigger_params_recv);
+}
+
+void receive_json_trigger_params_end(bool success) {
+  const triggerParamsEdit &edit = trigger_params_recv;
+  if (!success || (edit.sensor_id == -1)) {
+    CompositeSerial.println("E");
+    return;
+  }
+
+  triggerParams params = config.trigger_params[edit.sensor_id];
+  for (int i=0; i<TRIGGER_PARAMS_NUM_FIELDS; i++) {
+    if (edit.is_set[i] && !trigger_params_set_field(&params, i, edit.values[i])) {
+      CompositeSerial.println("E");
+      return;
+    }
+  }
+  config.trigger_params[edit.sensor_id] = params;
+  load_trigger_params();
+  CompositeSerial.println("S");
+}
+
+/// @brief Store a value read by the 'p' command into the triggerParamsEdit passed as context
+bool trigger_params_value_handler(const char *key, const int *indices, int depth, int32_t value, void *context) {
+  triggerParamsEdit *edit = (triggerParamsEdit *)context;
+
+  if (depth != 0) {
+    return false;
+  }
+  if (strcmp(key, "sensor") == 0) {
+    if ((value < 0) || (value >= NUM_SENSORS)) {
+      return false;
+    }
+    edit->sensor_id = value;
+    return true;
+  }
+  for (int i=0; i<TRIGGER_PARAMS_NUM_FIELDS; i++) {
+    if (strcmp(key, TRIGGER_PARAMS_FIELDS[i]) == 0) {
+      edit->values[i] = value;
+      edit->is_set[i] = true;
+      return true;
+    }
+  }
+  return false;
+}
+
+/// @brief Send every kit of the preset library, with the flash usage in bytes
+bool send_preset_library(int part) {
+  uint8 kits[PRESET_BANK_SIZE][PRESET_KIT_SIZE];
+
+  if (part == 0) {
+    CompositeSerial.print("{\"kits\":[");
+  }
+  int kit = part - 1;
+  if ((kit >= 0) && (kit < preset_library.num_kits())) {
+    preset_library.load_bank(kit/PRESET_BANK_SIZE, kits);
+    if (kit != 0) {
+      CompositeSerial.print(',');
+    }
+    send_json_array(kits[kit%PRESET_BANK_SIZE], PRESET_KIT_SIZE);
+    return true;
+  }
+  if (kit >= 0) {
+    CompositeSerial.print("],\"bytes_used\":");
+    CompositeSerial.print(preset_library.bytes_used());
+    CompositeSerial.print(",\"capacity\":");
+    CompositeSerial.print(preset_library.capacity());
+    CompositeSerial.println("}");
+    return false;
+  }
+  return true;
+}
+
+/// @brief Kit being received by the 'a' command
+struct presetKit {
+  uint8 notes[PRESET_KIT_SIZE];
+  int count;
+};
+
+presetKit preset_recv;
+
+/// @brief Append a kit to the preset library, e.g. {"notes":[43,41,36,41,43,47,38,47,49,46,42,51,0,0,0,0,36,4]}
+/// Notes, or CC numbers, are given for every sensor id. Every PRESET_BANK_SIZE kits form a new bank.
+void receive_json_preset() {
+  preset_recv.count = 0;
+  receive_json_begin('a', preset_value_handler, &preset_recv);
+}
+
+void receive_json_preset_end(bool success) {
+  const presetKit &kit = preset_recv;
+  if (!success || (kit.count != PRESET_KIT_SIZE)) {
+    CompositeSerial.println("E");
+    return;
+  }
+
+  int bank = NUM_CONFIG_BANKS + preset_library.num_kits()/PRESET_BANK_SIZE;
+  if (!preset_library.append_kit(kit.notes)) {
+    CompositeSerial.println("E");
+    return;
+  }
+  if (bank == preset_bank_loaded) {
+    preset_bank_loaded = -1;
+    load_bank_mapping();
+  }
+  CompositeSerial.println("S");
+}
+
+/// @brief Store a note read by the 'a' command into the presetKit passed as context
+bool preset_value_handler(const char *key, const int *indices, int depth, int32_t value, void *context) {
+  presetKit *kit = (presetKit *)context;
+
+  if ((depth != 1) || (strcmp(key, "notes") != 0) || (indices[0] != kit->count) || (indices[0] >= PRESET_KIT_SIZE)) {
+    return false;
+  }
+  if ((value < 0) || (value > 127)) {
+    return false;
+  }
+  kit->notes[kit->count++] = value;
+  return true;
+}
+
+/// @brief Erase the preset library and go back to the first bank if a preset library bank was selected
+void erase_preset_library() {
+  if (preset_library.erase()) {
+    CompositeSerial.println("S");
+  }
+  else {
+    CompositeSerial.println("E");
+  }
+  preset_bank_loaded = -1;
+  if (f_bank >= NUM_CONFIG_BANKS) {
+    f_bank = 0;
+    load_bank_mapping();
+  }
+}
+
+/// @brief Send the learnt velocity tables, with the flash usage in bytes. Point i of a table is the trigger reading giving the
+/// velocity 1 + 126*i/(points-1), e.g. {"points":16,"tables":[{"id":2,"readings":[180,...,3900]}],"bytes_used":72,"capacity":1024}
+bool send_velocity_tables(int part) {
+  const int HALF_POINTS = VELOCITY_TABLE_POINTS/2;
+  uint16 points[VELOCITY_TABLE_POINTS];
+
+  if (part == 0) {
+    CompositeSerial.print("{\"points\":");
+    CompositeSerial.print(VELOCITY_TABLE_POINTS);
+    CompositeSerial.print(",\"tables\":[");
+    return true;
+  }
+  int sensor = (part - 1)/2;
+  int half = (part - 1)%2;
+  if (sensor >= NUM_SENSORS) {
+    CompositeSerial.print("],\"bytes_used\":");
+    CompositeSerial.print(velocity_tables.bytes_used());
+    CompositeSerial.print(",\"capacity\":");
+    CompositeSerial.print(velocity_tables.capacity());
+    CompositeSerial.println("}");
+    return false;
+  }
+  if (!velocity_tables.get_table(sensor, points)) {
+    return true;
+  }
+
+  if (half == 0) {
+    bool first = true;
+    for (int i=0; (i<sensor) && first; i++) {
+      first = !velocity_tables.has_table(i);
+    }
+    CompositeSerial.print(first ? "{\"id\":" : ",{\"id\":");
+    CompositeSerial.print(sensor);
+    CompositeSerial.print(",\"readings\":[");
+  }
+  for (int j=half*HALF_POINTS; j<(half+1)*HALF_POINTS; j++) {
+    if (j != 0) {
+      CompositeSerial.print(',');
+    }
+    CompositeSerial.print(points[j]);
+  }
+  if (half == 1) {
+    CompositeSerial.print("]}");
+  }
+  return true;
+}
+
+/// @brief Remove every learnt velocity table, every sensor goes back to its velocity curve
+void erase_velocity_tables() {
+  if (velocity_tables.erase()) {
+    CompositeSerial.println("S");
+  }
+  else {
+    CompositeSerial.println("E");
+  }
+}
+
+/// @brief Report the signal quality of every sensor in use, one array per sensor in the order of "fields".
+/// baseline, noise_rms and the peaks are in ADC counts, snr_db compares the mean peak above the baseline with the noise.
+/// peak_hist counts the triggers in each 1/8 of the full scale. health is a PAD_HEALTH_* value, a sensor other than
+/// PAD_HEALTH_OK being excluded from the scan, and faults the number of times it was excluded. health_log lists the last
+/// health changes as [time_ms, id, health], oldest first.
+bool send_signal_diagnostics(int part) {
+  const int SENSOR_PART = 2;
+  const int LOG_PART = SENSOR_PART + 2*NUM_SENSORS;
+
+  if (part == 0) {
+    CompositeSerial.print("{\"fields\":[\"id\",\"baseline\",\"noise_rms\",\"snr_db\",\"clips\",\"triggers\",");
+  }
+  else if (part == 1) {
+    CompositeSerial.print("\"peak_min\",\"peak_mean\",\"peak_max\",\"peak_hist\",\"health\",\"faults\"],\"sensors\":[");
+  }
+  else if (part < LOG_PART) { // Half a sensor per part
+    int sensor = (part - SENSOR_PART)/2;
+    if (pads_bank.get_mode(sensor) != PAD_MODE_OFF) {
+      send_signal_stats(sensor, pads_bank.get_stats(sensor), (part - SENSOR_PART)%2);
+    }
+  }
+  else if (part == LOG_PART) {
+    CompositeSerial.print("],\"health_log\":");
+    send_health_log(0);
+  }
+  else {
+    send_health_log(1);
+    CompositeSerial.println("}");
+    return false;
+  }
+  return true;
+}
+
+/// @brief Stream the statistics of a single sensor as a JSON array, in two halves
+void send_signal_stats(int sensor_id, SignalStats &stats, int half) {
+  if (half == 1) {
+    CompositeSerial.print(",[");
+    for (int bucket=0; bucket<SIGNAL_STATS_HIST_BUCKETS; bucket++) {
+      if (bucket != 0) {
+        CompositeSerial.print(',');
+      }
+      CompositeSerial.print((int)stats.get_peak_hist(bucket));
+    }
+    CompositeSerial.print("],");
+    CompositeSerial.print(pads_bank.get_health(sensor_id));
+    CompositeSerial.print(',');
+    CompositeSerial.print(pads_bank.get_fault_count(sensor_id));
+    CompositeSerial.print(']');
+    return;
+  }
+
+  bool first = true;
+  for (int i=0; (i<sensor_id) && first; i++) {
+    first = (pads_bank.get_mode(i) == PAD_MODE_OFF);
+  }
+  CompositeSerial.print(first ? "[" : ",[");
+  CompositeSerial.print(sensor_id);
+  CompositeSerial.print(',');
+  CompositeSerial.print(stats.get_baseline(), 1);
+  CompositeSerial.print(',');
+  CompositeSerial.print(stats.get_noise_rms(), 1);
+  CompositeSerial.print(',');
+  CompositeSerial.print(stats.get_snr_db(), 1);
+  CompositeSerial.print(',');
+  CompositeSerial.print(stats.get_clips());
+  CompositeSerial.print(',');
+  CompositeSerial.print(stats.get_triggers());
+  CompositeSerial.print(',');
+  CompositeSerial.print((int)stats.get_peak_min());
+  CompositeSerial.print(',');
+  CompositeSerial.print(stats.get_peak_mean(), 0);
+  CompositeSerial.print(',');
+  CompositeSerial.print((int)stats.get_peak_max());
+}
+
+/// @brief Stream the health log as a JSON array, in two halves
+void send_health_log(int half) {
+  uint32 first = (health_log_count > SENSOR_HEALTH_LOG_SIZE) ? health_log_count - SENSOR_HEALTH_LOG_SIZE : 0;
+  uint32 middle = first + (health_log_count - first)/2;
+  if (half == 0) {
+    CompositeSerial.print('[');
+  }
+  for (uint32 n=(half == 0) ? first : middle; n<((half == 0) ? middle : health_log_count); n++) {
+    const sensorHealthEvent &event = health_log[n % SENSOR_HEALTH_LOG_SIZE];
+    if (n != first) {
+      CompositeSerial.print(',');
+    }
+    CompositeSerial.print('[');
+    CompositeSerial.print(event.time_millis);
+    CompositeSerial.print(',');
+    CompositeSerial.print(event.sensor_id);
+    CompositeSerial.print(',');
+    CompositeSerial.print(event.health);
+    CompositeSerial.print(']');
+  }
+  if (half == 1) {
+    CompositeSerial.print(']');
+  }
+}
+
+void reset_signal_diagnostics() {
+  for (int i=0; i<NUM_SENSORS; i++) {
+    pads_bank.get_stats(i).reset();
+  }
+}
+
+/// @brief Report the RAM usage in bytes. min_free is the high-water mark of the stack against the heap since boot.
+bool send_memory_report(int part) {
+  CompositeSerial.print("{\"free\":");
+  CompositeSerial.print(memory_free());
+  CompositeSerial.print(",\"min_free\":");
+  CompositeSerial.print(memory_min_free());
+  CompositeSerial.print(",\"heap_used\":");
+  CompositeSerial.print(memory_heap_used());
+  CompositeSerial.print(",\"heap_size\":");
+  CompositeSerial.print(memory_heap_size());
+  CompositeSerial.println("}");
+  return false;
+}
+
+/// @brief Report the execution time of the acquisition and output stage in microseconds, and the merge stage counters.
+/// The latency added by this unit to a merged message is at most merge_poll_gap_max_us + merge_max_latency_us after
+/// its last byte is received. The delay_* counters measure how late the constant latency mode sends events after their
+/// onset plus f_output_delay, and delay_early the events sent ahead of it to make room in a full delay line. The onset of a
+/// hit is only known to the sampling period of the idle pad, onset_window_*, so delay_jitter_max_us, their sum, is the
+/// spread of the time from a hit to its note. It cannot go below PADS_IDLE_SAMPLING_PERIOD plus the time of a sample
+/// without the onset being interpolated within the sampling window, which is not done.
+bool send_stage_timing(int part) {
+  switch (part) {
+    case 0:
+      CompositeSerial.print("{\"acquisition_us\":");
+      CompositeSerial.print(acquisition_last_micros);
+      CompositeSerial.print(",\"acquisition_max_us\":");
+      CompositeSerial.print(acquisition_max_micros);
+      CompositeSerial.print(",\"output_us\":");
+      CompositeSerial.print(output_last_micros);
+      CompositeSerial.print(",\"output_max_us\":");
+      CompositeSerial.print(output_max_micros);
+      break;
+    case 1:
+      CompositeSerial.print(",\"event_max_latency_us\":");
+      CompositeSerial.print(output_max_latency_micros);
+      CompositeSerial.print(",\"queue_high_water\":");
+      CompositeSerial.print(event_queue.get_high_water());
+      CompositeSerial.print(",\"queue_dropped\":");
+      CompositeSerial.print(event_queue.get_dropped());
+      break;
+    case 2:
+      CompositeSerial.print(",\"detection_lag_max_us\":");
+      CompositeSerial.print(detection_max_lag_micros);
+      CompositeSerial.print(",\"delay_released\":");
+      CompositeSerial.print(delay_released);
+      CompositeSerial.print(",\"delay_late\":");
+      CompositeSerial.print(delay_late);
+      CompositeSerial.print(",\"delay_dropped\":");
+      CompositeSerial.print(delay_line.get_dropped());
+      CompositeSerial.print(",\"delay_early\":");
+      CompositeSerial.print(delay_early);
+      break;
+    case 3:
+      CompositeSerial.print(",\"delay_error_mean_us\":");
+      CompositeSerial.print((delay_released == 0) ? 0.0 : (double)delay_error_sum_micros/delay_released, 1);
+      CompositeSerial.print(",\"delay_error_max_us\":");
+      CompositeSerial.print(delay_max_error_micros);
+      CompositeSerial.print(",\"onset_window_mean_us\":");
+      CompositeSerial.print(pads_bank.get_onset_window_mean(), 1);
+      CompositeSerial.print(",\"onset_window_max_us\":");
+      CompositeSerial.print(pads_bank.get_onset_window_max());
+      break;
+    case 4:
+      CompositeSerial.print(",\"delay_jitter_max_us\":");
+      CompositeSerial.print(pads_bank.get_onset_window_max() + delay_max_error_micros);
+      CompositeSerial.print(",\"merge_messages\":");
+      CompositeSerial.print(merge_messages);
+      break;
+    case 5:
+      CompositeSerial.print(",\"merge_dropped_bytes\":");
+      CompositeSerial.print(merge_parser.get_dropped_bytes());
+      CompositeSerial.print(",\"merge_latency_us\":");
+      CompositeSerial.print(merge_last_latency_micros);
+      CompositeSerial.print(",\"merge_max_latency_us\":");
+      CompositeSerial.print(merge_max_latency_micros);
+      break;
+    case 6:
+      CompositeSerial.print(",\"merge_poll_gap_max_us\":");
+      CompositeSerial.print(merge_max_poll_gap_micros);
+      // Mean cycles since the previous report, per sweep and per input sampled, settling and conversion included
+      CompositeSerial.print(",\"sweep_cycles\":");
+      CompositeSerial.print((sweep_count == 0) ? 0 : (uint32)(sweep_cycles_sum/sweep_count));
+      CompositeSerial.print(",\"sweep_max_cycles\":");
+      CompositeSerial.print(sweep_max_cycles);
+      CompositeSerial.print(",\"sample_cycles\":");
+      CompositeSerial.print((sweep_samples == 0) ? 0 : (uint32)(sweep_cycles_sum/sweep_samples));
+      sweep_cycles_sum = 0;
+      sweep_count = 0;
+      sweep_samples = 0;
+      break;
+    case 7:
+      // Longest run of the serial task receiving a JSON text since startup, the worst case parsing cost of any input
+      CompositeSerial.print(",\"json_recv_max_cycles\":");
+      CompositeSerial.print(json_recv_max_cycles);
+      CompositeSerial.print(",\"hot_path_ram\":");
+      CompositeSerial.print(HOT_PATH_IN_RAM ? "true" : "false");
+      CompositeSerial.print(",\"idle_sleep\":");
+      CompositeSerial.print(f_idle_sleep ? "true" : "false");
+      break;
+    default: {
+      // Awake fraction since the previous report, and the MCU current it works out to with the datasheet figures
+      uint32 now = micros();
+      uint32 elapsed = now - idle_report_micros;
+      uint32 slept = idle_sleep_micros - idle_report_sleep_micros;
+      double awake = (elapsed == 0) ? 1.0 : 1.0 - (double)slept/elapsed;
+      idle_report_micros = now;
+      idle_report_sleep_micros = idle_sleep_micros;
+      CompositeSerial.print(",\"awake_percent\":");
+      CompositeSerial.print(awake*100, 1);
+      CompositeSerial.print(",\"mcu_current_est_ma\":");
+      CompositeSerial.print((MCU_SLEEP_CURRENT_UA + awake*(MCU_RUN_CURRENT_UA - MCU_SLEEP_CURRENT_UA))/1000, 1);
+      CompositeSerial.println("}");
+      return false;
+    }
+  }
+  return true;
+}
+
+/// @brief Report the counters of the MIDI output scheduler for every transport
+bool send_midi_output_stats(int part) {
+  if (part == 0) {
+    CompositeSerial.print("{\"usb\":");
+    send_transport_stats(midi_scheduler.get_stats(MIDI_TRANSPORT_USB), midi_scheduler.pending(MIDI_TRANSPORT_USB));
+    return true;
+  }
+  CompositeSerial.print(",\"uart\":");
+  send_transport_stats(midi_scheduler.get_stats(MIDI_TRANSPORT_UART), midi_scheduler.pending(MIDI_TRANSPORT_UART));
+  CompositeSerial.println("}");
+  return false;
+}
+
+void send_transport_stats(const MIDITransportStats &stats, size_t pending) {
+  CompositeSerial.print("{\"sent\":");
+  CompositeSerial.print(stats.sent);
+  CompositeSerial.print(",\"coalesced\":");
+  CompositeSerial.print(stats.coalesced);
+  CompositeSerial.print(",\"dropped\":");
+  CompositeSerial.print(stats.dropped);
+  CompositeSerial.print(",\"pending\":");
+  CompositeSerial.print(pending);
+  CompositeSerial.print(",\"pending_max\":");
+  CompositeSerial.print(stats.pending_max);
+  CompositeSerial.print('}');
+}
+
+/// @brief Task timing being reported, taken when the report starts so that every task covers the same interval
+TaskStats task_stats_report[NUM_TASKS];
+
+/// @brief Report the timing of every task since the previous report, in microseconds, and reset it
+void send_task_stats() {
+  for (size_t i=0; i<scheduler.size(); i++) {
+    task_stats_report[i] = scheduler.get_stats(i);
+  }
+  scheduler.reset_stats();
+  serial_reply_begin(send_task_stats);
+}
+
+bool send_task_stats(int part) {
+  size_t i = part/3;
+  if (i >= scheduler.size()) {
+    CompositeSerial.println(']');
+    return false;
+  }
+  const TaskStats &stats = task_stats_report[i];
+  switch (part%3) {
+    case 0:
+      CompositeSerial.print((i == 0) ? "[{\"name\":\"" : ",{\"name\":\"");
+      CompositeSerial.print(scheduler.get_name(i));
+      CompositeSerial.print("\",\"priority\":");
+      CompositeSerial.print(scheduler.get_priority(i));
+      CompositeSerial.print(",\"period_us\":");
+      CompositeSerial.print(scheduler.get_period(i));
+      CompositeSerial.print(",\"deadline_us\":");
+      CompositeSerial.print(scheduler.get_deadline(i));
+      break;
+    case 1:
+      CompositeSerial.print(",\"runs\":");
+      CompositeSerial.print(stats.runs);
+      CompositeSerial.print(",\"deadline_misses\":");
+      CompositeSerial.print(stats.deadline_misses);
+      CompositeSerial.print(",\"max_lateness_us\":");
+      CompositeSerial.print(stats.max_lateness);
+      break;
+    case 2:
+      CompositeSerial.print(",\"run_mean_us\":");
+      CompositeSerial.print((stats.runs == 0) ? 0.0 : (double)stats.total_run_time/stats.runs, 1);
+      CompositeSerial.print(",\"run_max_us\":");
+      CompositeSerial.print(stats.max_run_time);
+      CompositeSerial.print('}');
+      break;
+  }
+  return true;
+}
+
+/// @brief Start a load test, e.g. {"pattern":0,"pads":4095,"rate_hz":20,"peak_min":400,"peak_max":3600,"duration_ms":5000}.
+/// The pads set in "pads" (bit i for sensor i) that are in use as triggers get synthetic hits in place of their readings,
+/// detected, mapped and sent like real ones. Fields that are not given keep the defaults below. Replies S once started,
+/// and the report of send_load_test_report once over.
+void receive_json_load_test() {
+  load_test_recv.pattern = LOAD_PATTERN_ROLL;
+  load_test_recv.inputs = (1UL << NUM_SENSORS) - 1;
+  load_test_recv.rate_hz = 10;
+  load_test_recv.peak_min = 400;
+  load_test_recv.peak_max = 3600;
+  load_test_recv.rise_us = 500;
+  load_test_recv.decay_us = 3000;
+  load_test_recv.duration_ms = 5000;
+  receive_json_begin('h', load_test_value_handler, &load_test_recv);
+}
+
+void receive_json_load_test_end(bool success) {
+  LoadParams &params = load_test_recv;
+  for (int i=0; i<NUM_SENSORS; i++) {
+    if (pads_bank.get_mode(i) != PAD_MODE_TRIGGER) {
+      params.inputs &= ~(1UL << i);
+    }
+  }
+  // A test in the bank edit or velocity learn modes would remap the pads or learn from the synthetic hits
+  if (!success || load_generator.is_running() || (params.inputs == 0) || (params.peak_min > params.peak_max) ||
+      (f_interface_level == INTERFACE_EDIT_BANK) || (f_interface_level == INTERFACE_VELOCITY_LEARN)) {
+    CompositeSerial.println("E");
+    return;
+  }
+
+  load_generator.start(params);
+  load_test_start_triggers = load_test_triggers();
+  load_test_start_queue_dropped = event_queue.get_dropped();
+  load_test_start_delay_dropped = delay_line.get_dropped();
+  load_test_start_usb = midi_scheduler.get_stats(MIDI_TRANSPORT_USB);
+  load_test_start_uart = midi_scheduler.get_stats(MIDI_TRANSPORT_UART);
+  event_queue.reset_high_water();
+  scheduler.reset_stats();
+  pads_bank.set_sample_source(LoadGenerator::sample_source, &load_generator);
+  CompositeSerial.println("S");
+}
+
+/// @brief Store a value read by the 'h' command into the LoadParams passed as context
+bool load_test_value_handler(const char *key, const int *indices, int depth, int32_t value, void *context) {
+  LoadParams *params = (LoadParams *)context;
+
+  if (depth != 0) {
+    return false;
+  }
+  if (strcmp(key, "pattern") == 0) {
+    if ((value < LOAD_PATTERN_ROLL) || (value > LOAD_PATTERN_RANDOM)) {
+      return false;
+    }
+    params->pattern = value;
+  }
+  else if (strcmp(key, "pads") == 0) {
+    if ((value < 0) || (value >= (1L << NUM_SENSORS))) {
+      return false;
+    }
+    params->inputs = value;
+  }
+  else if (strcmp(key, "rate_hz") == 0) {
+    if ((value < 1) || (value > LOAD_TEST_MAX_RATE)) {
+      return false;
+    }
+    params->rate_hz = value;
+  }
+  else if (strcmp(key, "peak_min") == 0) {
+    if ((value < 0) || (value > 4095)) {
+      return false;
+    }
+    params->peak_min = value;
+  }
+  else if (strcmp(key, "peak_max") == 0) {
+    if ((value < 0) || (value > 4095)) {
+      return false;
+    }
+    params->peak_max = value;
+  }
+  else if (strcmp(key, "rise_us") == 0) {
+    if ((value < 0) || (value > 10000)) {
+      return false;
+    }
+    params->rise_us = value;
+  }
+  else if (strcmp(key, "decay_us") == 0) {
+    if ((value < 1) || (value > 60000)) {
+      return false;
+    }
+    params->decay_us = value;
+  }
+  else if (strcmp(key, "duration_ms") == 0) {
+    if ((value < 1) || (value > (int32_t)LOAD_TEST_MAX_DURATION)) {
+      return false;
+    }
+    params->duration_ms = value;
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+/// @brief Triggers detected on the pads under test since startup
+uint32 load_test_triggers() {
+  uint32 triggers = 0;
+  for (int i=0; i<NUM_SENSORS; i++) {
+    if ((load_generator.get_params().inputs >> i) & 1) {
+      triggers += pads_bank.get_stats(i).get_triggers();
+    }
+  }
+  return triggers;
+}
+
+/// @brief End the load test once its last hits are sent, and report it
+void load_test_poll() {
+  if (load_generator.is_running() && load_generator.is_over()) {
+    pads_bank.set_sample_source(0, 0);
+    load_generator.stop();
+    serial_reply_begin(send_load_test_report);
+  }
+}
+
+/// @brief Report a load test. hits were played, triggers detected, and missed_hits is their difference: hits falling
+/// between two samples or on a pad still cooling down from the previous one. events_per_s counts the triggers over the
+/// duration. The *_sent and *_dropped counters are the MIDI messages, note-offs included, and the events lost by the
+/// queue and the delay line during the test. queue_high_water is the deepest the event queue got, and the deadline misses
+/// and lateness of the acquisition and output tasks show if the stages kept up. The task statistics of 'k' restart with the test.
+bool send_load_test_report(int part) {
+  const LoadParams &params = load_generator.get_params();
+  const MIDITransportStats &usb = midi_scheduler.get_stats(MIDI_TRANSPORT_USB);
+  const MIDITransportStats &uart = midi_scheduler.get_stats(MIDI_TRANSPORT_UART);
+  const TaskStats &acquisition = scheduler.get_stats(acquisition_task_id);
+  const TaskStats &output = scheduler.get_stats(output_task_id);
+  uint32 hits = load_generator.get_hits();
+  uint32 triggers = load_test_triggers() - load_test_start_triggers;
+
+  switch (part) {
+    case 0:
+      CompositeSerial.print("{\"pattern\":");
+      CompositeSerial.print(params.pattern);
+      CompositeSerial.print(",\"pads\":");
+      CompositeSerial.print(params.inputs);
+      CompositeSerial.print(",\"rate_hz\":");
+      CompositeSerial.print(params.rate_hz);
+      CompositeSerial.print(",\"duration_ms\":");
+      CompositeSerial.print(params.duration_ms);
+      break;
+    case 1:
+      CompositeSerial.print(",\"hits\":");
+      CompositeSerial.print(hits);
+      CompositeSerial.print(",\"triggers\":");
+      CompositeSerial.print(triggers);
+      CompositeSerial.print(",\"missed_hits\":");
+      CompositeSerial.print((hits > triggers) ? hits - triggers : 0);
+      CompositeSerial.print(",\"events_per_s\":");
+      CompositeSerial.print(triggers*1000.0/params.duration_ms, 1);
+      break;
+    case 2:
+      CompositeSerial.print(",\"usb_sent\":");
+      CompositeSerial.print(usb.sent - load_test_start_usb.sent);
+      CompositeSerial.print(",\"usb_dropped\":");
+      CompositeSerial.print(usb.dropped - load_test_start_usb.dropped);
+      CompositeSerial.print(",\"uart_sent\":");
+      CompositeSerial.print(uart.sent - load_test_start_uart.sent);
+      CompositeSerial.print(",\"uart_dropped\":");
+      CompositeSerial.print(uart.dropped - load_test_start_uart.dropped);
+      break;
+    case 3:
+      CompositeSerial.print(",\"queue_high_water\":");
+      CompositeSerial.print(event_queue.get_high_water());
+      CompositeSerial.print(",\"queue_dropped\":");
+      CompositeSerial.print(event_queue.get_dropped() - load_test_start_queue_dropped);
+      CompositeSerial.print(",\"delay_dropped\":");
+      CompositeSerial.print(delay_line.get_dropped() - load_test_start_delay_dropped);
+      break;
+    case 4:
+      CompositeSerial.print(",\"acquisition_deadline_misses\":");
+      CompositeSerial.print(acquisition.deadline_misses);
+      CompositeSerial.print(",\"acquisition_max_lateness_us\":");
+      CompositeSerial.print(acquisition.max_lateness);
+      break;
+    default:
+      CompositeSerial.print(",\"output_deadline_misses\":");
+      CompositeSerial.print(output.deadline_misses);
+      CompositeSerial.print(",\"output_max_lateness_us\":");
+      CompositeSerial.print(output.max_lateness);
+      CompositeSerial.println("}");
+      return false;
+  }
+  return true;
+}
+
 void serial_command_poll() {
-  if (CompositeSerial.available()) {
+  if (serial_reply != 0) {
+    serial_reply_poll();
+    return;
+  }
+  load_test_poll();
+  if (json_recv_command != 0) {
+    receive_json_poll();
+  }
+  else if (CompositeSerial.available()) {
     char cmd = CompositeSerial.read();
     switch (cmd) {
       case 'g':
-        send_json_config();
+        serial_reply_begin(send_json_config);
         break;
       case 's':
         receive_json_config();
         break;
       case 'f':
         EEPROM.format();
+        config_tables.erase();
+        preset_library.erase();
+        break;
+      case 't':
+        serial_reply_begin(send_stage_timing);
+        break;
+      case 'm':
+        serial_reply_begin(send_memory_report);
+        break;
+      case 'p':
+        receive_json_trigger_params();
+        break;
+      case 'w':
+        save_all_config();
+        break;
+      case 'l':
+        serial_reply_begin(send_preset_library);
+        break;
+      case 'a':
+        receive_json_preset();
+        break;
+      case 'x':
+        erase_preset_library();
+        break;
+      case 'd':
+        serial_reply_begin(send_signal_diagnostics);
+        break;
+      case 'r':
+        reset_signal_diagnostics();
+        break;
+      case 'b':
+        serial_reply_begin(send_midi_output_stats);
+        break;
+      case 'u':
+        measure_mux_settle_time();
+        break;
+      case 'k':
+        send_task_stats();
+        break;
+      case 'v':
+        serial_reply_begin(send_velocity_tables);
+        break;
+      case 'c':
+        erase_velocity_tables();
+        break;
+      case 'h':
+        receive_json_load_test();
         break;
     }
   }
@@ -838,8 +2698,11 @@ void serial_command_poll() {
 // ===== Main program =====
 
 void setup() {
+  memory_paint_stack();
+
   // LED setup
-  led.on(1,0,0);
+  led.begin(LED_TIMER);
+  led.on(LED_SLOT_COLOR[0]);
 
   // Button setup
   buttons[0].init(BUTTON1_PIN, HIGH, 0);
@@ -865,6 +2728,11 @@ void setup() {
   buttonConfig->setFeature(ace_button::ButtonConfig::kFeatureSuppressAfterDoubleClick);
   buttonConfig->setFeature(ace_button::ButtonConfig::kFeatureSuppressAfterLongPress);
 
+  // Sensors setup
+  for (int i=0; i<NUM_DIRECT_SENSORS; i++) {
+    pads_bank.set_input(NUM_MUX_SENSORS+i, DIRECT_SENSOR_PINS[i], PAD_DIRECT);
+  }
+
   // USB setup
 
   USBComposite.clear();
@@ -880,27 +2748,52 @@ void setup() {
   // UARTMIDI setup
 
   UARTMIDI.begin();
+  midi_scheduler.set_writer(MIDI_TRANSPORT_USB, usb_midi_write);
+  midi_scheduler.set_writer(MIDI_TRANSPORT_UART, uart_midi_write);
 
   // Configuration setup
+  preset_library.begin();
+  velocity_tables.begin();
+  config_tables.begin();
   uint32 signature = read_uint32(0);
-  if (signature != FLASH_SIGNATURE) { // First run of the code
+  if (signature == FLASH_SIGNATURE_V1) { // Configuration of the first release, the new settings keep their defaults
+    migrate_legacy_config();
+    EEPROM.format(); // The legacy variables would stay live and fill the pages
+    write_uint32(0, FLASH_SIGNATURE);
+    write_config_struct(CONFIG_ADDRESS, &config);
+  }
+  else if (signature != FLASH_SIGNATURE) { // First run of the code
+    EEPROM.format();
+    config_tables.erase();
+    preset_library.erase();
     write_uint32(0, FLASH_SIGNATURE);
     write_config_struct(CONFIG_ADDRESS, &config);
   }
   else {
     read_config_struct(CONFIG_ADDRESS, &config);
-    load_all_config();
   }
+  load_all_config();
+
+  idle_sleep_begin(IDLE_SLEEP_TIMER);
+  cycle_counter_begin();
+
+  // Task setup, the first ones taking precedence when released together
+  acquisition_task_id = scheduler.add_event("acquisition", acquisition_task, TASK_PRIORITY_ACQUISITION, PADS_IDLE_SAMPLING_PERIOD);
+  output_task_id = scheduler.add_event("output", output_task, TASK_PRIORITY_OUTPUT, OUTPUT_DEADLINE);
+  scheduler.add_periodic("midi_merge", midi_merge_poll, TASK_PRIORITY_MIDI_INPUT, MIDI_MERGE_PERIOD, MIDI_INPUT_DEADLINE);
+  scheduler.add_periodic("midi_control", midi_control_poll, TASK_PRIORITY_MIDI_INPUT, MIDI_CONTROL_PERIOD, MIDI_INPUT_DEADLINE);
+  scheduler.add_periodic("buttons", button_task, TASK_PRIORITY_UI, BUTTON_PERIOD, UI_DEADLINE);
+  scheduler.add_periodic("serial", serial_command_poll, TASK_PRIORITY_UI, SERIAL_COMMAND_PERIOD, UI_DEADLINE);
+  scheduler.add_periodic("sensor_health", sensor_health_task, TASK_PRIORITY_UI, SENSOR_HEALTH_PERIOD, UI_DEADLINE);
+  edit_bank_task_id = scheduler.add_event("edit_bank", edit_bank_task, TASK_PRIORITY_UI, UI_DEADLINE);
+  scheduler.signal(acquisition_task_id);
+
+  merge_last_poll_micros = micros();
+  idle_report_micros = micros();
 }
 
 void loop() {
-  switch (f_interface_level) {
-    case INTERFACE_MAIN:
-    case INTERFACE_SETTINGS:
-      global_poll();
-      break;
-    case INTERFACE_EDIT_BANK:
-      edit_bank_mapping();
-      break;
+  if (!scheduler.run()) {
+    idle_sleep_poll();
   }
 }
\ No newline at end of file
@@ -0,0 +1,241 @@
+#include "config-client.hpp"
+#include <chrono>
+
+ConfigClient::ConfigClient(SerialPort &port, int timeout_ms) : _port(port) {
+    _timeout_ms = timeout_ms;
+}
+
+bool ConfigClient::pull(ConfigDocument &config) {
+    std::string json;
+    if (!_send('g', "") || !_read_json(json)) {
+        return false;
+    }
+    if (!config.parse(json)) {
+        return _fail("invalid configuration received (JSON error " + std::to_string(config.error()) + ")");
+    }
+    return true;
+}
+
+bool ConfigClient::push(const ConfigDocument &config) {
+    std::string json = config.to_json();
+    if (json.size() > CONFIG_MAX_JSON_LENGTH) {
+        return _fail("configuration too long for the device (" + std::to_string(json.size()) + " bytes)");
+    }
+    return _send('s', json) && _read_status();
+}
+
+bool ConfigClient::save() {
+    return _send('w', "") && _sync();
+}
+
+bool ConfigClient::format() {
+    return _send('f', "") && _sync();
+}
+
+bool ConfigClient::pull_presets(PresetKits &kits) {
+    std::string json;
+    if (!_send('l', "") || !_read_json(json)) {
+        return false;
+    }
+    ConfigDocument library;
+    if (!library.parse(json)) {
+        return _fail("invalid preset library received (JSON error " + std::to_string(library.error()) + ")");
+    }
+
+    kits.clear();
+    const ConfigMember *member = library.find("kits");
+    if (member == NULL) {
+        return true; // Empty library
+    }
+    for (size_t i=0; i<member->values.size(); i++) {
+        const ConfigValue &value = member->values[i];
+        if (value.indices.size() != 2) {
+            return _fail("invalid preset library received");
+        }
+        if ((size_t)value.indices[0] >= kits.size()) {
+            kits.resize(value.indices[0] + 1);
+        }
+        kits[value.indices[0]].push_back(value.value);
+    }
+    return true;
+}
+
+bool ConfigClient::push_preset(const std::vector<int32_t> &kit) {
+    std::string json = "{\"notes\":[";
+    for (size_t i=0; i<kit.size(); i++) {
+        if (i != 0) {
+            json += ',';
+        }
+        json += std::to_string(kit[i]);
+    }
+    json += "]}";
+    return _send('a', json) && _read_status();
+}
+
+bool ConfigClient::erase_presets() {
+    return _send('x', "") && _read_status();
+}
+
+bool ConfigClient::backup(ConfigDocument &backup) {
+    PresetKits kits;
+    if (!pull(backup) || !pull_presets(kits)) {
+        return false;
+    }
+
+    ConfigMember member;
+    member.key = CONFIG_BACKUP_KITS_KEY;
+    member.is_bool = false;
+    for (size_t kit=0; kit<kits.size(); kit++) {
+        for (size_t i=0; i<kits[kit].size(); i++) {
+            ConfigValue value;
+            value.indices.push_back(kit);
+            value.indices.push_back(i);
+            value.value = kits[kit][i];
+            member.values.push_back(value);
+        }
+    }
+    if (!member.values.empty()) {
+        backup.set(member);
+    }
+    return true;
+}
+
+bool ConfigClient::restore(const ConfigDocument &backup) {
+    ConfigDocument config = backup;
+    config.remove(CONFIG_BACKUP_KITS_KEY);
+
+    ConfigDocument active;
+    if (!push(config) || !save() || !pull(active)) {
+        return false;
+    }
+    // Values out of the range of their field are silently truncated by the device
+    std::vector<std::string> differences = active.diff(config);
+    for (size_t i=0; i<differences.size(); i++) {
+        if (differences[i].find(": removed") == std::string::npos) {
+            return _fail("configuration not applied, " + differences[i]);
+        }
+    }
+
+    const ConfigMember *member = backup.find(CONFIG_BACKUP_KITS_KEY);
+    if (member == NULL) {
+        return true;
+    }
+    PresetKits kits;
+    for (size_t i=0; i<member->values.size(); i++) {
+        const ConfigValue &value = member->values[i];
+        if (value.indices.size() != 2) {
+            return _fail(CONFIG_BACKUP_KITS_KEY " must be an array of kits");
+        }
+        if ((size_t)value.indices[0] >= kits.size()) {
+            kits.resize(value.indices[0] + 1);
+        }
+        kits[value.indices[0]].push_back(value.value);
+    }
+
+    // The library is only appended to, rewriting it when nothing changed would wear the flash for nothing
+    PresetKits current;
+    if (!pull_presets(current)) {
+        return false;
+    }
+    if (current == kits) {
+        return true;
+    }
+    if (!erase_presets()) {
+        return false;
+    }
+    for (size_t i=0; i<kits.size(); i++) {
+        if (!push_preset(kits[i])) {
+            return _fail("kit " + std::to_string(i) + " rejected, " + _error);
+        }
+    }
+    return true;
+}
+
+const std::string &ConfigClient::error() const {
+    return _error;
+}
+
+double ConfigClient::last_round_trip_ms() const {
+    return _last_round_trip_ms;
+}
+
+size_t ConfigClient::last_bytes_sent() const {
+    return _last_bytes_sent;
+}
+
+size_t ConfigClient::last_bytes_received() const {
+    return _last_bytes_received;
+}
+
+bool ConfigClient::_send(char command, const std::string &payload) {
+    // Debug lines sent since the previous command would otherwise be taken for the reply
+    _port.drain();
+    _error.clear();
+    _last_bytes_sent = 1 + payload.size();
+    _last_bytes_received = 0;
+    _start_ns = _now_ns();
+    if (!_port.write(std::string(1, command) + payload)) {
+        return _fail("write to " + _port.path() + " failed");
+    }
+    return true;
+}
+
+bool ConfigClient::_read_json(std::string &json) {
+    json.clear();
+    int level = 0;
+    char byte;
+    while (_port.read(byte, _timeout_ms)) {
+        _last_bytes_received++;
+        if ((level == 0) && (byte != '{')) {
+            continue;
+        }
+        json += byte;
+        if (byte == '{') {
+            level++;
+        }
+        else if ((byte == '}') && (--level == 0)) {
+            _last_round_trip_ms = (_now_ns() - _start_ns)/1e6;
+            return true;
+        }
+    }
+    return _fail("no reply from " + _port.path());
+}
+
+bool ConfigClient::_read_status() {
+    std::string line;
+    char byte;
+    while (_port.read(byte, _timeout_ms)) {
+        _last_bytes_received++;
+        if (byte == '\r') {
+            continue;
+        }
+        if (byte != '\n') {
+            line += byte;
+            continue;
+        }
+        if ((line == "S") || (line == "E")) {
+            _last_round_trip_ms = (_now_ns() - _start_ns)/1e6;
+            return (line == "S") ? true : _fail("rejected by the device");
+        }
+        line.clear();
+    }
+    return _fail("no reply from " + _port.path());
+}
+
+bool ConfigClient::_sync() {
+    std::string json;
+    _last_bytes_sent++;
+    if (!_port.write("g")) {
+        return _fail("write to " + _port.path() + " failed");
+    }
+    return _read_json(json);
+}
+
+bool ConfigClient::_fail(const std::string &error) {
+    _error = error;
+    return false;
+}
+
+uint64_t ConfigClient::_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "config-document.hpp"
+#include "serial-port.hpp"
+
+/// @brief Longest JSON accepted by the 's' command of the firmware, JSON_RECV_MAX_LENGTH in src/main.cpp
+#define CONFIG_MAX_JSON_LENGTH 2559
+#define CONFIG_DEFAULT_TIMEOUT_MS 2000
+/// @brief Member holding the preset library kits in a backup, next to the configuration members
+#define CONFIG_BACKUP_KITS_KEY "preset_kits"
+
+typedef std::vector<std::vector<int32_t> > PresetKits;
+
+/// @brief Client of the serial configuration protocol of serial_command_poll() in src/main.cpp.
+/// Every call sends one command and waits for its whole reply. Lines sent by the device on its own (debug output) are
+/// skipped. The time and bytes of the last command are kept for benchmarks.
+class ConfigClient {
+    public:
+
+        /// @param timeout_ms Longest silence of the device while a reply is expected
+        ConfigClient(SerialPort &port, int timeout_ms = CONFIG_DEFAULT_TIMEOUT_MS);
+
+        /// @brief Read the active configuration ('g')
+        bool pull(ConfigDocument &config);
+
+        /// @brief Set the active configuration ('s'). Members left out are kept by the device, so a patch can be pushed.
+        /// It is only kept over a power cycle once saved.
+        bool push(const ConfigDocument &config);
+
+        /// @brief Save the active configuration to flash ('w'), acknowledged by reading the configuration back
+        bool save();
+
+        /// @brief Erase the flash holding the configuration ('f'), acknowledged by reading the configuration back
+        bool format();
+
+        /// @brief Read every kit of the preset library ('l')
+        bool pull_presets(PresetKits &kits);
+
+        /// @brief Append a kit to the preset library ('a'), one note or CC number per sensor
+        bool push_preset(const std::vector<int32_t> &kit);
+
+        /// @brief Erase the preset library ('x')
+        bool erase_presets();
+
+        /// @brief Read the configuration with every bank, and the preset library as CONFIG_BACKUP_KITS_KEY
+        bool backup(ConfigDocument &backup);
+
+        /// @brief Push, save and verify a backup or a configuration. The preset library is only rewritten if the backup
+        /// has kits that differ from it.
+        bool restore(const ConfigDocument &backup);
+
+        /// @brief Description of the last failure
+        const std::string &error() const;
+
+        /// @brief Time from sending the last command to receiving the end of its reply, in milliseconds
+        double last_round_trip_ms() const;
+        size_t last_bytes_sent() const;
+        size_t last_bytes_received() const;
+
+    private:
+
+        SerialPort &_port;
+        int _timeout_ms;
+        std::string _error;
+        double _last_round_trip_ms = 0;
+        size_t _last_bytes_sent = 0;
+        size_t _last_bytes_received = 0;
+        uint64_t _start_ns = 0;
+
+        /// @brief Send a command with its JSON payload, if any, and start timing it
+        bool _send(char command, const std::string &payload);
+        /// @brief Read a JSON object reply, skipping anything before it
+        bool _read_json(std::string &json);
+        /// @brief Read the "S" or "E" line ending a command
+        bool _read_status();
+        /// @brief Wait until every command sent before has been handled, for the commands that send no reply
+        bool _sync();
+        bool _fail(const std::string &error);
+
+        static uint64_t _now_ns();
+
+};
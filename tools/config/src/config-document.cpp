@@ -0,0 +1,214 @@
+#include "config-document.hpp"
+#include <json-reader.hpp>
+#include <map>
+
+bool ConfigMember::operator==(const ConfigMember &other) const {
+    if ((key != other.key) || (values.size() != other.values.size())) {
+        return false;
+    }
+    for (size_t i=0; i<values.size(); i++) {
+        if ((values[i].indices != other.values[i].indices) || (values[i].value != other.values[i].value)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ConfigMember::operator!=(const ConfigMember &other) const {
+    return !(*this == other);
+}
+
+bool ConfigDocument::parse(const std::string &json) {
+    _members.clear();
+    _error = json_read(json.data(), json.size(), _value_handler, this);
+    if (_error != JSON_OK) {
+        _members.clear();
+        return false;
+    }
+
+    // json_read passes booleans as integers, they are told apart from the text to write them back the same way
+    for (size_t i=0; i<_members.size(); i++) {
+        ConfigMember &member = _members[i];
+        if ((member.values.size() != 1) || !member.values[0].indices.empty()) {
+            continue;
+        }
+        size_t pos = json.find("\"" + member.key + "\"");
+        if (pos == std::string::npos) {
+            continue;
+        }
+        pos = json.find_first_not_of(" \t\r\n:", pos + member.key.size() + 2);
+        member.is_bool = (pos != std::string::npos) && ((json[pos] == 't') || (json[pos] == 'f'));
+    }
+    return true;
+}
+
+std::string ConfigDocument::to_json() const {
+    std::string json = "{";
+    for (size_t m=0; m<_members.size(); m++) {
+        const ConfigMember &member = _members[m];
+        if (m != 0) {
+            json += ',';
+        }
+        json += "\"" + member.key + "\":";
+
+        if (member.values.empty()) {
+            json += "[]";
+            continue;
+        }
+        size_t depth = member.values[0].indices.size();
+        json.append(depth, '[');
+        for (size_t i=0; i<member.values.size(); i++) {
+            if (i != 0) {
+                // Close the arrays that ended since the previous value and open the ones that start
+                const std::vector<int> &previous = member.values[i-1].indices;
+                const std::vector<int> &current = member.values[i].indices;
+                size_t level = 0;
+                while ((level+1 < depth) && (previous[level] == current[level])) {
+                    level++;
+                }
+                json.append(depth-1-level, ']');
+                json += ',';
+                json.append(depth-1-level, '[');
+            }
+            json += _format_value(member, member.values[i].value);
+        }
+        json.append(depth, ']');
+    }
+    json += '}';
+    return json;
+}
+
+const ConfigMember *ConfigDocument::find(const std::string &key) const {
+    for (size_t i=0; i<_members.size(); i++) {
+        if (_members[i].key == key) {
+            return &_members[i];
+        }
+    }
+    return NULL;
+}
+
+ConfigMember *ConfigDocument::find(const std::string &key) {
+    return const_cast<ConfigMember *>(static_cast<const ConfigDocument *>(this)->find(key));
+}
+
+void ConfigDocument::set(const ConfigMember &member) {
+    for (size_t i=0; i<_members.size(); i++) {
+        if (_members[i].key == member.key) {
+            _members[i] = member;
+            return;
+        }
+    }
+    _members.push_back(member);
+}
+
+bool ConfigDocument::remove(const std::string &key) {
+    for (size_t i=0; i<_members.size(); i++) {
+        if (_members[i].key == key) {
+            _members.erase(_members.begin() + i);
+            return true;
+        }
+    }
+    return false;
+}
+
+const std::vector<ConfigMember> &ConfigDocument::members() const {
+    return _members;
+}
+
+int ConfigDocument::error() const {
+    return _error;
+}
+
+std::vector<std::string> ConfigDocument::diff(const ConfigDocument &other) const {
+    std::vector<std::string> lines;
+
+    for (size_t m=0; m<_members.size(); m++) {
+        const ConfigMember &member = _members[m];
+        const ConfigMember *other_member = other.find(member.key);
+        if (other_member == NULL) {
+            lines.push_back(member.key + ": removed");
+            continue;
+        }
+
+        std::map<std::vector<int>, int32_t> other_values;
+        for (size_t i=0; i<other_member->values.size(); i++) {
+            other_values[other_member->values[i].indices] = other_member->values[i].value;
+        }
+        for (size_t i=0; i<member.values.size(); i++) {
+            const ConfigValue &value = member.values[i];
+            std::string name = member.key + _format_indices(value.indices);
+            std::map<std::vector<int>, int32_t>::iterator found = other_values.find(value.indices);
+            if (found == other_values.end()) {
+                lines.push_back(name + ": " + _format_value(member, value.value) + " -> (none)");
+                continue;
+            }
+            if (found->second != value.value) {
+                lines.push_back(name + ": " + _format_value(member, value.value) + " -> " + _format_value(*other_member, found->second));
+            }
+            other_values.erase(found);
+        }
+        // Values only in the other document, in its order
+        for (size_t i=0; i<other_member->values.size(); i++) {
+            const ConfigValue &value = other_member->values[i];
+            if (other_values.count(value.indices) != 0) {
+                lines.push_back(member.key + _format_indices(value.indices) + ": (none) -> " + _format_value(*other_member, value.value));
+            }
+        }
+    }
+
+    for (size_t m=0; m<other._members.size(); m++) {
+        if (find(other._members[m].key) == NULL) {
+            lines.push_back(other._members[m].key + ": added");
+        }
+    }
+    return lines;
+}
+
+ConfigDocument ConfigDocument::patch_to(const ConfigDocument &other) const {
+    ConfigDocument patch;
+    for (size_t m=0; m<other._members.size(); m++) {
+        const ConfigMember *member = find(other._members[m].key);
+        if ((member == NULL) || (*member != other._members[m])) {
+            patch._members.push_back(other._members[m]);
+        }
+    }
+    return patch;
+}
+
+void ConfigDocument::apply(const ConfigDocument &patch) {
+    for (size_t m=0; m<patch._members.size(); m++) {
+        set(patch._members[m]);
+    }
+}
+
+bool ConfigDocument::_value_handler(const char *key, const int *indices, int depth, int32_t value, void *context) {
+    ConfigDocument *document = (ConfigDocument *)context;
+
+    if (document->_members.empty() || (document->_members.back().key != key)) {
+        ConfigMember member;
+        member.key = key;
+        member.is_bool = false;
+        document->_members.push_back(member);
+    }
+
+    ConfigValue entry;
+    entry.indices.assign(indices, indices + depth);
+    entry.value = value;
+    document->_members.back().values.push_back(entry);
+    return true;
+}
+
+std::string ConfigDocument::_format_value(const ConfigMember &member, int32_t value) {
+    if (member.is_bool) {
+        return value ? "true" : "false";
+    }
+    return std::to_string(value);
+}
+
+std::string ConfigDocument::_format_indices(const std::vector<int> &indices) {
+    std::string text;
+    for (size_t i=0; i<indices.size(); i++) {
+        text += "[" + std::to_string(indices[i]) + "]";
+    }
+    return text;
+}
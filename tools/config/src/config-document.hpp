@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/// @brief Value of a member, with its index in each nested array, outermost first
+struct ConfigValue {
+    std::vector<int> indices;
+    int32_t value;
+};
+
+/// @brief Top level member of the JSON configuration
+struct ConfigMember {
+    std::string key;
+    /// @brief Written as true/false instead of 1/0
+    bool is_bool;
+    /// @brief Every value in the order of the JSON text, none for an empty array
+    std::vector<ConfigValue> values;
+
+    bool operator==(const ConfigMember &other) const;
+    bool operator!=(const ConfigMember &other) const;
+};
+
+/// @brief JSON configuration as sent by the 'g' command and accepted by the 's' command.
+/// Members are kept without knowing the configuration layout, so that the tools work with every firmware version.
+/// Like on the device, only integers, booleans and nested arrays of them are supported.
+class ConfigDocument {
+    public:
+
+        /// @brief Replace the document by the JSON text
+        /// @return false if the text is not valid, error() then gives the JSON_ERROR_* code
+        bool parse(const std::string &json);
+
+        /// @brief JSON text of the document, on a single line as sent by the device
+        std::string to_json() const;
+
+        /// @return NULL if the document has no such member
+        const ConfigMember *find(const std::string &key) const;
+        ConfigMember *find(const std::string &key);
+
+        /// @brief Replace the member with the same key, or append it
+        void set(const ConfigMember &member);
+
+        /// @return false if the document has no such member
+        bool remove(const std::string &key);
+
+        const std::vector<ConfigMember> &members() const;
+
+        int error() const;
+
+        /// @brief Every value differing from another document, one line each, e.g. "mapping_bank[0][1][2]: 36 -> 37"
+        std::vector<std::string> diff(const ConfigDocument &other) const;
+
+        /// @brief Patch turning this document into another one: every member of the other document that differs, in full.
+        /// Members missing from the other document can't be removed by a patch and are left out.
+        ConfigDocument patch_to(const ConfigDocument &other) const;
+
+        /// @brief Replace every member given by a patch
+        void apply(const ConfigDocument &patch);
+
+    private:
+
+        std::vector<ConfigMember> _members;
+        int _error = 0;
+
+        static bool _value_handler(const char *key, const int *indices, int depth, int32_t value, void *context);
+        static std::string _format_value(const ConfigMember &member, int32_t value);
+        static std::string _format_indices(const std::vector<int> &indices);
+
+};
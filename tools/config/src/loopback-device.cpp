@@ -0,0 +1,256 @@
+#include "loopback-device.hpp"
+#include <json-reader.hpp>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <unistd.h>
+#include <chrono>
+#include <thread>
+
+// Bound to references by the standard library, so they need a definition
+const size_t LoopbackDevice::RECV_MAX_LENGTH;
+const int LoopbackDevice::RECV_TIMEOUT_MS;
+
+LoopbackDevice::LoopbackDevice(const ConfigDocument &config) {
+    _master = -1;
+    _slave = -1;
+    _config = config;
+    _saved = config;
+}
+
+LoopbackDevice::~LoopbackDevice() {
+    if (_slave >= 0) {
+        close(_slave);
+    }
+    if (_master >= 0) {
+        close(_master);
+    }
+}
+
+bool LoopbackDevice::open() {
+    _master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((_master < 0) || (grantpt(_master) != 0) || (unlockpt(_master) != 0) || (ptsname(_master) == NULL)) {
+        return false;
+    }
+    _path = ptsname(_master);
+
+    // Kept open so that the master doesn't see a hangup between two clients, and set raw so that nothing is echoed
+    _slave = ::open(_path.c_str(), O_RDWR | O_NOCTTY);
+    if (_slave < 0) {
+        return false;
+    }
+    struct termios tio;
+    if (tcgetattr(_slave, &tio) == 0) {
+        cfmakeraw(&tio);
+        tcsetattr(_slave, TCSANOW, &tio);
+    }
+    return true;
+}
+
+const std::string &LoopbackDevice::path() {
+    return _path;
+}
+
+void LoopbackDevice::serve(int timeout_ms) {
+    char command;
+    while (_read(command, timeout_ms)) {
+        _handle(command);
+    }
+}
+
+void LoopbackDevice::set_reply_delay(int delay_us) {
+    _reply_delay_us = delay_us;
+}
+
+uint32_t LoopbackDevice::get_commands() {
+    return _commands;
+}
+
+bool LoopbackDevice::_read(char &byte, int timeout_ms) {
+    while (_received_pos == _received.size()) {
+        struct pollfd pfd = {_master, POLLIN, 0};
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready == 0) {
+            return false;
+        }
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        char buffer[512];
+        ssize_t result = ::read(_master, buffer, sizeof(buffer));
+        if (result > 0) {
+            _received.assign(buffer, result);
+            _received_pos = 0;
+        }
+        else if ((result < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+            return false;
+        }
+    }
+    byte = _received[_received_pos++];
+    return true;
+}
+
+bool LoopbackDevice::_read_payload(std::string &payload) {
+    payload.clear();
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(RECV_TIMEOUT_MS);
+    char byte;
+    while (true) {
+        int remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if ((remaining_ms <= 0) || !_read(byte, remaining_ms)) {
+            return false;
+        }
+        payload += byte;
+        if (byte == '}') {
+            // Like the device, a text too long is still read up to its end, then rejected
+            return payload.size() <= RECV_MAX_LENGTH;
+        }
+    }
+}
+
+void LoopbackDevice::_write(const std::string &text) {
+    if (_reply_delay_us > 0) {
+        std::this_thread::sleep_for(std::chrono::microseconds(_reply_delay_us));
+    }
+    size_t written = 0;
+    while (written < text.size()) {
+        ssize_t result = ::write(_master, text.data() + written, text.size() - written);
+        if (result > 0) {
+            written += result;
+        }
+        else if ((result < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+            return;
+        }
+    }
+}
+
+void LoopbackDevice::_handle(char command) {
+    std::string payload;
+    switch (command) {
+        case 'g':
+            _write(_config.to_json());
+            break;
+        case 's':
+            _receive_config();
+            break;
+        case 'w':
+            _saved = _config;
+            break;
+        case 'f':
+            _saved = ConfigDocument();
+            break;
+        case 'l':
+            _send_presets();
+            break;
+        case 'a':
+            _receive_preset();
+            break;
+        case 'x':
+            _kits.clear();
+            _write("S\r\n");
+            break;
+        case 'p':
+            // Trigger parameters need the firmware's field ranges, the payload is only consumed
+            _read_payload(payload);
+            _write("E\r\n");
+            break;
+        default:
+            return;
+    }
+    _commands++;
+}
+
+/// @brief Store a value received by 's' into the ConfigDocument passed as context, only if it already has that value
+static bool loopback_config_handler(const char *key, const int *indices, int depth, int32_t value, void *context) {
+    ConfigDocument *config = (ConfigDocument *)context;
+    ConfigMember *member = config->find(key);
+    if (member == NULL) {
+        return false;
+    }
+
+    std::vector<int> path(indices, indices + depth);
+    for (size_t i=0; i<member->values.size(); i++) {
+        if (member->values[i].indices == path) {
+            member->values[i].value = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+void LoopbackDevice::_receive_config() {
+    std::string payload;
+    if (!_read_payload(payload)) {
+        _write("E\r\n");
+        return;
+    }
+
+    ConfigDocument received = _config;
+    if (json_read(payload.data(), payload.size(), loopback_config_handler, &received) != JSON_OK) {
+        _write("E\r\n");
+        return;
+    }
+    _config = received;
+    _write("S\r\n");
+}
+
+void LoopbackDevice::_receive_preset() {
+    std::string payload;
+    ConfigDocument kit;
+    if (!_read_payload(payload) || !kit.parse(payload) || (kit.members().size() != 1) || (kit.find("notes") == NULL)) {
+        _write("E\r\n");
+        return;
+    }
+
+    const ConfigMember *notes = kit.find("notes");
+    if (notes->values.size() != _kit_size()) {
+        _write("E\r\n");
+        return;
+    }
+    std::vector<int32_t> values;
+    for (size_t i=0; i<notes->values.size(); i++) {
+        if ((notes->values[i].indices.size() != 1) || (notes->values[i].value < 0) || (notes->values[i].value > 127)) {
+            _write("E\r\n");
+            return;
+        }
+        values.push_back(notes->values[i].value);
+    }
+    _kits.push_back(values);
+    _write("S\r\n");
+}
+
+void LoopbackDevice::_send_presets() {
+    std::string json = "{\"kits\":[";
+    for (size_t kit=0; kit<_kits.size(); kit++) {
+        json += (kit == 0) ? "[" : ",[";
+        for (size_t i=0; i<_kits[kit].size(); i++) {
+            if (i != 0) {
+                json += ',';
+            }
+            json += std::to_string(_kits[kit][i]);
+        }
+        json += ']';
+    }
+    // As if every kit were stored in full, the device packs 2 notes per half-word behind a half-word header
+    json += "],\"bytes_used\":" + std::to_string(_kits.size()*(2 + _kit_size())) + ",\"capacity\":4096}\r\n";
+    _write(json);
+}
+
+size_t LoopbackDevice::_kit_size() {
+    const ConfigMember *mapping = _config.find("mapping_bank");
+    if (mapping == NULL) {
+        return 0;
+    }
+    size_t size = 0;
+    for (size_t i=0; i<mapping->values.size(); i++) {
+        const std::vector<int> &indices = mapping->values[i].indices;
+        if ((indices.size() == 3) && (indices[0] == 0) && (indices[1] == 0)) {
+            size++;
+        }
+    }
+    return size;
+}
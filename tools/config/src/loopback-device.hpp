@@ -0,0 +1,65 @@
+#pragma once
+
+#include "config-document.hpp"
+
+/// @brief Stand-in for the device on a pseudo terminal, answering the configuration commands of serial_command_poll()
+/// like the firmware does, so that the tools and scripts can be tested without hardware.
+///
+/// Only the members of the initial configuration are accepted by 's', with their array sizes, since the stand-in
+/// doesn't know the firmware's ranges. The other commands of the firmware are ignored.
+class LoopbackDevice {
+    public:
+
+        /// @param config Configuration the device starts with, usually pulled from a real device
+        LoopbackDevice(const ConfigDocument &config);
+        ~LoopbackDevice();
+
+        /// @brief Create the pseudo terminal
+        /// @return false if it can't be created
+        bool open();
+
+        /// @brief Path of the terminal to open instead of the device
+        const std::string &path();
+
+        /// @brief Handle the commands received until timeout_ms passes without any
+        /// @param timeout_ms -1 to serve forever
+        void serve(int timeout_ms);
+
+        /// @brief Delay every reply, to look like a device busy sampling its sensors
+        void set_reply_delay(int delay_us);
+
+        uint32_t get_commands();
+
+    private:
+
+        /// @brief Like JSON_RECV_MAX_LENGTH in src/main.cpp
+        static const size_t RECV_MAX_LENGTH = 2559;
+        /// @brief Like JSON_RECV_TIMEOUT in src/main.cpp, counted from the command
+        static const int RECV_TIMEOUT_MS = 1000;
+
+        int _master;
+        int _slave;
+        std::string _path;
+        /// @brief Bytes read from the terminal and not handled yet
+        std::string _received;
+        size_t _received_pos = 0;
+        ConfigDocument _config;
+        ConfigDocument _saved;
+        std::vector<std::vector<int32_t> > _kits;
+        int _reply_delay_us = 0;
+        uint32_t _commands = 0;
+
+        /// @brief Read one byte, false on timeout
+        bool _read(char &byte, int timeout_ms);
+        /// @brief Read a JSON payload up to its first '}' like the device, false on timeout or if it is too long
+        bool _read_payload(std::string &payload);
+        void _write(const std::string &text);
+
+        void _handle(char command);
+        void _receive_config();
+        void _receive_preset();
+        void _send_presets();
+        /// @brief Number of sensors, from the size of the first kit in mapping_bank
+        size_t _kit_size();
+
+};
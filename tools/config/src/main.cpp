@@ -0,0 +1,428 @@
+#include "config-client.hpp"
+#include "loopback-device.hpp"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+// Command line client of the serial configuration protocol, see the Configuration tool section of the README.
+
+const int BENCH_DEFAULT_ROUNDS = 20;
+
+static void usage(const char *program) {
+    fprintf(stderr,
+        "Usage: %s <command> ...\n"
+        "  pull <port> [file]                 Print or save the active configuration\n"
+        "  push <port> <file> [--save]        Set the configuration, or the members a patch gives\n"
+        "  diff <from> <to> [--patch <file>]  Show the differences, optionally saved as a patch\n"
+        "  patch <target> <patch> [--save]    Apply a patch to a device or a file\n"
+        "  backup <port> <file>               Save the configuration and the preset library\n"
+        "  restore <port> <file>              Push, save and verify a backup\n"
+        "  bulk <file> <port>...              Restore a backup to many devices at once\n"
+        "  bench <port> [rounds]              Measure the round trip time and throughput\n"
+        "  loopback <file> [--reply-delay-us <us>]\n"
+        "                                     Serve a configuration on a pseudo terminal, as a stand-in for the device\n"
+        "A <from>, <to> or <target> that is a character device is read from the device, otherwise from a file.\n",
+        program);
+}
+
+// ===== Files and devices =====
+
+static bool read_file(const std::string &path, std::string &text) {
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    text = buffer.str();
+    return true;
+}
+
+static bool write_file(const std::string &path, const std::string &text) {
+    std::ofstream file(path.c_str(), std::ios::binary);
+    file << text;
+    return file.good();
+}
+
+static bool is_device(const std::string &path) {
+    struct stat info;
+    return (stat(path.c_str(), &info) == 0) && S_ISCHR(info.st_mode);
+}
+
+static bool load_file(const std::string &path, ConfigDocument &config) {
+    std::string text;
+    if (!read_file(path, text)) {
+        fprintf(stderr, "Can't read %s\n", path.c_str());
+        return false;
+    }
+    if (!config.parse(text)) {
+        fprintf(stderr, "%s is not a valid configuration (JSON error %d)\n", path.c_str(), config.error());
+        return false;
+    }
+    return true;
+}
+
+static bool open_port(SerialPort &port, const std::string &path) {
+    if (!port.open(path)) {
+        fprintf(stderr, "Can't open %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+/// @brief Read a configuration from a device or a file
+static bool load_config(const std::string &source, ConfigDocument &config) {
+    if (!is_device(source)) {
+        return load_file(source, config);
+    }
+    SerialPort port;
+    if (!open_port(port, source)) {
+        return false;
+    }
+    ConfigClient client(port);
+    if (!client.pull(config)) {
+        fprintf(stderr, "%s: %s\n", source.c_str(), client.error().c_str());
+        return false;
+    }
+    return true;
+}
+
+/// @brief Report the failure of the last command of a client
+static int client_failed(ConfigClient &client, SerialPort &port) {
+    fprintf(stderr, "%s: %s\n", port.path().c_str(), client.error().c_str());
+    return 1;
+}
+
+// ===== Commands =====
+
+static int command_pull(const std::vector<std::string> &args) {
+    if ((args.size() < 1) || (args.size() > 2)) {
+        return -1;
+    }
+    SerialPort port;
+    if (!open_port(port, args[0])) {
+        return 1;
+    }
+    ConfigClient client(port);
+    ConfigDocument config;
+    if (!client.pull(config)) {
+        return client_failed(client, port);
+    }
+    if (args.size() == 1) {
+        printf("%s\n", config.to_json().c_str());
+    }
+    else if (!write_file(args[1], config.to_json() + "\n")) {
+        fprintf(stderr, "Can't write %s\n", args[1].c_str());
+        return 1;
+    }
+    return 0;
+}
+
+static int command_push(const std::vector<std::string> &args, bool save) {
+    if (args.size() != 2) {
+        return -1;
+    }
+    ConfigDocument config;
+    SerialPort port;
+    if (!load_file(args[1], config) || !open_port(port, args[0])) {
+        return 1;
+    }
+    ConfigClient client(port);
+    if (!client.push(config) || (save && !client.save())) {
+        return client_failed(client, port);
+    }
+    return 0;
+}
+
+static int command_diff(const std::vector<std::string> &args, const std::string &patch_path) {
+    if (args.size() != 2) {
+        return -1;
+    }
+    ConfigDocument from;
+    ConfigDocument to;
+    if (!load_config(args[0], from) || !load_config(args[1], to)) {
+        return 2;
+    }
+    std::vector<std::string> lines = from.diff(to);
+    for (size_t i=0; i<lines.size(); i++) {
+        printf("%s\n", lines[i].c_str());
+    }
+    if (!patch_path.empty() && !write_file(patch_path, from.patch_to(to).to_json() + "\n")) {
+        fprintf(stderr, "Can't write %s\n", patch_path.c_str());
+        return 2;
+    }
+    // Like diff(1)
+    return lines.empty() ? 0 : 1;
+}
+
+static int command_patch(const std::vector<std::string> &args, bool save) {
+    if (args.size() != 2) {
+        return -1;
+    }
+    ConfigDocument patch;
+    if (!load_file(args[1], patch)) {
+        return 1;
+    }
+    if (is_device(args[0])) {
+        // The device keeps the members a configuration leaves out
+        return command_push(args, save);
+    }
+
+    ConfigDocument config;
+    if (!load_file(args[0], config)) {
+        return 1;
+    }
+    config.apply(patch);
+    if (!write_file(args[0], config.to_json() + "\n")) {
+        fprintf(stderr, "Can't write %s\n", args[0].c_str());
+        return 1;
+    }
+    return 0;
+}
+
+static int command_backup(const std::vector<std::string> &args) {
+    if (args.size() != 2) {
+        return -1;
+    }
+    SerialPort port;
+    if (!open_port(port, args[0])) {
+        return 1;
+    }
+    ConfigClient client(port);
+    ConfigDocument backup;
+    if (!client.backup(backup)) {
+        return client_failed(client, port);
+    }
+    if (!write_file(args[1], backup.to_json() + "\n")) {
+        fprintf(stderr, "Can't write %s\n", args[1].c_str());
+        return 1;
+    }
+    return 0;
+}
+
+static int command_restore(const std::vector<std::string> &args) {
+    if (args.size() != 2) {
+        return -1;
+    }
+    ConfigDocument backup;
+    SerialPort port;
+    if (!load_file(args[1], backup) || !open_port(port, args[0])) {
+        return 1;
+    }
+    ConfigClient client(port);
+    if (!client.restore(backup)) {
+        return client_failed(client, port);
+    }
+    return 0;
+}
+
+struct BulkResult {
+    std::string port;
+    bool ok;
+    std::string error;
+    double ms;
+};
+
+static void bulk_restore(const ConfigDocument *backup, BulkResult *result) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    SerialPort port;
+    if (!port.open(result->port)) {
+        result->ok = false;
+        result->error = "can't open";
+    }
+    else {
+        ConfigClient client(port);
+        result->ok = client.restore(*backup);
+        result->error = client.error();
+    }
+    result->ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static int command_bulk(const std::vector<std::string> &args) {
+    if (args.size() < 2) {
+        return -1;
+    }
+    ConfigDocument backup;
+    if (!load_file(args[0], backup)) {
+        return 1;
+    }
+
+    // Every device has its own serial port, they are all programmed at the same time
+    std::vector<BulkResult> results(args.size()-1);
+    std::vector<std::thread> threads;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i=0; i<results.size(); i++) {
+        results[i].port = args[i+1];
+        threads.push_back(std::thread(bulk_restore, &backup, &results[i]));
+    }
+    int failed = 0;
+    for (size_t i=0; i<threads.size(); i++) {
+        threads[i].join();
+        if (results[i].ok) {
+            printf("%s: ok, %.1f ms\n", results[i].port.c_str(), results[i].ms);
+        }
+        else {
+            printf("%s: failed, %s\n", results[i].port.c_str(), results[i].error.c_str());
+            failed++;
+        }
+    }
+    double total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("%d of %d devices programmed in %.1f ms\n", (int)(results.size()-failed), (int)results.size(), total_ms);
+    return (failed == 0) ? 0 : 1;
+}
+
+/// @brief Time and bytes of every round trip of a command
+struct BenchStats {
+    std::vector<double> ms;
+    size_t bytes = 0;
+
+    void add(ConfigClient &client) {
+        ms.push_back(client.last_round_trip_ms());
+        bytes += client.last_bytes_sent() + client.last_bytes_received();
+    }
+
+    void report(const char *name) {
+        std::vector<double> sorted = ms;
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0;
+        for (size_t i=0; i<sorted.size(); i++) {
+            total += sorted[i];
+        }
+        printf("  %-5s %d round trips, %zu bytes each, rtt ms: min %.2f mean %.2f p50 %.2f p99 %.2f max %.2f, %.1f kB/s\n",
+            name, (int)sorted.size(), bytes/sorted.size(), sorted.front(), total/sorted.size(), sorted[sorted.size()/2],
+            sorted[(sorted.size()*99)/100], sorted.back(), bytes/total);
+    }
+};
+
+static int command_bench(const std::vector<std::string> &args) {
+    if ((args.size() < 1) || (args.size() > 2)) {
+        return -1;
+    }
+    int rounds = (args.size() == 2) ? atoi(args[1].c_str()) : BENCH_DEFAULT_ROUNDS;
+    if (rounds < 1) {
+        return -1;
+    }
+    SerialPort port;
+    if (!open_port(port, args[0])) {
+        return 1;
+    }
+    ConfigClient client(port);
+
+    // The active configuration is pushed back unchanged, the device doesn't save it
+    BenchStats pull;
+    BenchStats push;
+    BenchStats list;
+    ConfigDocument config;
+    PresetKits kits;
+    for (int i=0; i<rounds; i++) {
+        if (!client.pull(config)) {
+            return client_failed(client, port);
+        }
+        pull.add(client);
+        if (!client.push(config)) {
+            return client_failed(client, port);
+        }
+        push.add(client);
+        if (!client.pull_presets(kits)) {
+            return client_failed(client, port);
+        }
+        list.add(client);
+    }
+    printf("%s:\n", args[0].c_str());
+    pull.report("pull");
+    push.report("push");
+    list.report("list");
+    return 0;
+}
+
+static int command_loopback(const std::vector<std::string> &args, int reply_delay_us) {
+    if (args.size() != 1) {
+        return -1;
+    }
+    ConfigDocument config;
+    if (!load_file(args[0], config)) {
+        return 1;
+    }
+    LoopbackDevice device(config);
+    if (!device.open()) {
+        fprintf(stderr, "Can't create a pseudo terminal\n");
+        return 1;
+    }
+    device.set_reply_delay(reply_delay_us);
+    printf("%s\n", device.path().c_str());
+    fflush(stdout);
+    device.serve(-1);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+        return 2;
+    }
+    std::string command = argv[1];
+    std::vector<std::string> args;
+    bool save = false;
+    std::string patch_path;
+    int reply_delay_us = 0;
+
+    for (int i=2; i<argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--save") {
+            save = true;
+        }
+        else if ((arg == "--patch") && (i+1 < argc)) {
+            patch_path = argv[++i];
+        }
+        else if ((arg == "--reply-delay-us") && (i+1 < argc)) {
+            reply_delay_us = atoi(argv[++i]);
+        }
+        else if (arg.compare(0, 2, "--") == 0) {
+            usage(argv[0]);
+            return 2;
+        }
+        else {
+            args.push_back(arg);
+        }
+    }
+
+    int result = -1;
+    if (command == "pull") {
+        result = command_pull(args);
+    }
+    else if (command == "push") {
+        result = command_push(args, save);
+    }
+    else if (command == "diff") {
+        result = command_diff(args, patch_path);
+    }
+    else if (command == "patch") {
+        result = command_patch(args, save);
+    }
+    else if (command == "backup") {
+        result = command_backup(args);
+    }
+    else if (command == "restore") {
+        result = command_restore(args);
+    }
+    else if (command == "bulk") {
+        result = command_bulk(args);
+    }
+    else if (command == "bench") {
+        result = command_bench(args);
+    }
+    else if (command == "loopback") {
+        result = command_loopback(args, reply_delay_us);
+    }
+
+    if (result < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    return result;
+}
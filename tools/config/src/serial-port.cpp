@@ -0,0 +1,108 @@
+#include "serial-port.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+SerialPort::SerialPort() {
+    _fd = -1;
+    _buffer_pos = 0;
+    _buffer_length = 0;
+}
+
+SerialPort::~SerialPort() {
+    close();
+}
+
+bool SerialPort::open(const std::string &path) {
+    close();
+    _fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (_fd < 0) {
+        return false;
+    }
+    _path = path;
+
+    // The baud rate doesn't matter for USB CDC, only the line discipline has to be disabled
+    struct termios tio;
+    if (tcgetattr(_fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tio.c_cc[VMIN] = 0;
+        tio.c_cc[VTIME] = 0;
+        tcsetattr(_fd, TCSANOW, &tio);
+    }
+    return true;
+}
+
+void SerialPort::close() {
+    if (_fd >= 0) {
+        ::close(_fd);
+    }
+    _fd = -1;
+    _buffer_pos = 0;
+    _buffer_length = 0;
+}
+
+bool SerialPort::is_open() {
+    return _fd >= 0;
+}
+
+bool SerialPort::write(const std::string &data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        if (_fd < 0) {
+            return false;
+        }
+        ssize_t result = ::write(_fd, data.data() + written, data.size() - written);
+        if (result > 0) {
+            written += result;
+            continue;
+        }
+        if ((result < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+            return false;
+        }
+        struct pollfd pfd = {_fd, POLLOUT, 0};
+        poll(&pfd, 1, 100);
+    }
+    return true;
+}
+
+bool SerialPort::read(char &byte, int timeout_ms) {
+    while (_buffer_pos == _buffer_length) {
+        if (_fd < 0) {
+            return false;
+        }
+        struct pollfd pfd = {_fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, timeout_ms);
+        if (ready == 0) {
+            return false;
+        }
+        if ((ready < 0) && (errno == EINTR)) {
+            continue;
+        }
+        ssize_t result = ::read(_fd, _buffer, BUFFER_SIZE);
+        if (result > 0) {
+            _buffer_pos = 0;
+            _buffer_length = result;
+        }
+        else if ((result == 0) || ((errno != EAGAIN) && (errno != EINTR))) {
+            return false;
+        }
+    }
+    byte = _buffer[_buffer_pos++];
+    return true;
+}
+
+void SerialPort::drain() {
+    _buffer_pos = 0;
+    _buffer_length = 0;
+    if (_fd < 0) {
+        return;
+    }
+    while (::read(_fd, _buffer, BUFFER_SIZE) > 0) {
+    }
+}
+
+const std::string &SerialPort::path() {
+    return _path;
+}
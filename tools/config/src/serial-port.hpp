@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+/// @brief Raw, non-blocking serial port of the host (USB CDC of the device, or a pseudo terminal), read with timeouts.
+class SerialPort {
+    public:
+
+        SerialPort();
+        ~SerialPort();
+
+        /// @brief Open a serial device in raw mode, without echo or line editing
+        /// @return false if the device can't be opened
+        bool open(const std::string &path);
+
+        void close();
+
+        bool is_open();
+
+        /// @brief Write every byte of data
+        /// @return false if the port was closed or failed
+        bool write(const std::string &data);
+
+        /// @brief Read one byte
+        /// @param timeout_ms Longest time waited for the byte
+        /// @return false on timeout or error
+        bool read(char &byte, int timeout_ms);
+
+        /// @brief Discard everything received and not read yet
+        void drain();
+
+        const std::string &path();
+
+    private:
+
+        static const size_t BUFFER_SIZE = 512;
+
+        int _fd;
+        std::string _path;
+        char _buffer[BUFFER_SIZE];
+        size_t _buffer_pos;
+        size_t _buffer_length;
+
+};